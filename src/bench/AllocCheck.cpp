@@ -0,0 +1,298 @@
+// Steady-state allocation check: plays clips in real time through the player's
+// demux and decode stages into a headless video sink and a null audio sink, and
+// counts heap allocations across the whole process once playback has warmed up.
+// The report gives allocations per second, per demuxed packet and per video frame,
+// the threads that made them and the call sites that allocated most. Counts per
+// packet and per frame do not depend on timing, so a clip fails (exit code 2)
+// above --max-per-packet or --max-per-frame, and with --baseline also when either
+// grows by more than --tolerance percent.
+//
+//   qmlplayer-alloccheck [--warmup 2000] [--duration 5000] [--top 10]
+//                        [--max-per-packet 12] [--max-per-frame 40]
+//                        [--output alloccheck.json] [--baseline old.json --tolerance 2]
+//                        files...
+//
+// Needs glibc for the malloc interposer (AllocCounter); elsewhere it reports the
+// check as skipped and exits with 0.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+}
+
+#include "AllocCounter.h"
+#include "BenchReport.h"
+#include "HeadlessPipeline.h"
+
+namespace {
+
+constexpr int kSinkBufferMs = 100;
+
+struct CheckOptions {
+    int warmupMs = 2000;
+    int durationMs = 5000;
+    int topCallSites = 10;
+    double maxPerPacket = 12.0;     // 0 disables a limit
+    double maxPerFrame = 40.0;
+};
+
+QJsonArray threadReport(const std::vector<AllocCounter::ThreadSnapshot>& before,
+                        const std::vector<AllocCounter::ThreadSnapshot>& after) {
+    QHash<int, AllocCounter::ThreadSnapshot> start;
+    for (const AllocCounter::ThreadSnapshot& thread : before) start.insert(thread.tid, thread);
+
+    std::vector<AllocCounter::ThreadSnapshot> window;
+    for (AllocCounter::ThreadSnapshot thread : after) {
+        const AllocCounter::ThreadSnapshot previous = start.value(thread.tid);
+        thread.allocations -= previous.allocations;
+        thread.bytes -= previous.bytes;
+        if (thread.allocations > 0) window.push_back(thread);
+    }
+    std::sort(window.begin(), window.end(), [](const auto& a, const auto& b) { return a.allocations > b.allocations; });
+
+    QJsonArray threads;
+    for (const AllocCounter::ThreadSnapshot& thread : window) {
+        QJsonObject entry;
+        entry.insert(QStringLiteral("tid"), thread.tid);
+        entry.insert(QStringLiteral("name"), QString::fromStdString(thread.name));
+        entry.insert(QStringLiteral("allocations"), thread.allocations);
+        entry.insert(QStringLiteral("bytes"), thread.bytes);
+        threads.append(entry);
+    }
+    return threads;
+}
+
+QJsonArray callSiteReport(int count) {
+    QJsonArray sites;
+    for (const AllocCounter::CallSite& site : AllocCounter::topCallSites(count)) {
+        QJsonArray frames;
+        for (const std::string& frame : site.frames) frames.append(QString::fromStdString(frame));
+        QJsonObject entry;
+        entry.insert(QStringLiteral("allocations"), site.allocations);
+        entry.insert(QStringLiteral("bytes"), site.bytes);
+        entry.insert(QStringLiteral("frames"), frames);
+        sites.append(entry);
+    }
+    return sites;
+}
+
+// One real-time playback; an empty object if the file could not be played
+QJsonObject runFile(const QString& file, const CheckOptions& options, bool* passed) {
+    *passed = false;
+    HeadlessPipeline pipeline("qmlplayer-alloccheck");
+    if (!pipeline.open(file, HeadlessPipeline::Options())) return {};
+    AVDemuxer& demuxer = pipeline.demuxer();
+
+    QElapsedTimer clock;
+    clock.start();
+    std::atomic<qint64> video_frames{0};
+
+    // Stand-ins for the renderer and AudioOutput. Neither allocates: they only
+    // pop, wait and free, like their real counterparts on the hot path.
+    pipeline.start();
+    pipeline.startSinks(clock, kSinkBufferMs, 0.0, [&video_frames](const AVFrame*) { video_frames++; });
+    const auto running = [&]() { return !pipeline.sinksFinished() && !pipeline.failed(); };
+
+    while (running() && clock.elapsed() < options.warmupMs) {
+        QThread::msleep(10);
+    }
+
+    // The window: everything in it is counted, including this thread, which only sleeps
+    const std::vector<AllocCounter::ThreadSnapshot> threads_before = AllocCounter::threads();
+    AllocCounter::clearCallSites();
+    AllocCounter::setRecordingCallSites(true);
+    const AllocCounter::Snapshot before = AllocCounter::snapshot();
+    const qint64 frames_before = video_frames;
+    const qint64 packets_before = demuxer.demuxStats().packetsRead;
+    QElapsedTimer window;
+    window.start();
+    while (running() && window.elapsed() < options.durationMs) {
+        QThread::msleep(10);
+    }
+    const qint64 window_ns = window.nsecsElapsed();
+    const AllocCounter::Snapshot after = AllocCounter::snapshot();
+    const qint64 window_frames = video_frames - frames_before;
+    const qint64 window_packets = demuxer.demuxStats().packetsRead - packets_before;
+    AllocCounter::setRecordingCallSites(false);
+    const std::vector<AllocCounter::ThreadSnapshot> threads_after = AllocCounter::threads();
+
+    const bool has_video = pipeline.hasVideo();
+    const bool failed = pipeline.failed();
+    pipeline.close();
+    if (failed) return {};
+
+    const double window_s = window_ns / 1e9;
+    const qint64 allocations = after.allocations - before.allocations;
+    const double per_second = window_s > 0 ? allocations / window_s : 0.0;
+    QJsonObject result;
+    result.insert(QStringLiteral("file"), file);
+    result.insert(QStringLiteral("warmupMs"), options.warmupMs);
+    result.insert(QStringLiteral("windowMs"), window_ns / 1000000);
+    result.insert(QStringLiteral("allocations"), allocations);
+    result.insert(QStringLiteral("bytes"), after.bytes - before.bytes);
+    result.insert(QStringLiteral("allocationsPerSecond"), per_second);
+    if (window_packets > 0) {
+        result.insert(QStringLiteral("packets"), window_packets);
+        result.insert(QStringLiteral("allocationsPerPacket"), double(allocations) / window_packets);
+    }
+    if (has_video && window_frames > 0) {
+        result.insert(QStringLiteral("videoFrames"), window_frames);
+        result.insert(QStringLiteral("allocationsPerFrame"), double(allocations) / window_frames);
+    }
+    result.insert(QStringLiteral("threads"), threadReport(threads_before, threads_after));
+    result.insert(QStringLiteral("callSites"), callSiteReport(options.topCallSites));
+
+    // Less than a second of steady state is too few packets to compare
+    if (window_ns < 1000000000LL) {
+        qWarning() << "qmlplayer-alloccheck: clip too short for a" << options.warmupMs << "ms warm-up:" << file;
+        result.insert(QStringLiteral("passed"), false);
+        return result;
+    }
+    *passed = true;
+    const auto limit = [&](const QString& metric, double max) {
+        if (max <= 0 || !result.contains(metric)) return;
+        const double value = result.value(metric).toDouble();
+        if (value > max) {
+            qWarning().noquote() << "qmlplayer-alloccheck:" << file << metric << value << "is above the limit of" << max;
+            *passed = false;
+        }
+    };
+    limit(QStringLiteral("allocationsPerPacket"), options.maxPerPacket);
+    limit(QStringLiteral("allocationsPerFrame"), options.maxPerFrame);
+    result.insert(QStringLiteral("passed"), *passed);
+    return result;
+}
+
+void printResult(QTextStream& log, const QJsonObject& result, bool passed) {
+    log << result.value(QStringLiteral("file")).toString() << ": "
+        << QString::number(result.value(QStringLiteral("allocationsPerSecond")).toDouble(), 'f', 1) << " allocations/s";
+    if (result.contains(QStringLiteral("allocationsPerPacket"))) {
+        log << ", " << QString::number(result.value(QStringLiteral("allocationsPerPacket")).toDouble(), 'f', 2) << " per packet";
+    }
+    if (result.contains(QStringLiteral("allocationsPerFrame"))) {
+        log << ", " << QString::number(result.value(QStringLiteral("allocationsPerFrame")).toDouble(), 'f', 1) << " per video frame";
+    }
+    log << " over " << result.value(QStringLiteral("windowMs")).toInteger() << " ms: " << (passed ? "ok" : "FAILED") << "\n";
+
+    for (const QJsonValue& value : result.value(QStringLiteral("threads")).toArray()) {
+        const QJsonObject thread = value.toObject();
+        log << "  thread " << thread.value(QStringLiteral("name")).toString()
+            << " (" << thread.value(QStringLiteral("tid")).toInt() << "): "
+            << thread.value(QStringLiteral("allocations")).toInteger() << "\n";
+    }
+    for (const QJsonValue& value : result.value(QStringLiteral("callSites")).toArray()) {
+        const QJsonObject site = value.toObject();
+        log << "  " << site.value(QStringLiteral("allocations")).toInteger() << " allocations, "
+            << site.value(QStringLiteral("bytes")).toInteger() << " bytes:\n";
+        for (const QJsonValue& frame : site.value(QStringLiteral("frames")).toArray()) {
+            log << "      " << frame.toString() << "\n";
+        }
+    }
+    log.flush();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Same settings as the player, so "pipeline/*", "io/*" and "memory/*" apply here too
+    QCoreApplication::setOrganizationName(QStringLiteral("QmlPlayer"));
+    QCoreApplication::setApplicationName(QStringLiteral("QMLPlayerFFmpeg"));
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Plays clips in real time and checks that steady-state playback stays within a number of allocations per packet and frame."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("files"), QStringLiteral("Media files to play."), QStringLiteral("files..."));
+    const QCommandLineOption warmup_option(QStringLiteral("warmup"), QStringLiteral("Playback before counting starts, in ms."), QStringLiteral("ms"), QStringLiteral("2000"));
+    const QCommandLineOption duration_option(QStringLiteral("duration"), QStringLiteral("Length of the counted window, in ms."), QStringLiteral("ms"), QStringLiteral("5000"));
+    const QCommandLineOption top_option(QStringLiteral("top"), QStringLiteral("Number of call sites to report."), QStringLiteral("count"), QStringLiteral("10"));
+    const QCommandLineOption output_option(QStringLiteral("output"), QStringLiteral("Write the JSON report to this file instead of stdout."), QStringLiteral("file"));
+    const QCommandLineOption baseline_option(QStringLiteral("baseline"),
+        QStringLiteral("Earlier report to compare against; more allocations per packet or per frame fail the run."), QStringLiteral("file"));
+    const QCommandLineOption tolerance_option(QStringLiteral("tolerance"), QStringLiteral("Allowed growth against the baseline, in percent."), QStringLiteral("percent"), QStringLiteral("2"));
+    const QCommandLineOption max_packet_option(QStringLiteral("max-per-packet"),
+        QStringLiteral("Most allocations per demuxed packet a clip may make; 0 for no limit."), QStringLiteral("count"), QStringLiteral("12"));
+    const QCommandLineOption max_frame_option(QStringLiteral("max-per-frame"),
+        QStringLiteral("Most allocations per video frame a clip may make; 0 for no limit."), QStringLiteral("count"), QStringLiteral("40"));
+    parser.addOptions({warmup_option, duration_option, top_option, max_packet_option, max_frame_option,
+                       output_option, baseline_option, tolerance_option});
+    parser.process(app);
+
+    const QStringList files = parser.positionalArguments();
+    if (files.isEmpty()) {
+        parser.showHelp(1);
+    }
+    if (!AllocCounter::isActive()) {
+        qWarning() << "qmlplayer-alloccheck: allocation counting needs glibc, check skipped";
+        return 0;
+    }
+    CheckOptions options;
+    options.warmupMs = qMax(0, parser.value(warmup_option).toInt());
+    options.durationMs = qMax(1000, parser.value(duration_option).toInt());
+    options.topCallSites = qMax(0, parser.value(top_option).toInt());
+    options.maxPerPacket = qMax(0.0, parser.value(max_packet_option).toDouble());
+    options.maxPerFrame = qMax(0.0, parser.value(max_frame_option).toDouble());
+
+    QTextStream log(stderr);
+    QJsonArray results;
+    int failures = 0;
+    for (const QString& file : files) {
+        bool passed = false;
+        const QJsonObject result = runFile(file, options, &passed);
+        if (result.isEmpty()) {
+            failures++;
+            continue;
+        }
+        if (!passed) failures++;
+        printResult(log, result, passed);
+        results.append(result);
+    }
+
+    QJsonObject report;
+    report.insert(QStringLiteral("tool"), QStringLiteral("qmlplayer-alloccheck"));
+    report.insert(QStringLiteral("version"), 2);
+    report.insert(QStringLiteral("maxPerPacket"), options.maxPerPacket);
+    report.insert(QStringLiteral("maxPerFrame"), options.maxPerFrame);
+    report.insert(QStringLiteral("ffmpeg"), QString::fromLatin1(av_version_info()));
+    report.insert(QStringLiteral("failures"), failures);
+    report.insert(QStringLiteral("results"), results);
+    const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+
+    if (parser.isSet(output_option)) {
+        QFile out(parser.value(output_option));
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "qmlplayer-alloccheck: cannot write" << out.fileName();
+            return 1;
+        }
+        out.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+
+    if (parser.isSet(baseline_option)) {
+        const QJsonArray baseline = BenchReport::loadArray(parser.value(baseline_option), QStringLiteral("results"));
+        if (baseline.isEmpty()) {
+            qWarning() << "qmlplayer-alloccheck: cannot read baseline" << parser.value(baseline_option);
+            return 1;
+        }
+        const double tolerance = parser.value(tolerance_option).toDouble();
+        for (const QString& metric : {QStringLiteral("allocationsPerPacket"), QStringLiteral("allocationsPerFrame")}) {
+            failures += BenchReport::compare(baseline, results, {QStringLiteral("file")}, metric, tolerance, log);
+        }
+    }
+    return failures > 0 ? 2 : 0;
+}
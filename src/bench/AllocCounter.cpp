@@ -0,0 +1,306 @@
+#include "AllocCounter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+std::atomic<int64_t> g_allocations{0};
+std::atomic<int64_t> g_bytes{0};
+} // namespace
+
+#if defined(__GLIBC__)
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// Everything the wrappers touch is constant-initialized and lives in the
+// executable's static TLS or data, so counting itself never allocates
+constexpr int kMaxThreads = 512;        // the last slot collects any threads beyond
+constexpr int kMaxCallSites = 4096;
+constexpr int kStackDepth = 10;
+constexpr int kSkipFrames = 2;          // recordCallSite() and the wrapper itself
+
+struct ThreadSlot {
+    std::atomic<int> tid{0};
+    std::atomic<int64_t> allocations{0};
+    std::atomic<int64_t> bytes{0};
+    char name[16] = {};
+};
+
+struct CallSiteSlot {
+    std::atomic<uint64_t> key{0};
+    std::atomic<int> depth{0};
+    void* frames[kStackDepth] = {};
+    std::atomic<int64_t> allocations{0};
+    std::atomic<int64_t> bytes{0};
+};
+
+ThreadSlot g_threads[kMaxThreads];
+std::atomic<int> g_thread_slots{0};
+CallSiteSlot g_call_sites[kMaxCallSites];
+std::atomic<bool> g_recording{false};
+
+thread_local ThreadSlot* t_slot = nullptr;
+thread_local bool t_walking = false;
+
+ThreadSlot* claimThreadSlot() {
+    const int index = g_thread_slots.fetch_add(1, std::memory_order_relaxed);
+    if (index >= kMaxThreads - 1) return &g_threads[kMaxThreads - 1];
+    ThreadSlot* slot = &g_threads[index];
+    slot->tid.store(int(syscall(SYS_gettid)), std::memory_order_relaxed);
+    // Usually still the parent's name; threads() looks again while the thread lives
+    prctl(PR_GET_NAME, slot->name);
+    return slot;
+}
+
+__attribute__((noinline)) void recordCallSite(size_t size) {
+    // backtrace() itself allocates only on its very first call, which
+    // setRecordingCallSites() makes before recording starts; the flag covers the rest
+    void* frames[kStackDepth + kSkipFrames];
+    t_walking = true;
+    const int captured = backtrace(frames, kStackDepth + kSkipFrames);
+    t_walking = false;
+    const int depth = std::max(0, captured - kSkipFrames);
+
+    uint64_t key = 14695981039346656037ull;   // FNV-1a over the return addresses
+    for (int i = 0; i < depth; i++) {
+        key = (key ^ uint64_t(reinterpret_cast<uintptr_t>(frames[kSkipFrames + i]))) * 1099511628211ull;
+    }
+    if (key == 0) key = 1;
+
+    for (int probe = 0; probe < kMaxCallSites; probe++) {
+        CallSiteSlot& site = g_call_sites[(key + uint64_t(probe)) % kMaxCallSites];
+        uint64_t expected = 0;
+        if (site.key.compare_exchange_strong(expected, key, std::memory_order_acq_rel)) {
+            std::memcpy(site.frames, frames + kSkipFrames, size_t(depth) * sizeof(void*));
+            site.depth.store(depth, std::memory_order_release);
+        } else if (expected != key) {
+            continue;
+        }
+        site.allocations.fetch_add(1, std::memory_order_relaxed);
+        site.bytes.fetch_add(int64_t(size), std::memory_order_relaxed);
+        return;
+    }
+    // Table full: still in the totals, just without a call site
+}
+
+__attribute__((always_inline)) inline void count(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_bytes.fetch_add(int64_t(size), std::memory_order_relaxed);
+    ThreadSlot* slot = t_slot;
+    if (!slot) slot = t_slot = claimThreadSlot();
+    slot->allocations.fetch_add(1, std::memory_order_relaxed);
+    slot->bytes.fetch_add(int64_t(size), std::memory_order_relaxed);
+    if (g_recording.load(std::memory_order_relaxed) && !t_walking) {
+        recordCallSite(size);
+    }
+}
+
+std::string symbolize(void* address) {
+    Dl_info info;
+    if (!dladdr(address, &info)) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%p", address);
+        return buffer;
+    }
+    std::string name;
+    if (info.dli_sname) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        name = status == 0 && demangled ? demangled : info.dli_sname;
+        std::free(demangled);
+        char offset[32];
+        std::snprintf(offset, sizeof(offset), "+0x%zx",
+                      size_t(static_cast<char*>(address) - static_cast<char*>(info.dli_saddr)));
+        name += offset;
+    } else {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%p", address);
+        name = buffer;
+    }
+    if (info.dli_fname) {
+        const char* module = std::strrchr(info.dli_fname, '/');
+        name += " (";
+        name += module ? module + 1 : info.dli_fname;
+        name += ")";
+    }
+    return name;
+}
+
+} // namespace
+
+// glibc's own entry points; the definitions below take precedence over the
+// libc exports for every module of the process. Nothing here may allocate.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size) noexcept {
+    count(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) noexcept {
+    count(n * size);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) noexcept {
+    // Shrinking or freeing through realloc is not an allocation
+    if (size > 0) count(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) noexcept {
+    __libc_free(ptr);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+    count(size);
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    count(size);
+    return __libc_memalign(alignment, size);
+}
+
+// av_malloc() allocates through here
+int posix_memalign(void** result, size_t alignment, size_t size) noexcept {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) return EINVAL;
+    count(size);
+    void* ptr = __libc_memalign(alignment, size);
+    if (!ptr) return ENOMEM;
+    *result = ptr;
+    return 0;
+}
+}
+
+bool AllocCounter::isActive() {
+    return true;
+}
+
+std::vector<AllocCounter::ThreadSnapshot> AllocCounter::threads() {
+    std::vector<ThreadSnapshot> result;
+    const int slots = std::min(g_thread_slots.load(std::memory_order_relaxed), kMaxThreads);
+    for (int i = 0; i < slots; i++) {
+        const ThreadSlot& slot = g_threads[i];
+        ThreadSnapshot thread;
+        thread.tid = slot.tid.load(std::memory_order_relaxed);
+        thread.allocations = slot.allocations.load(std::memory_order_relaxed);
+        thread.bytes = slot.bytes.load(std::memory_order_relaxed);
+        if (thread.allocations == 0) continue;
+        thread.name = i == kMaxThreads - 1 ? "(other threads)" : slot.name;
+
+        // The current name, if the thread is still around
+        char path[64];
+        std::snprintf(path, sizeof(path), "/proc/self/task/%d/comm", thread.tid);
+        if (FILE* comm = thread.tid > 0 ? std::fopen(path, "r") : nullptr) {
+            char name[32] = {};
+            if (std::fgets(name, sizeof(name), comm)) {
+                name[std::strcspn(name, "\n")] = '\0';
+                thread.name = name;
+            }
+            std::fclose(comm);
+        }
+        result.push_back(thread);
+    }
+    return result;
+}
+
+void AllocCounter::setRecordingCallSites(bool recording) {
+    if (recording) {
+        // The first backtrace() loads the unwinder, which allocates
+        void* frame = nullptr;
+        t_walking = true;
+        backtrace(&frame, 1);
+        t_walking = false;
+    }
+    g_recording.store(recording, std::memory_order_relaxed);
+}
+
+void AllocCounter::clearCallSites() {
+    for (CallSiteSlot& site : g_call_sites) {
+        site.key.store(0, std::memory_order_relaxed);
+        site.depth.store(0, std::memory_order_relaxed);
+        site.allocations.store(0, std::memory_order_relaxed);
+        site.bytes.store(0, std::memory_order_relaxed);
+    }
+}
+
+std::vector<AllocCounter::CallSite> AllocCounter::topCallSites(int count) {
+    std::vector<const CallSiteSlot*> used;
+    for (const CallSiteSlot& site : g_call_sites) {
+        if (site.key.load(std::memory_order_acquire) != 0 && site.allocations.load(std::memory_order_relaxed) > 0) {
+            used.push_back(&site);
+        }
+    }
+    std::sort(used.begin(), used.end(), [](const CallSiteSlot* a, const CallSiteSlot* b) {
+        return a->allocations.load(std::memory_order_relaxed) > b->allocations.load(std::memory_order_relaxed);
+    });
+
+    std::vector<CallSite> result;
+    for (size_t i = 0; i < used.size() && int(i) < count; i++) {
+        CallSite site;
+        site.allocations = used[i]->allocations.load(std::memory_order_relaxed);
+        site.bytes = used[i]->bytes.load(std::memory_order_relaxed);
+        const int depth = used[i]->depth.load(std::memory_order_acquire);
+        for (int f = 0; f < depth; f++) {
+            site.frames.push_back(symbolize(used[i]->frames[f]));
+        }
+        result.push_back(site);
+    }
+    return result;
+}
+
+#else
+
+namespace {
+[[maybe_unused]] inline void count(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_bytes.fetch_add(int64_t(size), std::memory_order_relaxed);
+}
+} // namespace
+
+bool AllocCounter::isActive() {
+    return false;
+}
+
+std::vector<AllocCounter::ThreadSnapshot> AllocCounter::threads() {
+    return {};
+}
+
+void AllocCounter::setRecordingCallSites(bool recording) {
+    (void)recording;
+}
+
+void AllocCounter::clearCallSites() {
+}
+
+std::vector<AllocCounter::CallSite> AllocCounter::topCallSites(int count) {
+    (void)count;
+    return {};
+}
+
+#endif
+
+AllocCounter::Snapshot AllocCounter::snapshot() {
+    Snapshot snapshot;
+    snapshot.allocations = g_allocations.load(std::memory_order_relaxed);
+    snapshot.bytes = g_bytes.load(std::memory_order_relaxed);
+    return snapshot;
+}
@@ -0,0 +1,52 @@
+#ifndef ALLOCCOUNTER_H
+#define ALLOCCOUNTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Heap allocation counts for the benchmark tools. Linking AllocCounter.cpp
+// into an executable replaces malloc and friends for the whole process
+// (Qt, FFmpeg and the C++ runtime included) with thin wrappers that bump
+// relaxed atomics and forward to the C library. FFmpeg has no allocator hook
+// of its own (av_max_alloc() only caps sizes), but av_malloc() goes through
+// posix_memalign(), which is covered. Only glibc exposes the underlying
+// allocator, so elsewhere isActive() is false and everything stays empty.
+class AllocCounter {
+public:
+    struct Snapshot {
+        int64_t allocations = 0;
+        int64_t bytes = 0;
+    };
+
+    struct ThreadSnapshot {
+        int tid = 0;
+        std::string name;
+        int64_t allocations = 0;
+        int64_t bytes = 0;
+    };
+
+    struct CallSite {
+        int64_t allocations = 0;
+        int64_t bytes = 0;
+        std::vector<std::string> frames;    // innermost first, starting at the allocator entry point
+    };
+
+    static bool isActive();
+    static Snapshot snapshot();
+
+    // Totals of every thread that allocated so far, finished ones included.
+    // Allocates itself, so call it outside the window being measured.
+    static std::vector<ThreadSnapshot> threads();
+
+    // While recording, every allocation also walks a few stack frames and is
+    // counted per distinct stack. That is far slower than plain counting and
+    // meant for the measured window of a test only.
+    static void setRecordingCallSites(bool recording);
+    static void clearCallSites();
+    // The stacks that allocated most often, symbolized; stop recording first.
+    // Names of the executable's own functions need it linked with -rdynamic.
+    static std::vector<CallSite> topCallSites(int count);
+};
+
+#endif // ALLOCCOUNTER_H
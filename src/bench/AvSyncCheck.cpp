@@ -0,0 +1,298 @@
+// A/V sync harness: plays the flash-and-beep clips written by qmlplayer-fixtures
+// (fixtures/sync/) through the player's demux and decode stages in real time.
+// A null audio sink stands in for the device and a headless video sink for the
+// renderer. Each sink timestamps the markers as they would be seen and heard,
+// and the report gives the offset per marker with its mean, maximum and drift.
+// Exits with 2 when any offset exceeds the tolerance or a marker went missing.
+//
+//   qmlplayer-avsync [--tolerance 40] [--sink-buffer 100] [--refresh 60]
+//                    [--clock-skew 0] [--output avsync.json] files or directories...
+//
+// Positive offsets mean the picture is ahead of the sound, as in PlayerStats.
+// --clock-skew runs the null sink's clock fast (or slow, negative) by that many
+// ppm, the way real audio hardware drifts against the system clock.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include <cmath>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+}
+
+#include "HeadlessPipeline.h"
+
+namespace {
+
+constexpr int kMarkerIntervalMs = 1000;  // as written by qmlplayer-fixtures
+
+struct SyncOptions {
+    double toleranceMs = 40.0;
+    int sinkBufferMs = 100;
+    double refreshHz = 60.0;    // 0 presents frames the moment they are queued
+    double clockSkewPpm = 0.0;
+};
+
+// A marker as seen or heard: where it is in the clip and when it was presented,
+// both in ms, the latter on the harness clock
+struct Marker {
+    double streamMs;
+    double presentedMs;
+};
+
+// Mean luma across the middle row: the clips are black (16) or white (235)
+bool isFlash(const AVFrame* frame) {
+    const uint8_t* row = frame->data[0] + (frame->height / 2) * frame->linesize[0];
+    qint64 sum = 0;
+    int count = 0;
+    for (int x = 0; x < frame->width; x += 8) {
+        sum += row[x];
+        count++;
+    }
+    return count > 0 && sum / count > 128;
+}
+
+// One real-time playback of the file; an empty object if it could not be played
+QJsonObject runFile(const QString& file, const SyncOptions& options, bool* passed) {
+    *passed = false;
+    HeadlessPipeline pipeline("qmlplayer-avsync");
+    if (!pipeline.open(file, HeadlessPipeline::Options())) return {};
+    if (!pipeline.hasVideo() || !pipeline.hasAudio()) {
+        qWarning() << "qmlplayer-avsync: needs both audio and video:" << file;
+        return {};
+    }
+    AVFormatContext* ctx = pipeline.formatContext();
+    const AVRational video_time_base = ctx->streams[pipeline.demuxer().videoStreamIndex()]->time_base;
+    const AVRational audio_time_base = pipeline.audio().timeBase();
+    const int sample_rate = pipeline.audio().sampleRate();
+    const int channels = pipeline.audio().channels();
+    const qint64 media_ms = pipeline.mediaMs();
+
+    QElapsedTimer clock;
+    clock.start();
+    QVector<Marker> flashes;
+    QVector<Marker> beeps;
+
+    // The renderer picks a queued frame up at the next display refresh
+    const qint64 refresh_ns = options.refreshHz > 0 ? qint64(1e9 / options.refreshHz) : 0;
+    bool previous_flash = false;
+    const auto onVideo = [&](const AVFrame* frame) {
+        qint64 presented_ns = clock.nsecsElapsed();
+        if (refresh_ns > 0) presented_ns = (presented_ns / refresh_ns + 1) * refresh_ns;
+        const bool flash = isFlash(frame);
+        const int64_t pts = frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+        if (flash && !previous_flash && pts != AV_NOPTS_VALUE) {
+            flashes.append(Marker{pts * av_q2d(video_time_base) * 1000.0, presented_ns / 1e6});
+        }
+        previous_flash = flash;
+    };
+
+    // Beep onsets: a sample above a tenth of full scale after at least a quarter second of silence
+    const int threshold = 32767 / 10;
+    const int min_quiet = sample_rate / 4;
+    int quiet = min_quiet;
+    const auto onAudio = [&](const AVFrame* frame, qint64 start_ns, double ns_per_sample) {
+        const int16_t* samples = reinterpret_cast<const int16_t*>(frame->data[0]);
+        for (int i = 0; i < frame->nb_samples; i++) {
+            int peak = 0;
+            for (int c = 0; c < channels; c++) {
+                peak = qMax(peak, qAbs(int(samples[i * channels + c])));
+            }
+            if (peak < threshold) {
+                quiet++;
+                continue;
+            }
+            if (quiet >= min_quiet && frame->pts != AV_NOPTS_VALUE) {
+                beeps.append(Marker{frame->pts * av_q2d(audio_time_base) * 1000.0 + i * 1000.0 / sample_rate,
+                              (start_ns + i * ns_per_sample) / 1e6});
+            }
+            quiet = 0;
+        }
+    };
+
+    pipeline.start();
+    pipeline.startSinks(clock, options.sinkBufferMs, options.clockSkewPpm, onVideo, onAudio);
+
+    // Real time, so allow for twice the clip plus startup
+    const qint64 timeout_ms = media_ms * 2 + 10000;
+    bool timed_out = false;
+    while (!pipeline.sinksFinished() && !pipeline.failed()) {
+        if (clock.elapsed() > timeout_ms) {
+            timed_out = true;
+            break;
+        }
+        QThread::msleep(50);
+    }
+    const bool failed = pipeline.failed();
+    pipeline.close();
+    if (failed || timed_out) {
+        if (timed_out) qWarning() << "qmlplayer-avsync: timed out on" << file;
+        return {};
+    }
+
+    // Pair flash and beep by the marker they belong to in the clip
+    const auto byMarker = [](const QVector<Marker>& markers) {
+        QMap<int, double> presented;
+        for (const Marker& marker : markers) {
+            const int index = int(std::lround(marker.streamMs / kMarkerIntervalMs));
+            if (!presented.contains(index)) presented.insert(index, marker.presentedMs);
+        }
+        return presented;
+    };
+    const QMap<int, double> flash_at = byMarker(flashes);
+    const QMap<int, double> beep_at = byMarker(beeps);
+    const int expected = media_ms > 0 ? int((media_ms - 1) / kMarkerIntervalMs) : 0;
+
+    QJsonArray offsets;
+    QVector<double> times;
+    QVector<double> values;
+    for (int index = 1; index <= expected; index++) {
+        if (!flash_at.contains(index) || !beep_at.contains(index)) continue;
+        const double offset = beep_at.value(index) - flash_at.value(index);
+        times.append(double(index) * kMarkerIntervalMs);
+        values.append(offset);
+        QJsonObject entry;
+        entry.insert(QStringLiteral("atMs"), index * kMarkerIntervalMs);
+        entry.insert(QStringLiteral("offsetMs"), offset);
+        offsets.append(entry);
+    }
+
+    QJsonObject result;
+    result.insert(QStringLiteral("file"), file);
+    result.insert(QStringLiteral("mediaMs"), media_ms);
+    result.insert(QStringLiteral("markersExpected"), expected);
+    result.insert(QStringLiteral("markersPaired"), values.size());
+    result.insert(QStringLiteral("flashesSeen"), flash_at.size());
+    result.insert(QStringLiteral("beepsHeard"), beep_at.size());
+    if (!values.isEmpty()) {
+        const int n = values.size();
+        double mean = 0.0;
+        double mean_time = 0.0;
+        double max_abs = 0.0;
+        for (int i = 0; i < n; i++) {
+            mean += values[i] / n;
+            mean_time += times[i] / n;
+            max_abs = qMax(max_abs, std::fabs(values[i]));
+        }
+        // Least-squares slope of the offset over the clip
+        double variance = 0.0;
+        double covariance = 0.0;
+        double time_variance = 0.0;
+        for (int i = 0; i < n; i++) {
+            variance += (values[i] - mean) * (values[i] - mean) / n;
+            covariance += (times[i] - mean_time) * (values[i] - mean);
+            time_variance += (times[i] - mean_time) * (times[i] - mean_time);
+        }
+        const double slope = time_variance > 0 ? covariance / time_variance : 0.0;
+        result.insert(QStringLiteral("meanOffsetMs"), mean);
+        result.insert(QStringLiteral("maxAbsOffsetMs"), max_abs);
+        result.insert(QStringLiteral("stddevMs"), std::sqrt(variance));
+        result.insert(QStringLiteral("firstOffsetMs"), values.first());
+        result.insert(QStringLiteral("lastOffsetMs"), values.last());
+        result.insert(QStringLiteral("driftMsPerMinute"), slope * 60000.0);
+        *passed = n == expected && max_abs <= options.toleranceMs;
+    }
+    result.insert(QStringLiteral("passed"), *passed);
+    result.insert(QStringLiteral("offsets"), offsets);
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Same settings as the player, so "pipeline/*" and "io/*" apply here too
+    QCoreApplication::setOrganizationName(QStringLiteral("QmlPlayer"));
+    QCoreApplication::setApplicationName(QStringLiteral("QMLPlayerFFmpeg"));
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Plays flash-and-beep clips in real time and checks audio/video sync."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("files"), QStringLiteral("Sync clips; directories are expanded to their clips."), QStringLiteral("files..."));
+    const QCommandLineOption tolerance_option(QStringLiteral("tolerance"), QStringLiteral("Largest allowed offset, in ms either way."), QStringLiteral("ms"), QStringLiteral("40"));
+    const QCommandLineOption buffer_option(QStringLiteral("sink-buffer"), QStringLiteral("Null audio sink buffer, in ms."), QStringLiteral("ms"), QStringLiteral("100"));
+    const QCommandLineOption refresh_option(QStringLiteral("refresh"), QStringLiteral("Display refresh rate of the video sink; 0 presents immediately."), QStringLiteral("hz"), QStringLiteral("60"));
+    const QCommandLineOption skew_option(QStringLiteral("clock-skew"), QStringLiteral("Audio device clock error, in ppm."), QStringLiteral("ppm"), QStringLiteral("0"));
+    const QCommandLineOption output_option(QStringLiteral("output"), QStringLiteral("Write the JSON report to this file instead of stdout."), QStringLiteral("file"));
+    parser.addOptions({tolerance_option, buffer_option, refresh_option, skew_option, output_option});
+    parser.process(app);
+
+    QStringList files;
+    for (const QString& argument : parser.positionalArguments()) {
+        if (!QFileInfo(argument).isDir()) {
+            files.append(argument);
+            continue;
+        }
+        const QDir dir(argument);
+        for (const QString& name : dir.entryList({QStringLiteral("*.mp4"), QStringLiteral("*.mkv"), QStringLiteral("*.ts")},
+                                                 QDir::Files, QDir::Name)) {
+            files.append(dir.filePath(name));
+        }
+    }
+    if (files.isEmpty()) {
+        parser.showHelp(1);
+    }
+    SyncOptions options;
+    options.toleranceMs = parser.value(tolerance_option).toDouble();
+    options.sinkBufferMs = qMax(1, parser.value(buffer_option).toInt());
+    options.refreshHz = qMax(0.0, parser.value(refresh_option).toDouble());
+    options.clockSkewPpm = parser.value(skew_option).toDouble();
+
+    QTextStream log(stderr);
+    QJsonArray results;
+    int failures = 0;
+    for (const QString& file : files) {
+        bool passed = false;
+        const QJsonObject result = runFile(file, options, &passed);
+        if (result.isEmpty()) {
+            failures++;
+            continue;
+        }
+        if (!passed) failures++;
+        log << file << ": mean " << QString::number(result.value(QStringLiteral("meanOffsetMs")).toDouble(), 'f', 1)
+            << " ms, max " << QString::number(result.value(QStringLiteral("maxAbsOffsetMs")).toDouble(), 'f', 1)
+            << " ms, drift " << QString::number(result.value(QStringLiteral("driftMsPerMinute")).toDouble(), 'f', 2)
+            << " ms/min, " << result.value(QStringLiteral("markersPaired")).toInt() << "/"
+            << result.value(QStringLiteral("markersExpected")).toInt() << " markers: "
+            << (passed ? "ok" : "FAILED") << "\n";
+        log.flush();
+        results.append(result);
+    }
+
+    QJsonObject report;
+    report.insert(QStringLiteral("tool"), QStringLiteral("qmlplayer-avsync"));
+    report.insert(QStringLiteral("version"), 1);
+    report.insert(QStringLiteral("toleranceMs"), options.toleranceMs);
+    report.insert(QStringLiteral("sinkBufferMs"), options.sinkBufferMs);
+    report.insert(QStringLiteral("refreshHz"), options.refreshHz);
+    report.insert(QStringLiteral("clockSkewPpm"), options.clockSkewPpm);
+    report.insert(QStringLiteral("ffmpeg"), QString::fromLatin1(av_version_info()));
+    report.insert(QStringLiteral("failures"), failures);
+    report.insert(QStringLiteral("results"), results);
+    const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+
+    if (parser.isSet(output_option)) {
+        QFile out(parser.value(output_option));
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "qmlplayer-avsync: cannot write" << out.fileName();
+            return 1;
+        }
+        out.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return failures > 0 ? 2 : 0;
+}
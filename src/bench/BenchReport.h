@@ -0,0 +1,64 @@
+#ifndef BENCHREPORT_H
+#define BENCHREPORT_H
+
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+#include <QTextStream>
+
+// Baseline comparison shared by the benchmark tools, so CI can fail a build on
+// a regression: entries of a result array are matched by their id fields and
+// a lower-is-better metric may not grow by more than the tolerance.
+namespace BenchReport {
+
+inline QString entryKey(const QJsonObject& entry, const QStringList& idFields) {
+    QStringList parts;
+    for (const QString& field : idFields) {
+        QString value = entry.value(field).toVariant().toString();
+        // Fixture paths differ between build directories
+        if (field == QLatin1String("file")) value = QFileInfo(value).fileName();
+        parts.append(value);
+    }
+    return parts.join(QLatin1Char('/'));
+}
+
+// The array under arrayKey of a report written earlier; empty when unreadable
+inline QJsonArray loadArray(const QString& path, const QString& arrayKey) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return {};
+    return QJsonDocument::fromJson(file.readAll()).object().value(arrayKey).toArray();
+}
+
+// Number of regressions; entries missing on either side are skipped
+inline int compare(const QJsonArray& baseline, const QJsonArray& current, const QStringList& idFields,
+                   const QString& metric, double tolerancePercent, QTextStream& log) {
+    QHash<QString, double> reference;
+    for (const QJsonValue& value : baseline) {
+        const QJsonObject entry = value.toObject();
+        if (entry.contains(metric)) reference.insert(entryKey(entry, idFields), entry.value(metric).toDouble());
+    }
+    int regressions = 0;
+    for (const QJsonValue& value : current) {
+        const QJsonObject entry = value.toObject();
+        const QString key = entryKey(entry, idFields);
+        const auto it = reference.constFind(key);
+        if (it == reference.constEnd() || *it <= 0.0 || !entry.contains(metric)) continue;
+        const double now = entry.value(metric).toDouble();
+        const double change = (now / *it - 1.0) * 100.0;
+        if (change > tolerancePercent) {
+            regressions++;
+            log << "REGRESSION " << key << ": " << metric << " " << *it << " -> " << now
+                << " (+" << QString::number(change, 'f', 1) << "%)\n";
+        }
+    }
+    log.flush();
+    return regressions;
+}
+
+} // namespace BenchReport
+
+#endif // BENCHREPORT_H
@@ -0,0 +1,441 @@
+// Headless decode throughput benchmark: runs the player's demux and decode
+// stages over media files with frame pacing off, discards the output and
+// reports throughput, CPU cost and memory as JSON, one run per file, threading
+// configuration and repetition. --streams decodes several copies of a file at
+// once, the load of a mosaic, to compare dedicated threads with a shared pool.
+//
+//   qmlplayer-bench [--config dedicated:0 --config shared:4 ...] [--repeat N]
+//                   [--streams 16] [--no-audio] [--no-video] [--output results.json]
+//                   [--baseline old.json --tolerance 10] [--trace trace.json]
+//                   files or directories...
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "../core/PipelineExecutor.h"
+#include "../core/Trace.h"
+#include "AllocCounter.h"
+#include "BenchReport.h"
+#include "HeadlessPipeline.h"
+#include "ProcessStats.h"
+
+namespace {
+
+// How the stages are run: a thread each, optionally with a multi-threaded video
+// codec, or as tasks on a PipelineExecutor of their own
+struct ThreadingConfig {
+    QString name;
+    bool shared = false;
+    int poolThreads = 0;    // shared: 0 is one worker per core
+    int codecThreads = -1;  // dedicated: video codec threads, 0 lets FFmpeg pick, -1 the codec default
+};
+
+// "dedicated", "dedicated:<codec threads>", "shared" or "shared:<pool threads>"
+bool parseConfig(const QString& spec, ThreadingConfig* config) {
+    const QStringList parts = spec.split(QLatin1Char(':'));
+    if (parts.size() > 2) return false;
+    int count = -1;
+    if (parts.size() == 2) {
+        bool ok = false;
+        count = parts[1].toInt(&ok);
+        if (!ok || count < 0) return false;
+    }
+    config->name = spec;
+    if (parts[0] == QLatin1String("dedicated")) {
+        config->shared = false;
+        config->codecThreads = count;
+        return true;
+    }
+    if (parts[0] == QLatin1String("shared")) {
+        config->shared = true;
+        config->poolThreads = qMax(0, count);
+        return true;
+    }
+    return false;
+}
+
+struct RunOptions {
+    bool video = true;
+    bool audio = true;
+    int timeoutMs = 0;
+    int streams = 1;    // copies decoded at once, like the tiles of a mosaic
+};
+
+void drainPackets(ThreadSafeQueue<AVPacket*>& queue) {
+    AVPacket* packet = nullptr;
+    while (queue.tryPop(packet)) {
+        av_packet_free(&packet);
+    }
+}
+
+// One copy of the file being decoded, a tile of the mosaic when there are several
+struct Tile {
+    std::unique_ptr<HeadlessPipeline> pipeline;
+    qint64 videoFrames = 0;
+    qint64 audioFrames = 0;
+    qint64 audioSamples = 0;
+    bool videoDone = false;
+    bool audioDone = false;
+
+    bool done() const { return videoDone && audioDone; }
+
+    // Stand-in for the renderer and audio output: take frames as soon as they
+    // are queued. Packets of streams not being decoded are dropped the same way.
+    // False when there was nothing to take.
+    bool drain() {
+        bool busy = false;
+        AVFrame* frame = nullptr;
+        if (!videoDone) {
+            // Frames are queued before endOfStream(), so draining after reading the flag gets them all
+            const bool ended = pipeline->videoEnded();
+            while (pipeline->video().frameQueue().tryPop(frame)) {
+                videoFrames++;
+                av_frame_free(&frame);
+                busy = true;
+            }
+            videoDone = ended;
+        }
+        while (!audioDone && pipeline->audio().frameQueue().tryPop(frame)) {
+            busy = true;
+            if (!frame) {
+                audioDone = true;
+                break;
+            }
+            audioFrames++;
+            audioSamples += frame->nb_samples;
+            av_frame_free(&frame);
+        }
+        if (!pipeline->hasVideo()) drainPackets(pipeline->demuxer().videoQueue());
+        if (!pipeline->hasAudio()) drainPackets(pipeline->demuxer().audioQueue());
+        return busy;
+    }
+};
+
+// One pass over the file, or options.streams passes at once; an empty object on failure
+QJsonObject runOnce(const QString& file, const ThreadingConfig& config, const RunOptions& options) {
+    // Declared first so the stages are gone before their pool
+    std::unique_ptr<PipelineExecutor> pool;
+    if (config.shared) pool = std::make_unique<PipelineExecutor>(config.poolThreads);
+
+    HeadlessPipeline::Options pipeline_options;
+    pipeline_options.video = options.video;
+    pipeline_options.audio = options.audio;
+    pipeline_options.executor = pool.get();
+    pipeline_options.paced = false;
+    pipeline_options.codecThreads = config.codecThreads;
+
+    QElapsedTimer open_timer;
+    open_timer.start();
+    std::vector<Tile> tiles(options.streams);
+    for (Tile& tile : tiles) {
+        tile.pipeline = std::make_unique<HeadlessPipeline>("qmlplayer-bench");
+        if (!tile.pipeline->open(file, pipeline_options)) return {};
+        tile.videoDone = !tile.pipeline->hasVideo();
+        tile.audioDone = !tile.pipeline->hasAudio();
+    }
+    const qint64 open_ms = open_timer.elapsed();
+    HeadlessPipeline& first = *tiles.front().pipeline;
+    const bool has_video = first.hasVideo();
+    const bool has_audio = first.hasAudio();
+
+    const AllocCounter::Snapshot allocs_before = AllocCounter::snapshot();
+    const qint64 cpu_before = ProcessStats::cpuTimeUs();
+    QElapsedTimer wall;
+    wall.start();
+
+    for (Tile& tile : tiles) {
+        tile.pipeline->start();
+    }
+
+    const auto failed = [&tiles]() {
+        return std::any_of(tiles.begin(), tiles.end(), [](const Tile& tile) { return tile.pipeline->failed(); });
+    };
+    bool timed_out = false;
+    while (!failed()) {
+        bool idle = true;
+        bool done = true;
+        for (Tile& tile : tiles) {
+            if (tile.drain()) idle = false;
+            done = done && tile.done();
+        }
+        if (done) break;
+        if (options.timeoutMs > 0 && wall.elapsed() > options.timeoutMs) {
+            timed_out = true;
+            break;
+        }
+        if (idle) QThread::usleep(200);
+    }
+
+    const qint64 wall_ns = wall.nsecsElapsed();
+    const qint64 cpu_us = ProcessStats::cpuTimeUs() - cpu_before;
+    const AllocCounter::Snapshot allocs_after = AllocCounter::snapshot();
+
+    qint64 video_frames = 0;
+    qint64 audio_frames = 0;
+    qint64 audio_samples = 0;
+    for (const Tile& tile : tiles) {
+        video_frames += tile.videoFrames;
+        audio_frames += tile.audioFrames;
+        audio_samples += tile.audioSamples;
+    }
+    // Of one tile: every tile plays the whole file
+    qint64 media_ms = first.mediaMs();
+    if (media_ms <= 0 && has_audio && first.audio().sampleRate() > 0) {
+        media_ms = tiles.front().audioSamples * 1000 / first.audio().sampleRate();
+    }
+    QJsonObject run;
+    run.insert(QStringLiteral("file"), file);
+    run.insert(QStringLiteral("config"), config.name);
+    if (options.streams > 1) {
+        run.insert(QStringLiteral("streams"), options.streams);
+    }
+    if (has_video) {
+        run.insert(QStringLiteral("videoCodec"), first.video().videoCodec());
+        run.insert(QStringLiteral("width"), first.video().videoWidth());
+        run.insert(QStringLiteral("height"), first.video().videoHeight());
+    }
+
+    const bool any_failed = failed();
+    tiles.clear();
+
+    if (any_failed || timed_out) {
+        if (timed_out) qWarning() << "qmlplayer-bench: timed out on" << file;
+        return {};
+    }
+
+    // Per-frame figures are over video frames, or audio frames for audio-only runs,
+    // summed over the tiles
+    const qint64 frames = has_video ? video_frames : audio_frames;
+    const double wall_ms = wall_ns / 1e6;
+    const qint64 allocations = allocs_after.allocations - allocs_before.allocations;
+    run.insert(QStringLiteral("mediaMs"), media_ms);
+    run.insert(QStringLiteral("openMs"), open_ms);
+    run.insert(QStringLiteral("wallMs"), wall_ms);
+    run.insert(QStringLiteral("videoFrames"), video_frames);
+    run.insert(QStringLiteral("audioFrames"), audio_frames);
+    run.insert(QStringLiteral("audioSamples"), audio_samples);
+    run.insert(QStringLiteral("fps"), wall_ms > 0 ? frames * 1000.0 / wall_ms : 0.0);
+    // Of the slowest tile, as the run waits for all of them; 1 and above keeps a mosaic real time
+    run.insert(QStringLiteral("realtimeFactor"), wall_ms > 0 ? media_ms / wall_ms : 0.0);
+    if (cpu_us >= 0) {
+        run.insert(QStringLiteral("cpuMs"), cpu_us / 1000.0);
+        run.insert(QStringLiteral("cpuUsPerFrame"), frames > 0 ? double(cpu_us) / frames : 0.0);
+        // Cores kept busy on average; above 1 means the work was spread over threads
+        run.insert(QStringLiteral("cpuUtilization"), wall_ms > 0 ? cpu_us / 1000.0 / wall_ms : 0.0);
+    }
+    if (AllocCounter::isActive()) {
+        run.insert(QStringLiteral("allocations"), allocations);
+        run.insert(QStringLiteral("allocatedBytes"), allocs_after.bytes - allocs_before.bytes);
+        run.insert(QStringLiteral("allocationsPerFrame"), frames > 0 ? double(allocations) / frames : 0.0);
+    }
+    // High-water mark of the whole process so far, i.e. of the most demanding run up to here
+    run.insert(QStringLiteral("peakRssKiB"), ProcessStats::peakRssKiB());
+    if (pool) {
+        run.insert(QStringLiteral("poolThreads"), pool->threadCount());
+        run.insert(QStringLiteral("poolSteps"), pool->stepCount());
+        run.insert(QStringLiteral("poolSteals"), pool->stealCount());
+    }
+    return run;
+}
+
+double median(QVector<double> values) {
+    if (values.isEmpty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    const int middle = values.size() / 2;
+    return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2.0;
+}
+
+// Medians over the repetitions of one file and configuration
+QJsonObject summarize(const QJsonArray& runs) {
+    static const char* const kKeys[] = {"fps", "realtimeFactor", "wallMs", "cpuUsPerFrame", "allocationsPerFrame"};
+    QJsonObject summary;
+    const QJsonObject first = runs.first().toObject();
+    summary.insert(QStringLiteral("file"), first.value(QStringLiteral("file")));
+    summary.insert(QStringLiteral("config"), first.value(QStringLiteral("config")));
+    if (first.contains(QStringLiteral("streams"))) {
+        summary.insert(QStringLiteral("streams"), first.value(QStringLiteral("streams")));
+    }
+    summary.insert(QStringLiteral("runs"), runs.size());
+    for (const char* key : kKeys) {
+        const QString name = QLatin1String(key);
+        if (!first.contains(name)) continue;
+        QVector<double> values;
+        for (const QJsonValue& run : runs) {
+            values.append(run.toObject().value(name).toDouble());
+        }
+        summary.insert(name, median(values));
+    }
+    return summary;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Same settings as the player, so "pipeline/*" and "io/*" apply here too
+    QCoreApplication::setOrganizationName(QStringLiteral("QmlPlayer"));
+    QCoreApplication::setApplicationName(QStringLiteral("QMLPlayerFFmpeg"));
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Decodes media files as fast as possible and reports throughput as JSON."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("files"), QStringLiteral("Media files to decode; directories are expanded to their clips."), QStringLiteral("files..."));
+    const QCommandLineOption config_option(QStringLiteral("config"),
+        QStringLiteral("Threading configuration, repeatable: dedicated[:codecThreads] or shared[:poolThreads]. "
+                       "Default: dedicated, dedicated:0 and shared."),
+        QStringLiteral("spec"));
+    const QCommandLineOption repeat_option(QStringLiteral("repeat"), QStringLiteral("Measured runs per file and configuration."), QStringLiteral("n"), QStringLiteral("3"));
+    const QCommandLineOption warmup_option(QStringLiteral("warmup"), QStringLiteral("Unreported runs before measuring, to warm caches."), QStringLiteral("n"), QStringLiteral("1"));
+    const QCommandLineOption timeout_option(QStringLiteral("timeout"), QStringLiteral("Abandon a run after this many seconds; 0 waits forever."), QStringLiteral("s"), QStringLiteral("0"));
+    const QCommandLineOption streams_option(QStringLiteral("streams"),
+        QStringLiteral("Decode this many copies of each file at once, like the tiles of a mosaic."), QStringLiteral("n"), QStringLiteral("1"));
+    const QCommandLineOption no_video_option(QStringLiteral("no-video"), QStringLiteral("Do not decode video."));
+    const QCommandLineOption no_audio_option(QStringLiteral("no-audio"), QStringLiteral("Do not decode audio."));
+    const QCommandLineOption output_option(QStringLiteral("output"), QStringLiteral("Write the JSON report to this file instead of stdout."), QStringLiteral("file"));
+    const QCommandLineOption baseline_option(QStringLiteral("baseline"),
+        QStringLiteral("Earlier report to compare against; a CPU time per frame regression fails the run."), QStringLiteral("file"));
+    const QCommandLineOption tolerance_option(QStringLiteral("tolerance"), QStringLiteral("Allowed growth against the baseline, in percent."), QStringLiteral("percent"), QStringLiteral("10"));
+    const QCommandLineOption trace_option(QStringLiteral("trace"),
+        QStringLiteral("Record the pipeline timeline and write it as Chrome trace JSON (needs -DQMLPLAYER_TRACING=ON)."), QStringLiteral("file"));
+    parser.addOptions({config_option, repeat_option, warmup_option, timeout_option, streams_option, no_video_option, no_audio_option,
+                       output_option, baseline_option, tolerance_option, trace_option});
+    parser.process(app);
+
+    QStringList files;
+    for (const QString& argument : parser.positionalArguments()) {
+        const QFileInfo info(argument);
+        if (!info.isDir()) {
+            files.append(argument);
+            continue;
+        }
+        // A fixture directory: every clip in it, in a stable order
+        const QDir dir(argument);
+        for (const QString& name : dir.entryList({QStringLiteral("*.mp4"), QStringLiteral("*.mkv"), QStringLiteral("*.ts")},
+                                                 QDir::Files, QDir::Name)) {
+            files.append(dir.filePath(name));
+        }
+    }
+    if (files.isEmpty()) {
+        parser.showHelp(1);
+    }
+    RunOptions options;
+    options.video = !parser.isSet(no_video_option);
+    options.audio = !parser.isSet(no_audio_option);
+    options.timeoutMs = qMax(0, parser.value(timeout_option).toInt()) * 1000;
+    options.streams = qMax(1, parser.value(streams_option).toInt());
+    if (!options.video && !options.audio) {
+        qWarning() << "qmlplayer-bench: --no-video and --no-audio leave nothing to decode";
+        return 1;
+    }
+    const int repeat = qMax(1, parser.value(repeat_option).toInt());
+    const int warmup = qMax(0, parser.value(warmup_option).toInt());
+
+    QStringList specs = parser.values(config_option);
+    if (specs.isEmpty()) {
+        specs = {QStringLiteral("dedicated"), QStringLiteral("dedicated:0"), QStringLiteral("shared")};
+    }
+    QVector<ThreadingConfig> configs;
+    for (const QString& spec : specs) {
+        ThreadingConfig config;
+        if (!parseConfig(spec, &config)) {
+            qWarning() << "qmlplayer-bench: invalid --config" << spec;
+            return 1;
+        }
+        configs.append(config);
+    }
+
+    if (parser.isSet(trace_option)) {
+        if (!Trace::isAvailable()) {
+            qWarning() << "qmlplayer-bench: --trace needs a build with -DQMLPLAYER_TRACING=ON";
+            return 1;
+        }
+        Trace::setEnabled(true);
+    }
+
+    QTextStream log(stderr);
+    QJsonArray runs;
+    QJsonArray summaries;
+    int failures = 0;
+    for (const QString& file : files) {
+        for (const ThreadingConfig& config : configs) {
+            for (int i = 0; i < warmup; i++) {
+                runOnce(file, config, options);
+            }
+            QJsonArray repetitions;
+            for (int i = 0; i < repeat; i++) {
+                const QJsonObject run = runOnce(file, config, options);
+                if (run.isEmpty()) {
+                    failures++;
+                    continue;
+                }
+                log << file << " [" << config.name;
+                if (options.streams > 1) log << " x" << options.streams;
+                log << "] "
+                    << QString::number(run.value(QStringLiteral("fps")).toDouble(), 'f', 1) << " fps, "
+                    << QString::number(run.value(QStringLiteral("realtimeFactor")).toDouble(), 'f', 1) << "x realtime\n";
+                log.flush();
+                repetitions.append(run);
+                runs.append(run);
+            }
+            if (!repetitions.isEmpty()) {
+                summaries.append(summarize(repetitions));
+            }
+        }
+    }
+
+    if (parser.isSet(trace_option)) {
+        // Each thread keeps its latest events only, so long sessions show the last runs
+        Trace::setEnabled(false);
+        Trace::dump(parser.value(trace_option));
+    }
+
+    QJsonObject report;
+    report.insert(QStringLiteral("tool"), QStringLiteral("qmlplayer-bench"));
+    report.insert(QStringLiteral("version"), 1);
+    report.insert(QStringLiteral("idealThreadCount"), QThread::idealThreadCount());
+    report.insert(QStringLiteral("allocationCounting"), AllocCounter::isActive());
+    report.insert(QStringLiteral("ffmpeg"), QString::fromLatin1(av_version_info()));
+    report.insert(QStringLiteral("peakRssKiB"), ProcessStats::peakRssKiB());
+    report.insert(QStringLiteral("failures"), failures);
+    report.insert(QStringLiteral("runs"), runs);
+    report.insert(QStringLiteral("summary"), summaries);
+    const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+
+    if (parser.isSet(output_option)) {
+        QFile out(parser.value(output_option));
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "qmlplayer-bench: cannot write" << out.fileName();
+            return 1;
+        }
+        out.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+
+    if (parser.isSet(baseline_option)) {
+        const QJsonArray baseline = BenchReport::loadArray(parser.value(baseline_option), QStringLiteral("summary"));
+        if (baseline.isEmpty()) {
+            qWarning() << "qmlplayer-bench: cannot read baseline" << parser.value(baseline_option);
+            return 1;
+        }
+        // CPU time per frame rather than wall time: far less sensitive to what else the machine is doing
+        const int regressions = BenchReport::compare(baseline, summaries, {QStringLiteral("file"), QStringLiteral("config")},
+                                                     QStringLiteral("cpuUsPerFrame"), parser.value(tolerance_option).toDouble(), log);
+        if (regressions > 0) return 2;
+    }
+    return failures > 0 ? 2 : 0;
+}
@@ -0,0 +1,421 @@
+// Writes the synthetic clips the benchmark suite runs on. Everything is made
+// with FFmpeg's built-in encoders from procedural pictures and tones, with
+// bit-exact flags and single-threaded encoders, so the same FFmpeg build
+// produces byte-identical files on every machine and no media has to be
+// downloaded or checked in.
+//
+//   qmlplayer-fixtures <output directory>
+//
+// Besides the clips, the directory receives fixtures.json describing them. The
+// A/V sync clips go into sync/, out of the way of the throughput benchmarks.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <cmath>
+#include <cstring>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+}
+
+namespace {
+
+constexpr int kFrameRate = 25;
+// Sync clips: a white frame and a 1 kHz beep at the start of every second but the first
+constexpr int kMarkerIntervalMs = 1000;
+constexpr int kBeepMs = 40;
+
+struct FixtureSpec {
+    const char* name;        // container from the extension
+    const char* videoCodec;  // nullptr for audio-only clips
+    int width;
+    int height;
+    int gop;
+    int bFrames;
+    const char* audioCodec;  // nullptr for video-only clips
+    int sampleRate;
+    int seconds;
+    bool syncMarkers = false;  // flash and beep markers on black and silence
+};
+
+// Covers the containers, GOP structures and sizes the player meets most. The
+// 854 pixel width leaves decoders padding their rows, so YuvPacker has to copy.
+const FixtureSpec kFixtures[] = {
+    {"mpeg4_360p_gop12_b2_aac.mp4", "mpeg4", 640, 360, 12, 2, "aac", 48000, 10},
+    {"mpeg4_360p_gop25_aac.ts", "mpeg4", 640, 360, 25, 0, "aac", 48000, 10},
+    {"mpeg4_720p_gop250_pcm.mkv", "mpeg4", 1280, 720, 250, 0, "pcm_s16le", 48000, 10},
+    {"mpeg4_1080p_gop50.mp4", "mpeg4", 1920, 1080, 50, 0, nullptr, 0, 5},
+    {"mpeg4_854x480_gop25_pcm.mkv", "mpeg4", 854, 480, 25, 0, "pcm_s16le", 48000, 10},
+    {"ffv1_360p_intra_pcm.mkv", "ffv1", 640, 360, 1, 0, "pcm_s16le", 44100, 5},
+    {"pcm_44k1_stereo.mkv", nullptr, 0, 0, 0, 0, "pcm_s16le", 44100, 30},
+    // AAC priming, MPEG-TS timestamps and 44.1 kHz resampling are the usual sources of an offset;
+    // the long clip shows drift
+    {"sync/sync_mpeg4_aac_30s.mp4", "mpeg4", 640, 360, 25, 2, "aac", 48000, 30, true},
+    {"sync/sync_mpeg4_aac_30s.ts", "mpeg4", 640, 360, 25, 0, "aac", 48000, 30, true},
+    {"sync/sync_mpeg4_pcm44k1_30s.mkv", "mpeg4", 640, 360, 25, 0, "pcm_s16le", 44100, 30, true},
+    {"sync/sync_mpeg4_aac_300s.mp4", "mpeg4", 640, 360, 50, 0, "aac", 48000, 300, true},
+};
+
+QString errorString(int error) {
+    char buffer[AV_ERROR_MAX_STRING_SIZE] = {};
+    av_strerror(error, buffer, sizeof(buffer));
+    return QString::fromUtf8(buffer);
+}
+
+struct OutputStream {
+    AVStream* stream = nullptr;
+    AVCodecContext* codec = nullptr;
+    AVFrame* frame = nullptr;
+    int64_t next_pts = 0;
+    int64_t end_pts = 0;   // in codec time base
+    double phase = 0.0;    // tone generator
+    bool finished = false;
+
+    ~OutputStream() {
+        avcodec_free_context(&codec);
+        av_frame_free(&frame);
+    }
+};
+
+bool openVideo(AVFormatContext* format, const FixtureSpec& spec, OutputStream* out) {
+    const AVCodec* codec = avcodec_find_encoder_by_name(spec.videoCodec);
+    if (!codec) {
+        qWarning() << "qmlplayer-fixtures: no encoder" << spec.videoCodec;
+        return false;
+    }
+    out->codec = avcodec_alloc_context3(codec);
+    AVCodecContext* ctx = out->codec;
+    ctx->width = spec.width;
+    ctx->height = spec.height;
+    ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    ctx->time_base = {1, kFrameRate};
+    ctx->framerate = {kFrameRate, 1};
+    ctx->gop_size = spec.gop;
+    ctx->max_b_frames = spec.bFrames;
+    ctx->thread_count = 1;
+    ctx->flags |= AV_CODEC_FLAG_BITEXACT;
+    if (codec->id == AV_CODEC_ID_MPEG4) {
+        // Constant quantizer: realistic bitrates at every size without rate control
+        ctx->flags |= AV_CODEC_FLAG_QSCALE;
+        ctx->global_quality = FF_QP2LAMBDA * 4;
+    }
+    if (format->oformat->flags & AVFMT_GLOBALHEADER) {
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    int ret = avcodec_open2(ctx, codec, nullptr);
+    if (ret < 0) {
+        qWarning() << "qmlplayer-fixtures: cannot open" << spec.videoCodec << errorString(ret);
+        return false;
+    }
+
+    out->frame = av_frame_alloc();
+    out->frame->format = ctx->pix_fmt;
+    out->frame->width = ctx->width;
+    out->frame->height = ctx->height;
+    if (av_frame_get_buffer(out->frame, 0) < 0) return false;
+    out->end_pts = int64_t(spec.seconds) * kFrameRate;
+
+    out->stream = avformat_new_stream(format, nullptr);
+    out->stream->time_base = ctx->time_base;
+    out->stream->avg_frame_rate = ctx->framerate;
+    return avcodec_parameters_from_context(out->stream->codecpar, ctx) >= 0;
+}
+
+bool openAudio(AVFormatContext* format, const FixtureSpec& spec, OutputStream* out) {
+    const AVCodec* codec = avcodec_find_encoder_by_name(spec.audioCodec);
+    if (!codec) {
+        qWarning() << "qmlplayer-fixtures: no encoder" << spec.audioCodec;
+        return false;
+    }
+    out->codec = avcodec_alloc_context3(codec);
+    AVCodecContext* ctx = out->codec;
+    const AVChannelLayout stereo = AV_CHANNEL_LAYOUT_STEREO;
+    av_channel_layout_copy(&ctx->ch_layout, &stereo);
+    ctx->sample_rate = spec.sampleRate;
+    ctx->sample_fmt = codec->id == AV_CODEC_ID_AAC ? AV_SAMPLE_FMT_FLTP : AV_SAMPLE_FMT_S16;
+    ctx->bit_rate = 128000;
+    ctx->time_base = {1, spec.sampleRate};
+    ctx->thread_count = 1;
+    ctx->flags |= AV_CODEC_FLAG_BITEXACT;
+    if (format->oformat->flags & AVFMT_GLOBALHEADER) {
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    int ret = avcodec_open2(ctx, codec, nullptr);
+    if (ret < 0) {
+        qWarning() << "qmlplayer-fixtures: cannot open" << spec.audioCodec << errorString(ret);
+        return false;
+    }
+
+    out->frame = av_frame_alloc();
+    out->frame->format = ctx->sample_fmt;
+    out->frame->sample_rate = ctx->sample_rate;
+    out->frame->nb_samples = ctx->frame_size > 0 ? ctx->frame_size : 1024;
+    av_channel_layout_copy(&out->frame->ch_layout, &ctx->ch_layout);
+    if (av_frame_get_buffer(out->frame, 0) < 0) return false;
+    out->end_pts = int64_t(spec.seconds) * spec.sampleRate;
+
+    out->stream = avformat_new_stream(format, nullptr);
+    out->stream->time_base = ctx->time_base;
+    return avcodec_parameters_from_context(out->stream->codecpar, ctx) >= 0;
+}
+
+// Diagonal gradients drifting in opposite directions, a bright box crossing the
+// picture and a little hashed grain, so motion search and entropy coding have
+// real work to do
+void fillPicture(AVFrame* frame, int64_t index) {
+    const int t = int(index);
+    const int box_x = (t * 7) % qMax(1, frame->width - 64);
+    const int box_y = (t * 3) % qMax(1, frame->height - 64);
+    for (int y = 0; y < frame->height; y++) {
+        uint8_t* row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < frame->width; x++) {
+            const uint32_t grain = (uint32_t(x) * 73856093u ^ uint32_t(y) * 19349663u ^ uint32_t(t) * 83492791u) >> 29;
+            int value = ((x + y + t * 2) & 0xff) / 2 + 32 + int(grain);
+            if (x >= box_x && x < box_x + 64 && y >= box_y && y < box_y + 64) value = 235;
+            row[x] = uint8_t(value);
+        }
+    }
+    for (int y = 0; y < (frame->height + 1) / 2; y++) {
+        uint8_t* u = frame->data[1] + y * frame->linesize[1];
+        uint8_t* v = frame->data[2] + y * frame->linesize[2];
+        for (int x = 0; x < (frame->width + 1) / 2; x++) {
+            u[x] = uint8_t(96 + ((x * 2 - t) & 63));
+            v[x] = uint8_t(96 + ((y * 2 + t) & 63));
+        }
+    }
+}
+
+// Black, or white on the first frame of each marker interval
+void fillSyncPicture(AVFrame* frame, int64_t index) {
+    const int64_t frames_per_marker = int64_t(kFrameRate) * kMarkerIntervalMs / 1000;
+    const bool flash = index > 0 && index % frames_per_marker == 0;
+    for (int y = 0; y < frame->height; y++) {
+        memset(frame->data[0] + y * frame->linesize[0], flash ? 235 : 16, frame->width);
+    }
+    for (int plane = 1; plane < 3; plane++) {
+        for (int y = 0; y < (frame->height + 1) / 2; y++) {
+            memset(frame->data[plane] + y * frame->linesize[plane], 128, (frame->width + 1) / 2);
+        }
+    }
+}
+
+// Silence, with a beep starting exactly where each flash frame starts
+void fillSyncTone(OutputStream* out) {
+    AVFrame* frame = out->frame;
+    const int rate = frame->sample_rate;
+    const int samples = int(qMin<int64_t>(frame->nb_samples, out->end_pts - out->next_pts));
+    frame->nb_samples = samples;
+    const int64_t samples_per_marker = int64_t(rate) * kMarkerIntervalMs / 1000;
+    const int64_t beep_samples = int64_t(rate) * kBeepMs / 1000;
+    for (int i = 0; i < samples; i++) {
+        const int64_t n = out->next_pts + i;
+        const int64_t offset = n % samples_per_marker;
+        double value = 0.0;
+        if (n >= samples_per_marker && offset < beep_samples) {
+            value = 0.5 * std::sin(6.283185307179586 * 1000.0 * double(offset) / rate);
+        }
+        if (frame->format == AV_SAMPLE_FMT_FLTP) {
+            reinterpret_cast<float*>(frame->data[0])[i] = float(value);
+            reinterpret_cast<float*>(frame->data[1])[i] = float(value);
+        } else {
+            int16_t* interleaved = reinterpret_cast<int16_t*>(frame->data[0]);
+            interleaved[i * 2] = interleaved[i * 2 + 1] = int16_t(std::lround(value * 32767.0));
+        }
+    }
+}
+
+// A rising sweep, a fifth apart between the channels
+void fillTone(OutputStream* out, int seconds) {
+    AVFrame* frame = out->frame;
+    const int rate = frame->sample_rate;
+    const int samples = int(qMin<int64_t>(frame->nb_samples, out->end_pts - out->next_pts));
+    frame->nb_samples = samples;
+    const double two_pi = 6.283185307179586;
+    for (int i = 0; i < samples; i++) {
+        const double progress = double(out->next_pts + i) / (double(rate) * seconds);
+        const double frequency = 220.0 + 660.0 * progress;
+        // Not wrapped: the right channel runs at 1.5 times the phase
+        out->phase += two_pi * frequency / rate;
+        const double left = 0.4 * std::sin(out->phase);
+        const double right = 0.4 * std::sin(out->phase * 1.5);
+        if (frame->format == AV_SAMPLE_FMT_FLTP) {
+            reinterpret_cast<float*>(frame->data[0])[i] = float(left);
+            reinterpret_cast<float*>(frame->data[1])[i] = float(right);
+        } else {
+            int16_t* interleaved = reinterpret_cast<int16_t*>(frame->data[0]);
+            interleaved[i * 2] = int16_t(std::lround(left * 32767.0));
+            interleaved[i * 2 + 1] = int16_t(std::lround(right * 32767.0));
+        }
+    }
+}
+
+bool writePackets(AVFormatContext* format, OutputStream* out, AVPacket* packet) {
+    for (;;) {
+        int ret = avcodec_receive_packet(out->codec, packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return true;
+        if (ret < 0) return false;
+        av_packet_rescale_ts(packet, out->codec->time_base, out->stream->time_base);
+        packet->stream_index = out->stream->index;
+        ret = av_interleaved_write_frame(format, packet);
+        if (ret < 0) {
+            qWarning() << "qmlplayer-fixtures: write failed" << errorString(ret);
+            return false;
+        }
+    }
+}
+
+// Sends the next frame of the stream, or the end-of-stream flush
+bool encodeNext(AVFormatContext* format, const FixtureSpec& spec, OutputStream* out, AVPacket* packet) {
+    int ret = 0;
+    if (out->next_pts >= out->end_pts) {
+        ret = avcodec_send_frame(out->codec, nullptr);
+        out->finished = true;
+    } else {
+        if (av_frame_make_writable(out->frame) < 0) return false;
+        if (out->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
+            if (spec.syncMarkers) {
+                fillSyncPicture(out->frame, out->next_pts);
+            } else {
+                fillPicture(out->frame, out->next_pts);
+            }
+            out->frame->pts = out->next_pts++;
+        } else {
+            if (spec.syncMarkers) {
+                fillSyncTone(out);
+            } else {
+                fillTone(out, spec.seconds);
+            }
+            out->frame->pts = out->next_pts;
+            out->next_pts += out->frame->nb_samples;
+        }
+        ret = avcodec_send_frame(out->codec, out->frame);
+    }
+    if (ret < 0) {
+        qWarning() << "qmlplayer-fixtures: encoding failed" << errorString(ret);
+        return false;
+    }
+    return writePackets(format, out, packet);
+}
+
+bool writeFixture(const QString& path, const FixtureSpec& spec) {
+    const QByteArray file = QFile::encodeName(path);
+    AVFormatContext* format = nullptr;
+    if (avformat_alloc_output_context2(&format, nullptr, nullptr, file.constData()) < 0) {
+        qWarning() << "qmlplayer-fixtures: no muxer for" << path;
+        return false;
+    }
+    // No library versions or dates in the headers
+    format->flags |= AVFMT_FLAG_BITEXACT;
+
+    OutputStream video;
+    OutputStream audio;
+    bool ok = (!spec.videoCodec || openVideo(format, spec, &video))
+           && (!spec.audioCodec || openAudio(format, spec, &audio));
+    video.finished = !spec.videoCodec;
+    audio.finished = !spec.audioCodec;
+
+    if (ok && !(format->oformat->flags & AVFMT_NOFILE)) {
+        int ret = avio_open(&format->pb, file.constData(), AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            qWarning() << "qmlplayer-fixtures: cannot create" << path << errorString(ret);
+            ok = false;
+        }
+    }
+    if (ok && avformat_write_header(format, nullptr) < 0) {
+        qWarning() << "qmlplayer-fixtures: cannot write header of" << path;
+        ok = false;
+    }
+
+    AVPacket* packet = av_packet_alloc();
+    while (ok && !(video.finished && audio.finished)) {
+        // Interleave by presentation time
+        OutputStream* next = &video;
+        if (video.finished || (!audio.finished
+                && av_compare_ts(audio.next_pts, audio.codec->time_base, video.next_pts, video.codec->time_base) < 0)) {
+            next = &audio;
+        }
+        ok = encodeNext(format, spec, next, packet);
+    }
+    av_packet_free(&packet);
+
+    if (ok) ok = av_write_trailer(format) >= 0;
+    if (format->pb && !(format->oformat->flags & AVFMT_NOFILE)) avio_closep(&format->pb);
+    avformat_free_context(format);
+    return ok;
+}
+
+QJsonObject describe(const FixtureSpec& spec) {
+    QJsonObject fixture;
+    fixture.insert(QStringLiteral("file"), QString::fromLatin1(spec.name));
+    fixture.insert(QStringLiteral("container"), QFileInfo(QString::fromLatin1(spec.name)).suffix());
+    fixture.insert(QStringLiteral("durationMs"), spec.seconds * 1000);
+    if (spec.videoCodec) {
+        fixture.insert(QStringLiteral("videoCodec"), QString::fromLatin1(spec.videoCodec));
+        fixture.insert(QStringLiteral("width"), spec.width);
+        fixture.insert(QStringLiteral("height"), spec.height);
+        fixture.insert(QStringLiteral("frameRate"), kFrameRate);
+        fixture.insert(QStringLiteral("gop"), spec.gop);
+        fixture.insert(QStringLiteral("bFrames"), spec.bFrames);
+    }
+    if (spec.audioCodec) {
+        fixture.insert(QStringLiteral("audioCodec"), QString::fromLatin1(spec.audioCodec));
+        fixture.insert(QStringLiteral("sampleRate"), spec.sampleRate);
+    }
+    if (spec.syncMarkers) {
+        fixture.insert(QStringLiteral("markerIntervalMs"), kMarkerIntervalMs);
+        fixture.insert(QStringLiteral("beepMs"), kBeepMs);
+    }
+    return fixture;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Generates the synthetic clips of the benchmark suite."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("directory"), QStringLiteral("Output directory."));
+    parser.process(app);
+    if (parser.positionalArguments().size() != 1) {
+        parser.showHelp(1);
+    }
+
+    QDir dir(parser.positionalArguments().first());
+    if (!dir.mkpath(QStringLiteral("sync"))) {
+        qWarning() << "qmlplayer-fixtures: cannot create" << dir.path();
+        return 1;
+    }
+    av_log_set_level(AV_LOG_ERROR);
+
+    QJsonArray fixtures;
+    for (const FixtureSpec& spec : kFixtures) {
+        const QString path = dir.filePath(QString::fromLatin1(spec.name));
+        if (!writeFixture(path, spec)) {
+            QFile::remove(path);
+            return 1;
+        }
+        fixtures.append(describe(spec));
+    }
+
+    QFile manifest(dir.filePath(QStringLiteral("fixtures.json")));
+    if (!manifest.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "qmlplayer-fixtures: cannot write" << manifest.fileName();
+        return 1;
+    }
+    QJsonObject root;
+    root.insert(QStringLiteral("ffmpeg"), QString::fromLatin1(av_version_info()));
+    root.insert(QStringLiteral("fixtures"), fixtures);
+    manifest.write(QJsonDocument(root).toJson(QJsonDocument::Indented));
+    return 0;
+}
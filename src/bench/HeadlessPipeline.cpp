@@ -0,0 +1,127 @@
+#include "HeadlessPipeline.h"
+#include "NullAudioSink.h"
+#include <QDebug>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+}
+
+HeadlessPipeline::HeadlessPipeline(const char* tool)
+    : tool_(tool) {
+    const auto report = [this](const QString& message) { fail(message); };
+    QObject::connect(&demuxer_, &AVDemuxer::errorOccurred, report);
+    QObject::connect(&video_, &VideoDecoder::errorOccurred, report);
+    QObject::connect(&audio_, &AudioDecoder::errorOccurred, report);
+    QObject::connect(&video_, &VideoDecoder::endOfStream, [this]() { video_ended_ = true; });
+}
+
+HeadlessPipeline::~HeadlessPipeline() {
+    close();
+}
+
+void HeadlessPipeline::fail(const QString& message) {
+    qWarning().noquote() << QLatin1String(tool_) + QLatin1Char(':') << message;
+    failed_ = true;
+}
+
+bool HeadlessPipeline::open(const QString& file, const Options& options) {
+    if (!demuxer_.open(file)) {
+        qWarning().noquote() << QLatin1String(tool_) + QLatin1String(": cannot open") << file;
+        return false;
+    }
+    // A network demuxer blocks in reads, which would hold up a pool worker
+    demuxer_.setExecutor(demuxer_.isNetworkSource() ? nullptr : options.executor);
+    video_.setExecutor(options.executor);
+    audio_.setExecutor(options.executor);
+    video_.setPaced(options.paced);
+    video_.setCodecThreads(options.codecThreads);
+
+    AVFormatContext* ctx = demuxer_.formatContext();
+    has_video_ = options.video && demuxer_.videoStreamIndex() >= 0;
+    has_audio_ = options.audio && demuxer_.audioStreamIndex() >= 0;
+    if (has_video_) {
+        video_.setPacketQueue(&demuxer_.videoQueue());
+        has_video_ = video_.open(ctx, demuxer_.videoStreamIndex());
+    }
+    if (has_audio_) {
+        audio_.setPacketQueue(&demuxer_.audioQueue());
+        has_audio_ = audio_.open(ctx, demuxer_.audioStreamIndex());
+    }
+    if ((options.video || options.audio) && !has_video_ && !has_audio_) {
+        qWarning().noquote() << QLatin1String(tool_) + QLatin1String(": nothing to decode in") << file;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void HeadlessPipeline::start() {
+    demuxer_.start();
+    if (has_video_) {
+        video_.start();
+        video_.play();
+    }
+    if (has_audio_) {
+        audio_.start();
+    }
+}
+
+void HeadlessPipeline::close() {
+    stopSinks();
+    audio_.close();
+    video_.close();
+    demuxer_.close();
+}
+
+qint64 HeadlessPipeline::mediaMs() const {
+    const AVFormatContext* ctx = demuxer_.formatContext();
+    return ctx && ctx->duration != AV_NOPTS_VALUE ? ctx->duration * 1000 / AV_TIME_BASE : 0;
+}
+
+void HeadlessPipeline::startSinks(const QElapsedTimer& clock, int sinkBufferMs, double clockSkewPpm,
+                                  VideoSink onVideo, AudioSink onAudio) {
+    stop_sinks_ = false;
+    if (has_video_) {
+        video_sink_.reset(QThread::create([this, onVideo]() {
+            while (!stop_sinks_) {
+                // Frames are queued before endOfStream(), so an empty queue after the flag means done
+                const bool ended = video_ended_;
+                AVFrame* frame = nullptr;
+                if (!video_.frameQueue().popFor(frame, 20)) {
+                    if (ended) break;
+                    continue;
+                }
+                if (onVideo) onVideo(frame);
+                av_frame_free(&frame);
+            }
+        }));
+        video_sink_->start();
+    }
+    if (has_audio_) {
+        audio_sink_.reset(QThread::create([this, &clock, sinkBufferMs, clockSkewPpm, onAudio]() {
+            NullAudioSink sink(clock, audio_.sampleRate(), sinkBufferMs, clockSkewPpm);
+            while (!stop_sinks_) {
+                AVFrame* frame = nullptr;
+                if (!audio_.frameQueue().popFor(frame, 20)) continue;
+                if (!frame) break;  // end of stream
+                const qint64 played_ns = sink.write(frame->nb_samples);
+                if (onAudio) onAudio(frame, played_ns, sink.nsPerSample());
+                av_frame_free(&frame);
+            }
+        }));
+        audio_sink_->start();
+    }
+}
+
+bool HeadlessPipeline::sinksFinished() const {
+    return (!video_sink_ || video_sink_->isFinished()) && (!audio_sink_ || audio_sink_->isFinished());
+}
+
+void HeadlessPipeline::stopSinks() {
+    stop_sinks_ = true;
+    if (video_sink_) video_sink_->wait();
+    if (audio_sink_) audio_sink_->wait();
+    video_sink_.reset();
+    audio_sink_.reset();
+}
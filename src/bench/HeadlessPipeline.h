@@ -0,0 +1,83 @@
+#ifndef HEADLESSPIPELINE_H
+#define HEADLESSPIPELINE_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QThread>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "../core/AVDemuxer.h"
+#include "../core/AudioDecoder.h"
+#include "../core/VideoDecoder.h"
+
+class PipelineExecutor;
+struct AVFrame;
+
+// The demux and decode stages VideoRenderer runs for a file, without a window or
+// an audio device, as the bench tools drive them. Errors of any stage are logged
+// under the tool's name and make failed() true. Optional sink threads stand in
+// for the renderer and AudioOutput in real-time runs.
+class HeadlessPipeline {
+public:
+    struct Options {
+        bool video = true;
+        bool audio = true;
+        PipelineExecutor* executor = nullptr;   // nullptr runs every stage on a thread of its own
+        bool paced = true;                      // false decodes video as fast as possible
+        int codecThreads = -1;                  // video codec threads, -1 the codec default
+    };
+
+    // A frame taken off the decoder's queue; freed after the callback returns.
+    // Audio gets the time its first sample is played, in ns on the sink clock,
+    // and the sink's (skewed) duration of a sample.
+    using VideoSink = std::function<void(const AVFrame* frame)>;
+    using AudioSink = std::function<void(const AVFrame* frame, qint64 playedNs, double nsPerSample)>;
+
+    explicit HeadlessPipeline(const char* tool);
+    ~HeadlessPipeline();
+
+    // Opens the file and the decoders for the streams asked for; false, with a
+    // warning, when it cannot be opened or has none of them. Neither video nor
+    // audio asked for leaves a demuxer only, whose queues the caller drains.
+    bool open(const QString& file, const Options& options);
+    void start();
+    // Stops the sinks and closes all stages; called by the destructor too
+    void close();
+
+    // Threads that take frames the moment they are queued, audio at the pace of a
+    // NullAudioSink on clock. Each ends with its stream or at stopSinks().
+    void startSinks(const QElapsedTimer& clock, int sinkBufferMs, double clockSkewPpm,
+                    VideoSink onVideo = {}, AudioSink onAudio = {});
+    bool sinksFinished() const;
+    void stopSinks();
+
+    bool failed() const { return failed_; }
+    void fail(const QString& message);
+    bool videoEnded() const { return video_ended_; }
+    bool hasVideo() const { return has_video_; }
+    bool hasAudio() const { return has_audio_; }
+    qint64 mediaMs() const;     // 0 when the container does not know
+
+    AVDemuxer& demuxer() { return demuxer_; }
+    VideoDecoder& video() { return video_; }
+    AudioDecoder& audio() { return audio_; }
+    AVFormatContext* formatContext() const { return demuxer_.formatContext(); }
+
+private:
+    const char* tool_;
+    AVDemuxer demuxer_;
+    VideoDecoder video_;
+    AudioDecoder audio_;
+    std::atomic<bool> failed_{false};
+    std::atomic<bool> video_ended_{false};
+    bool has_video_ = false;
+    bool has_audio_ = false;
+
+    std::atomic<bool> stop_sinks_{false};
+    std::unique_ptr<QThread> video_sink_;
+    std::unique_ptr<QThread> audio_sink_;
+};
+
+#endif // HEADLESSPIPELINE_H
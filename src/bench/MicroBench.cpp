@@ -0,0 +1,296 @@
+// Microbenchmarks of the player's hot paths that need no GPU and no audio
+// device: the packet/frame queue, the AudioDecoder decode + resample path and
+// the YUV packing done before each texture upload. Every benchmark takes
+// several timed samples after a warm-up one and reports the median cost per
+// operation, which is what --baseline gates on.
+//
+//   qmlplayer-microbench [--fixtures <dir>] [--samples N] [--filter text]
+//                        [--output results.json] [--baseline old.json --tolerance 10]
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+}
+
+#include "../core/AudioDecoder.h"
+#include "../core/ThreadSafeQueue.h"
+#include "../core/YuvPacker.h"
+#include "BenchReport.h"
+
+namespace {
+
+struct Sample {
+    qint64 operations = 0;
+    qint64 ns = 0;
+};
+
+struct Benchmark {
+    QString name;
+    QString operation;  // what one operation is
+    std::function<Sample()> run;
+};
+
+QJsonObject measure(const Benchmark& benchmark, int samples) {
+    benchmark.run();  // warm-up: caches, allocator, lazily created state
+    QVector<double> ns_per_op;
+    qint64 operations = 0;
+    for (int i = 0; i < samples; i++) {
+        const Sample sample = benchmark.run();
+        if (sample.operations <= 0) return {};
+        operations = sample.operations;
+        ns_per_op.append(double(sample.ns) / sample.operations);
+    }
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    const int middle = ns_per_op.size() / 2;
+    const double median = ns_per_op.size() % 2 ? ns_per_op[middle] : (ns_per_op[middle - 1] + ns_per_op[middle]) / 2.0;
+
+    QJsonObject result;
+    result.insert(QStringLiteral("name"), benchmark.name);
+    result.insert(QStringLiteral("operation"), benchmark.operation);
+    result.insert(QStringLiteral("operationsPerSample"), operations);
+    result.insert(QStringLiteral("samples"), samples);
+    result.insert(QStringLiteral("nsPerOp"), median);
+    result.insert(QStringLiteral("minNsPerOp"), ns_per_op.first());
+    result.insert(QStringLiteral("maxNsPerOp"), ns_per_op.last());
+    return result;
+}
+
+// --- ThreadSafeQueue ---------------------------------------------------------
+
+// Uncontended tryPush/tryPop pairs, the pattern of the pipeline stages' steps
+Sample queueTryPushPop(bool accounting) {
+    constexpr int kOperations = 1000000;
+    ThreadSafeQueue<int> queue(64);
+    if (accounting) {
+        queue.setWeigher([](const int& value) -> qint64 { return value; });
+        queue.setSizer([](const int&) -> qint64 { return 1; });
+    }
+    QElapsedTimer timer;
+    timer.start();
+    int value = 0;
+    for (int i = 0; i < kOperations; i++) {
+        queue.tryPush(i);
+        queue.tryPop(value);
+    }
+    return {kOperations, timer.nsecsElapsed()};
+}
+
+// Blocking hand-over between two threads through a short queue, as between
+// demuxer and decoder
+Sample queueProducerConsumer() {
+    constexpr int kItems = 200000;
+    ThreadSafeQueue<int> queue(16);
+    QElapsedTimer timer;
+    timer.start();
+    QThread* producer = QThread::create([&queue]() {
+        for (int i = 0; i < kItems; i++) queue.push(i);
+    });
+    producer->start();
+    int value = 0;
+    for (int i = 0; i < kItems; i++) queue.pop(value);
+    const qint64 ns = timer.nsecsElapsed();
+    producer->wait();
+    delete producer;
+    return {kItems, ns};
+}
+
+// --- AudioDecoder ------------------------------------------------------------
+
+// The audio packets of a clip, read up front so file I/O and demuxing stay out
+// of the measurement
+struct AudioClip {
+    AVFormatContext* format = nullptr;
+    int stream = -1;
+    std::vector<AVPacket*> packets;
+
+    ~AudioClip() {
+        for (AVPacket* packet : packets) av_packet_free(&packet);
+        avformat_close_input(&format);
+    }
+
+    bool load(const QString& path) {
+        const QByteArray file = QFile::encodeName(path);
+        if (avformat_open_input(&format, file.constData(), nullptr, nullptr) < 0) return false;
+        if (avformat_find_stream_info(format, nullptr) < 0) return false;
+        stream = av_find_best_stream(format, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+        if (stream < 0) return false;
+        AVPacket* packet = av_packet_alloc();
+        while (av_read_frame(format, packet) >= 0) {
+            if (packet->stream_index == stream) packets.push_back(av_packet_clone(packet));
+            av_packet_unref(packet);
+        }
+        av_packet_free(&packet);
+        return !packets.empty();
+    }
+};
+
+// Decode and resample to the output format (48 kHz stereo S16); one operation
+// is one output sample frame
+Sample audioDecode(const AudioClip& clip) {
+    ThreadSafeQueue<AVPacket*> packets(clip.packets.size() + 1);
+    for (AVPacket* packet : clip.packets) packets.push(av_packet_clone(packet));
+    packets.push(nullptr);
+
+    AudioDecoder decoder;
+    decoder.setPacketQueue(&packets);
+    if (!decoder.open(clip.format, clip.stream)) return {};
+    qint64 samples = 0;
+    QElapsedTimer timer;
+    timer.start();
+    decoder.start();
+    AVFrame* frame = nullptr;
+    while (decoder.frameQueue().pop(frame) && frame) {
+        samples += frame->nb_samples;
+        av_frame_free(&frame);
+    }
+    const qint64 ns = timer.nsecsElapsed();
+    decoder.close();
+    return {samples, ns};
+}
+
+// --- YUV packing -------------------------------------------------------------
+
+AVFrame* makePicture(AVPixelFormat format, int width, int height, int align) {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    av_frame_get_buffer(frame, align);
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+        memset(frame->buf[i]->data, 0x80 + i * 16, frame->buf[i]->size);
+    }
+    return frame;
+}
+
+// One operation is one picture prepared for upload
+Sample yuvPack(AVPixelFormat format, int width, int height, int align) {
+    constexpr int kPictures = 200;
+    AVFrame* frame = makePicture(format, width, height, align);
+    YuvPacker packer;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < kPictures; i++) {
+        if (!packer.pack(frame)) {
+            av_frame_free(&frame);
+            return {};
+        }
+    }
+    const qint64 ns = timer.nsecsElapsed();
+    av_frame_free(&frame);
+    return {kPictures, ns};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Microbenchmarks of the playback pipeline."));
+    parser.addHelpOption();
+    const QCommandLineOption fixtures_option(QStringLiteral("fixtures"), QStringLiteral("Directory written by qmlplayer-fixtures; audio benchmarks need it."), QStringLiteral("dir"));
+    const QCommandLineOption samples_option(QStringLiteral("samples"), QStringLiteral("Timed samples per benchmark."), QStringLiteral("n"), QStringLiteral("9"));
+    const QCommandLineOption filter_option(QStringLiteral("filter"), QStringLiteral("Only run benchmarks whose name contains this text."), QStringLiteral("text"));
+    const QCommandLineOption output_option(QStringLiteral("output"), QStringLiteral("Write the JSON report to this file instead of stdout."), QStringLiteral("file"));
+    const QCommandLineOption baseline_option(QStringLiteral("baseline"), QStringLiteral("Earlier report to compare against; regressions fail the run."), QStringLiteral("file"));
+    const QCommandLineOption tolerance_option(QStringLiteral("tolerance"), QStringLiteral("Allowed slowdown against the baseline, in percent."), QStringLiteral("percent"), QStringLiteral("10"));
+    parser.addOptions({fixtures_option, samples_option, filter_option, output_option, baseline_option, tolerance_option});
+    parser.process(app);
+
+    const int samples = qMax(1, parser.value(samples_option).toInt());
+    av_log_set_level(AV_LOG_ERROR);
+
+    QVector<Benchmark> benchmarks = {
+        {QStringLiteral("queue/tryPushPop"), QStringLiteral("push+pop"), [] { return queueTryPushPop(false); }},
+        {QStringLiteral("queue/tryPushPopAccounted"), QStringLiteral("push+pop"), [] { return queueTryPushPop(true); }},
+        {QStringLiteral("queue/producerConsumer"), QStringLiteral("item"), queueProducerConsumer},
+        {QStringLiteral("yuv/tight_1280x720"), QStringLiteral("picture"), [] { return yuvPack(AV_PIX_FMT_YUV420P, 1280, 720, 1); }},
+        {QStringLiteral("yuv/padded_854x480"), QStringLiteral("picture"), [] { return yuvPack(AV_PIX_FMT_YUV420P, 854, 480, 64); }},
+        {QStringLiteral("yuv/padded_1366x768"), QStringLiteral("picture"), [] { return yuvPack(AV_PIX_FMT_YUV420P, 1366, 768, 64); }},
+        {QStringLiteral("yuv/convert422_1280x720"), QStringLiteral("picture"), [] { return yuvPack(AV_PIX_FMT_YUV422P, 1280, 720, 64); }},
+    };
+
+    // Kept alive until the benchmarks have run
+    std::vector<std::unique_ptr<AudioClip>> clips;
+    if (parser.isSet(fixtures_option)) {
+        const QDir dir(parser.value(fixtures_option));
+        const struct { const char* name; const char* file; } kAudio[] = {
+            {"audio/resamplePcm44k1", "pcm_44k1_stereo.mkv"},
+            {"audio/decodeAac48k", "mpeg4_360p_gop12_b2_aac.mp4"},
+        };
+        for (const auto& audio : kAudio) {
+            auto clip = std::make_unique<AudioClip>();
+            if (!clip->load(dir.filePath(QString::fromLatin1(audio.file)))) {
+                qWarning() << "qmlplayer-microbench: cannot load fixture" << audio.file;
+                return 1;
+            }
+            const AudioClip* data = clip.get();
+            benchmarks.append({QString::fromLatin1(audio.name), QStringLiteral("sample frame"), [data] { return audioDecode(*data); }});
+            clips.push_back(std::move(clip));
+        }
+    } else {
+        qWarning() << "qmlplayer-microbench: no --fixtures, skipping the audio benchmarks";
+    }
+
+    QTextStream log(stderr);
+    QJsonArray results;
+    const QString filter = parser.value(filter_option);
+    for (const Benchmark& benchmark : benchmarks) {
+        if (!filter.isEmpty() && !benchmark.name.contains(filter)) continue;
+        const QJsonObject result = measure(benchmark, samples);
+        if (result.isEmpty()) {
+            qWarning() << "qmlplayer-microbench:" << benchmark.name << "failed";
+            return 1;
+        }
+        log << benchmark.name << ": " << QString::number(result.value(QStringLiteral("nsPerOp")).toDouble(), 'f', 2)
+            << " ns/" << benchmark.operation << "\n";
+        log.flush();
+        results.append(result);
+    }
+
+    QJsonObject report;
+    report.insert(QStringLiteral("tool"), QStringLiteral("qmlplayer-microbench"));
+    report.insert(QStringLiteral("version"), 1);
+    report.insert(QStringLiteral("ffmpeg"), QString::fromLatin1(av_version_info()));
+    report.insert(QStringLiteral("results"), results);
+    const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+    if (parser.isSet(output_option)) {
+        QFile out(parser.value(output_option));
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "qmlplayer-microbench: cannot write" << out.fileName();
+            return 1;
+        }
+        out.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+
+    if (parser.isSet(baseline_option)) {
+        const QJsonArray baseline = BenchReport::loadArray(parser.value(baseline_option), QStringLiteral("results"));
+        if (baseline.isEmpty()) {
+            qWarning() << "qmlplayer-microbench: cannot read baseline" << parser.value(baseline_option);
+            return 1;
+        }
+        const int regressions = BenchReport::compare(baseline, results, {QStringLiteral("name")}, QStringLiteral("nsPerOp"),
+                                                     parser.value(tolerance_option).toDouble(), log);
+        if (regressions > 0) return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,446 @@
+// Network buffering check: serves a clip from a local HTTP server at a throttled
+// rate and plays it through the player's demuxer and StreamBuffer the way
+// VideoRenderer does for network sources, with a playback clock that consumes
+// the queued packets in real time and stops while buffering. Partway through,
+// the server stalls for a while, which has to drain the queues into a rebuffer.
+// Checked are the state transitions and the watermarks they happened at:
+//   prebuffer   playback starts in Buffering and leaves it at prebufferMs
+//   rebuffer    exactly one underrun, during the stall, entered at or below lowMs
+//   refill      which ends at or above highMs
+//   starvation  the playback clock never ran out of packets outside Buffering
+//   completed   the clip played to its end
+// Exits with 2 when a check fails.
+//
+//   qmlplayer-netbuffer [--speed 1.5] [--stall-at 8000] [--stall 10000]
+//                       [--low 300] [--high 3000] [--prebuffer 2000]
+//                       [--output netbuffer.json] file
+//
+// --speed is the server rate as a multiple of the clip's average bitrate.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "../core/StreamBuffer.h"
+#include "HeadlessPipeline.h"
+
+namespace {
+
+constexpr qint64 kChunkBytes = 8 * 1024;
+constexpr qint64 kBurstBytes = 64 * 1024;
+constexpr int kTickMs = 10;
+constexpr int kPollMs = 100;    // VideoRenderer's buffer timer
+
+// Token bucket shared by all connections. No tokens accrue during the stall,
+// and the bucket is emptied when it begins, so nothing at all is sent then.
+class Throttle {
+public:
+    Throttle(qint64 bytesPerSecond, qint64 stallAtMs, qint64 stallMs)
+        : rate_(bytesPerSecond), stall_at_ms_(stallAtMs), stall_ms_(stallMs) {}
+
+    // Blocks until count more bytes may be sent; false once stopped
+    bool acquire(qint64 count, const std::atomic<bool>& stop) {
+        while (!stop) {
+            {
+                QMutexLocker locker(&mutex_);
+                if (!clock_.isValid()) clock_.start();
+                refill(clock_.elapsed());
+                if (tokens_ >= count) {
+                    tokens_ -= count;
+                    return true;
+                }
+            }
+            QThread::msleep(2);
+        }
+        return false;
+    }
+
+private:
+    void refill(qint64 nowMs) {
+        if (nowMs >= stall_at_ms_ && nowMs < stall_at_ms_ + stall_ms_) {
+            tokens_ = 0;
+        } else {
+            tokens_ = qMin(kBurstBytes, tokens_ + (nowMs - last_ms_) * rate_ / 1000);
+        }
+        last_ms_ = nowMs;
+    }
+
+    QMutex mutex_;
+    QElapsedTimer clock_;
+    const qint64 rate_;
+    const qint64 stall_at_ms_;
+    const qint64 stall_ms_;
+    qint64 tokens_ = kBurstBytes;
+    qint64 last_ms_ = 0;
+};
+
+// One file over HTTP/1.1 with byte ranges, one thread per connection
+class ThrottledServer : public QTcpServer {
+public:
+    ThrottledServer(const QString& file, Throttle& throttle, const std::atomic<bool>& stop)
+        : file_(file), throttle_(throttle), stop_(stop) {}
+
+    ~ThrottledServer() override {
+        for (const std::unique_ptr<QThread>& connection : connections_) {
+            connection->wait();
+        }
+    }
+
+protected:
+    void incomingConnection(qintptr handle) override {
+        connections_.emplace_back(QThread::create([this, handle]() { serve(handle); }));
+        connections_.back()->start();
+    }
+
+private:
+    void serve(qintptr handle) {
+        QTcpSocket socket;
+        if (!socket.setSocketDescriptor(handle)) return;
+        QByteArray request;
+        while (!request.contains("\r\n\r\n")) {
+            if (stop_ || !socket.waitForReadyRead(5000)) return;
+            request += socket.readAll();
+        }
+
+        QFile file(file_);
+        if (!file.open(QIODevice::ReadOnly)) return;
+        const qint64 size = file.size();
+        qint64 first = 0;
+        const QRegularExpressionMatch range =
+            QRegularExpression(QStringLiteral("\\r\\nRange: *bytes=(\\d+)-"), QRegularExpression::CaseInsensitiveOption)
+                .match(QString::fromLatin1(request));
+        if (range.hasMatch()) first = range.captured(1).toLongLong();
+        if (first >= size && size > 0) {
+            socket.write(QByteArrayLiteral("HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+            socket.waitForBytesWritten(1000);
+            return;
+        }
+
+        QByteArray header = range.hasMatch() ? QByteArrayLiteral("HTTP/1.1 206 Partial Content\r\n")
+                                             : QByteArrayLiteral("HTTP/1.1 200 OK\r\n");
+        header += "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\nConnection: close\r\n";
+        header += "Content-Length: " + QByteArray::number(size - first) + "\r\n";
+        if (range.hasMatch()) {
+            header += "Content-Range: bytes " + QByteArray::number(first) + "-" + QByteArray::number(size - 1) +
+                      "/" + QByteArray::number(size) + "\r\n";
+        }
+        header += "\r\n";
+        socket.write(header);
+        file.seek(first);
+
+        while (!file.atEnd() && socket.state() == QAbstractSocket::ConnectedState) {
+            const QByteArray chunk = file.read(kChunkBytes);
+            if (chunk.isEmpty() || !throttle_.acquire(chunk.size(), stop_)) break;
+            socket.write(chunk);
+            // The client closes connections it no longer needs, e.g. after a seek
+            while (socket.bytesToWrite() > 0 && !stop_) {
+                if (!socket.waitForBytesWritten(100) && socket.state() != QAbstractSocket::ConnectedState) break;
+            }
+        }
+        socket.disconnectFromHost();
+        if (socket.state() != QAbstractSocket::UnconnectedState) socket.waitForDisconnected(1000);
+    }
+
+    const QString file_;
+    Throttle& throttle_;
+    const std::atomic<bool>& stop_;
+    std::vector<std::unique_ptr<QThread>> connections_;
+};
+
+struct CheckOptions {
+    double speed = 1.5;
+    qint64 stallAtMs = 8000;
+    qint64 stallMs = 10000;
+    StreamBuffer::Watermarks watermarks;
+};
+
+struct Transition {
+    qint64 atMs;        // harness clock
+    bool buffering;
+    qint64 bufferedMs;
+    bool endOfStream;
+};
+
+// Consumes one stream's packets at the playback clock
+struct Lane {
+    ThreadSafeQueue<AVPacket*>* queue = nullptr;
+    AVRational timeBase{1, 1000};
+    AVPacket* next = nullptr;
+    bool ended = false;
+};
+
+QJsonObject check(const QString& file, const CheckOptions& options, bool* passed) {
+    *passed = false;
+
+    // The local file gives the rate to throttle to
+    AVFormatContext* probe = nullptr;
+    const QByteArray path = file.toUtf8();
+    if (avformat_open_input(&probe, path.constData(), nullptr, nullptr) < 0 ||
+        avformat_find_stream_info(probe, nullptr) < 0) {
+        avformat_close_input(&probe);
+        qWarning() << "qmlplayer-netbuffer: cannot open" << file;
+        return {};
+    }
+    const qint64 media_ms = probe->duration != AV_NOPTS_VALUE ? probe->duration * 1000 / AV_TIME_BASE : 0;
+    avformat_close_input(&probe);
+    const qint64 file_bytes = QFile(file).size();
+    if (media_ms <= 0 || file_bytes <= 0) {
+        qWarning() << "qmlplayer-netbuffer: no duration for" << file;
+        return {};
+    }
+    const qint64 rate = qint64(options.speed * file_bytes * 1000 / media_ms);
+
+    std::atomic<bool> stop{false};
+    std::atomic<int> port{0};
+    Throttle throttle(rate, options.stallAtMs, options.stallMs);
+    std::unique_ptr<QThread> server_thread(QThread::create([&]() {
+        ThrottledServer server(file, throttle, stop);
+        if (!server.listen(QHostAddress::LocalHost, 0)) {
+            port = -1;
+            return;
+        }
+        port = server.serverPort();
+        while (!stop) {
+            server.waitForNewConnection(50);
+        }
+    }));
+    server_thread->start();
+    while (port == 0) QThread::msleep(5);
+    if (port < 0) {
+        server_thread->wait();
+        qWarning() << "qmlplayer-netbuffer: cannot listen on localhost";
+        return {};
+    }
+    const auto shutdown = [&]() {
+        stop = true;
+        server_thread->wait();
+    };
+
+    QElapsedTimer clock;
+    clock.start();
+    // Packets only; the playback clock below consumes them undecoded
+    HeadlessPipeline pipeline("qmlplayer-netbuffer");
+    HeadlessPipeline::Options demux_only;
+    demux_only.video = false;
+    demux_only.audio = false;
+    const QString url = QStringLiteral("http://127.0.0.1:%1/%2").arg(port.load()).arg(QFileInfo(file).fileName());
+    if (!pipeline.open(url, demux_only)) {
+        shutdown();
+        return {};
+    }
+    AVDemuxer& demuxer = pipeline.demuxer();
+    AVFormatContext* ctx = demuxer.formatContext();
+    std::vector<Lane> lanes;
+    for (int index : {demuxer.videoStreamIndex(), demuxer.audioStreamIndex()}) {
+        if (index < 0) continue;
+        Lane lane;
+        lane.queue = index == demuxer.videoStreamIndex() ? &demuxer.videoQueue() : &demuxer.audioQueue();
+        lane.timeBase = ctx->streams[index]->time_base;
+        lanes.push_back(lane);
+    }
+    const qint64 origin_ms = ctx->start_time != AV_NOPTS_VALUE ? ctx->start_time / 1000 : 0;
+
+    // As VideoRenderer::openMedia() sets up a network source
+    StreamBuffer buffer;
+    buffer.setWatermarks(options.watermarks);
+    const StreamBuffer::Watermarks& watermarks = buffer.watermarks();
+    demuxer.setTargetBufferMs(qMax(demuxer.targetBufferMs(), watermarks.highMs + 1000));
+    buffer.reset();
+    pipeline.start();
+
+    QVector<Transition> transitions;
+    transitions.append(Transition{clock.elapsed(), true, demuxer.bufferedMs(), false});
+    qint64 played_ms = 0;
+    qint64 starved_ms = 0;
+    qint64 last_tick = clock.elapsed();
+    qint64 last_poll = last_tick;
+    const qint64 timeout_ms = media_ms * 2 + options.stallAtMs + options.stallMs + 10000;
+    bool timed_out = false;
+
+    while (true) {
+        QThread::msleep(kTickMs);
+        const qint64 now = clock.elapsed();
+        if (pipeline.failed()) break;
+        if (now > timeout_ms) {
+            timed_out = true;
+            break;
+        }
+        const bool playing = !buffer.isBuffering();
+        if (playing) played_ms += now - last_tick;
+        last_tick = now;
+
+        bool ended = true;
+        bool starved = false;
+        for (Lane& lane : lanes) {
+            while (!lane.ended) {
+                if (!lane.next && !lane.queue->tryPop(lane.next)) {
+                    starved = true;
+                    break;
+                }
+                if (!lane.next) {
+                    lane.ended = true;      // end-of-stream marker
+                    break;
+                }
+                const int64_t ts = lane.next->pts != AV_NOPTS_VALUE ? lane.next->pts : lane.next->dts;
+                if (ts != AV_NOPTS_VALUE && av_rescale_q(ts, lane.timeBase, {1, 1000}) - origin_ms > played_ms) break;
+                av_packet_free(&lane.next);
+            }
+            ended = ended && lane.ended;
+        }
+        if (ended) break;
+        if (playing && starved) starved_ms += kTickMs;
+
+        if (now - last_poll >= kPollMs) {
+            last_poll = now;
+            const qint64 buffered = demuxer.bufferedMs();
+            if (buffer.update(buffered, demuxer.isEndOfFile(), demuxer.queuesSaturated())) {
+                transitions.append(Transition{now, buffer.isBuffering(), buffered, demuxer.isEndOfFile()});
+            }
+        }
+    }
+    for (Lane& lane : lanes) {
+        av_packet_free(&lane.next);
+    }
+    const bool failed = pipeline.failed();
+    pipeline.close();
+    shutdown();
+    if (failed || timed_out) {
+        if (timed_out) qWarning() << "qmlplayer-netbuffer: timed out on" << file;
+        return {};
+    }
+
+    QJsonArray transition_list;
+    for (const Transition& transition : transitions) {
+        QJsonObject entry;
+        entry.insert(QStringLiteral("atMs"), transition.atMs);
+        entry.insert(QStringLiteral("buffering"), transition.buffering);
+        entry.insert(QStringLiteral("bufferedMs"), transition.bufferedMs);
+        entry.insert(QStringLiteral("endOfStream"), transition.endOfStream);
+        transition_list.append(entry);
+    }
+
+    QJsonObject checks;
+    const auto record = [&checks](const char* name, bool ok) {
+        checks.insert(QLatin1String(name), ok);
+        return ok;
+    };
+    bool ok = true;
+    // [0] is the initial prebuffering, [1] its end, then underrun/refill pairs
+    ok &= record("prebuffer", transitions.size() >= 2 && !transitions[1].buffering &&
+                              (transitions[1].bufferedMs >= watermarks.prebufferMs || transitions[1].endOfStream));
+    // Transition times are on the harness clock, which starts before the server's
+    // first byte, so "after the stall began" errs on the lenient side
+    const int underruns = (transitions.size() - 1) / 2;
+    const bool one_underrun = underruns == 1 && transitions[2].buffering;
+    ok &= record("rebuffer", one_underrun && transitions[2].atMs >= options.stallAtMs &&
+                             transitions[2].bufferedMs <= watermarks.lowMs);
+    ok &= record("refill", one_underrun && transitions.size() == 4 &&
+                           (transitions[3].bufferedMs >= watermarks.highMs || transitions[3].endOfStream));
+    // One tick of slack: an underrun is only noticed at the next poll
+    ok &= record("starvation", starved_ms <= kPollMs);
+    ok &= record("completed", played_ms >= media_ms - 1000);
+    *passed = ok;
+
+    QJsonObject result;
+    result.insert(QStringLiteral("file"), file);
+    result.insert(QStringLiteral("mediaMs"), media_ms);
+    result.insert(QStringLiteral("bytesPerSecond"), rate);
+    result.insert(QStringLiteral("playedMs"), played_ms);
+    result.insert(QStringLiteral("starvedMs"), starved_ms);
+    result.insert(QStringLiteral("underruns"), underruns);
+    result.insert(QStringLiteral("transitions"), transition_list);
+    result.insert(QStringLiteral("checks"), checks);
+    result.insert(QStringLiteral("passed"), ok);
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Same settings as the player, so "io/*" applies here too
+    QCoreApplication::setOrganizationName(QStringLiteral("QmlPlayer"));
+    QCoreApplication::setApplicationName(QStringLiteral("QMLPlayerFFmpeg"));
+    QCoreApplication app(argc, argv);
+    avformat_network_init();
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Streams a clip from a throttled local HTTP server and checks network buffering."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("file"), QStringLiteral("Clip to serve; MPEG-TS streams best."));
+    const QCommandLineOption speed_option(QStringLiteral("speed"), QStringLiteral("Server rate as a multiple of the clip bitrate."), QStringLiteral("factor"), QStringLiteral("1.5"));
+    const QCommandLineOption stall_at_option(QStringLiteral("stall-at"), QStringLiteral("When the server stalls, in ms after its first byte."), QStringLiteral("ms"), QStringLiteral("8000"));
+    const QCommandLineOption stall_option(QStringLiteral("stall"), QStringLiteral("How long the server stalls, in ms."), QStringLiteral("ms"), QStringLiteral("10000"));
+    const QCommandLineOption low_option(QStringLiteral("low"), QStringLiteral("Low watermark, in ms."), QStringLiteral("ms"), QStringLiteral("300"));
+    const QCommandLineOption high_option(QStringLiteral("high"), QStringLiteral("High watermark, in ms."), QStringLiteral("ms"), QStringLiteral("3000"));
+    const QCommandLineOption prebuffer_option(QStringLiteral("prebuffer"), QStringLiteral("Prebuffer watermark, in ms."), QStringLiteral("ms"), QStringLiteral("2000"));
+    const QCommandLineOption output_option(QStringLiteral("output"), QStringLiteral("Write the JSON report to this file instead of stdout."), QStringLiteral("file"));
+    parser.addOptions({speed_option, stall_at_option, stall_option, low_option, high_option, prebuffer_option, output_option});
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1) {
+        parser.showHelp(1);
+    }
+    const QString file = parser.positionalArguments().first();
+    CheckOptions options;
+    options.speed = qMax(1.05, parser.value(speed_option).toDouble());
+    options.stallAtMs = qMax<qint64>(0, parser.value(stall_at_option).toLongLong());
+    options.stallMs = qMax<qint64>(0, parser.value(stall_option).toLongLong());
+    options.watermarks.lowMs = parser.value(low_option).toLongLong();
+    options.watermarks.highMs = parser.value(high_option).toLongLong();
+    options.watermarks.prebufferMs = parser.value(prebuffer_option).toLongLong();
+
+    bool passed = false;
+    const QJsonObject result = check(file, options, &passed);
+    QTextStream log(stderr);
+    if (!result.isEmpty()) {
+        log << file << ": " << result.value(QStringLiteral("underruns")).toInt() << " underrun(s), starved "
+            << result.value(QStringLiteral("starvedMs")).toInt() << " ms: " << (passed ? "ok" : "FAILED") << "\n";
+    }
+
+    QJsonObject report;
+    report.insert(QStringLiteral("tool"), QStringLiteral("qmlplayer-netbuffer"));
+    report.insert(QStringLiteral("version"), 1);
+    report.insert(QStringLiteral("speed"), options.speed);
+    report.insert(QStringLiteral("stallAtMs"), options.stallAtMs);
+    report.insert(QStringLiteral("stallMs"), options.stallMs);
+    report.insert(QStringLiteral("lowMs"), options.watermarks.lowMs);
+    report.insert(QStringLiteral("highMs"), options.watermarks.highMs);
+    report.insert(QStringLiteral("prebufferMs"), options.watermarks.prebufferMs);
+    report.insert(QStringLiteral("ffmpeg"), QString::fromLatin1(av_version_info()));
+    report.insert(QStringLiteral("result"), result);
+    const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+
+    if (parser.isSet(output_option)) {
+        QFile out(parser.value(output_option));
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "qmlplayer-netbuffer: cannot write" << out.fileName();
+            return 1;
+        }
+        out.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+    if (result.isEmpty()) return 1;
+    return passed ? 0 : 2;
+}
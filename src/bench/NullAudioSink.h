@@ -0,0 +1,39 @@
+#ifndef NULLAUDIOSINK_H
+#define NULLAUDIOSINK_H
+
+#include <QElapsedTimer>
+#include <QThread>
+
+// Stand-in for the audio device in the headless tools: consumes samples at the
+// (skewed) sample rate from a buffer of fixed size and blocks writers while it is
+// full, the way AudioOutput is held back by QAudioSink
+class NullAudioSink {
+public:
+    NullAudioSink(const QElapsedTimer& clock, int sampleRate, int bufferMs, double clockSkewPpm = 0.0)
+        : clock_(clock)
+        , ns_per_sample_(1e9 / (sampleRate * (1.0 + clockSkewPpm / 1e6)))
+        , buffer_ns_(qint64(bufferMs) * 1000000) {}
+
+    // Returns once the samples are in the device buffer; the time the first of
+    // them is played, in ns on the clock
+    qint64 write(int samples) {
+        const qint64 now = clock_.nsecsElapsed();
+        // Ran dry (or nothing written yet): the device plays these right away
+        if (play_end_ns_ < now) play_end_ns_ = now;
+        const qint64 start = play_end_ns_;
+        const qint64 duration = qint64(samples * ns_per_sample_);
+        const qint64 wait_ns = start + duration - buffer_ns_ - now;
+        if (wait_ns > 0) QThread::usleep(wait_ns / 1000);
+        play_end_ns_ = start + duration;
+        return start;
+    }
+    double nsPerSample() const { return ns_per_sample_; }
+
+private:
+    const QElapsedTimer& clock_;
+    const double ns_per_sample_;
+    const qint64 buffer_ns_;
+    qint64 play_end_ns_ = -1;
+};
+
+#endif // NULLAUDIOSINK_H
@@ -0,0 +1,371 @@
+// Seek latency and time-to-first-frame benchmark: drives the player's demux and
+// decode stages the way VideoRenderer::setSource() and seek() do and times each
+// request until the first frame from the new position is ready to present. There
+// are three patterns per file:
+//   open        opening the file until its first frame (time to first frame)
+//   random      seeks to random positions, from a fixed seed
+//   sequential  forward steps of --step ms, wrapping around at the end
+// The tool reports p50/p95/p99 per file and pattern as JSON. It needs no display
+// or audio device, so it runs in CI.
+//
+//   qmlplayer-seekbench [--seeks 40] [--opens 5] [--step 1000] [--settle 200] [--seed 1]
+//                       [--output results.json] [--baseline old.json --tolerance 10]
+//                       files or directories...
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+}
+
+#include "BenchReport.h"
+#include "HeadlessPipeline.h"
+
+namespace {
+
+constexpr qint64 kRequestTimeoutMs = 5000;
+
+struct SeekOptions {
+    int seeks = 40;
+    int opens = 5;
+    qint64 stepMs = 1000;
+    int settleMs = 200;     // playback between seeks, so each one starts with full queues
+    quint32 seed = 1;
+};
+
+// Latencies of one pattern, in ms
+struct Samples {
+    QVector<double> latencies;
+    int timeouts = 0;
+    int staleFrames = 0;    // frames from before a seek that were skipped
+};
+
+// The stages VideoRenderer runs for a file, with audio decoded and discarded
+class Pipeline {
+public:
+    explicit Pipeline(const QString& file)
+        : pipeline_("qmlplayer-seekbench") {
+        if (!pipeline_.open(file, HeadlessPipeline::Options()) || !pipeline_.hasVideo()) return;
+        AVFormatContext* ctx = pipeline_.formatContext();
+        has_audio_ = pipeline_.hasAudio();
+
+        const AVStream* stream = ctx->streams[pipeline_.demuxer().videoStreamIndex()];
+        time_base_ = stream->time_base;
+        start_ms_ = stream->start_time != AV_NOPTS_VALUE ? qint64(stream->start_time * av_q2d(time_base_) * 1000.0) : 0;
+        duration_ms_ = pipeline_.mediaMs();
+        const double fps = stream->avg_frame_rate.num > 0 ? av_q2d(stream->avg_frame_rate) : 25.0;
+        frame_ms_ = 1000.0 / fps;
+
+        pipeline_.start();
+        open_ = true;
+    }
+
+    bool isOpen() const { return open_ && !pipeline_.failed(); }
+    qint64 durationMs() const { return duration_ms_; }
+
+    // As VideoRenderer::seek(); the serial frames have to reach to count
+    quint64 seek(qint64 positionMs) {
+        const quint64 serial = pipeline_.demuxer().seekSerial() + 1;
+        pipeline_.demuxer().seek(positionMs);
+        pipeline_.video().flush();
+        if (has_audio_) pipeline_.audio().flush();
+        pipeline_.video().play();
+        return serial;
+    }
+
+    // Waits for the first frame from the demuxer's position after minSerial; its delay
+    // from start, or -1 after the timeout. With a target, frames past it are stale.
+    double waitForFrame(const QElapsedTimer& start, quint64 minSerial, qint64 targetMs, Samples* samples) {
+        while (!pipeline_.failed() && start.elapsed() < kRequestTimeoutMs) {
+            drainAudio();
+            AVFrame* frame = nullptr;
+            if (!pipeline_.video().frameQueue().tryPop(frame)) {
+                QThread::usleep(100);
+                continue;
+            }
+            const double ms = start.nsecsElapsed() / 1e6;
+            const bool current = AVDemuxer::frameSerial(frame) >= minSerial
+                && (targetMs < 0 || frameMs(frame) <= targetMs + frame_ms_);
+            av_frame_free(&frame);
+            if (current) return ms;
+            samples->staleFrames++;
+        }
+        return -1.0;
+    }
+
+    // Plays on for a while, as a user watches before the next seek
+    void settle(int ms) {
+        QElapsedTimer timer;
+        timer.start();
+        while (timer.elapsed() < ms) {
+            drainAudio();
+            AVFrame* frame = nullptr;
+            while (pipeline_.video().frameQueue().tryPop(frame)) av_frame_free(&frame);
+            QThread::msleep(2);
+        }
+    }
+
+private:
+    // Relative to the start of the stream, like seek positions
+    double frameMs(const AVFrame* frame) const {
+        const int64_t pts = frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+        return pts == AV_NOPTS_VALUE ? 0.0 : pts * av_q2d(time_base_) * 1000.0 - start_ms_;
+    }
+
+    void drainAudio() {
+        AVFrame* frame = nullptr;
+        while (has_audio_ && pipeline_.audio().frameQueue().tryPop(frame)) av_frame_free(&frame);
+    }
+
+    HeadlessPipeline pipeline_;
+    bool open_ = false;
+    bool has_audio_ = false;
+    AVRational time_base_{1, 1000};
+    qint64 start_ms_ = 0;
+    qint64 duration_ms_ = 0;
+    double frame_ms_ = 40.0;
+};
+
+Samples measureOpens(const QString& file, const SeekOptions& options) {
+    Samples samples;
+    for (int i = 0; i < options.opens; i++) {
+        QElapsedTimer start;
+        start.start();
+        Pipeline pipeline(file);
+        if (!pipeline.isOpen()) {
+            samples.timeouts++;
+            continue;
+        }
+        const double ms = pipeline.waitForFrame(start, 0, -1, &samples);
+        if (ms < 0) {
+            samples.timeouts++;
+        } else {
+            samples.latencies.append(ms);
+        }
+    }
+    return samples;
+}
+
+Samples measureSeeks(const QString& file, const SeekOptions& options, bool random) {
+    Samples samples;
+    Pipeline pipeline(file);
+    if (!pipeline.isOpen() || pipeline.durationMs() <= 0) {
+        samples.timeouts = options.seeks;
+        return samples;
+    }
+    QElapsedTimer none;
+    none.start();
+    pipeline.waitForFrame(none, 0, -1, &samples);
+    samples.staleFrames = 0;
+
+    // Leave the last half second alone, seeking there mostly measures the end of the stream
+    const qint64 range = qMax<qint64>(1, pipeline.durationMs() - 500);
+    std::mt19937 generator(options.seed);
+    std::uniform_int_distribution<qint64> position(0, range - 1);
+    qint64 next = 0;
+    for (int i = 0; i < options.seeks; i++) {
+        qint64 target = 0;
+        if (random) {
+            target = position(generator);
+        } else {
+            next += options.stepMs;
+            if (next >= range) next = 0;
+            target = next;
+        }
+        pipeline.settle(options.settleMs);
+        QElapsedTimer start;
+        start.start();
+        const quint64 serial = pipeline.seek(target);
+        const double ms = pipeline.waitForFrame(start, serial, target, &samples);
+        if (ms < 0) {
+            samples.timeouts++;
+        } else {
+            samples.latencies.append(ms);
+        }
+    }
+    return samples;
+}
+
+// Nearest rank
+double percentile(const QVector<double>& sorted, double p) {
+    if (sorted.isEmpty()) return 0.0;
+    const int rank = int(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[qBound(0, rank - 1, sorted.size() - 1)];
+}
+
+QJsonObject summarize(const QString& file, const QString& pattern, const Samples& samples) {
+    QVector<double> sorted = samples.latencies;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (double value : sorted) sum += value;
+    QJsonObject result;
+    result.insert(QStringLiteral("file"), file);
+    result.insert(QStringLiteral("container"), QFileInfo(file).suffix());
+    result.insert(QStringLiteral("pattern"), pattern);
+    result.insert(QStringLiteral("count"), sorted.size());
+    result.insert(QStringLiteral("timeouts"), samples.timeouts);
+    result.insert(QStringLiteral("staleFrames"), samples.staleFrames);
+    if (!sorted.isEmpty()) {
+        result.insert(QStringLiteral("meanMs"), sum / sorted.size());
+        result.insert(QStringLiteral("p50Ms"), percentile(sorted, 50));
+        result.insert(QStringLiteral("p95Ms"), percentile(sorted, 95));
+        result.insert(QStringLiteral("p99Ms"), percentile(sorted, 99));
+        result.insert(QStringLiteral("maxMs"), sorted.last());
+    }
+    return result;
+}
+
+// GOP length and the like from the fixtures.json next to a generated clip
+QJsonObject fixtureInfo(const QString& file) {
+    const QFileInfo info(file);
+    QFile manifest(info.dir().filePath(QStringLiteral("fixtures.json")));
+    if (!manifest.open(QIODevice::ReadOnly)) return {};
+    const QJsonArray fixtures = QJsonDocument::fromJson(manifest.readAll()).object().value(QStringLiteral("fixtures")).toArray();
+    for (const QJsonValue& fixture : fixtures) {
+        if (fixture.toObject().value(QStringLiteral("file")).toString() == info.fileName()) return fixture.toObject();
+    }
+    return {};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Same settings as the player, so "pipeline/*" and "io/*" apply here too
+    QCoreApplication::setOrganizationName(QStringLiteral("QmlPlayer"));
+    QCoreApplication::setApplicationName(QStringLiteral("QMLPlayerFFmpeg"));
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Measures seek latency and time to first frame, reported as JSON."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("files"), QStringLiteral("Media files; directories are expanded to their clips."), QStringLiteral("files..."));
+    const QCommandLineOption seeks_option(QStringLiteral("seeks"), QStringLiteral("Seeks per file for each of the random and sequential patterns."), QStringLiteral("n"), QStringLiteral("40"));
+    const QCommandLineOption opens_option(QStringLiteral("opens"), QStringLiteral("Times each file is opened."), QStringLiteral("n"), QStringLiteral("5"));
+    const QCommandLineOption step_option(QStringLiteral("step"), QStringLiteral("Step of the sequential pattern."), QStringLiteral("ms"), QStringLiteral("1000"));
+    const QCommandLineOption settle_option(QStringLiteral("settle"), QStringLiteral("Playback between seeks."), QStringLiteral("ms"), QStringLiteral("200"));
+    const QCommandLineOption seed_option(QStringLiteral("seed"), QStringLiteral("Seed of the random positions."), QStringLiteral("n"), QStringLiteral("1"));
+    const QCommandLineOption output_option(QStringLiteral("output"), QStringLiteral("Write the JSON report to this file instead of stdout."), QStringLiteral("file"));
+    const QCommandLineOption baseline_option(QStringLiteral("baseline"),
+        QStringLiteral("Earlier report to compare against; a p95 latency regression fails the run."), QStringLiteral("file"));
+    const QCommandLineOption tolerance_option(QStringLiteral("tolerance"), QStringLiteral("Allowed growth against the baseline, in percent."), QStringLiteral("percent"), QStringLiteral("10"));
+    parser.addOptions({seeks_option, opens_option, step_option, settle_option, seed_option,
+                       output_option, baseline_option, tolerance_option});
+    parser.process(app);
+
+    QStringList files;
+    for (const QString& argument : parser.positionalArguments()) {
+        if (!QFileInfo(argument).isDir()) {
+            files.append(argument);
+            continue;
+        }
+        const QDir dir(argument);
+        for (const QString& name : dir.entryList({QStringLiteral("*.mp4"), QStringLiteral("*.mkv"), QStringLiteral("*.ts")},
+                                                 QDir::Files, QDir::Name)) {
+            files.append(dir.filePath(name));
+        }
+    }
+    if (files.isEmpty()) {
+        parser.showHelp(1);
+    }
+    SeekOptions options;
+    options.seeks = qMax(1, parser.value(seeks_option).toInt());
+    options.opens = qMax(0, parser.value(opens_option).toInt());
+    options.stepMs = qMax(1, parser.value(step_option).toInt());
+    options.settleMs = qMax(0, parser.value(settle_option).toInt());
+    options.seed = parser.value(seed_option).toUInt();
+    av_log_set_level(AV_LOG_ERROR);
+
+    QTextStream log(stderr);
+    QJsonArray results;
+    int timeouts = 0;
+    for (const QString& file : files) {
+        {
+            // Audio-only clips have no first frame to wait for
+            AVFormatContext* probe = nullptr;
+            const QByteArray path = QFile::encodeName(file);
+            bool has_video = false;
+            if (avformat_open_input(&probe, path.constData(), nullptr, nullptr) == 0) {
+                has_video = avformat_find_stream_info(probe, nullptr) >= 0
+                    && av_find_best_stream(probe, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0) >= 0;
+                avformat_close_input(&probe);
+            }
+            if (!has_video) {
+                log << file << ": no video, skipped\n";
+                continue;
+            }
+        }
+        const QJsonObject fixture = fixtureInfo(file);
+        const struct {
+            const char* name;
+            Samples samples;
+        } patterns[] = {
+            {"open", measureOpens(file, options)},
+            {"random", measureSeeks(file, options, true)},
+            {"sequential", measureSeeks(file, options, false)},
+        };
+        for (const auto& pattern : patterns) {
+            if (pattern.samples.latencies.isEmpty() && pattern.samples.timeouts == 0) continue;
+            QJsonObject result = summarize(file, QLatin1String(pattern.name), pattern.samples);
+            if (fixture.contains(QStringLiteral("gop"))) result.insert(QStringLiteral("gop"), fixture.value(QStringLiteral("gop")));
+            timeouts += pattern.samples.timeouts;
+            log << file << " [" << pattern.name << "] p50 "
+                << QString::number(result.value(QStringLiteral("p50Ms")).toDouble(), 'f', 1) << " ms, p95 "
+                << QString::number(result.value(QStringLiteral("p95Ms")).toDouble(), 'f', 1) << " ms, p99 "
+                << QString::number(result.value(QStringLiteral("p99Ms")).toDouble(), 'f', 1) << " ms";
+            if (pattern.samples.timeouts > 0) log << ", " << pattern.samples.timeouts << " timed out";
+            log << "\n";
+            log.flush();
+            results.append(result);
+        }
+    }
+
+    QJsonObject report;
+    report.insert(QStringLiteral("tool"), QStringLiteral("qmlplayer-seekbench"));
+    report.insert(QStringLiteral("version"), 1);
+    report.insert(QStringLiteral("seed"), qint64(options.seed));
+    report.insert(QStringLiteral("stepMs"), options.stepMs);
+    report.insert(QStringLiteral("settleMs"), options.settleMs);
+    report.insert(QStringLiteral("ffmpeg"), QString::fromLatin1(av_version_info()));
+    report.insert(QStringLiteral("timeouts"), timeouts);
+    report.insert(QStringLiteral("results"), results);
+    const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+
+    if (parser.isSet(output_option)) {
+        QFile out(parser.value(output_option));
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "qmlplayer-seekbench: cannot write" << out.fileName();
+            return 1;
+        }
+        out.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+
+    if (parser.isSet(baseline_option)) {
+        const QJsonArray baseline = BenchReport::loadArray(parser.value(baseline_option), QStringLiteral("results"));
+        if (baseline.isEmpty()) {
+            qWarning() << "qmlplayer-seekbench: cannot read baseline" << parser.value(baseline_option);
+            return 1;
+        }
+        const int regressions = BenchReport::compare(baseline, results, {QStringLiteral("file"), QStringLiteral("pattern")},
+                                                     QStringLiteral("p95Ms"), parser.value(tolerance_option).toDouble(), log);
+        if (regressions > 0) return 2;
+    }
+    return timeouts > 0 ? 2 : 0;
+}
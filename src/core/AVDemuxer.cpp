@@ -1,10 +1,31 @@
 #include "AVDemuxer.h"
+#include "ConfigManager.h"
+#include "MemoryBudget.h"
+#include "ProbeCache.h"
+#include "Trace.h"
 #include <QDebug>
+#include <iterator>
+
+namespace {
+constexpr size_t kMaxOverflowPackets = 2048;
+constexpr qint64 kMaxOverflowBytes = 64 * 1024 * 1024;
+constexpr int kIdleSleepMs = 5;
+constexpr qint64 kMinTargetMs = 100;
+
+// Stream probing, smallest first
+constexpr struct { int64_t probeSize; int64_t analyzeDurationUs; } kProbeLevels[] = {
+    {1 << 20, 1 * AV_TIME_BASE},
+    {5 << 20, 5 * AV_TIME_BASE},   // FFmpeg's defaults
+    {32 << 20, 20 * AV_TIME_BASE},
+};
+}
 
 extern "C" {
+#include "libavcodec/avcodec.h"
 #include "libavcodec/packet.h"
 #include "libavformat/avformat.h"
 #include "libavutil/avutil.h"
+#include "libavutil/dict.h"
 #include "libavutil/error.h"
 }
 #include <qobject.h>
@@ -12,24 +33,39 @@ extern "C" {
 #include <qtypes.h>
 
 AVDemuxer::AVDemuxer(QObject *parent)
-    : QThread(parent) {}
+    : PipelineStage(parent)
+    , keyframe_indexer_(new KeyframeIndexer(this)) {
+    for (ThreadSafeQueue<AVPacket*>* queue : {&video_queue_, &audio_queue_, &subtitle_queue_}) {
+        queue->setSizer([](AVPacket* const& packet) -> qint64 { return packet ? packet->size : 0; },
+                        MemoryBudget::Packets);
+    }
+}
 
 AVDemuxer::~AVDemuxer() {
     close();
 }
 
 bool AVDemuxer::open(const QString& filename) {
+    TRACE_SCOPE("demux", "open");
     file_name_ = filename;
-    QByteArray file_name_utf8 = filename.toUtf8();
-    if (avformat_open_input(&format_context_, file_name_utf8.constData(), nullptr, nullptr) < 0) {
+
+    // A known local file skips container detection and stream probing entirely
+    ProbeCache probe_cache;
+    const bool cached = probe_cache.load(filename);
+    const int probe_level = cached ? probeLevelFor(probe_cache.probeSize()) : 0;
+
+    if (!openInput(cached ? probe_cache.inputFormat() : nullptr, probe_level)) {
         emit errorOccurred("Failed to open file: " + filename);
         return false;
     }
 
-    if (avformat_find_stream_info(format_context_, nullptr) < 0) {
-        emit errorOccurred("Failed to find stream info");
-        cleanup();
-        return false;
+    const bool restored = cached && probe_cache.apply(format_context_);
+    if (!restored) {
+        if (!probeStreams(probe_level)) {
+            emit errorOccurred("Failed to find stream info");
+            cleanup();
+            return false;
+        }
     }
 
     for (unsigned int i = 0; i < format_context_->nb_streams; i++) {
@@ -47,95 +83,668 @@ bool AVDemuxer::open(const QString& filename) {
         cleanup();
         return false;
     }
+    updateStreamDiscard();
+    if (video_stream_index_ >= 0) {
+        setPacketWeigher(video_queue_, video_stream_index_);
+    }
+    if (audio_stream_index_ >= 0) {
+        setPacketWeigher(audio_queue_, audio_stream_index_);
+    }
+    target_buffer_ms_ = qMax<qint64>(100, ConfigManager::instance().value(QStringLiteral("demux/targetMs"), 2000).toLongLong());
+    packets_read_ = 0;
+    packets_parked_ = 0;
+    overflow_peak_ = 0;
+    video_underruns_ = 0;
+    audio_underruns_ = 0;
+    overflow_stalls_ = 0;
+    network_source_ = filename.contains(QLatin1String("://")) &&
+                      !filename.startsWith(QLatin1String("file:"), Qt::CaseInsensitive);
+
+    // Local containers that allow byte seeks get a keyframe table built in the
+    // background; seeks use it as soon as it covers the target
+    if (!network_source_ && !(format_context_->iformat->flags & AVFMT_NO_BYTE_SEEK)) {
+        const int indexed = video_stream_index_ >= 0 ? video_stream_index_ : audio_stream_index_;
+        keyframe_indexer_->index(filename, format_context_->streams[indexed]);
+    }
+    if (network_source_ && isLiveSource()) {
+        openTimeshift();
+    }
     
     emit opened();
     return true;
 }
 
+int AVDemuxer::probeLevelFor(qint64 probeSize) {
+    for (int level = 0; level < int(std::size(kProbeLevels)); level++) {
+        if (kProbeLevels[level].probeSize >= probeSize) return level;
+    }
+    return int(std::size(kProbeLevels)) - 1;
+}
+
+bool AVDemuxer::openInput(const AVInputFormat* format, int probeLevel) {
+    // Byte-stream sources go through our own AVIOContext (mmap or read-ahead)
+    io_ = MediaIO::create(file_name_);
+    format_context_ = avformat_alloc_context();
+    if (io_) {
+        format_context_->pb = io_->avioContext();
+        // Without a context FFmpeg opens the URL itself
+        if (format_context_->pb) format_context_->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+    format_context_->probesize = kProbeLevels[probeLevel].probeSize;
+    format_context_->max_analyze_duration = kProbeLevels[probeLevel].analyzeDurationUs;
+
+    const QByteArray file_name_utf8 = file_name_.toUtf8();
+    if (avformat_open_input(&format_context_, file_name_utf8.constData(), format, nullptr) < 0) {
+        // avformat_open_input frees a user-supplied context on failure
+        format_context_ = nullptr;
+        io_.reset();
+        return false;
+    }
+    return true;
+}
+
+bool AVDemuxer::probeStreams(int probeLevel) {
+    // Start with a small probe and only go further while some stream is still
+    // missing parameters. A size that worked for this file before is used directly.
+    for (int level = probeLevel; level < int(std::size(kProbeLevels)); level++) {
+        if (level > probeLevel) {
+            // A larger probe starts over from the beginning; find_stream_info on the
+            // same context would carry on from where the smaller one stopped reading
+            const AVInputFormat* format = format_context_->iformat;
+            avformat_close_input(&format_context_);
+            io_.reset();
+            if (!openInput(format, level)) {
+                return false;
+            }
+        }
+        if (avformat_find_stream_info(format_context_, nullptr) < 0) {
+            return false;
+        }
+        if (streamParametersComplete()) {
+            ProbeCache::store(file_name_, format_context_, kProbeLevels[level].probeSize,
+                              kProbeLevels[level].analyzeDurationUs);
+            return true;
+        }
+    }
+    // Still incomplete at the largest probe; let the decoders cope with what we have
+    return true;
+}
+
+bool AVDemuxer::streamParametersComplete() const {
+    for (unsigned int i = 0; i < format_context_->nb_streams; i++) {
+        const AVCodecParameters* par = format_context_->streams[i]->codecpar;
+        if (par->codec_type == AVMEDIA_TYPE_VIDEO) {
+            if (format_context_->streams[i]->disposition & AV_DISPOSITION_ATTACHED_PIC) continue;
+            if (par->codec_id == AV_CODEC_ID_NONE || par->width <= 0 || par->height <= 0 || par->format < 0)
+                return false;
+        } else if (par->codec_type == AVMEDIA_TYPE_AUDIO) {
+            if (par->codec_id == AV_CODEC_ID_NONE || par->sample_rate <= 0 ||
+                par->ch_layout.nb_channels <= 0 || par->format < 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+void AVDemuxer::setPacketWeigher(ThreadSafeQueue<AVPacket*>& queue, int streamIndex) {
+    // Queue weight is the queued media duration in microseconds. Packets without a
+    // duration count as one frame (video) or one codec frame (audio).
+    AVStream* stream = format_context_->streams[streamIndex];
+    const AVRational time_base = stream->time_base;
+    int64_t fallback = 0;
+    if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && stream->avg_frame_rate.num > 0) {
+        fallback = av_rescale_q(1, av_inv_q(stream->avg_frame_rate), time_base);
+    } else if (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && stream->codecpar->sample_rate > 0) {
+        fallback = av_rescale_q(stream->codecpar->frame_size, {1, stream->codecpar->sample_rate}, time_base);
+    }
+
+    queue.setWeigher([time_base, fallback](AVPacket* const& packet) -> qint64 {
+        if (!packet) return 0;
+        const int64_t duration = packet->duration > 0 ? packet->duration : fallback;
+        return av_rescale_q(duration, time_base, {1, 1000000});
+    });
+}
+
+qint64 AVDemuxer::bufferedMs() const {
+    qint64 buffered = -1;
+    if (video_stream_index_ >= 0) {
+        buffered = video_queue_.weight() / 1000;
+    }
+    if (audio_stream_index_ >= 0) {
+        const qint64 audio = audio_queue_.weight() / 1000;
+        buffered = buffered < 0 ? audio : qMin(buffered, audio);
+    }
+    return qMax<qint64>(0, buffered);
+}
+
+bool AVDemuxer::queuesSaturated() const {
+    const qint64 target_us = effectiveTargetUs();
+    auto saturated = [target_us](const ThreadSafeQueue<AVPacket*>& queue) {
+        return queue.size() >= queue.capacity() || queue.weight() >= target_us;
+    };
+    return (video_stream_index_ >= 0 && saturated(video_queue_)) ||
+           (audio_stream_index_ >= 0 && saturated(audio_queue_));
+}
+
+bool AVDemuxer::seekByIndex(qint64 positionMs) {
+    const int stream_index = keyframe_indexer_->streamIndex();
+    if (stream_index < 0 || (stream_index != video_stream_index_ && stream_index != audio_stream_index_))
+        return false;
+
+    AVStream* stream = format_context_->streams[stream_index];
+    int64_t pts = av_rescale_q(positionMs, {1, 1000}, stream->time_base);
+    if (stream->start_time != AV_NOPTS_VALUE) {
+        pts += stream->start_time;
+    }
+    KeyframeEntry entry;
+    if (!keyframe_indexer_->lookup(pts, entry))
+        return false;
+    return av_seek_frame(format_context_, stream_index, entry.pos, AVSEEK_FLAG_BYTE) >= 0;
+}
+
+void AVDemuxer::openTimeshift() {
+    ConfigManager& config = ConfigManager::instance();
+    if (!config.value(QStringLiteral("timeshift/enabled"), true).toBool()) return;
+
+    // The window is set in minutes; the ring size caps the disk use for high bitrates
+    const qint64 minutes = qBound(1, config.value(QStringLiteral("timeshift/minutes"), 30).toInt(), 24 * 60);
+    const qint64 max_mb = qBound(16, config.value(QStringLiteral("timeshift/maxMB"), 2048).toInt(), 64 * 1024);
+    const int clock_stream = video_stream_index_ >= 0 ? video_stream_index_ : audio_stream_index_;
+    if (!timeshift_.open(format_context_, clock_stream, minutes * 60 * 1000, max_mb * 1024 * 1024)) {
+        qWarning() << "AVDemuxer: timeshift unavailable, playing live only";
+        return;
+    }
+    timeshift_drained_ = false;
+    updateStreamDiscard();
+}
+
+bool AVDemuxer::isLiveSource() const {
+    return format_context_ && (format_context_->duration == AV_NOPTS_VALUE || format_context_->duration <= 0);
+}
+
+QVector<TrackInfo> AVDemuxer::audioTracks() const {
+    return tracks(AVMEDIA_TYPE_AUDIO);
+}
+
+QVector<TrackInfo> AVDemuxer::subtitleTracks() const {
+    return tracks(AVMEDIA_TYPE_SUBTITLE);
+}
+
+QVector<TrackInfo> AVDemuxer::tracks(AVMediaType type) const {
+    QVector<TrackInfo> tracks;
+    if (!format_context_) return tracks;
+
+    for (unsigned int i = 0; i < format_context_->nb_streams; i++) {
+        AVStream* stream = format_context_->streams[i];
+        if (stream->codecpar->codec_type != type) continue;
+
+        TrackInfo info;
+        info.streamIndex = i;
+        info.codec = QString::fromUtf8(avcodec_get_name(stream->codecpar->codec_id));
+        info.channels = stream->codecpar->ch_layout.nb_channels;
+        info.sampleRate = stream->codecpar->sample_rate;
+        if (AVDictionaryEntry* lang = av_dict_get(stream->metadata, "language", nullptr, 0)) {
+            info.language = QString::fromUtf8(lang->value);
+        }
+        if (AVDictionaryEntry* title = av_dict_get(stream->metadata, "title", nullptr, 0)) {
+            info.title = QString::fromUtf8(title->value);
+        }
+        tracks.append(info);
+    }
+    return tracks;
+}
+
+bool AVDemuxer::selectAudioStream(int streamIndex, qint64 resumeMs) {
+    if (!format_context_ || streamIndex < 0 || streamIndex >= (int)format_context_->nb_streams ||
+        format_context_->streams[streamIndex]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) {
+        return false;
+    }
+    if (streamIndex == audio_stream_index_) return true;
+
+    // Packets of the old track still queued are useless from now on; anything step()
+    // reads for it afterwards no longer matches the index and is dropped
+    audio_stream_index_ = streamIndex;
+    setPacketWeigher(audio_queue_, streamIndex);
+    clearAudioQueue();
+    audio_resume_ms_ = resumeMs;
+    audio_switch_pending_ = true;
+    if (!isRunning()) {
+        applyAudioSwitch();
+    }
+    return true;
+}
+
+bool AVDemuxer::selectSubtitleStream(int streamIndex) {
+    if (!format_context_ || streamIndex >= (int)format_context_->nb_streams ||
+        (streamIndex >= 0 && format_context_->streams[streamIndex]->codecpar->codec_type != AVMEDIA_TYPE_SUBTITLE)) {
+        return false;
+    }
+    subtitle_stream_index_ = streamIndex < 0 ? -1 : streamIndex;
+    clearSubtitleQueue();
+    // The format context belongs to the reading thread while it runs
+    if (isRunning()) {
+        subtitle_switch_pending_ = true;
+    } else {
+        updateStreamDiscard();
+    }
+    return true;
+}
+
+void AVDemuxer::updateStreamDiscard() {
+    // Only the selected tracks are read, everything else is skipped by the demuxer.
+    // A timeshift recording keeps every audio and subtitle track so tracks can be
+    // switched within it.
+    for (unsigned int i = 0; i < format_context_->nb_streams; i++) {
+        const AVMediaType type = format_context_->streams[i]->codecpar->codec_type;
+        const bool active = (int)i == video_stream_index_ || (int)i == audio_stream_index_ ||
+            (int)i == subtitle_stream_index_ ||
+            (timeshift_.isOpen() && (type == AVMEDIA_TYPE_AUDIO || type == AVMEDIA_TYPE_SUBTITLE));
+        format_context_->streams[i]->discard = active ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+}
+
+void AVDemuxer::applyAudioSwitch() {
+    audio_switch_pending_ = false;
+    updateStreamDiscard();
+    freeOverflow(audio_overflow_);
+
+    // Re-read from the resume point; video packets already delivered are skipped
+    // so the video decoder carries on undisturbed
+    const qint64 resume_ms = audio_resume_ms_.load();
+    const int64_t target = resume_ms * AV_TIME_BASE / 1000;
+    if (timeshift_.isOpen()) {
+        timeshift_.seek(resume_ms);
+    }
+    if (timeshift_.isOpen() || av_seek_frame(format_context_, -1, target, AVSEEK_FLAG_BACKWARD) >= 0) {
+        skip_video_until_dts_ = last_video_dts_;
+        skip_audio_before_pts_ = audioPts(resume_ms);
+        isEOF_ = false;
+    }
+    clearAudioQueue();
+}
+
+// A playback position in the time base of the selected audio stream
+int64_t AVDemuxer::audioPts(qint64 positionMs) const {
+    const AVStream* audio = format_context_->streams[audio_stream_index_];
+    int64_t pts = av_rescale_q(positionMs, {1, 1000}, audio->time_base);
+    // Positions within a recording are raw stream times, without the start offset
+    if (!timeshift_.isOpen() && audio->start_time != AV_NOPTS_VALUE) {
+        pts += audio->start_time;
+    }
+    return pts;
+}
+
 void AVDemuxer::close() {
     if (isRunning()) {
         stop_requested_ = true;
         video_queue_.stop();
         audio_queue_.stop();
+        subtitle_queue_.stop();
         wait();
     }
     cleanup();
 }
 
 void AVDemuxer::cleanup() {
+    keyframe_indexer_->cancel();
+    timeshift_.close();
     clearQueues();
     if (format_context_) {
         avformat_close_input(&format_context_);
         format_context_ = nullptr;
     }
+    // The custom AVIOContext is not closed by avformat_close_input
+    io_.reset();
 
     video_stream_index_ = -1;
     audio_stream_index_ = -1;
+    subtitle_stream_index_ = -1;
+    subtitle_switch_pending_ = false;
+    network_source_ = false;
+    audio_switch_pending_ = false;
+    last_video_dts_ = AV_NOPTS_VALUE;
+    skip_video_until_dts_ = AV_NOPTS_VALUE;
+    skip_audio_before_pts_ = AV_NOPTS_VALUE;
     isEOF_ = false;
     stop_requested_ = false;
 }
 
 void AVDemuxer::clearQueues() {
+    // Called from step() or while the stage is not running; the overflow belongs to that thread
+    freeOverflow(video_overflow_);
+    freeOverflow(audio_overflow_);
     AVPacket* pkt = nullptr;
     while(video_queue_.tryPop(pkt)) {
         av_packet_free(&pkt);
     }
+
+    video_queue_.clear();
+    clearAudioQueue();
+    clearSubtitleQueue();
+}
+
+void AVDemuxer::clearAudioQueue() {
+    AVPacket* pkt = nullptr;
     while(audio_queue_.tryPop(pkt)) {
         av_packet_free(&pkt);
     }
-
-    video_queue_.clear();
     audio_queue_.clear();
 }
 
-void AVDemuxer::seek(qint64 position) {
+void AVDemuxer::clearSubtitleQueue() {
+    AVPacket* pkt = nullptr;
+    while (subtitle_queue_.tryPop(pkt)) {
+        av_packet_free(&pkt);
+    }
+    subtitle_queue_.clear();
+}
+
+void AVDemuxer::freeOverflow(std::deque<AVPacket*>& overflow) {
+    for (AVPacket* pkt : overflow) {
+        if (!pkt) continue;
+        overflow_bytes_ -= pkt->size;
+        MemoryBudget::release(MemoryBudget::Packets, pkt->size);
+        av_packet_free(&pkt);
+    }
+    overflow.clear();
+}
+
+void AVDemuxer::deliver(ThreadSafeQueue<AVPacket*>& queue, std::deque<AVPacket*>& overflow, AVPacket* packet) {
+    // Keep packet order: once something is parked, everything behind it is parked too
+    if (overflow.empty() && queue.tryPush(packet)) return;
+
+    overflow.push_back(packet);
+    overflow_bytes_ += packet ? packet->size : 0;
+    // Queued packets are charged by the queue, parked ones here
+    MemoryBudget::charge(MemoryBudget::Packets, packet ? packet->size : 0);
+    packets_parked_++;
+    const int parked = int(video_overflow_.size() + audio_overflow_.size());
+    if (parked > overflow_peak_) overflow_peak_ = parked;
+}
+
+void AVDemuxer::drainOverflow(ThreadSafeQueue<AVPacket*>& queue, std::deque<AVPacket*>& overflow) {
+    while (!overflow.empty() && queue.tryPush(overflow.front())) {
+        overflow_bytes_ -= overflow.front() ? overflow.front()->size : 0;
+        MemoryBudget::release(MemoryBudget::Packets, overflow.front() ? overflow.front()->size : 0);
+        overflow.pop_front();
+    }
+}
+
+bool AVDemuxer::wantsMorePackets() const {
+    // A stream wants data while its queue is below the target duration and has room;
+    // with packets still parked it is fed from the overflow area first
+    const qint64 target_us = effectiveTargetUs();
+    auto wants = [target_us](const ThreadSafeQueue<AVPacket*>& queue, const std::deque<AVPacket*>& overflow) {
+        return overflow.empty() && queue.size() < queue.capacity() && queue.weight() < target_us;
+    };
+    return (video_stream_index_ >= 0 && wants(video_queue_, video_overflow_)) ||
+           (audio_stream_index_ >= 0 && wants(audio_queue_, audio_overflow_));
+}
+
+bool AVDemuxer::overflowFull() const {
+    return video_overflow_.size() + audio_overflow_.size() >= kMaxOverflowPackets ||
+           overflow_bytes_ >= MemoryBudget::scaled(kMaxOverflowBytes);
+}
+
+qint64 AVDemuxer::effectiveTargetUs() const {
+    // Read-ahead is the first thing given up when the process nears its memory budget
+    return qMax<qint64>(kMinTargetMs, MemoryBudget::scaled(target_buffer_ms_)) * 1000;
+}
+
+void AVDemuxer::updateUnderruns() {
+    // Count transitions from "has data" to "empty"; the empty start after open or
+    // a seek is not an underrun
+    if (isEOF_) return;
+    if (video_stream_index_ >= 0) {
+        const bool empty = video_queue_.empty();
+        if (empty && !video_starved_) video_underruns_++;
+        video_starved_ = empty;
+    }
+    if (audio_stream_index_ >= 0) {
+        const bool empty = audio_queue_.empty();
+        if (empty && !audio_starved_) audio_underruns_++;
+        audio_starved_ = empty;
+    }
+}
+
+DemuxStats AVDemuxer::demuxStats() const {
+    DemuxStats stats;
+    stats.packetsRead = packets_read_;
+    stats.packetsParked = packets_parked_;
+    stats.overflowPeak = overflow_peak_;
+    stats.videoUnderruns = video_underruns_;
+    stats.audioUnderruns = audio_underruns_;
+    stats.overflowStalls = overflow_stalls_;
+    return stats;
+}
+
+void AVDemuxer::seek(qint64 position, bool exact) {
+    seek_exact_.store(exact);
     seek_target_.store(position);
 }
 
-void AVDemuxer::run() {
-    if (!format_context_) return;
+bool AVDemuxer::begin() {
+    if (!format_context_) return false;
 
     stop_requested_ = false;
     isEOF_ = false;
     video_queue_.start();
     audio_queue_.start();
+    subtitle_queue_.start();
+    if (timeshift_.isOpen()) {
+        stop_recording_ = false;
+        live_ended_ = false;
+        record_failed_ = false;
+        format_context_->interrupt_callback = {&AVDemuxer::interruptRead, this};
+        record_thread_.reset(QThread::create([this] { recordLive(); }));
+        record_thread_->start();
+    }
+    return true;
+}
+
+void AVDemuxer::end() {
+    if (record_thread_) {
+        stop_recording_ = true;
+        record_thread_->wait();
+        record_thread_.reset();
+        format_context_->interrupt_callback = {nullptr, nullptr};
+    }
+}
+
+int AVDemuxer::interruptRead(void* opaque) {
+    auto* self = static_cast<AVDemuxer*>(opaque);
+    return self->stop_recording_ || self->stop_requested_;
+}
+
+PipelineStep AVDemuxer::step() {
+    if (stop_requested_ || record_failed_) return PipelineStep::done();
 
-    while (!stop_requested_) {
-        qint64 seekMs = seek_target_.exchange(-1);
-        if (seekMs >= 0) {
+    qint64 seekMs = seek_target_.exchange(-1);
+    if (seekMs >= 0) {
+        const bool exact = seek_exact_.exchange(false);
+        TRACE_SCOPE("demux", "seek");
+        bool moved = false;
+        if (timeshift_.isOpen()) {
+            // The live source itself is never seeked, playback moves within the recording
+            timeshift_.seek(seekMs);
+            timeshift_drained_ = false;
+            moved = true;
+        } else {
             int64_t seekTarget = seekMs * AV_TIME_BASE / 1000;
-            if (av_seek_frame(format_context_, -1, seekTarget, AVSEEK_FLAG_BACKWARD) >= 0) {
+            moved = seekByIndex(seekMs) ||
+                    av_seek_frame(format_context_, -1, seekTarget, AVSEEK_FLAG_BACKWARD) >= 0;
+            if (moved) {
                 avformat_flush(format_context_);
-                clearQueues();
-                isEOF_ = false;
             }
         }
+        if (moved) {
+            clearQueues();
+            isEOF_ = false;
+            last_video_dts_ = AV_NOPTS_VALUE;
+            skip_video_until_dts_ = AV_NOPTS_VALUE;
+            skip_audio_before_pts_ = exact && audio_stream_index_ >= 0 ? audioPts(seekMs) : AV_NOPTS_VALUE;
+            video_starved_ = true;
+            audio_starved_ = true;
+            seek_serial_++;
+        }
+    }
 
-        AVPacket* packet = av_packet_alloc();
-        if (!packet) {
-            emit errorOccurred("Failed to allocate packet");
-            break;
+    if (audio_switch_pending_) {
+        applyAudioSwitch();
+        audio_starved_ = true;
+    }
+    if (subtitle_switch_pending_.exchange(false)) {
+        updateStreamDiscard();
+    }
+
+    drainOverflow(video_queue_, video_overflow_);
+    if (!audio_switch_pending_) {
+        drainOverflow(audio_queue_, audio_overflow_);
+    }
+    updateUnderruns();
+
+    if (timeshift_.isOpen()) {
+        // Recording runs on its own thread and never waits for playback: the
+        // queues are fed from the ring as far as the scheduler wants
+        AVPacket* packet = nullptr;
+        while (wantsMorePackets() && !overflowFull()) {
+            packet = av_packet_alloc();
+            if (!packet || !timeshift_.readNext(packet)) break;
+            route(packet);
+            packet = nullptr;
+        }
+        av_packet_free(&packet);
+
+        if (live_ended_) {
+            isEOF_ = true;
+            // The live stream has ended; once its recording has played out, let the decoders drain
+            if (!timeshift_drained_ && timeshift_.delayMs() == 0 && wantsMorePackets()) {
+                if (video_stream_index_ >= 0) deliver(video_queue_, video_overflow_, nullptr);
+                if (audio_stream_index_ >= 0) deliver(audio_queue_, audio_overflow_, nullptr);
+                timeshift_drained_ = true;
+            }
+            return PipelineStep::sleep(10);
+        }
+        return PipelineStep::sleep(kIdleSleepMs);
+    }
+
+    // Only read when some stream actually needs data; sleep when all are satisfied
+    // or when nothing more can be parked for the starving one
+    const bool wants_more = wantsMorePackets();
+    if (!wants_more || overflowFull()) {
+        if (wants_more && !overflow_stalled_) {
+            overflow_stalls_++;
+            qWarning() << "AVDemuxer: overflow area full while a stream is starving";
+        }
+        overflow_stalled_ = wants_more;
+        return PipelineStep::sleep(kIdleSleepMs);
+    }
+    overflow_stalled_ = false;
+
+    TRACE_SCOPE("demux", "read");
+    AVPacket* packet = av_packet_alloc();
+    if (!packet) {
+        emit errorOccurred("Failed to allocate packet");
+        return PipelineStep::done();
+    }
+
+    int ret = av_read_frame(format_context_, packet);
+    if (ret < 0) {
+        av_packet_free(&packet);
+        if (ret == AVERROR_EOF) {
+            if (!isEOF_) {
+                // End-of-stream markers let the decoders drain their last frames
+                if (video_stream_index_ >= 0) deliver(video_queue_, video_overflow_, nullptr);
+                if (audio_stream_index_ >= 0) deliver(audio_queue_, audio_overflow_, nullptr);
+            }
+            isEOF_ = true;
+            return PipelineStep::sleep(10);
         }
+        emit errorOccurred("Error reading frame");
+        return PipelineStep::done();
+    }
+    packets_read_++;
+    route(packet);
+    return PipelineStep::again();
+}
 
-        int ret = av_read_frame(format_context_, packet);
+void AVDemuxer::recordLive() {
+    TRACE_THREAD_NAME("Live recorder");
+    AVPacket* packet = av_packet_alloc();
+    if (!packet) {
+        emit errorOccurred("Failed to allocate packet");
+        record_failed_ = true;
+        return;
+    }
+    while (!stop_recording_ && !stop_requested_) {
+        int ret = 0;
+        {
+            TRACE_SCOPE("demux", "read live");
+            ret = av_read_frame(format_context_, packet);
+        }
+        if (ret == AVERROR(EAGAIN)) {
+            QThread::msleep(kIdleSleepMs);
+            continue;
+        }
+        if (ret == AVERROR_EOF) {
+            live_ended_ = true;
+            break;
+        }
         if (ret < 0) {
-            av_packet_free(&packet);
-            if (ret == AVERROR_EOF) {
-                isEOF_ = true;
-                msleep(10);
-                continue;
-            } else {
+            // AVERROR_EXIT is the interrupt callback ending a blocked read on stop
+            if (!stop_recording_ && !stop_requested_) {
                 emit errorOccurred("Error reading frame");
-                break;
+                record_failed_ = true;
             }
+            break;
         }
+        packets_read_++;
+        timeshift_.append(packet);
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+}
 
-        if (packet->stream_index == video_stream_index_) {
-            video_queue_.push(packet);
-        } else if (packet->stream_index == audio_stream_index_) {
-            audio_queue_.push(packet);
-        } else {
+quint64 AVDemuxer::frameSerial(const AVFrame* frame) {
+#if QMLPLAYER_HAS_COPY_OPAQUE
+    return quint64(reinterpret_cast<uintptr_t>(frame->opaque));
+#else
+    return quint64(frame->reordered_opaque);
+#endif
+}
+
+void AVDemuxer::route(AVPacket* packet) {
+    packet->opaque = reinterpret_cast<void*>(uintptr_t(seek_serial_.load()));
+    if (packet->stream_index == video_stream_index_) {
+        if (skip_video_until_dts_ != AV_NOPTS_VALUE && packet->dts != AV_NOPTS_VALUE) {
+            if (packet->dts <= skip_video_until_dts_) {
+                av_packet_free(&packet);
+                return;
+            }
+            skip_video_until_dts_ = AV_NOPTS_VALUE;
+        }
+        if (packet->dts != AV_NOPTS_VALUE) {
+            last_video_dts_ = packet->dts;
+        }
+        deliver(video_queue_, video_overflow_, packet);
+        TRACE_COUNTER("queue", "video packets", video_queue_.size());
+    } else if (packet->stream_index == audio_stream_index_) {
+        if (skip_audio_before_pts_ != AV_NOPTS_VALUE && packet->pts != AV_NOPTS_VALUE) {
+            if (packet->pts + packet->duration <= skip_audio_before_pts_) {
+                av_packet_free(&packet);
+                return;
+            }
+            skip_audio_before_pts_ = AV_NOPTS_VALUE;
+        }
+        deliver(audio_queue_, audio_overflow_, packet);
+        TRACE_COUNTER("queue", "audio packets", audio_queue_.size());
+    } else if (packet->stream_index == subtitle_stream_index_) {
+        // Subtitle packets are small and far apart; if the decoder falls this far
+        // behind the event is dropped rather than holding up audio and video
+        if (!subtitle_queue_.tryPush(packet)) {
             av_packet_free(&packet);
         }
+    } else {
+        av_packet_free(&packet);
     }
-}
\ No newline at end of file
+}
@@ -1,10 +1,12 @@
 #ifndef AVDEMUXER_H
 #define AVDEMUXER_H
 
-#include <QThread>
 #include <QMutex>
 #include <QString>
+#include <QVector>
 #include <atomic>
+#include <deque>
+#include <memory>
 #include <qobject.h>
 #include <qtmetamacros.h>
 #include <qtypes.h>
@@ -12,11 +14,41 @@
 extern "C" {
 #include <libavformat/avformat.h>
 #include <libavcodec/packet.h>
+#include <libavcodec/version.h>
 }
 
+// AV_CODEC_FLAG_COPY_OPAQUE (libavcodec 59.63, FFmpeg 6.0) hands packet->opaque on to
+// the frames decoded from it; before that only reordered_opaque makes the trip
+#define QMLPLAYER_HAS_COPY_OPAQUE (LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(59, 63, 100))
+
+#include "KeyframeIndexer.h"
+#include "MediaIO.h"
+#include "PipelineStage.h"
 #include "ThreadSafeQueue.h"
+#include "TimeshiftBuffer.h"
+
+struct AVFrame;
+
+struct TrackInfo {
+    int streamIndex = -1;
+    QString codec;
+    QString language;
+    QString title;
+    int channels = 0;
+    int sampleRate = 0;
+};
 
-class AVDemuxer : public QThread {
+// Scheduler counters, cumulative since open()
+struct DemuxStats {
+    qint64 packetsRead = 0;
+    qint64 packetsParked = 0;   // packets that had to wait in the overflow area
+    int overflowPeak = 0;       // most packets parked at once
+    qint64 videoUnderruns = 0;  // video queue ran dry before end of file
+    qint64 audioUnderruns = 0;
+    qint64 overflowStalls = 0;  // reading paused with a stream starving because the overflow area was full
+};
+
+class AVDemuxer : public PipelineStage {
     Q_OBJECT
 public:
     explicit AVDemuxer(QObject *parent = nullptr);
@@ -24,39 +56,145 @@ public:
 
     bool open(const QString& filename);
     void close();
-    void seek(qint64 timestampMs);
+    // Exact seeks also drop the audio before timestampMs, for playback that has to
+    // continue right there; video is trimmed by VideoDecoder::skipFramesBefore()
+    void seek(qint64 timestampMs, bool exact = false);
 
     ThreadSafeQueue<AVPacket*>& videoQueue() { return video_queue_; }
     ThreadSafeQueue<AVPacket*>& audioQueue() { return audio_queue_; }
+    // Packets of the selected subtitle stream; sparse, so not part of the read-ahead scheduling
+    ThreadSafeQueue<AVPacket*>& subtitleQueue() { return subtitle_queue_; }
 
     int videoStreamIndex() const { return video_stream_index_; }
     int audioStreamIndex() const { return audio_stream_index_; }
+    int subtitleStreamIndex() const { return subtitle_stream_index_; }
+
+    QVector<TrackInfo> audioTracks() const;
+    // Switch the demuxed audio track without reopening the file. Audio packets
+    // are re-read from resumeMs while the video stream continues where it was.
+    bool selectAudioStream(int streamIndex, qint64 resumeMs);
+
+    QVector<TrackInfo> subtitleTracks() const;
+    // Start or stop (-1) demuxing a subtitle stream. Reading continues where it is,
+    // so the new stream's events show up from the next one read.
+    bool selectSubtitleStream(int streamIndex);
 
     AVFormatContext* formatContext() const { return format_context_; }
     bool isEndOfFile() const { return isEOF_; }
+    // Seeks carried out so far; packets queued once it has moved past a seek() come from the new position
+    quint64 seekSerial() const { return seek_serial_.load(); }
+    // The seek serial the packets of a frame were read under; audio and video packets
+    // carry it in their opaque field, which AV_CODEC_FLAG_COPY_OPAQUE hands on to frames
+    static quint64 frameSerial(const AVFrame* frame);
+    bool isNetworkSource() const { return network_source_; }
+    // Demuxed media waiting in the packet queues, minimum over the active streams
+    qint64 bufferedMs() const;
+    // True when a packet queue is full or at the target, i.e. the scheduler reads no further ahead
+    bool queuesSaturated() const;
+
+    // Reading continues while an active stream has less than this much media queued;
+    // under memory pressure (see MemoryBudget) the demuxer aims for a fraction of it
+    void setTargetBufferMs(qint64 ms) { target_buffer_ms_ = qMax<qint64>(100, ms); }
+    qint64 targetBufferMs() const { return target_buffer_ms_; }
+    DemuxStats demuxStats() const;
+
+    // Counters of the custom I/O layer; all zero when FFmpeg's own I/O is used
+    IoStats ioStats() const { return io_ ? io_->stats() : IoStats(); }
+    // Sources without a known duration (RTSP, UDP/TS multicast, live HLS, ...)
+    bool isLiveSource() const;
+
+    // Live network sources are recorded into an on-disk ring and played back from
+    // it; seeks move within the recording, TimeshiftBuffer::kLiveEdge returns to live
+    bool isTimeshifting() const { return timeshift_.isOpen(); }
+    qint64 timeshiftWindowMs() const { return timeshift_.windowMs(); }
+    qint64 timeshiftDelayMs() const { return timeshift_.delayMs(); }
 
 signals:
     void errorOccurred(QString message);
     void opened();
 
 protected:
-    void run() override;
+    bool begin() override;
+    void end() override;
+    PipelineStep step() override;
 
 private:
     void cleanup();
     void clearQueues();
+    void clearAudioQueue();
+    void clearSubtitleQueue();
+    void applyAudioSwitch();
+    void updateStreamDiscard();
+    QVector<TrackInfo> tracks(AVMediaType type) const;
+    static int probeLevelFor(qint64 probeSize);
+    bool openInput(const AVInputFormat* format, int probeLevel);
+    bool probeStreams(int probeLevel);
+    bool streamParametersComplete() const;
+    void setPacketWeigher(ThreadSafeQueue<AVPacket*>& queue, int streamIndex);
+    bool seekByIndex(qint64 positionMs);
+    int64_t audioPts(qint64 positionMs) const;
+    void deliver(ThreadSafeQueue<AVPacket*>& queue, std::deque<AVPacket*>& overflow, AVPacket* packet);
+    void drainOverflow(ThreadSafeQueue<AVPacket*>& queue, std::deque<AVPacket*>& overflow);
+    void freeOverflow(std::deque<AVPacket*>& overflow);
+    bool wantsMorePackets() const;
+    qint64 effectiveTargetUs() const;
+    bool overflowFull() const;
+    void updateUnderruns();
+    void route(AVPacket* packet);
+    void openTimeshift();
+    void recordLive();
+    static int interruptRead(void* opaque);
 
     QString file_name_;
     AVFormatContext* format_context_ = nullptr;
+    std::unique_ptr<MediaIO> io_;
+    bool network_source_ = false;
+    KeyframeIndexer* keyframe_indexer_ = nullptr;
+    TimeshiftBuffer timeshift_;
+    bool timeshift_drained_ = false;    // end-of-stream markers sent after the recording ran out
+    // Live packets are read on their own thread so a stalled source never holds
+    // up playback from the ring; the interrupt callback aborts a blocked read
+    std::unique_ptr<QThread> record_thread_;
+    std::atomic<bool> stop_recording_{false};
+    std::atomic<bool> live_ended_{false};
+    std::atomic<bool> record_failed_{false};
     int video_stream_index_ = -1;
-    int audio_stream_index_ = -1;
+    std::atomic<int> audio_stream_index_{-1};
+    std::atomic<int> subtitle_stream_index_{-1};
+    std::atomic<bool> subtitle_switch_pending_{false};
 
     ThreadSafeQueue<AVPacket*> video_queue_{100};
     ThreadSafeQueue<AVPacket*> audio_queue_{200};
+    ThreadSafeQueue<AVPacket*> subtitle_queue_{256};
+
+    // Demux scheduling: packets for a full queue are parked here instead of
+    // blocking, so the other stream keeps being fed. Only touched by step().
+    std::deque<AVPacket*> video_overflow_;
+    std::deque<AVPacket*> audio_overflow_;
+    qint64 overflow_bytes_ = 0;
+    std::atomic<qint64> target_buffer_ms_{2000};
+    bool video_starved_ = true;
+    bool audio_starved_ = true;
+    bool overflow_stalled_ = false;
+    std::atomic<qint64> packets_read_{0};
+    std::atomic<qint64> packets_parked_{0};
+    std::atomic<int> overflow_peak_{0};
+    std::atomic<qint64> video_underruns_{0};
+    std::atomic<qint64> audio_underruns_{0};
+    std::atomic<qint64> overflow_stalls_{0};
 
     std::atomic<bool> stop_requested_{false};
     std::atomic<bool> isEOF_{false};
     std::atomic<qint64> seek_target_{-1};
+    std::atomic<bool> seek_exact_{false};
+    std::atomic<quint64> seek_serial_{0};
+
+    // Audio track switching
+    std::atomic<bool> audio_switch_pending_{false};
+    std::atomic<qint64> audio_resume_ms_{0};
+    int64_t last_video_dts_ = AV_NOPTS_VALUE;
+    int64_t skip_video_until_dts_ = AV_NOPTS_VALUE;
+    int64_t skip_audio_before_pts_ = AV_NOPTS_VALUE;
 };
 
 #endif // AVDEMUXER_H
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "AudioDecoder.h"
+#include "MemoryBudget.h"
+#include "Trace.h"
 #include <QDebug>
 
 extern "C" {
@@ -8,11 +10,34 @@ extern "C" {
 #include "libswresample/swresample.h"
 }
 
+#include <cmath>
 #include <qthread.h>
 #include <qtmetamacros.h>
 
-AudioDecoder::AudioDecoder(QObject *parent) : QThread(parent) {
-    
+namespace {
+constexpr size_t kDefaultFrameQueue = 50;
+// 5 ms chunks: with the 20 ms sink buffer about 35 ms are queued ahead of the device
+constexpr size_t kLowLatencyFrameQueue = 3;
+
+// Drift controller: target queue depth, smoothing and PI gains. The correction is
+// capped at 0.5%, well below what is audible as a pitch change.
+constexpr double kDriftTargetMs = 150.0;
+constexpr double kLowLatencyDriftTargetMs = 10.0;
+constexpr double kFillSmoothing = 0.01;
+constexpr double kDriftProportional = 0.002;
+constexpr double kDriftIntegral = 0.002;
+constexpr double kDriftIntegralStep = 0.001;
+constexpr double kMaxDriftCorrection = 0.005;
+}
+
+AudioDecoder::AudioDecoder(QObject *parent) : PipelineStage(parent) {
+    frame_queue_.setWeigher([](AVFrame* const& frame) -> qint64 {
+        return frame ? frame->nb_samples : 0;
+    });
+    // The packed plane, not buf[0]: low-latency chunks share the buffer of the frame they were cut from
+    frame_queue_.setSizer([](AVFrame* const& frame) -> qint64 {
+        return frame ? frame->linesize[0] : 0;
+    }, MemoryBudget::AudioFrames);
 }
 
 AudioDecoder::~AudioDecoder() {
@@ -26,6 +51,7 @@ bool AudioDecoder::open(AVFormatContext *formatContext, int streamIndex) {
     }
 
     AVStream* stream = formatContext->streams[streamIndex];
+    time_base_ = stream->time_base;
     const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
     if (!codec) {
         emit errorOccurred("Unsupported codec");
@@ -76,6 +102,11 @@ bool AudioDecoder::initResampler() {
     av_opt_set_int(swr_ctx_, "out_sample_rate", out_sample_rate_, 0);
     av_opt_set_sample_fmt(swr_ctx_, "in_sample_fmt", codec_ctx_->sample_fmt, 0);
     av_opt_set_sample_fmt(swr_ctx_, "out_sample_fmt", out_sample_fmt_, 0);
+    if (drift_compensation_) {
+        // Keep the resampler engaged even at equal rates so compensation can be
+        // changed per frame without re-initializing the context
+        av_opt_set_int(swr_ctx_, "flags", SWR_FLAG_RESAMPLE, 0);
+    }
     
     if (swr_init(swr_ctx_) < 0) {
         emit errorOccurred("Failed to initialize SwrContext");
@@ -86,6 +117,114 @@ bool AudioDecoder::initResampler() {
     return true;
 }
 
+void AudioDecoder::setLowLatency(bool enabled) {
+    chunk_samples_ = enabled ? out_sample_rate_ / 200 : 0;
+    frame_queue_.setCapacity(enabled ? kLowLatencyFrameQueue : kDefaultFrameQueue);
+}
+
+void AudioDecoder::setDriftCompensation(bool enabled) {
+    drift_compensation_ = enabled;
+    resetDriftCompensation();
+}
+
+void AudioDecoder::resetDriftCompensation() {
+    fill_average_ms_ = -1.0;
+    drift_integral_ = 0.0;
+    compensation_remainder_ = 0.0;
+    drift_correction_ppm_ = 0.0;
+}
+
+void AudioDecoder::updateDriftCompensation(int inputSamples) {
+    const double target = chunk_samples_ > 0 ? kLowLatencyDriftTargetMs : kDriftTargetMs;
+    const double fill = queuedDurationMs();
+    fill_average_ms_ = fill_average_ms_ < 0 ? fill
+        : fill_average_ms_ + kFillSmoothing * (fill - fill_average_ms_);
+
+    // Positive error: the sender runs fast and audio piles up, so produce fewer samples
+    const double error = (fill_average_ms_ - target) / target;
+    drift_integral_ = qBound(-1.0, drift_integral_ + error * kDriftIntegralStep, 1.0);
+    const double correction = qBound(-kMaxDriftCorrection,
+                                     -(kDriftProportional * error + kDriftIntegral * drift_integral_),
+                                     kMaxDriftCorrection);
+
+    // The compensation covers exactly this chunk, so it is re-armed for every one;
+    // the fraction of a sample left over by rounding carries into the next
+    const int out_samples = (int)av_rescale(inputSamples, out_sample_rate_, codec_ctx_->sample_rate);
+    if (out_samples > 0) {
+        const double exact = correction * out_samples + compensation_remainder_;
+        const int delta = (int)lrint(exact);
+        if (swr_set_compensation(swr_ctx_, delta, out_samples) >= 0) {
+            compensation_remainder_ = exact - delta;
+        }
+    }
+    drift_correction_ppm_ = correction * 1e6;
+}
+
+void AudioDecoder::convertFrame(AVFrame* decoded) {
+    TRACE_SCOPE("audio", "resample");
+    // nullptr flushes the samples still buffered in the resampler
+    const int in_samples = decoded ? decoded->nb_samples : 0;
+    const int out_samples = swr_get_out_samples(swr_ctx_, in_samples);
+    if (out_samples <= 0) return;
+
+    AVFrame* resampled_frame = av_frame_alloc();
+    resampled_frame->sample_rate = out_sample_rate_;
+    resampled_frame->format = out_sample_fmt_;
+    AVChannelLayout stereo_layout = AV_CHANNEL_LAYOUT_STEREO;
+    av_channel_layout_copy(&resampled_frame->ch_layout, &stereo_layout);
+    resampled_frame->nb_samples = out_samples;
+    if (av_frame_get_buffer(resampled_frame, 0) < 0) {
+        av_frame_free(&resampled_frame);
+        return;
+    }
+
+    int converted = swr_convert(swr_ctx_,
+                                resampled_frame->data, resampled_frame->nb_samples,
+                                decoded ? (const uint8_t**)decoded->data : nullptr, in_samples);
+
+    if (converted <= 0) {
+        av_frame_free(&resampled_frame);
+        return;
+    }
+
+    resampled_frame->nb_samples = converted;
+    resampled_frame->pts = decoded ? decoded->pts : AV_NOPTS_VALUE;
+
+    pushFrame(resampled_frame);
+}
+
+void AudioDecoder::pushFrame(AVFrame* frame) {
+    const int chunk = chunk_samples_;
+    if (chunk <= 0 || frame->nb_samples <= chunk) {
+        queueFrame(frame);
+        return;
+    }
+
+    // Interleaved output, so each chunk is a contiguous slice of data[0]; the
+    // chunks reference the resampled buffer instead of copying out of it
+    const int bytes_per_sample = av_get_bytes_per_sample(out_sample_fmt_) * out_channels_;
+    for (int offset = 0; offset < frame->nb_samples; offset += chunk) {
+        AVFrame* part = av_frame_alloc();
+        if (!part) break;
+        part->buf[0] = av_buffer_ref(frame->buf[0]);
+        if (!part->buf[0]) {
+            av_frame_free(&part);
+            break;
+        }
+        part->sample_rate = frame->sample_rate;
+        part->format = frame->format;
+        av_channel_layout_copy(&part->ch_layout, &frame->ch_layout);
+        part->nb_samples = qMin(chunk, frame->nb_samples - offset);
+        part->data[0] = frame->data[0] + offset * bytes_per_sample;
+        part->extended_data = part->data;
+        part->linesize[0] = part->nb_samples * bytes_per_sample;
+        part->pts = frame->pts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE
+            : frame->pts + av_rescale_q(offset, {1, out_sample_rate_}, time_base_);
+        queueFrame(part);
+    }
+    av_frame_free(&frame);
+}
+
 void AudioDecoder::close() {
     requestStop();
     if (isRunning()) wait();
@@ -117,88 +256,137 @@ void AudioDecoder::flush()
     if (codec_ctx_) {
         avcodec_flush_buffers(codec_ctx_);
     }
-    // flush_requested_ will be reset by run()
+    if (packet_queue_) packet_queue_->wake();
+    // flush_requested_ will be reset by step()
 }
 
 void AudioDecoder::requestStop()
 {
     stop_requested_ = true;
     frame_queue_.stop();
+    if (packet_queue_) packet_queue_->wake();
 }
 
-void AudioDecoder::run()
+bool AudioDecoder::begin()
 {
     if (!packet_queue_ || !codec_ctx_) {
         emit errorOccurred("AudioDecoder not properly initialized");
-        return;
+        return false;
     }
 
-    AVFrame* decoded_frame = av_frame_alloc();
-    if (!decoded_frame) {
+    decoded_frame_ = av_frame_alloc();
+    if (!decoded_frame_) {
         emit errorOccurred("Failed to allocate decoded frame");
-        return;
+        return false;
+    }
+    return true;
+}
+
+void AudioDecoder::end()
+{
+    freePendingFrames();
+    av_frame_free(&decoded_frame_);
+}
+
+PipelineStep AudioDecoder::step()
+{
+    if (stop_requested_) return PipelineStep::done();
+
+    if (flush_requested_) {
+        flush_requested_ = false;
+        freePendingFrames();
+        resetDriftCompensation();
+        return PipelineStep::sleep(10);
     }
 
-    while (!stop_requested_) {
-        if (flush_requested_) {
-            flush_requested_ = false;
-            QThread::msleep(10);
-            continue;
-        }
+    // Nothing new is decoded while earlier output still waits for room
+    if (!drainPendingFrames()) {
+        return PipelineStep::wait(5);
+    }
 
-        AVPacket* packet = nullptr;
-        if (!packet_queue_->pop(packet)) {
-            break;
-        }
+    // The packet queue is owned by the demuxer and may outlive this decoder
+    // (track switching), so never pop blocking; waitForWork() waits with a timeout
+    AVPacket* packet = nullptr;
+    if (!packet_queue_->tryPop(packet)) {
+        return packet_queue_->isStopped() ? PipelineStep::done() : PipelineStep::wait(5);
+    }
 
-        if (!packet) {
-            continue;
-        }
+    // A null packet marks the end of the stream: drain the codec and the
+    // resampler completely so the last samples are not lost (gapless playback)
+    const bool end_of_stream = packet == nullptr;
+    int ret = 0;
+    {
+        TRACE_SCOPE("audio", "decode");
+        ret = avcodec_send_packet(codec_ctx_, packet);
+    }
+    av_packet_free(&packet);
 
-        int ret = avcodec_send_packet(codec_ctx_, packet);
-        av_packet_free(&packet);
+    if (ret < 0 && !end_of_stream) {
+        qWarning() << "Error sending audio packet for decoding";
+        return PipelineStep::again();
+    }
 
+    while (ret >= 0 && !stop_requested_) {
+        {
+            TRACE_SCOPE("audio", "decode");
+            ret = avcodec_receive_frame(codec_ctx_, decoded_frame_);
+        }
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            break;
+        }
         if (ret < 0) {
-            qWarning() << "Error sending audio packet for decoding";
-            continue; 
+            qWarning() << "Error receiving audio frame";
+            break;
         }
 
-        while (ret >= 0 && !stop_requested_) {
-            ret = avcodec_receive_frame(codec_ctx_, decoded_frame);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                break;
-            }
-            if (ret < 0) {
-                qWarning() << "Error receiving audio frame";
-                break;
-            }
-
-            AVFrame* resampled_frame = av_frame_alloc();
-            resampled_frame->sample_rate = out_sample_rate_;
-            resampled_frame->format = out_sample_fmt_;
-            AVChannelLayout stereo_layout = AV_CHANNEL_LAYOUT_STEREO;
-            av_channel_layout_copy(&resampled_frame->ch_layout, &stereo_layout);
-            resampled_frame->nb_samples = swr_get_out_samples(swr_ctx_, decoded_frame->nb_samples);
-            if (av_frame_get_buffer(resampled_frame, 0) < 0) {
-                av_frame_free(&resampled_frame);
-                continue;
-            }
-
-            int converted = swr_convert(swr_ctx_,
-                                        resampled_frame->data, resampled_frame->nb_samples,
-                                        (const uint8_t**)decoded_frame->data, decoded_frame->nb_samples);
-
-            if (converted < 0) {
-                av_frame_free(&resampled_frame);
-                continue;
-            }
-
-            resampled_frame->nb_samples = converted;
-            resampled_frame->pts = decoded_frame->pts;
-
-            frame_queue_.push(resampled_frame);
-            av_frame_unref(decoded_frame);
+        if (drift_compensation_) {
+            updateDriftCompensation(decoded_frame_->nb_samples);
         }
+        convertFrame(decoded_frame_);
+        av_frame_unref(decoded_frame_);
     }
-    av_frame_free(&decoded_frame);
-}
\ No newline at end of file
+
+    if (end_of_stream && !stop_requested_) {
+        convertFrame(nullptr);
+        queueFrame(nullptr);
+        // Ready for more packets should the demuxer seek back
+        avcodec_flush_buffers(codec_ctx_);
+    }
+    return PipelineStep::again();
+}
+
+void AudioDecoder::queueFrame(AVFrame* frame)
+{
+    // Keep the order: once something waits, everything behind it waits too
+    if (!pending_frames_.empty() || !frame_queue_.tryPush(frame)) {
+        pending_frames_.push_back(frame);
+    }
+    TRACE_COUNTER("queue", "audio frames", frame_queue_.size());
+}
+
+bool AudioDecoder::waitForWork(int timeoutMs)
+{
+    // Either output waits for room or the codec for the next packet
+    if (!pending_frames_.empty()) {
+        frame_queue_.waitNotFull(timeoutMs);
+    } else {
+        packet_queue_->waitNotEmpty(timeoutMs);
+    }
+    return true;
+}
+
+bool AudioDecoder::drainPendingFrames()
+{
+    while (!pending_frames_.empty() && frame_queue_.tryPush(pending_frames_.front())) {
+        pending_frames_.pop_front();
+    }
+    return pending_frames_.empty();
+}
+
+void AudioDecoder::freePendingFrames()
+{
+    for (AVFrame* frame : pending_frames_) {
+        av_frame_free(&frame);
+    }
+    pending_frames_.clear();
+}
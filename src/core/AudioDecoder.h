@@ -1,9 +1,9 @@
 #ifndef AUDIO_DECODER_H
 #define AUDIO_DECODER_H
 
-#include <QThread>
 #include <QMutex>
 #include <atomic>
+#include <deque>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -15,9 +15,10 @@ extern "C" {
 #include <libavutil/opt.h>
 }
 
+#include "PipelineStage.h"
 #include "ThreadSafeQueue.h"
 
-class AudioDecoder : public QThread {
+class AudioDecoder : public PipelineStage {
     Q_OBJECT
 public:
     explicit AudioDecoder(QObject *parent = nullptr);
@@ -27,11 +28,25 @@ public:
     void close();
 
     void setPacketQueue(ThreadSafeQueue<AVPacket*>* queue);
+    // A nullptr frame follows the last frame of the stream
     ThreadSafeQueue<AVFrame*>& frameQueue() { return frame_queue_; }
 
     int sampleRate() const { return out_sample_rate_; }
     int channels() const { return out_channels_; }
     AVSampleFormat sampleFormat() const { return out_sample_fmt_; }
+    // Of the frame pts, i.e. of the decoded stream
+    AVRational timeBase() const { return time_base_; }
+
+    // Duration of the resampled audio waiting in frameQueue()
+    qint64 queuedDurationMs() const { return frame_queue_.weight() * 1000 / out_sample_rate_; }
+
+    // Low latency splits output into 5 ms chunks and keeps the frame queue short
+    void setLowLatency(bool enabled);
+
+    // Closed-loop clock drift compensation for live sources: the resampling ratio
+    // is nudged so the frame queue stays near its target depth. Set before open().
+    void setDriftCompensation(bool enabled);
+    qreal driftCorrectionPpm() const { return drift_correction_ppm_.load(); }
 
     void flush();
     void requestStop();
@@ -40,19 +55,41 @@ signals:
     void errorOccurred(const QString& message);
 
 protected:
-    void run() override;
+    bool begin() override;
+    void end() override;
+    PipelineStep step() override;
+    bool waitForWork(int timeoutMs) override;
 
 private:
     void cleanup();
     bool initResampler();
+    void convertFrame(AVFrame* decoded);
+    void pushFrame(AVFrame* frame);
+    void queueFrame(AVFrame* frame);
+    bool drainPendingFrames();
+    void freePendingFrames();
+    void updateDriftCompensation(int inputSamples);
+    void resetDriftCompensation();
 
     AVCodecContext* codec_ctx_ = nullptr;
     SwrContext* swr_ctx_ = nullptr;
     ThreadSafeQueue<AVPacket*>* packet_queue_ = nullptr;
     ThreadSafeQueue<AVFrame*> frame_queue_{50};
+    // Output that did not fit into frame_queue_ yet; the next packet waits for it.
+    // Only touched by the steps.
+    std::deque<AVFrame*> pending_frames_;
+    AVFrame* decoded_frame_ = nullptr;
     int out_sample_rate_ = 48000;
     int out_channels_ = 2;
     AVSampleFormat out_sample_fmt_ = AV_SAMPLE_FMT_S16;
+    AVRational time_base_{1, 48000};
+    std::atomic<int> chunk_samples_{0};
+
+    bool drift_compensation_ = false;
+    double fill_average_ms_ = -1.0;
+    double drift_integral_ = 0.0;
+    double compensation_remainder_ = 0.0;  // samples not yet applied
+    std::atomic<qreal> drift_correction_ppm_{0.0};
     std::atomic<bool> stop_requested_{false};
     std::atomic<bool> flush_requested_{false};
 };
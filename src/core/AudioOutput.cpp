@@ -1,6 +1,11 @@
 #include "AudioOutput.h"
 #include "AudioDecoder.h"
+#include "ConfigManager.h"
+#include "SpectrumAnalyzer.h"
+#include "PlayerStats.h"
+#include "Trace.h"
 #include <QAudioDevice>
+#include <QDateTime>
 #include <QMediaDevices>
 #include <cstddef>
 #include <cstdint>
@@ -27,18 +32,16 @@ void AudioOutput::start(AudioDecoder* decoder) {
     decoder_ = decoder;
     stop_requested_ = false;
     paused_ = false;
+    clock_ms_ = -1;
+    // A seek restarts the output; the refill after it is not an underrun
+    sink_primed_ = false;
     QThread::start();
 }
 
 void AudioOutput::stop() {
     stop_requested_ = true;
     if (isRunning()) wait();
-    if (audio_sink_) {
-        audio_sink_->stop();
-        delete audio_sink_;
-        audio_sink_ = nullptr;
-        audio_io_ = nullptr;
-    }
+    releaseAudioOutput();
 }
 
 void AudioOutput::pause() {
@@ -49,6 +52,8 @@ void AudioOutput::pause() {
 }
 
 void AudioOutput::resume() {
+    // The sink drained on purpose while paused
+    sink_primed_ = false;
     paused_ = false;
     if (audio_sink_) {
         audio_sink_->resume();
@@ -77,7 +82,24 @@ void AudioOutput::setMuted(bool muted) {
     emit mutedChanged(muted_);
 }
 
+void AudioOutput::setLatencyProfile(LatencyProfile profile) {
+    if (profile_.exchange(profile) != profile) {
+        // The sink is owned by the output thread, which rebuilds it on the next write
+        profile_changed_ = true;
+    }
+}
+
 void AudioOutput::initAudioOutput() {
+    const int bytes_per_ms = sample_rate_ * channels_ * int(sizeof(int16_t)) / 1000;
+    const bool low_latency = profile_ == LowLatency;
+    // Sink buffer and write period of the low-latency profile; the buffer holds at least two periods
+    const int period_ms = qBound(1, ConfigManager::instance().value(QStringLiteral("audio/lowLatencyPeriodMs"), 5).toInt(), 20);
+    const int buffer_ms = qBound(2 * period_ms, ConfigManager::instance().value(QStringLiteral("audio/lowLatencyBufferMs"), 20).toInt(), 200);
+    period_bytes_ = low_latency ? period_ms * bytes_per_ms : 0;
+    idle_sleep_us_ = low_latency ? 1000 : 5000;
+    QThread::currentThread()->setPriority(low_latency ? QThread::TimeCriticalPriority
+                                                      : QThread::HighPriority);
+
     QAudioFormat format;
     format.setSampleRate(sample_rate_);
     format.setChannelCount(channels_);
@@ -92,8 +114,41 @@ void AudioOutput::initAudioOutput() {
     }
 
     audio_sink_ = new QAudioSink(device, format);
+    if (low_latency) {
+        audio_sink_->setBufferSize(buffer_ms * bytes_per_ms);
+    }
     audio_sink_->setVolume(muted_ ? 0.0 : volume_);
     audio_io_ = audio_sink_->start();
+    sink_primed_ = false;
+    if (paused_) {
+        audio_sink_->suspend();
+    }
+}
+
+void AudioOutput::releaseAudioOutput() {
+    if (audio_sink_) {
+        audio_sink_->stop();
+        delete audio_sink_;
+        audio_sink_ = nullptr;
+        audio_io_ = nullptr;
+    }
+}
+
+void AudioOutput::updateLatency() {
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (now - last_latency_update_ms_ < 250 || !audio_sink_) return;
+    last_latency_update_ms_ = now;
+
+    // Data still in the sink plus whole frames waiting in the decoder queue
+    const qreal bytes_per_ms = sample_rate_ * channels_ * sizeof(int16_t) / 1000.0;
+    const qint64 sink_bytes = audio_sink_->bufferSize() - audio_sink_->bytesFree();
+    qreal latency = qMax<qint64>(0, sink_bytes) / bytes_per_ms;
+    latency += decoder_->queuedDurationMs();
+
+    const qreal previous = output_latency_ms_.exchange(latency);
+    if (qAbs(previous - latency) >= 1.0) {
+        emit latencyChanged(latency);
+    }
 }
 
 void AudioOutput::run() {
@@ -102,45 +157,109 @@ void AudioOutput::run() {
         return;
     }
 
+    TRACE_THREAD_NAME("AudioOutput");
     initAudioOutput();
     if (!audio_io_) {
         return;
     }
 
-    auto& frame_queue = decoder_->frameQueue();
+    bool at_end = false;
     while (!stop_requested_) {
         if (paused_) {
             QThread::msleep(10);
             continue;
         }
+        if (profile_changed_.exchange(false)) {
+            releaseAudioOutput();
+            initAudioOutput();
+            if (!audio_io_) break;
+        }
+
+        if (at_end) {
+            // Keep the sink open; a queued next item or a seek resumes output
+            AudioDecoder* next = next_decoder_.exchange(nullptr);
+            if (!next && decoder_->frameQueue().empty()) {
+                QThread::msleep(10);
+                continue;
+            }
+            if (next) {
+                decoder_ = next;
+                emit decoderSwitched(next);
+            }
+            at_end = false;
+        }
+
         AVFrame* frame = nullptr;
-        if (!frame_queue.pop(frame)) {
+        if (!decoder_->frameQueue().pop(frame)) {
             break;
         }
 
-        if (!frame) continue;
+        if (!frame) {
+            // End-of-stream marker: switch right here so the first sample of the
+            // next item directly follows the last one of this item
+            if (AudioDecoder* next = next_decoder_.exchange(nullptr)) {
+                decoder_ = next;
+                emit decoderSwitched(next);
+            } else {
+                at_end = true;
+                sink_primed_ = false;
+                emit endOfStream();
+            }
+            continue;
+        }
         if (frame->pts != AV_NOPTS_VALUE) {
             current_pts_.store(frame->pts);
         }
 
+        // The sink played out everything before this frame arrived: audible gap
+        const qreal bytes_per_ms = sample_rate_ * channels_ * sizeof(int16_t) / 1000.0;
+        if (sink_primed_ && audio_sink_->bytesFree() >= audio_sink_->bufferSize()) {
+            if (PlayerStats* stats = stats_.load(std::memory_order_relaxed)) {
+                stats->addAudioUnderrun();
+            }
+            sink_primed_ = false;
+        }
+
+        if (SpectrumAnalyzer* tap = spectrum_tap_.load(std::memory_order_relaxed)) {
+            tap->feed(reinterpret_cast<const int16_t*>(frame->data[0]), frame->nb_samples, channels_);
+        }
+
         int data_size = frame->nb_samples * channels_ * sizeof(int16_t);
         const char* data = reinterpret_cast<const char*>(frame->data[0]);
         int written = 0;
+        // Includes the waits for room in the sink, which is where a stalled device shows
+        TRACE_SCOPE("audio", "write");
         while (written < data_size && !stop_requested_) {
             int bytes_free = audio_sink_->bytesFree();
+            // Only a sink that was filled up can run dry; the startup fill does not count
+            if (bytes_free == 0) {
+                sink_primed_ = true;
+            }
+            if (period_bytes_ > 0) {
+                bytes_free = qMin(bytes_free, period_bytes_);
+            }
             if (bytes_free > 0) {
                 int to_write = qMin(bytes_free, data_size - written);
                 int result = audio_io_->write(data + written, to_write);
                 if (result > 0) {
                     written += result;
                 } else {
-                    QThread::msleep(5);
+                    QThread::usleep(idle_sleep_us_);
                 }
             } else {
-                QThread::msleep(5);
+                QThread::usleep(idle_sleep_us_);
             }
         }
+        // Playback position: the end of this frame minus what the sink still holds
+        if (frame->pts != AV_NOPTS_VALUE) {
+            const qint64 end_ms = av_rescale_q(frame->pts, decoder_->timeBase(), {1, 1000})
+                + frame->nb_samples * 1000 / sample_rate_;
+            const qint64 sink_bytes = audio_sink_->bufferSize() - audio_sink_->bytesFree();
+            clock_ms_.store(end_ms - qint64(qMax<qint64>(0, sink_bytes) / bytes_per_ms));
+        }
+        TRACE_COUNTER("audio", "sink buffered bytes", audio_sink_->bufferSize() - audio_sink_->bytesFree());
         av_frame_free(&frame);
+        updateLatency();
     }
 
     if (audio_sink_) {
@@ -11,10 +11,21 @@
 #include <qobject.h>
 #include <qtmetamacros.h>
 
-class AudioDecoder;
+#include "AudioDecoder.h"
+
+class SpectrumAnalyzer;
+class PlayerStats;
 class AudioOutput : public QThread {
     Q_OBJECT
 public:
+    // Default leaves buffering to the backend (file playback); LowLatency uses a
+    // small explicit sink buffer ("audio/lowLatencyBufferMs", 20 by default), short
+    // write periods ("audio/lowLatencyPeriodMs", 5) and a time-critical thread
+    enum LatencyProfile {
+        DefaultLatency,
+        LowLatency
+    };
+
     explicit AudioOutput(QObject* parent = nullptr);
     ~AudioOutput();
     void start(AudioDecoder* decoder);
@@ -29,18 +40,43 @@ public:
     void pause();
     void resume();
 
+    LatencyProfile latencyProfile() const { return profile_.load(); }
+    void setLatencyProfile(LatencyProfile profile);
+    // Measured audio buffered between the decoder output and the device, in ms
+    qreal outputLatencyMs() const { return output_latency_ms_.load(); }
+
+    // Gapless playback: once the current decoder delivers its end-of-stream marker the
+    // output thread continues with this one, on the same sink and without a gap.
+    // Survives stop()/start(); queue nullptr to withdraw it.
+    void queueNext(AudioDecoder* decoder) { next_decoder_ = decoder; }
+
+    // PCM tap for level/spectrum display; nullptr (the default) costs nothing
+    void setSpectrumTap(SpectrumAnalyzer* analyzer) { spectrum_tap_ = analyzer; }
+
+    // Counts sink underruns
+    void setStats(PlayerStats* stats) { stats_ = stats; }
+    // Stream time of the sample being played, in ms; -1 before the first write
+    qint64 clockMs() const { return clock_ms_.load(); }
+
 signals:
     void volumeChanged(qreal volume);
     void mutedChanged(bool muted);
     void errorOccurred(const QString& message);
+    void latencyChanged(qreal latencyMs);
+    // Emitted from the output thread
+    void decoderSwitched(AudioDecoder* decoder);
+    void endOfStream();
 
 protected:
     void run() override;
 
 private:
     void initAudioOutput();
+    void releaseAudioOutput();
+    void updateLatency();
     
     AudioDecoder* decoder_ = nullptr;
+    std::atomic<AudioDecoder*> next_decoder_{nullptr};
     QAudioSink* audio_sink_ = nullptr;
     QIODevice* audio_io_ = nullptr;
     
@@ -51,6 +87,17 @@ private:
     std::atomic<qint64> current_pts_{0};
     int sample_rate_ = 48000;
     int channels_ = 2;
+
+    std::atomic<LatencyProfile> profile_{DefaultLatency};
+    std::atomic<bool> profile_changed_{false};
+    int period_bytes_ = 0;
+    unsigned long idle_sleep_us_ = 5000;
+    std::atomic<qreal> output_latency_ms_{0.0};
+    std::atomic<SpectrumAnalyzer*> spectrum_tap_{nullptr};
+    std::atomic<PlayerStats*> stats_{nullptr};
+    std::atomic<qint64> clock_ms_{-1};
+    std::atomic<bool> sink_primed_{false};  // filled up since the sink (re)started, resumed or ran dry
+    qint64 last_latency_update_ms_ = 0;
 };
 
 #endif // AUDIOOUTPUT_H
\ No newline at end of file
@@ -0,0 +1,332 @@
+#include "FrameStepper.h"
+#include "ConfigManager.h"
+#include "MediaIO.h"
+#include "MemoryBudget.h"
+#include "ProbeCache.h"
+#include <QDebug>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+namespace {
+constexpr qint64 kMiB = 1024 * 1024;
+constexpr int kMaxPacketsPerFrame = 1000;
+constexpr size_t kMinCachedFrames = 2;  // the current frame and its neighbour
+// How much further back a step retries when the seek landed on or after the
+// current frame; doubled on every attempt
+constexpr qint64 kRewindMs = 1000;
+constexpr int kMaxRewinds = 6;
+
+qint64 frameBytes(const AVFrame* frame) {
+    qint64 bytes = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+        bytes += frame->buf[i]->size;
+    }
+    return bytes;
+}
+}
+
+FrameStepper::FrameStepper(QObject *parent)
+    : QThread(parent) {
+    cache_limit_ = qMax<qint64>(1, ConfigManager::instance().value(QStringLiteral("step/cacheMB"), 256).toLongLong()) * kMiB;
+}
+
+FrameStepper::~FrameStepper() {
+    close();
+}
+
+void FrameStepper::setOutputQueue(ThreadSafeQueue<AVFrame*>* queue) {
+    QMutexLocker locker(&mutex_);
+    output_ = queue;
+}
+
+void FrameStepper::setSource(const QString& filename) {
+    QMutexLocker locker(&mutex_);
+    if (file_name_ == filename) return;
+    file_name_ = filename;
+    source_changed_ = true;
+    session_ = false;
+}
+
+void FrameStepper::close() {
+    reset();
+    {
+        QMutexLocker locker(&mutex_);
+        stop_requested_ = true;
+        wake_.wakeAll();
+    }
+    if (isRunning()) wait();
+    stop_requested_ = false;
+    // The thread reopens the file on the next step
+    QMutexLocker locker(&mutex_);
+    source_changed_ = !file_name_.isEmpty();
+}
+
+void FrameStepper::step(int64_t fromPts, int direction) {
+    {
+        QMutexLocker locker(&mutex_);
+        if (!session_ && pending_.empty()) {
+            origin_pts_ = fromPts;
+        }
+        pending_.push_back(direction > 0 ? 1 : -1);
+        wake_.wakeOne();
+    }
+    if (!isRunning()) start();
+}
+
+void FrameStepper::reset() {
+    QMutexLocker locker(&mutex_);
+    generation_++;
+    pending_.clear();
+    session_ = false;
+}
+
+void FrameStepper::run() {
+    while (true) {
+        int direction = 0;
+        QString reopen;
+        {
+            QMutexLocker locker(&mutex_);
+            while (pending_.empty() && !stop_requested_) {
+                wake_.wait(&mutex_);
+            }
+            if (stop_requested_) break;
+            direction = pending_.front();
+            pending_.pop_front();
+            step_generation_ = generation_;
+            if (!session_) {
+                current_pts_ = origin_pts_;
+                session_ = true;
+            }
+            if (source_changed_) {
+                reopen = file_name_;
+                source_changed_ = false;
+            }
+        }
+
+        if (!reopen.isEmpty()) {
+            closeContext();
+            if (!openContext(reopen)) {
+                closeContext();
+                emit errorOccurred(QStringLiteral("FrameStepper: cannot decode %1").arg(reopen));
+            }
+        }
+        if (!codec_ctx_) continue;
+
+        const AVFrame* frame = direction > 0 ? nextFrame() : previousFrame();
+        if (frame) output(frame, step_generation_);
+    }
+    closeContext();
+}
+
+bool FrameStepper::openContext(const QString& filename) {
+    io_ = MediaIO::create(filename);
+    format_ctx_ = avformat_alloc_context();
+    if (io_) {
+        format_ctx_->pb = io_->avioContext();
+        if (format_ctx_->pb) format_ctx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    ProbeCache probe_cache;
+    const bool cached = probe_cache.load(filename);
+    QByteArray path_utf8 = filename.toUtf8();
+    if (avformat_open_input(&format_ctx_, path_utf8.constData(), cached ? probe_cache.inputFormat() : nullptr,
+                            nullptr) < 0) {
+        format_ctx_ = nullptr;
+        return false;
+    }
+    if (!(cached && probe_cache.apply(format_ctx_)) && avformat_find_stream_info(format_ctx_, nullptr) < 0) {
+        return false;
+    }
+
+    const AVCodec* codec = nullptr;
+    stream_index_ = av_find_best_stream(format_ctx_, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (stream_index_ < 0 || !codec) return false;
+    for (unsigned int i = 0; i < format_ctx_->nb_streams; i++) {
+        format_ctx_->streams[i]->discard = (int)i == stream_index_ ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+    time_base_ = format_ctx_->streams[stream_index_]->time_base;
+
+    codec_ctx_ = avcodec_alloc_context3(codec);
+    if (!codec_ctx_ || avcodec_parameters_to_context(codec_ctx_, format_ctx_->streams[stream_index_]->codecpar) < 0) {
+        return false;
+    }
+    // Playback is paused, so a step back may use every core for its burst
+    codec_ctx_->thread_count = 0;
+    if (avcodec_open2(codec_ctx_, codec, nullptr) < 0) return false;
+
+    packet_ = av_packet_alloc();
+    frame_ = av_frame_alloc();
+    return packet_ && frame_;
+}
+
+void FrameStepper::closeContext() {
+    clearCache();
+    av_frame_free(&frame_);
+    av_packet_free(&packet_);
+    avcodec_free_context(&codec_ctx_);
+    avformat_close_input(&format_ctx_);
+    io_.reset();
+    stream_index_ = -1;
+    sequential_ = false;
+    draining_ = false;
+}
+
+const AVFrame* FrameStepper::nextFrame() {
+    const int64_t current = current_pts_;
+    if (!cache_.empty() && cache_.front()->best_effort_timestamp <= current) {
+        for (const AVFrame* frame : cache_) {
+            if (frame->best_effort_timestamp > current) return frame;
+        }
+        // On the newest cached frame: the codec carries on from there
+        if (sequential_ && cache_.back()->best_effort_timestamp == current) {
+            return decodeNext() ? cache_.back() : nullptr;
+        }
+    }
+
+    if (!load(current, current)) return nullptr;
+    for (const AVFrame* frame : cache_) {
+        if (frame->best_effort_timestamp > current) return frame;
+    }
+    return nullptr;     // the last frame
+}
+
+const AVFrame* FrameStepper::previousFrame() {
+    const int64_t current = current_pts_;
+    auto previous = [this, current]() -> const AVFrame* {
+        for (auto it = cache_.rbegin(); it != cache_.rend(); ++it) {
+            if ((*it)->best_effort_timestamp < current) return *it;
+        }
+        return nullptr;
+    };
+    // The cache is contiguous, so the newest frame before the current one is its neighbour
+    if (!cache_.empty() && cache_.front()->best_effort_timestamp < current &&
+        cache_.back()->best_effort_timestamp >= current) {
+        return previous();
+    }
+
+    // Decode the GOP up to the current frame in one go
+    const AVStream* stream = format_ctx_->streams[stream_index_];
+    const int64_t first = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    int64_t rewind = av_rescale_q(kRewindMs, {1, 1000}, time_base_);
+    int64_t target = current - 1;
+    for (int attempt = 0; attempt < kMaxRewinds; attempt++) {
+        if (!load(target, current - 1)) return nullptr;
+        if (cache_.front()->best_effort_timestamp < current) return previous();
+        // Landed on or after the current frame: the seek was imprecise, or it is the first one
+        if (target <= first) return nullptr;
+        target -= rewind;
+        rewind *= 2;
+    }
+    return nullptr;
+}
+
+bool FrameStepper::cancelled() const {
+    return stop_requested_ || generation_ != step_generation_;
+}
+
+// Refills the cache from the keyframe at or before seekPts until a frame
+// past untilPts is in it
+bool FrameStepper::load(int64_t seekPts, int64_t untilPts) {
+    clearCache();
+    sequential_ = false;
+    if (av_seek_frame(format_ctx_, stream_index_, seekPts, AVSEEK_FLAG_BACKWARD) < 0) {
+        return false;
+    }
+    avcodec_flush_buffers(codec_ctx_);
+    draining_ = false;
+    sequential_ = true;
+
+    while (cache_.empty() || cache_.back()->best_effort_timestamp <= untilPts) {
+        // A partial cache is still contiguous and stays usable
+        if (cancelled() || !decodeNext()) break;
+    }
+    return !cache_.empty() && !cancelled();
+}
+
+// Appends the next frame in presentation order; false at the end of the stream
+bool FrameStepper::decodeNext() {
+    for (int i = 0; i < kMaxPacketsPerFrame; i++) {
+        const int ret = avcodec_receive_frame(codec_ctx_, frame_);
+        if (ret == 0) {
+            // Frames without a timestamp, or out of order, cannot be stepped to
+            const int64_t pts = frame_->best_effort_timestamp;
+            if (pts == AV_NOPTS_VALUE || (!cache_.empty() && pts <= cache_.back()->best_effort_timestamp)) {
+                av_frame_unref(frame_);
+                continue;
+            }
+            append(frame_);
+            return true;
+        }
+        if (ret != AVERROR(EAGAIN) || draining_) return false;
+
+        if (av_read_frame(format_ctx_, packet_) < 0) {
+            // Let the codec output the frames it still holds
+            avcodec_send_packet(codec_ctx_, nullptr);
+            draining_ = true;
+            continue;
+        }
+        if (packet_->stream_index == stream_index_) {
+            avcodec_send_packet(codec_ctx_, packet_);
+        }
+        av_packet_unref(packet_);
+    }
+    return false;
+}
+
+void FrameStepper::append(AVFrame* frame) {
+    AVFrame* cached = av_frame_alloc();
+    if (!cached) {
+        av_frame_unref(frame);
+        return;
+    }
+    av_frame_move_ref(cached, frame);
+    cache_.push_back(cached);
+    cache_bytes_ += frameBytes(cached);
+    MemoryBudget::charge(MemoryBudget::Caches, frameBytes(cached));
+
+    // Drop the frames furthest back; every load ends at the current frame
+    const qint64 limit = MemoryBudget::scaled(cache_limit_);
+    while (cache_.size() > kMinCachedFrames && cache_bytes_ > limit) {
+        AVFrame* oldest = cache_.front();
+        cache_.pop_front();
+        cache_bytes_ -= frameBytes(oldest);
+        MemoryBudget::release(MemoryBudget::Caches, frameBytes(oldest));
+        av_frame_free(&oldest);
+    }
+}
+
+void FrameStepper::clearCache() {
+    for (AVFrame* frame : cache_) {
+        av_frame_free(&frame);
+    }
+    cache_.clear();
+    MemoryBudget::release(MemoryBudget::Caches, cache_bytes_);
+    cache_bytes_ = 0;
+}
+
+void FrameStepper::output(const AVFrame* frame, quint64 generation) {
+    AVFrame* copy = av_frame_clone(frame);
+    if (!copy) return;
+    const int64_t pts = frame->best_effort_timestamp;
+    {
+        QMutexLocker locker(&mutex_);
+        if (generation != generation_ || !output_) {
+            av_frame_free(&copy);
+            return;
+        }
+        // Frames the paused decoder had queued would be shown after this one
+        AVFrame* stale = nullptr;
+        while (output_->tryPop(stale)) {
+            av_frame_free(&stale);
+        }
+        if (!output_->tryPush(copy)) {
+            av_frame_free(&copy);
+            return;
+        }
+    }
+    current_pts_ = pts;
+    emit stepped(pts, av_rescale_q(pts, time_base_, {1, 1000}));
+}
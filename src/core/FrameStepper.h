@@ -0,0 +1,100 @@
+#ifndef FRAMESTEPPER_H
+#define FRAMESTEPPER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <memory>
+
+#include "ThreadSafeQueue.h"
+
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+struct AVCodecContext;
+struct AVFormatContext;
+struct AVFrame;
+struct AVPacket;
+class MediaIO;
+
+// Single-frame stepping while playback is paused. Runs on a private format
+// context and decoder, so the playback pipeline stays where it paused. Decoded
+// frames around the current one are kept in a cache ordered by pts: a step back
+// past its start seeks to the previous keyframe and decodes up to the current
+// frame in one burst, after which further steps back are served from memory.
+// The cache is bounded by "step/cacheMB" (less under memory pressure) and keeps
+// the frames nearest to the current one. Frames are matched by their
+// best-effort timestamp, so every step lands exactly on the neighbouring frame.
+class FrameStepper : public QThread {
+    Q_OBJECT
+public:
+    explicit FrameStepper(QObject *parent = nullptr);
+    ~FrameStepper();
+
+    // Stepped frames replace the contents of this queue
+    void setOutputQueue(ThreadSafeQueue<AVFrame*>* queue);
+    // The file to step through; opened by the thread on the first step
+    void setSource(const QString& filename);
+    void close();
+
+    // Queues a step of one frame, forward for direction > 0. The first step after
+    // reset() starts from fromPts (stream time base), the frame on screen; later
+    // ones continue from the frame of the previous step.
+    void step(int64_t fromPts, int direction);
+    // Ends the stepping session: queued steps are dropped and nothing more is output
+    void reset();
+
+signals:
+    // A frame was output, at pts (stream time base) and positionMs
+    void stepped(qint64 pts, qint64 positionMs);
+    void errorOccurred(const QString& error);
+
+protected:
+    void run() override;
+
+private:
+    bool openContext(const QString& filename);
+    void closeContext();
+    const AVFrame* nextFrame();
+    const AVFrame* previousFrame();
+    bool cancelled() const;
+    bool load(int64_t seekPts, int64_t untilPts);
+    bool decodeNext();
+    void append(AVFrame* frame);
+    void clearCache();
+    void output(const AVFrame* frame, quint64 generation);
+
+    // Shared with the GUI thread
+    QMutex mutex_;
+    QWaitCondition wake_;
+    ThreadSafeQueue<AVFrame*>* output_ = nullptr;
+    QString file_name_;
+    bool source_changed_ = false;
+    std::deque<int> pending_;       // step directions
+    int64_t origin_pts_ = 0;
+    bool session_ = false;          // origin_pts_ applies to the next step when false
+    std::atomic<quint64> generation_{0};    // bumped by reset() and close()
+    std::atomic<bool> stop_requested_{false};
+
+    // Stepper thread only
+    std::unique_ptr<MediaIO> io_;
+    AVFormatContext* format_ctx_ = nullptr;
+    AVCodecContext* codec_ctx_ = nullptr;
+    AVPacket* packet_ = nullptr;
+    AVFrame* frame_ = nullptr;
+    int stream_index_ = -1;
+    AVRational time_base_{1, 1000};
+    quint64 step_generation_ = 0;   // session of the step being worked on
+    int64_t current_pts_ = 0;       // frame of the last step
+    std::deque<AVFrame*> cache_;    // decode order, ascending pts
+    qint64 cache_bytes_ = 0;
+    qint64 cache_limit_ = 0;
+    bool sequential_ = false;       // the codec continues right after cache_.back()
+    bool draining_ = false;
+};
+
+#endif // FRAMESTEPPER_H
@@ -0,0 +1,109 @@
+#include "GlyphAtlas.h"
+#include <QFontMetrics>
+#include <QImage>
+#include <QPainter>
+#include <QPainterPath>
+#include <cstring>
+
+GlyphAtlas::GlyphAtlas(int size)
+    : size_(size)
+    , pixels_(size * size * 2, 0) {
+    font_.setStyleHint(QFont::SansSerif);
+    font_.setWeight(QFont::DemiBold);
+    dirty_ = QRect(0, 0, size_, size_);
+}
+
+void GlyphAtlas::setPixelSize(int pixelSize) {
+    pixelSize = qMax(8, pixelSize);
+    if (pixelSize == pixel_size_) return;
+
+    pixel_size_ = pixelSize;
+    font_.setPixelSize(pixelSize);
+    // Thin enough to keep small text readable, thick enough to stand out on bright video
+    outline_ = qMax(1, pixelSize / 14);
+    const QFontMetrics metrics(font_);
+    ascent_ = metrics.ascent();
+    line_height_ = metrics.height() + outline_ * 2;
+    clear();
+}
+
+void GlyphAtlas::clear() {
+    std::memset(pixels_.data(), 0, pixels_.size());
+    glyphs_.clear();
+    shelf_x_ = 0;
+    shelf_y_ = 0;
+    shelf_height_ = 0;
+    dirty_ = QRect(0, 0, size_, size_);
+}
+
+QRect GlyphAtlas::takeDirtyRect() {
+    const QRect dirty = dirty_;
+    dirty_ = QRect();
+    return dirty;
+}
+
+const AtlasGlyph* GlyphAtlas::glyph(char32_t codePoint) {
+    auto it = glyphs_.constFind(codePoint);
+    if (it != glyphs_.constEnd()) return &it.value();
+
+    AtlasGlyph glyph;
+    if (!rasterize(codePoint, glyph)) return nullptr;
+    return &glyphs_.insert(codePoint, glyph).value();
+}
+
+bool GlyphAtlas::rasterize(char32_t codePoint, AtlasGlyph& glyph) {
+    const QString text = QString::fromUcs4(&codePoint, 1);
+    glyph.advance = QFontMetrics(font_).horizontalAdvance(text);
+
+    QPainterPath path;
+    path.addText(0, 0, font_, text);
+    if (path.isEmpty()) return true;  // whitespace: advance only
+
+    // Room for the outline plus one pixel so linear filtering never picks up a neighbour
+    const int pad = outline_ + 1;
+    const QRect bounds = path.boundingRect().toAlignedRect().adjusted(-pad, -pad, pad, pad);
+    const int w = bounds.width();
+    const int h = bounds.height();
+
+    if (shelf_x_ + w > size_) {
+        shelf_y_ += shelf_height_;
+        shelf_x_ = 0;
+        shelf_height_ = 0;
+    }
+    if (w > size_ || shelf_y_ + h > size_) return false;
+
+    glyph.rect = QRect(shelf_x_, shelf_y_, w, h);
+    glyph.offset = bounds.topLeft();
+    shelf_x_ += w;
+    shelf_height_ = qMax(shelf_height_, h);
+
+    QImage fill(w, h, QImage::Format_Alpha8);
+    QImage outline(w, h, QImage::Format_Alpha8);
+    fill.fill(0);
+    outline.fill(0);
+    {
+        QPainter painter(&fill);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.translate(-bounds.topLeft());
+        painter.fillPath(path, Qt::white);
+    }
+    {
+        QPainter painter(&outline);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.translate(-bounds.topLeft());
+        painter.strokePath(path, QPen(Qt::white, outline_ * 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+        painter.fillPath(path, Qt::white);
+    }
+
+    for (int y = 0; y < h; y++) {
+        const uchar* fill_row = fill.constScanLine(y);
+        const uchar* outline_row = outline.constScanLine(y);
+        uchar* dst = pixels_.data() + ((glyph.rect.y() + y) * size_ + glyph.rect.x()) * 2;
+        for (int x = 0; x < w; x++) {
+            dst[x * 2] = fill_row[x];
+            dst[x * 2 + 1] = outline_row[x];
+        }
+    }
+    dirty_ |= glyph.rect;
+    return true;
+}
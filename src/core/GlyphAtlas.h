@@ -0,0 +1,63 @@
+#ifndef GLYPH_ATLAS_H
+#define GLYPH_ATLAS_H
+
+#include <QFont>
+#include <QHash>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+// Placement of one glyph in the atlas. offset is the top-left corner of rect
+// relative to the pen position on the baseline.
+struct AtlasGlyph {
+    QRect rect;
+    QPoint offset;
+    int advance = 0;
+};
+
+// CPU side of the subtitle glyph texture: glyphs are rasterized once per pixel
+// size and packed into shelves of a two-channel (RG8) image, fill coverage in R
+// and outline coverage in G, so one texture draws outlined text. The renderer
+// uploads only the region that changed since the last upload.
+class GlyphAtlas {
+public:
+    explicit GlyphAtlas(int size = 1024);
+
+    int size() const { return size_; }
+    const uchar* data() const { return pixels_.constData(); }
+
+    // A different size starts over with an empty atlas
+    void setPixelSize(int pixelSize);
+    int pixelSize() const { return pixel_size_; }
+    int ascent() const { return ascent_; }
+    int lineHeight() const { return line_height_; }
+
+    // nullptr when the glyph does not fit anymore; clear() and lay out again
+    const AtlasGlyph* glyph(char32_t codePoint);
+    void clear();
+
+    // Area written since the last call, empty if nothing changed
+    QRect takeDirtyRect();
+
+private:
+    bool rasterize(char32_t codePoint, AtlasGlyph& glyph);
+
+    int size_;
+    QVector<uchar> pixels_;  // size_ * size_ * 2, row-major RG pairs
+    QHash<char32_t, AtlasGlyph> glyphs_;
+    QRect dirty_;
+
+    QFont font_;
+    int pixel_size_ = 0;
+    int outline_ = 1;
+    int ascent_ = 0;
+    int line_height_ = 0;
+
+    // Shelf packing: glyphs fill the current shelf left to right, a new shelf
+    // opens below when one does not fit
+    int shelf_x_ = 0;
+    int shelf_y_ = 0;
+    int shelf_height_ = 0;
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include "KeyframeIndexer.h"
+#include "MediaCache.h"
+#include "MediaIO.h"
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <algorithm>
+
+extern "C" {
+#include <libavcodec/packet.h>
+#include <libavformat/avformat.h>
+}
+
+namespace {
+constexpr quint32 kCacheMagic = 0x514B4649; // "QKFI"
+constexpr quint32 kCacheVersion = 1;
+}
+
+KeyframeIndexer::KeyframeIndexer(QObject *parent)
+    : QThread(parent) {}
+
+KeyframeIndexer::~KeyframeIndexer() {
+    cancel();
+}
+
+void KeyframeIndexer::index(const QString& filename, const AVStream* stream) {
+    cancel();
+    {
+        QMutexLocker locker(&mutex_);
+        entries_.clear();
+    }
+    file_name_ = filename;
+    stream_index_ = stream->index;
+    stream_id_ = stream->id;
+    media_type_ = stream->codecpar->codec_type;
+    codec_id_ = stream->codecpar->codec_id;
+    complete_ = false;
+    stop_requested_ = false;
+    start(QThread::IdlePriority);
+}
+
+void KeyframeIndexer::cancel() {
+    stop_requested_ = true;
+    if (isRunning()) wait();
+}
+
+int KeyframeIndexer::keyframeCount() const {
+    QMutexLocker locker(&mutex_);
+    return entries_.size();
+}
+
+bool KeyframeIndexer::lookup(int64_t pts, KeyframeEntry& entry) const {
+    QMutexLocker locker(&mutex_);
+    if (entries_.isEmpty() || (!complete_ && pts >= entries_.constLast().pts)) return false;
+
+    auto it = std::upper_bound(entries_.cbegin(), entries_.cend(), pts,
+                               [](int64_t value, const KeyframeEntry& e) { return value < e.pts; });
+    if (it == entries_.cbegin()) return false;
+    entry = *(it - 1);
+    return true;
+}
+
+void KeyframeIndexer::run() {
+    const QString cache_path = MediaCache::cacheFilePath(QStringLiteral("keyframes"), file_name_,
+                                                         QStringLiteral(".kfi"));
+    if (!cache_path.isEmpty() && loadCache(cache_path)) {
+        complete_ = true;
+        emit indexReady(true);
+        return;
+    }
+
+    if (!scan()) return;
+    complete_ = true;
+
+    if (!cache_path.isEmpty()) {
+        saveCache(cache_path);
+    }
+    emit indexReady(false);
+}
+
+bool KeyframeIndexer::scan() {
+    // Same byte source as playback (mmap for local files), but a context of our own
+    std::unique_ptr<MediaIO> io = MediaIO::create(file_name_);
+    AVFormatContext* format_ctx = avformat_alloc_context();
+    if (!format_ctx) return false;
+    if (io) {
+        format_ctx->pb = io->avioContext();
+        if (format_ctx->pb) format_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+    format_ctx->interrupt_callback.callback = [](void* opaque) -> int {
+        return static_cast<KeyframeIndexer*>(opaque)->stop_requested_ ? 1 : 0;
+    };
+    format_ctx->interrupt_callback.opaque = this;
+
+    QByteArray file_name_utf8 = file_name_.toUtf8();
+    if (avformat_open_input(&format_ctx, file_name_utf8.constData(), nullptr, nullptr) < 0) {
+        return false;
+    }
+
+    // No avformat_find_stream_info: packet flags and positions come straight from
+    // the container, and skipping the other streams keeps this I/O bound
+    const int scan_index = findStream(format_ctx);
+    if (scan_index < 0) {
+        avformat_close_input(&format_ctx);
+        return false;
+    }
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+        format_ctx->streams[i]->discard = (int)i == scan_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+
+    AVPacket* packet = av_packet_alloc();
+    bool finished = false;
+    while (packet && !stop_requested_) {
+        const int ret = av_read_frame(format_ctx, packet);
+        if (ret == AVERROR_EOF) {
+            finished = true;
+            break;
+        }
+        if (ret < 0) break;
+
+        if (packet->stream_index == scan_index) {
+            const int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+            if ((packet->flags & AV_PKT_FLAG_KEY) && packet->pos >= 0 && ts != AV_NOPTS_VALUE) {
+                QMutexLocker locker(&mutex_);
+                if (entries_.isEmpty() || ts > entries_.constLast().pts) {
+                    entries_.append({ts, packet->pos});
+                }
+            }
+        } else if (packet->stream_index < (int)format_ctx->nb_streams) {
+            // Streams discovered mid-file (MPEG-TS) are dropped from then on
+            format_ctx->streams[packet->stream_index]->discard = AVDISCARD_ALL;
+        }
+        av_packet_unref(packet);
+    }
+
+    av_packet_free(&packet);
+    avformat_close_input(&format_ctx);
+    return finished && keyframeCount() > 0;
+}
+
+int KeyframeIndexer::findStream(const AVFormatContext* format_ctx) const {
+    // Without stream probing, streams may be numbered differently than in the
+    // playback context: match the container's stream id, then fall back to the
+    // same position if the stream there is of the same kind
+    const auto matches = [this](const AVStream* stream) {
+        return stream->codecpar->codec_type == media_type_ &&
+               (codec_id_ == AV_CODEC_ID_NONE || stream->codecpar->codec_id == AV_CODEC_ID_NONE ||
+                stream->codecpar->codec_id == codec_id_);
+    };
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+        const AVStream* stream = format_ctx->streams[i];
+        if (stream_id_ != 0 && stream->id == stream_id_ && matches(stream)) return int(i);
+    }
+    if (stream_index_ < int(format_ctx->nb_streams) && matches(format_ctx->streams[stream_index_])) {
+        return stream_index_;
+    }
+    return -1;
+}
+
+bool KeyframeIndexer::loadCache(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0, version = 0;
+    qint32 stream_index = -1;
+    qint64 count = 0;
+    in >> magic >> version >> stream_index >> count;
+    if (in.status() != QDataStream::Ok || magic != kCacheMagic || version != kCacheVersion ||
+        stream_index != stream_index_ || count <= 0 || count > (qint64(1) << 24)) {
+        return false;
+    }
+
+    QVector<KeyframeEntry> entries(count);
+    const int bytes = int(count * qint64(sizeof(KeyframeEntry)));
+    if (in.readRawData(reinterpret_cast<char*>(entries.data()), bytes) != bytes) return false;
+
+    QMutexLocker locker(&mutex_);
+    entries_ = std::move(entries);
+    return true;
+}
+
+void KeyframeIndexer::saveCache(const QString& path) const {
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "KeyframeIndexer: cannot write cache" << path;
+        return;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    QMutexLocker locker(&mutex_);
+    out << kCacheMagic << kCacheVersion << qint32(stream_index_) << qint64(entries_.size());
+    out.writeRawData(reinterpret_cast<const char*>(entries_.constData()),
+                     int(entries_.size() * sizeof(KeyframeEntry)));
+}
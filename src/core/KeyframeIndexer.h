@@ -0,0 +1,67 @@
+#ifndef KEYFRAMEINDEXER_H
+#define KEYFRAMEINDEXER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <atomic>
+
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavcodec/codec_id.h>
+}
+
+struct AVFormatContext;
+struct AVStream;
+
+struct KeyframeEntry {
+    int64_t pts = 0; // stream time base
+    int64_t pos = 0; // byte offset of the packet in the file
+};
+
+// Builds a keyframe table (pts -> byte position) for one stream of a local file.
+// Only packet headers are read, on a private format context with every other
+// stream discarded, so the scan runs at I/O speed without decoding and does not
+// touch the playback context. Complete tables are cached on disk.
+class KeyframeIndexer : public QThread {
+    Q_OBJECT
+public:
+    explicit KeyframeIndexer(QObject *parent = nullptr);
+    ~KeyframeIndexer();
+
+    // The stream is one of the playback context's; the scan finds it again on its own
+    void index(const QString& filename, const AVStream* stream);
+    void cancel();
+
+    int streamIndex() const { return stream_index_; }
+    bool isComplete() const { return complete_; }
+    int keyframeCount() const;
+    // Latest keyframe at or before pts. Fails while pts lies past the part of
+    // the file scanned so far, since a closer keyframe may still follow.
+    bool lookup(int64_t pts, KeyframeEntry& entry) const;
+
+signals:
+    void indexReady(bool fromCache);
+
+protected:
+    void run() override;
+
+private:
+    bool scan();
+    int findStream(const AVFormatContext* format_ctx) const;
+    bool loadCache(const QString& path);
+    void saveCache(const QString& path) const;
+
+    QString file_name_;
+    int stream_index_ = -1;     // in the playback context
+    int stream_id_ = 0;         // container-level id, 0 when the format has none
+    AVMediaType media_type_ = AVMEDIA_TYPE_UNKNOWN;
+    AVCodecID codec_id_ = AV_CODEC_ID_NONE;
+    mutable QMutex mutex_;
+    QVector<KeyframeEntry> entries_;
+    std::atomic<bool> complete_{false};
+    std::atomic<bool> stop_requested_{false};
+};
+
+#endif // KEYFRAMEINDEXER_H
@@ -0,0 +1,40 @@
+#include "MediaCache.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QStandardPaths>
+
+namespace MediaCache {
+
+QString cacheDirectory(const QString& category)
+{
+    const QString base = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    QDir dir(base + QLatin1Char('/') + category);
+    if (!dir.exists()) {
+        dir.mkpath(QStringLiteral("."));
+    }
+    return dir.absolutePath();
+}
+
+QString fileIdentity(const QString& path)
+{
+    QFileInfo info(path);
+    if (!info.exists() || !info.isFile())
+        return QString();
+
+    QByteArray key = info.canonicalFilePath().toUtf8();
+    key.append('|').append(QByteArray::number(info.size()));
+    key.append('|').append(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+    return QString::fromLatin1(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex());
+}
+
+QString cacheFilePath(const QString& category, const QString& path, const QString& suffix)
+{
+    const QString id = fileIdentity(path);
+    if (id.isEmpty())
+        return QString();
+    return cacheDirectory(category) + QLatin1Char('/') + id + suffix;
+}
+
+}
@@ -0,0 +1,17 @@
+#ifndef MEDIACACHE_H
+#define MEDIACACHE_H
+
+#include <QString>
+
+// On-disk cache locations for data derived from media files (waveforms, indexes, ...).
+// Entries are keyed by file identity (canonical path, size and mtime) so that a
+// modified or replaced file never picks up stale data.
+namespace MediaCache {
+
+QString cacheDirectory(const QString& category);
+QString fileIdentity(const QString& path);
+QString cacheFilePath(const QString& category, const QString& path, const QString& suffix);
+
+}
+
+#endif // MEDIACACHE_H
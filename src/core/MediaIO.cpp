@@ -0,0 +1,357 @@
+#include "MediaIO.h"
+#include "ConfigManager.h"
+#include "MemoryBudget.h"
+#include <QFileInfo>
+#include <QStorageInfo>
+#include <QStringList>
+#include <QThread>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+namespace {
+constexpr int kAvioBufferSize = 256 * 1024;
+constexpr int kReadAheadChunk = 256 * 1024;
+constexpr int64_t kWillNeedBytes = 8 * 1024 * 1024;
+constexpr int64_t kMaxForwardSlack = 4 * 1024 * 1024;
+constexpr qint64 kMinReadAhead = 1024 * 1024;
+
+// Protocols that are plain byte streams and benefit from client-side read-ahead
+const QStringList& byteStreamProtocols() {
+    static const QStringList protocols = {
+        QStringLiteral("http"), QStringLiteral("https"), QStringLiteral("ftp"),
+        QStringLiteral("sftp"), QStringLiteral("smb")
+    };
+    return protocols;
+}
+
+// NFS, SMB/CIFS and similar mounts: mapped pages fault in over the network one
+// by one, so these are read through the read-ahead ring like remote URLs
+bool isNetworkFileSystem(const QString& path) {
+    if (path.startsWith(QLatin1String("//")) || path.startsWith(QLatin1String("\\\\")))
+        return true;    // UNC path
+    static const QStringList types = {
+        QStringLiteral("nfs"), QStringLiteral("nfs4"), QStringLiteral("cifs"), QStringLiteral("smb"),
+        QStringLiteral("smb2"), QStringLiteral("smb3"), QStringLiteral("smbfs"), QStringLiteral("afs"),
+        QStringLiteral("ceph"), QStringLiteral("9p"), QStringLiteral("fuse.sshfs"), QStringLiteral("webdav"),
+        QStringLiteral("davfs")
+    };
+    const QString type = QString::fromLatin1(QStorageInfo(path).fileSystemType()).toLower();
+    return types.contains(type);
+}
+}
+
+// ========== MediaIO ==========
+
+MediaIO::MediaIO() = default;
+
+MediaIO::~MediaIO() {
+    if (avio_) {
+        av_freep(&avio_->buffer);
+        avio_context_free(&avio_);
+    }
+}
+
+std::unique_ptr<MediaIO> MediaIO::create(const QString& url) {
+    ConfigManager& config = ConfigManager::instance();
+    // The ring is allocated up front, so it only gets what the memory budget can spare
+    const qint64 read_ahead = MemoryBudget::grant(
+        qint64(qBound(1, config.value(QStringLiteral("io/readAheadMB"), 32).toInt(), 1024)) * 1024 * 1024,
+        kMinReadAhead);
+
+    if (QFileInfo(url).isFile()) {
+        // "auto" (default: mmap, read-ahead on network filesystems), "mmap", "readahead" for
+        // HDD-backed archives, or "default" for FFmpeg's file protocol
+        const QString mode = config.value(QStringLiteral("io/localMode"), QStringLiteral("auto")).toString();
+        if (mode == QLatin1String("default"))
+            return nullptr;
+        if (mode == QLatin1String("mmap") || (mode == QLatin1String("auto") && !isNetworkFileSystem(url))) {
+            if (std::unique_ptr<MediaIO> io = MmapMediaIO::open(url))
+                return io;
+        }
+        return ReadAheadMediaIO::open(url, read_ahead);
+    }
+
+    const int separator = url.indexOf(QLatin1String("://"));
+    if (separator > 0 && byteStreamProtocols().contains(url.left(separator).toLower()))
+        return ReadAheadMediaIO::open(url, read_ahead);
+    return nullptr;
+}
+
+AVIOContext* MediaIO::avioContext() {
+    if (!avio_) {
+        unsigned char* buffer = static_cast<unsigned char*>(av_malloc(kAvioBufferSize));
+        if (!buffer) return nullptr;
+        avio_ = avio_alloc_context(buffer, kAvioBufferSize, 0, this, &MediaIO::readPacket, nullptr,
+                                   isSeekable() ? &MediaIO::seekPacket : nullptr);
+        if (!avio_) {
+            av_free(buffer);
+            return nullptr;
+        }
+        avio_->seekable = isSeekable() ? AVIO_SEEKABLE_NORMAL : 0;
+        since_open_.start();
+    }
+    return avio_;
+}
+
+IoStats MediaIO::stats() const {
+    IoStats stats;
+    stats.bytesRead = bytes_read_;
+    stats.readCalls = read_calls_;
+    stats.seeks = seeks_;
+    stats.stallMs = stall_us_ / 1000;
+    const qint64 elapsed = since_open_.isValid() ? since_open_.elapsed() : 0;
+    if (elapsed > 0) {
+        stats.throughputMBps = stats.bytesRead / (1024.0 * 1024.0) / (elapsed / 1000.0);
+    }
+    return stats;
+}
+
+int MediaIO::readPacket(void* opaque, uint8_t* buf, int size) {
+    MediaIO* io = static_cast<MediaIO*>(opaque);
+    const int n = io->read(buf, size);
+    io->read_calls_++;
+    if (n > 0) {
+        io->bytes_read_ += n;
+    }
+    return n;
+}
+
+int64_t MediaIO::seekPacket(void* opaque, int64_t offset, int whence) {
+    MediaIO* io = static_cast<MediaIO*>(opaque);
+    whence &= ~AVSEEK_FORCE;
+    if (whence == AVSEEK_SIZE) {
+        return io->size() >= 0 ? io->size() : AVERROR(ENOSYS);
+    }
+
+    int64_t target = 0;
+    switch (whence) {
+    case SEEK_SET:
+        target = offset;
+        break;
+    case SEEK_CUR:
+        target = io->position() + offset;
+        break;
+    case SEEK_END:
+        if (io->size() < 0) return AVERROR(ENOSYS);
+        target = io->size() + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    io->seeks_++;
+    return io->seekTo(target);
+}
+
+// ========== MmapMediaIO ==========
+
+MmapMediaIO::~MmapMediaIO() {
+    if (data_) {
+        file_.unmap(data_);
+    }
+}
+
+std::unique_ptr<MediaIO> MmapMediaIO::open(const QString& path) {
+    std::unique_ptr<MmapMediaIO> io(new MmapMediaIO());
+    io->file_.setFileName(path);
+    if (!io->file_.open(QIODevice::ReadOnly))
+        return nullptr;
+    io->size_ = io->file_.size();
+    if (io->size_ <= 0)
+        return nullptr;
+    io->data_ = io->file_.map(0, io->size_);
+    if (!io->data_)
+        return nullptr;
+#ifdef Q_OS_UNIX
+    madvise(io->data_, io->size_, MADV_SEQUENTIAL);
+#endif
+    io->adviseWindow(0);
+    return io;
+}
+
+int MmapMediaIO::read(uint8_t* buf, int size) {
+    const int64_t n = std::min<int64_t>(size, size_ - pos_);
+    if (n <= 0) return AVERROR_EOF;
+    std::memcpy(buf, data_ + pos_, n);
+    pos_ += n;
+    return (int)n;
+}
+
+int64_t MmapMediaIO::seekTo(int64_t offset) {
+    if (offset < 0 || offset > size_) return AVERROR(EINVAL);
+    pos_ = offset;
+    adviseWindow(offset);
+    return pos_;
+}
+
+void MmapMediaIO::adviseWindow(int64_t offset) {
+#ifdef Q_OS_UNIX
+    // Start paging in the data right after a seek instead of faulting it in page by page
+    static const int64_t page = sysconf(_SC_PAGESIZE);
+    const int64_t begin = offset / page * page;
+    const int64_t length = std::min(kWillNeedBytes, size_ - begin);
+    if (length > 0) {
+        madvise(data_ + begin, length, MADV_WILLNEED);
+    }
+#else
+    Q_UNUSED(offset);
+#endif
+}
+
+// ========== ReadAheadMediaIO ==========
+
+ReadAheadMediaIO::ReadAheadMediaIO(qint64 bufferBytes)
+    : buffer_(bufferBytes) {
+    MemoryBudget::charge(MemoryBudget::Caches, qint64(buffer_.size()));
+}
+
+ReadAheadMediaIO::~ReadAheadMediaIO() {
+    {
+        QMutexLocker locker(&mutex_);
+        stop_ = true;
+        space_available_.wakeAll();
+        data_available_.wakeAll();
+    }
+    if (thread_) {
+        thread_->wait();
+        delete thread_;
+    }
+    if (source_) {
+        avio_closep(&source_);
+    }
+    MemoryBudget::release(MemoryBudget::Caches, qint64(buffer_.size()));
+}
+
+std::unique_ptr<MediaIO> ReadAheadMediaIO::open(const QString& url, qint64 bufferBytes) {
+    std::unique_ptr<ReadAheadMediaIO> io(new ReadAheadMediaIO(bufferBytes));
+
+    // Lets a blocking network read be abandoned when the player closes the file
+    AVIOInterruptCB interrupt;
+    interrupt.callback = [](void* opaque) -> int {
+        return static_cast<ReadAheadMediaIO*>(opaque)->stop_ ? 1 : 0;
+    };
+    interrupt.opaque = io.get();
+
+    QByteArray url_utf8 = url.toUtf8();
+    if (avio_open2(&io->source_, url_utf8.constData(), AVIO_FLAG_READ, &interrupt, nullptr) < 0)
+        return nullptr;
+    io->size_ = avio_size(io->source_);
+    io->seekable_ = (io->source_->seekable & AVIO_SEEKABLE_NORMAL) != 0;
+
+    ReadAheadMediaIO* raw = io.get();
+    io->thread_ = QThread::create([raw]() { raw->fillLoop(); });
+    io->thread_->start();
+    return io;
+}
+
+int64_t ReadAheadMediaIO::position() const {
+    QMutexLocker locker(&mutex_);
+    return read_pos_;
+}
+
+int ReadAheadMediaIO::read(uint8_t* buf, int size) {
+    QMutexLocker locker(&mutex_);
+    QElapsedTimer stall;
+    while (read_pos_ >= window_start_ + window_len_) {
+        if (source_error_ < 0) return source_error_;
+        if (source_eof_ || stop_) return AVERROR_EOF;
+        if (!stall.isValid()) stall.start();
+        data_available_.wait(&mutex_);
+    }
+    if (stall.isValid()) {
+        stall_us_ += stall.nsecsElapsed() / 1000;
+    }
+
+    const int64_t capacity = buffer_.size();
+    const int n = (int)std::min<int64_t>(size, window_start_ + window_len_ - read_pos_);
+    const int64_t ring = read_pos_ % capacity;
+    const int first = (int)std::min<int64_t>(n, capacity - ring);
+    std::memcpy(buf, buffer_.data() + ring, first);
+    std::memcpy(buf + first, buffer_.data(), n - first);
+    read_pos_ += n;
+    space_available_.wakeOne();
+    return n;
+}
+
+int64_t ReadAheadMediaIO::seekTo(int64_t offset) {
+    if (offset < 0 || (size_ >= 0 && offset > size_)) return AVERROR(EINVAL);
+
+    QMutexLocker locker(&mutex_);
+    const int64_t slack = std::min<int64_t>(kMaxForwardSlack, buffer_.size() / 8);
+    const int64_t window_end = window_start_ + window_len_;
+    if (offset >= window_start_ && offset <= window_end + slack && source_error_ == 0) {
+        // Served from the buffer, or shortly by the running prefetch
+        read_pos_ = offset;
+        space_available_.wakeOne();
+        return offset;
+    }
+
+    // Far seek: drop the window and restart prefetching at the new offset
+    read_pos_ = offset;
+    window_start_ = offset;
+    window_len_ = 0;
+    generation_++;
+    restart_ = true;
+    source_eof_ = false;
+    source_error_ = 0;
+    space_available_.wakeOne();
+    return offset;
+}
+
+void ReadAheadMediaIO::fillLoop() {
+    const int64_t capacity = buffer_.size();
+    const int64_t keep_behind = capacity / 4;
+
+    QMutexLocker locker(&mutex_);
+    while (!stop_) {
+        // Recycle space well behind the reader, keeping some for short backward seeks
+        if (window_len_ == capacity) {
+            const int64_t evictable = std::min(window_len_, read_pos_ - window_start_ - keep_behind);
+            if (evictable > 0) {
+                window_start_ += evictable;
+                window_len_ -= evictable;
+            }
+        }
+        if (!restart_ && (window_len_ == capacity || source_eof_ || source_error_ < 0)) {
+            space_available_.wait(&mutex_);
+            continue;
+        }
+
+        const bool restart = restart_;
+        restart_ = false;
+        const quint64 generation = generation_;
+        const int64_t offset = window_start_ + window_len_;
+        const int64_t ring = offset % capacity;
+        const int to_read = (int)std::min<int64_t>({kReadAheadChunk, capacity - ring, capacity - window_len_});
+
+        // The region being filled lies beyond the window end, the reader never touches it
+        locker.unlock();
+        int n = 0;
+        if (restart && avio_seek(source_, offset, SEEK_SET) < 0) {
+            n = AVERROR(EIO);
+        } else {
+            n = avio_read(source_, buffer_.data() + ring, to_read);
+        }
+        locker.relock();
+
+        if (generation != generation_) continue;
+        if (n > 0) {
+            window_len_ += n;
+        } else if (n == 0 || n == AVERROR_EOF) {
+            source_eof_ = true;
+        } else if (!stop_) {
+            source_error_ = n;
+        }
+        data_available_.wakeAll();
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef MEDIAIO_H
+#define MEDIAIO_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+class QThread;
+
+struct IoStats {
+    qint64 bytesRead = 0;
+    qint64 readCalls = 0;
+    qint64 seeks = 0;
+    qint64 stallMs = 0;         // time readers spent waiting for data
+    qreal throughputMBps = 0.0; // bytesRead over the time since open
+};
+
+// Pluggable byte source behind a custom AVIOContext. create() picks the
+// implementation for a URL: memory-mapped local files, or an asynchronous
+// read-ahead buffer in front of FFmpeg's own protocols for remote/slow media
+// and for files on network filesystems.
+// It returns nullptr for packet-oriented protocols (RTSP, UDP, ...), which
+// keep using FFmpeg's default I/O.
+class MediaIO {
+public:
+    virtual ~MediaIO();
+
+    static std::unique_ptr<MediaIO> create(const QString& url);
+
+    AVIOContext* avioContext();
+    IoStats stats() const;
+
+protected:
+    MediaIO();
+
+    // AVERROR codes on failure, AVERROR_EOF at the end
+    virtual int read(uint8_t* buf, int size) = 0;
+    // Absolute offset; return the new position or a negative AVERROR
+    virtual int64_t seekTo(int64_t offset) = 0;
+    virtual int64_t size() const = 0;
+    virtual bool isSeekable() const { return true; }
+    virtual int64_t position() const = 0;
+
+    std::atomic<qint64> bytes_read_{0};
+    std::atomic<qint64> read_calls_{0};
+    std::atomic<qint64> seeks_{0};
+    std::atomic<qint64> stall_us_{0};
+
+private:
+    static int readPacket(void* opaque, uint8_t* buf, int size);
+    static int64_t seekPacket(void* opaque, int64_t offset, int whence);
+
+    AVIOContext* avio_ = nullptr;
+    QElapsedTimer since_open_;
+};
+
+// Whole local file mapped into memory; reads are plain copies and the kernel is
+// told the access pattern is sequential
+class MmapMediaIO : public MediaIO {
+public:
+    ~MmapMediaIO() override;
+    static std::unique_ptr<MediaIO> open(const QString& path);
+
+protected:
+    int read(uint8_t* buf, int size) override;
+    int64_t seekTo(int64_t offset) override;
+    int64_t size() const override { return size_; }
+    int64_t position() const override { return pos_; }
+
+private:
+    MmapMediaIO() = default;
+    void adviseWindow(int64_t offset);
+
+    QFile file_;
+    uchar* data_ = nullptr;
+    int64_t size_ = 0;
+    int64_t pos_ = 0;
+};
+
+// Large ring buffer filled by a background thread from an FFmpeg protocol.
+// Seeks inside the buffered window are free; seeks outside restart the
+// prefetch at the new offset.
+class ReadAheadMediaIO : public MediaIO {
+public:
+    ~ReadAheadMediaIO() override;
+    static std::unique_ptr<MediaIO> open(const QString& url, qint64 bufferBytes);
+
+protected:
+    int read(uint8_t* buf, int size) override;
+    int64_t seekTo(int64_t offset) override;
+    int64_t size() const override { return size_; }
+    bool isSeekable() const override { return seekable_; }
+    int64_t position() const override;
+
+private:
+    explicit ReadAheadMediaIO(qint64 bufferBytes);
+    void fillLoop();
+
+    AVIOContext* source_ = nullptr;
+    int64_t size_ = -1;
+    bool seekable_ = false;
+
+    std::vector<uint8_t> buffer_;
+    mutable QMutex mutex_;
+    QWaitCondition data_available_;
+    QWaitCondition space_available_;
+    int64_t read_pos_ = 0;     // consumer offset
+    int64_t window_start_ = 0; // oldest buffered offset
+    int64_t window_len_ = 0;   // buffered bytes from window_start_
+    quint64 generation_ = 0;   // bumped when the window is reset by a seek
+    bool restart_ = false;
+    bool source_eof_ = false;
+    int source_error_ = 0;
+    std::atomic<bool> stop_{false};
+    QThread* thread_ = nullptr;
+};
+
+#endif // MEDIAIO_H
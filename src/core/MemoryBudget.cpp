@@ -0,0 +1,112 @@
+#include "MemoryBudget.h"
+#include "ConfigManager.h"
+#include <QDebug>
+
+std::array<std::atomic<qint64>, MemoryBudget::CategoryCount> MemoryBudget::used_{};
+std::atomic<qint64> MemoryBudget::total_{0};
+std::atomic<qint64> MemoryBudget::peak_{0};
+std::atomic<qint64> MemoryBudget::budget_{-1};
+std::atomic<int> MemoryBudget::reported_pressure_{MemoryBudget::Normal};
+
+namespace {
+
+constexpr qint64 kMiB = 1024 * 1024;
+
+const char* pressureName(MemoryBudget::Pressure pressure) {
+    switch (pressure) {
+    case MemoryBudget::High: return "high";
+    case MemoryBudget::Critical: return "critical";
+    default: return "normal";
+    }
+}
+
+}
+
+void MemoryBudget::charge(Category category, qint64 bytes) {
+    if (bytes <= 0 || category >= CategoryCount) return;
+    used_[category].fetch_add(bytes, std::memory_order_relaxed);
+    const qint64 total = total_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    qint64 peak = peak_.load(std::memory_order_relaxed);
+    while (total > peak && !peak_.compare_exchange_weak(peak, total, std::memory_order_relaxed)) {}
+
+    if (budget() <= 0) return;
+    const int level = pressure();
+    if (level > reported_pressure_.exchange(level, std::memory_order_relaxed)) {
+        qWarning().nospace() << "MemoryBudget: " << total / kMiB << " of " << budget() / kMiB
+                             << " MiB in use, pressure " << pressureName(Pressure(level))
+                             << "; shrinking buffers";
+    }
+}
+
+void MemoryBudget::release(Category category, qint64 bytes) {
+    if (bytes <= 0 || category >= CategoryCount) return;
+    used_[category].fetch_sub(bytes, std::memory_order_relaxed);
+    total_.fetch_sub(bytes, std::memory_order_relaxed);
+    if (reported_pressure_.load(std::memory_order_relaxed) != Normal) {
+        reported_pressure_.store(pressure(), std::memory_order_relaxed);
+    }
+}
+
+qint64 MemoryBudget::used(Category category) {
+    return used_[category].load(std::memory_order_relaxed);
+}
+
+qint64 MemoryBudget::used() {
+    return total_.load(std::memory_order_relaxed);
+}
+
+qint64 MemoryBudget::peak() {
+    return peak_.load(std::memory_order_relaxed);
+}
+
+qint64 MemoryBudget::budget() {
+    qint64 budget = budget_.load(std::memory_order_relaxed);
+    if (budget < 0) {
+        budget = qMax<qint64>(0, ConfigManager::instance().value(QStringLiteral("memory/budgetMB"), 0).toLongLong()) * kMiB;
+        budget_.store(budget, std::memory_order_relaxed);
+    }
+    return budget;
+}
+
+void MemoryBudget::setBudget(qint64 bytes) {
+    budget_.store(qMax<qint64>(0, bytes), std::memory_order_relaxed);
+    reported_pressure_.store(pressure(), std::memory_order_relaxed);
+}
+
+MemoryBudget::Pressure MemoryBudget::pressure() {
+    const qint64 budget = MemoryBudget::budget();
+    if (budget <= 0) return Normal;
+    const qint64 used = total_.load(std::memory_order_relaxed);
+    if (used >= budget / 10 * 9) return Critical;
+    if (used >= budget / 4 * 3) return High;
+    return Normal;
+}
+
+qint64 MemoryBudget::scaled(qint64 value) {
+    switch (pressure()) {
+    case High: return value / 2;
+    case Critical: return value / 4;
+    default: return value;
+    }
+}
+
+qint64 MemoryBudget::grant(qint64 wanted, qint64 minimum) {
+    const qint64 budget = MemoryBudget::budget();
+    if (budget <= 0) return wanted;
+    const qint64 headroom = budget / 4 * 3 - used();
+    return qMin(wanted, qMax(minimum, headroom));
+}
+
+QVariantMap MemoryBudget::snapshot() {
+    QVariantMap map;
+    map.insert(QStringLiteral("packets"), used(Packets));
+    map.insert(QStringLiteral("videoFrames"), used(VideoFrames));
+    map.insert(QStringLiteral("audioFrames"), used(AudioFrames));
+    map.insert(QStringLiteral("textures"), used(Textures));
+    map.insert(QStringLiteral("caches"), used(Caches));
+    map.insert(QStringLiteral("total"), used());
+    map.insert(QStringLiteral("peak"), peak());
+    map.insert(QStringLiteral("budget"), budget());
+    map.insert(QStringLiteral("pressure"), QString::fromLatin1(pressureName(pressure())));
+    return map;
+}
@@ -0,0 +1,63 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QVariantMap>
+#include <QtGlobal>
+#include <array>
+#include <atomic>
+
+// Process-wide accounting of the large allocations behind playback, shared by all
+// players in the process. Packets and decoded frames are charged while they wait
+// in the pipeline queues (ThreadSafeQueue::setSizer()) or the demuxer's overflow;
+// GL textures and caches are charged by their owners.
+//
+// "memory/budgetMB" sets the budget (0, the default, is unlimited). Consumers that
+// trade memory for read-ahead size themselves through scaled() and grant(): as
+// usage approaches the budget, demux targets, read-ahead rings and caches shrink,
+// so the player runs with shallower buffers instead of running out of memory.
+class MemoryBudget {
+public:
+    enum Category {
+        Packets,
+        VideoFrames,
+        AudioFrames,
+        Textures,
+        Caches,
+        CategoryCount
+    };
+
+    enum Pressure {
+        Normal,
+        High,       // above 75% of the budget
+        Critical    // above 90%
+    };
+
+    // CategoryCount charges nothing, for owners that account only optionally
+    static void charge(Category category, qint64 bytes);
+    static void release(Category category, qint64 bytes);
+
+    static qint64 used(Category category);
+    static qint64 used();
+    static qint64 peak();
+    // Bytes, 0 when unlimited; read from the settings on first use
+    static qint64 budget();
+    static void setBudget(qint64 bytes);
+    static Pressure pressure();
+
+    // value at Normal pressure, half of it at High and a quarter at Critical
+    static qint64 scaled(qint64 value);
+    // wanted, reduced to what fits below the High threshold, but at least minimum
+    static qint64 grant(qint64 wanted, qint64 minimum);
+
+    // Per-category bytes, totals and pressure for the statistics overlay
+    static QVariantMap snapshot();
+
+private:
+    static std::array<std::atomic<qint64>, CategoryCount> used_;
+    static std::atomic<qint64> total_;
+    static std::atomic<qint64> peak_;
+    static std::atomic<qint64> budget_;
+    static std::atomic<int> reported_pressure_;
+};
+
+#endif // MEMORYBUDGET_H
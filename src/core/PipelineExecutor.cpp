@@ -0,0 +1,226 @@
+#include "PipelineExecutor.h"
+#include "ConfigManager.h"
+#include "PipelineStage.h"
+#include "Trace.h"
+#include <QDeadlineTimer>
+#include <algorithm>
+#include <limits>
+
+namespace {
+constexpr qint64 kNoDeadline = std::numeric_limits<qint64>::max();
+constexpr qint64 kMaxIdleWaitMs = 50;
+}
+
+PipelineExecutor& PipelineExecutor::instance() {
+    static PipelineExecutor executor(ConfigManager::instance().value(QStringLiteral("pipeline/threads"), 0).toInt());
+    return executor;
+}
+
+PipelineExecutor::PipelineExecutor(int threadCount)
+    : next_deadline_(kNoDeadline) {
+    const int count = threadCount > 0 ? threadCount : qMax(1, QThread::idealThreadCount());
+    clock_.start();
+    for (int i = 0; i < count; i++) {
+        queues_.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (int i = 0; i < count; i++) {
+        std::unique_ptr<QThread> worker(QThread::create([this, i]() { workerLoop(i); }));
+        worker->setObjectName(QStringLiteral("PipelineWorker%1").arg(i));
+        worker->start();
+        workers_.push_back(std::move(worker));
+    }
+}
+
+PipelineExecutor::~PipelineExecutor() {
+    shutdown_ = true;
+    {
+        QMutexLocker locker(&idle_mutex_);
+        work_available_.wakeAll();
+    }
+    for (auto& worker : workers_) {
+        worker->wait();
+    }
+}
+
+PipelineExecutor::Band PipelineExecutor::bandOf(const PipelineStage* stage) {
+    return stage->priority() > 0 ? High : Normal;
+}
+
+void PipelineExecutor::submit(PipelineStage* stage) {
+    QMutexLocker locker(&state_mutex_);
+    if (stage->sched_state_ != PipelineStage::Idle) return;
+    stage->sched_state_ = PipelineStage::Queued;
+    // New stages are spread over the workers; stealing evens out the rest
+    enqueue(next_queue_.fetch_add(1) % int(queues_.size()), stage);
+}
+
+void PipelineExecutor::finish(PipelineStage* stage) {
+    QMutexLocker locker(&state_mutex_);
+    bool sleeping = false;
+    {
+        QMutexLocker timer_locker(&timer_mutex_);
+        for (auto it = timers_.begin(); it != timers_.end();) {
+            if (it->second == stage) {
+                it = timers_.erase(it);
+                sleeping = true;
+            } else {
+                ++it;
+            }
+        }
+        next_deadline_ = timers_.empty() ? kNoDeadline : timers_.begin()->first;
+    }
+    if (sleeping) {
+        enqueue(next_queue_.fetch_add(1) % int(queues_.size()), stage);
+    }
+
+    while (stage->sched_state_ != PipelineStage::Idle) {
+        step_finished_.wait(&state_mutex_);
+    }
+}
+
+void PipelineExecutor::remove(PipelineStage* stage) {
+    QMutexLocker locker(&state_mutex_);
+    stage->removing_ = true;
+
+    // Purge first: a worker that already took the stage has marked it Running
+    // under the queue lock, so it is waited for below
+    for (auto& queue : queues_) {
+        QMutexLocker queue_locker(&queue->mutex);
+        for (auto& band : queue->bands) {
+            const auto it = std::remove(band.begin(), band.end(), stage);
+            queued_ -= int(band.end() - it);
+            band.erase(it, band.end());
+        }
+    }
+    {
+        QMutexLocker timer_locker(&timer_mutex_);
+        for (auto it = timers_.begin(); it != timers_.end();) {
+            it = it->second == stage ? timers_.erase(it) : std::next(it);
+        }
+        next_deadline_ = timers_.empty() ? kNoDeadline : timers_.begin()->first;
+    }
+
+    while (stage->sched_state_ == PipelineStage::Running) {
+        step_finished_.wait(&state_mutex_);
+    }
+    stage->sched_state_ = PipelineStage::Idle;
+    stage->removing_ = false;
+}
+
+void PipelineExecutor::workerLoop(int index) {
+    TRACE_THREAD_NAME("PipelineExecutor worker");
+    while (!shutdown_) {
+        PipelineStage* stage = take(index);
+        if (!stage) {
+            waitForWork();
+            continue;
+        }
+        PipelineStep step;
+        {
+            // One span per step, so the stages sharing a worker can be told apart
+            TRACE_SCOPE("pipeline", stage->metaObject()->className());
+            step = stage->runStep();
+        }
+        steps_++;
+        finishStep(index, stage, step);
+    }
+}
+
+PipelineStage* PipelineExecutor::take(int index) {
+    // Presentation deadlines first, then the priority band, each from the own
+    // queue before stealing
+    if (PipelineStage* stage = takeDue()) return stage;
+    for (Band band : {High, Normal}) {
+        if (PipelineStage* stage = takeFrom(index, band, false)) return stage;
+        if (PipelineStage* stage = takeFrom(index, band, true)) return stage;
+    }
+    return nullptr;
+}
+
+PipelineStage* PipelineExecutor::takeFrom(int index, Band band, bool steal) {
+    if (queued_ <= 0) return nullptr;
+    const int count = int(queues_.size());
+    for (int offset = steal ? 1 : 0; offset < (steal ? count : 1); offset++) {
+        WorkerQueue& queue = *queues_[(index + offset) % count];
+        QMutexLocker locker(&queue.mutex);
+        std::deque<PipelineStage*>& ready = queue.bands[band];
+        if (ready.empty()) continue;
+        // Owners take the oldest entry (round robin), thieves the newest
+        PipelineStage* stage = steal ? ready.back() : ready.front();
+        if (steal) ready.pop_back(); else ready.pop_front();
+        queued_--;
+        stage->sched_state_ = PipelineStage::Running;
+        if (steal) steals_++;
+        return stage;
+    }
+    return nullptr;
+}
+
+PipelineStage* PipelineExecutor::takeDue() {
+    const qint64 now = clock_.elapsed();
+    if (next_deadline_ > now) return nullptr;
+
+    QMutexLocker locker(&timer_mutex_);
+    if (timers_.empty() || timers_.begin()->first > now) {
+        next_deadline_ = timers_.empty() ? kNoDeadline : timers_.begin()->first;
+        return nullptr;
+    }
+    PipelineStage* stage = timers_.begin()->second;
+    timers_.erase(timers_.begin());
+    next_deadline_ = timers_.empty() ? kNoDeadline : timers_.begin()->first;
+    stage->sched_state_ = PipelineStage::Running;
+    return stage;
+}
+
+void PipelineExecutor::finishStep(int index, PipelineStage* stage, const PipelineStep& step) {
+    QMutexLocker locker(&state_mutex_);
+    if (stage->removing_ || step.kind == PipelineStep::Done) {
+        stage->sched_state_ = PipelineStage::Idle;
+        step_finished_.wakeAll();
+        return;
+    }
+
+    stage->sched_state_ = PipelineStage::Queued;
+    // A pool worker never blocks on one stage's input, so waiting is polling here
+    if (step.kind == PipelineStep::Sleep || step.kind == PipelineStep::Wait) {
+        const qint64 deadline = clock_.elapsed() + step.sleepMs;
+        bool earliest = false;
+        {
+            QMutexLocker timer_locker(&timer_mutex_);
+            timers_.emplace(deadline, stage);
+            if (deadline < next_deadline_) {
+                next_deadline_ = deadline;
+                earliest = true;
+            }
+        }
+        // Idle workers sleep until the earliest deadline; let one of them recompute
+        if (earliest) notifyWork();
+    } else {
+        // Back to the worker that ran it: its data is still in that core's caches
+        enqueue(index, stage);
+    }
+}
+
+void PipelineExecutor::enqueue(int index, PipelineStage* stage) {
+    {
+        WorkerQueue& queue = *queues_[index];
+        QMutexLocker locker(&queue.mutex);
+        queue.bands[bandOf(stage)].push_back(stage);
+        queued_++;
+    }
+    notifyWork();
+}
+
+void PipelineExecutor::waitForWork() {
+    QMutexLocker locker(&idle_mutex_);
+    if (shutdown_ || queued_ > 0) return;
+    const qint64 now = clock_.elapsed();
+    const qint64 deadline = next_deadline_;
+    if (deadline <= now) return;
+    work_available_.wait(&idle_mutex_, QDeadlineTimer(qMin(deadline - now, kMaxIdleWaitMs)));
+}
+
+void PipelineExecutor::notifyWork() {
+    QMutexLocker locker(&idle_mutex_);
+    work_available_.wakeOne();
+}
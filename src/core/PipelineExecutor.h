@@ -0,0 +1,84 @@
+#ifndef PIPELINEEXECUTOR_H
+#define PIPELINEEXECUTOR_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+
+class PipelineStage;
+struct PipelineStep;
+
+// Shared pool running the steps of many PipelineStages, for layouts with many
+// players (mosaics, monitoring walls) that would otherwise start several threads
+// per item. One worker per core by default ("pipeline/threads" overrides).
+//
+// Each worker has its own ready queue; a stage that wants to continue goes back
+// to the queue of the worker that ran it, and idle workers steal from the others.
+// Stages are re-queued after every step, so items get turns round robin. Stages
+// with a positive priority have a band of their own that is always served first.
+// Sleeping stages wait in a deadline-ordered timer list.
+class PipelineExecutor {
+public:
+    static PipelineExecutor& instance();
+
+    explicit PipelineExecutor(int threadCount = 0);
+    ~PipelineExecutor();
+
+    int threadCount() const { return int(workers_.size()); }
+    qint64 stepCount() const { return steps_; }
+    qint64 stealCount() const { return steals_; }
+
+    void submit(PipelineStage* stage);
+    // Waits for a stage that was asked to stop to return its last step; a sleeping
+    // stage is run right away. Its end() runs on the worker of that step.
+    void finish(PipelineStage* stage);
+    // Takes the stage off the pool; waits while one of its steps is running
+    void remove(PipelineStage* stage);
+
+private:
+    enum Band { High, Normal, BandCount };
+
+    struct WorkerQueue {
+        QMutex mutex;
+        std::deque<PipelineStage*> bands[BandCount];
+    };
+
+    void workerLoop(int index);
+    PipelineStage* take(int index);
+    PipelineStage* takeFrom(int index, Band band, bool steal);
+    PipelineStage* takeDue();
+    void finishStep(int index, PipelineStage* stage, const PipelineStep& step);
+    void enqueue(int index, PipelineStage* stage);
+    void waitForWork();
+    void notifyWork();
+    static Band bandOf(const PipelineStage* stage);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::unique_ptr<QThread>> workers_;
+    std::atomic<int> next_queue_{0};
+    std::atomic<int> queued_{0};
+    std::atomic<bool> shutdown_{false};
+
+    QElapsedTimer clock_;
+    QMutex timer_mutex_;
+    std::multimap<qint64, PipelineStage*> timers_;  // wake-up time on clock_
+    std::atomic<qint64> next_deadline_;
+
+    // Scheduling state transitions of the stages; ordered before queue and timer locks
+    QMutex state_mutex_;
+    QWaitCondition step_finished_;
+
+    QMutex idle_mutex_;
+    QWaitCondition work_available_;
+
+    std::atomic<qint64> steps_{0};
+    std::atomic<qint64> steals_{0};
+};
+
+#endif // PIPELINEEXECUTOR_H
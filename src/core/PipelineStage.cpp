@@ -0,0 +1,80 @@
+#include "PipelineStage.h"
+#include "PipelineExecutor.h"
+#include "Trace.h"
+
+namespace {
+// Bounds a blocking wait, so flags set without waking the stage (pause, flush) are still seen
+constexpr int kMaxWaitMs = 50;
+}
+
+PipelineStage::PipelineStage(QObject *parent)
+    : QObject(parent) {}
+
+PipelineStage::~PipelineStage() {
+    // Subclasses stop and wait in their own destructors; this only guards against a
+    // pool worker or the thread touching a half-destroyed object
+    if (executor_) {
+        executor_->remove(this);
+    }
+    if (thread_) {
+        thread_->wait();
+    }
+}
+
+void PipelineStage::start() {
+    if (isRunning()) return;
+    if (executor_) {
+        executor_->submit(this);
+        return;
+    }
+    // A thread made by QThread::create() runs its function once, so every start gets a new one
+    thread_.reset(QThread::create([this]() { runThread(); }));
+    thread_->setObjectName(QString::fromLatin1(metaObject()->className()));
+    thread_->start();
+}
+
+bool PipelineStage::isRunning() const {
+    return (thread_ && thread_->isRunning()) || sched_state_ != Idle;
+}
+
+bool PipelineStage::wait() {
+    if (thread_ && thread_->isRunning()) {
+        return thread_->wait();
+    }
+    if (executor_) {
+        executor_->finish(this);
+    }
+    return true;
+}
+
+PipelineStep PipelineStage::runStep() {
+    if (!begun_) {
+        if (!begin()) return PipelineStep::done();
+        begun_ = true;
+    }
+    const PipelineStep result = step();
+    if (result.kind == PipelineStep::Done) {
+        finishSteps();
+    }
+    return result;
+}
+
+void PipelineStage::finishSteps() {
+    if (begun_) {
+        begun_ = false;
+        end();
+    }
+}
+
+void PipelineStage::runThread() {
+    TRACE_THREAD_NAME(metaObject()->className());
+    for (;;) {
+        const PipelineStep result = runStep();
+        if (result.kind == PipelineStep::Done) break;
+        if (result.kind == PipelineStep::Sleep) {
+            QThread::msleep(result.sleepMs);
+        } else if (result.kind == PipelineStep::Wait && !waitForWork(kMaxWaitMs)) {
+            QThread::msleep(result.sleepMs);
+        }
+    }
+}
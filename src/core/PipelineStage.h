@@ -0,0 +1,74 @@
+#ifndef PIPELINESTAGE_H
+#define PIPELINESTAGE_H
+
+#include <QObject>
+#include <QThread>
+#include <atomic>
+#include <memory>
+
+class PipelineExecutor;
+
+// Outcome of one PipelineStage::step(): run again right away, run again after
+// a delay (waiting for a presentation time), wait for input, or stop.
+struct PipelineStep {
+    enum Kind { Again, Sleep, Wait, Done };
+    Kind kind = Again;
+    int sleepMs = 0;
+
+    static PipelineStep again() { return {Again, 0}; }
+    static PipelineStep sleep(qint64 ms) { return {Sleep, int(qBound<qint64>(1, ms, 1000))}; }
+    // Nothing to do until input arrives or output drains: a dedicated thread
+    // blocks in PipelineStage::waitForWork(), a shared pool polls after pollMs
+    static PipelineStep wait(qint64 pollMs) { return {Wait, int(qBound<qint64>(1, pollMs, 1000))}; }
+    static PipelineStep done() { return {Done, 0}; }
+};
+
+// Demux and decode work split into short, non-blocking steps. A stage either
+// runs its steps on a thread of its own (the default) or, with an executor set,
+// as a task on a shared pool; start(), isRunning() and wait() cover both modes.
+class PipelineStage : public QObject {
+    Q_OBJECT
+public:
+    explicit PipelineStage(QObject *parent = nullptr);
+    ~PipelineStage() override;
+
+    // Takes effect at the next start(); nullptr means a dedicated thread
+    void setExecutor(PipelineExecutor* executor) { executor_ = executor; }
+    PipelineExecutor* executor() const { return executor_; }
+    // Higher runs first on a shared pool, e.g. the focused tile of a mosaic
+    void setPriority(int priority) { priority_ = priority; }
+    int priority() const { return priority_; }
+
+    void start();
+    bool isRunning() const;
+    // Returns once the last step and end() have run; call after the stage was asked to stop
+    bool wait();
+
+protected:
+    // Called once before the first step and after the last one, on the thread running the steps
+    virtual bool begin() { return true; }
+    virtual void end() {}
+    virtual PipelineStep step() = 0;
+    // After a Wait step on a dedicated thread: block until there may be work, at
+    // most timeoutMs. False when the stage cannot block; the poll interval is slept.
+    virtual bool waitForWork(int timeoutMs) { Q_UNUSED(timeoutMs); return false; }
+
+private:
+    friend class PipelineExecutor;
+    enum SchedState { Idle, Queued, Running };
+
+    PipelineStep runStep();
+    void finishSteps();
+    void runThread();
+
+    PipelineExecutor* executor_ = nullptr;
+    std::unique_ptr<QThread> thread_;   // without an executor
+    std::atomic<int> priority_{0};
+    bool begun_ = false;
+
+    // Owned by PipelineExecutor
+    std::atomic<int> sched_state_{Idle};
+    bool removing_ = false;
+};
+
+#endif // PIPELINESTAGE_H
@@ -0,0 +1,152 @@
+#include "PlayerStats.h"
+#include "ConfigManager.h"
+#include "MemoryBudget.h"
+#include "Trace.h"
+#include <QTimer>
+#include <QtAlgorithms>
+
+int StatsHistogram::bucketOf(qint64 us) {
+    if (us < 4) return int(qMax<qint64>(0, us));
+    // Four sub-buckets per power of two: the two bits below the leading one
+    const int msb = 63 - qCountLeadingZeroBits(quint64(us));
+    const int sub = int(us >> (msb - 2)) & 3;
+    return qMin(kBuckets - 1, msb * 4 + sub - 4);
+}
+
+qint64 StatsHistogram::bucketValue(int bucket) {
+    if (bucket < 4) return bucket;
+    const int msb = (bucket + 4) / 4;
+    const int sub = (bucket + 4) % 4;
+    return qint64(4 + sub) << (msb - 2);
+}
+
+void StatsHistogram::record(qint64 us) {
+    buckets_[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    sum_us_.fetch_add(us, std::memory_order_relaxed);
+    qint64 max = max_us_.load(std::memory_order_relaxed);
+    while (us > max && !max_us_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+}
+
+StatsHistogram::Summary StatsHistogram::take() {
+    std::array<qint64, kBuckets> counts;
+    Summary summary;
+    for (int i = 0; i < kBuckets; i++) {
+        counts[i] = buckets_[i].exchange(0, std::memory_order_relaxed);
+        summary.count += counts[i];
+    }
+    const qint64 sum = sum_us_.exchange(0, std::memory_order_relaxed);
+    const qint64 max = max_us_.exchange(0, std::memory_order_relaxed);
+    if (summary.count == 0) return summary;
+
+    summary.averageMs = sum / 1000.0 / summary.count;
+    summary.maxMs = max / 1000.0;
+    const qint64 p50_rank = (summary.count + 1) / 2;
+    const qint64 p95_rank = (summary.count * 95 + 99) / 100;
+    qint64 seen = 0;
+    for (int i = 0; i < kBuckets; i++) {
+        if (counts[i] == 0) continue;
+        const qint64 before = seen;
+        seen += counts[i];
+        if (before < p50_rank && seen >= p50_rank) summary.p50Ms = bucketValue(i) / 1000.0;
+        if (before < p95_rank && seen >= p95_rank) summary.p95Ms = bucketValue(i) / 1000.0;
+    }
+    return summary;
+}
+
+PlayerStats::PlayerStats(QObject *parent)
+    : QObject(parent)
+    , timer_(new QTimer(this)) {
+    interval_ms_ = qBound(50, ConfigManager::instance().value(QStringLiteral("stats/intervalMs"), 500).toInt(), 10000);
+    timer_->setInterval(interval_ms_);
+    connect(timer_, &QTimer::timeout, this, &PlayerStats::sample);
+    latency_clock_.start();
+}
+
+void PlayerStats::setActive(bool active) {
+    if (active_ == active) return;
+    active_ = active;
+    if (active_) {
+        // Drop what piled up while nobody was looking
+        decode_time_.take();
+        upload_time_.take();
+        render_time_.take();
+        timer_->start();
+    } else {
+        timer_->stop();
+    }
+    emit activeChanged();
+}
+
+void PlayerStats::setInterval(int ms) {
+    ms = qBound(50, ms, 10000);
+    if (interval_ms_ == ms) return;
+    interval_ms_ = ms;
+    timer_->setInterval(ms);
+    emit intervalChanged();
+}
+
+void PlayerStats::beginLatency(LatencyKind kind, quint64 minSerial) {
+    if (kind == OpenLatency) first_frame_latency_ms_ = -1.0;
+    latency_start_ns_.store(-1);
+    latency_kind_.store(kind);
+    latency_serial_.store(minSerial);
+    latency_start_ns_.store(latency_clock_.nsecsElapsed());
+}
+
+void PlayerStats::recordFramePresented(quint64 serial) {
+    qint64 start = latency_start_ns_.load();
+    if (start < 0 || serial < latency_serial_.load()) return;
+    if (!latency_start_ns_.compare_exchange_strong(start, -1)) return;
+    const qreal ms = (latency_clock_.nsecsElapsed() - start) / 1e6;
+    const LatencyKind kind = LatencyKind(latency_kind_.load());
+    if (kind == OpenLatency) {
+        first_frame_latency_ms_ = ms;
+        TRACE_COUNTER("latency", "first frame ms", ms);
+    } else {
+        seek_latency_ms_ = ms;
+        TRACE_COUNTER("latency", "seek ms", ms);
+    }
+    emit latencyMeasured(kind, ms);
+}
+
+void PlayerStats::reset() {
+    frames_decoded_ = 0;
+    dropped_frames_ = 0;
+    late_frames_ = 0;
+    audio_underruns_ = 0;
+    av_offset_ms_ = 0.0;
+    seek_latency_ms_ = -1.0;
+    decode_time_.take();
+    upload_time_.take();
+    render_time_.take();
+}
+
+void PlayerStats::setQueue(const QString& name, qint64 depth, qint64 capacity, qint64 bytes) {
+    QVariantMap queue;
+    queue.insert(QStringLiteral("name"), name);
+    queue.insert(QStringLiteral("depth"), depth);
+    queue.insert(QStringLiteral("capacity"), capacity);
+    queue.insert(QStringLiteral("bytes"), bytes);
+    pending_queues_.append(queue);
+}
+
+void PlayerStats::sample() {
+    pending_queues_.clear();
+    emit aboutToSample();
+    queues_ = pending_queues_;
+    decode_summary_ = toMap(decode_time_.take());
+    upload_summary_ = toMap(upload_time_.take());
+    render_summary_ = toMap(render_time_.take());
+    memory_ = MemoryBudget::snapshot();
+    emit updated();
+}
+
+QVariantMap PlayerStats::toMap(const StatsHistogram::Summary& summary) {
+    QVariantMap map;
+    map.insert(QStringLiteral("count"), summary.count);
+    map.insert(QStringLiteral("average"), summary.averageMs);
+    map.insert(QStringLiteral("p50"), summary.p50Ms);
+    map.insert(QStringLiteral("p95"), summary.p95Ms);
+    map.insert(QStringLiteral("max"), summary.maxMs);
+    return map;
+}
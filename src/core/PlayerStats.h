@@ -0,0 +1,160 @@
+#ifndef PLAYERSTATS_H
+#define PLAYERSTATS_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QVariantList>
+#include <QVariantMap>
+#include <array>
+#include <atomic>
+
+class QTimer;
+
+// Latency histogram for hot paths: record() is a few relaxed atomic adds, no
+// locks and no allocation. Buckets are quarter octaves of microseconds, so
+// percentiles are accurate to about 20%. take() empties the histogram, so each
+// summary covers one sampling interval.
+class StatsHistogram {
+public:
+    struct Summary {
+        qint64 count = 0;
+        qreal averageMs = 0.0;
+        qreal p50Ms = 0.0;
+        qreal p95Ms = 0.0;
+        qreal maxMs = 0.0;
+    };
+
+    void record(qint64 us);
+    Summary take();
+
+private:
+    static constexpr int kBuckets = 100;
+    static int bucketOf(qint64 us);
+    static qint64 bucketValue(int bucket);
+
+    std::array<std::atomic<qint64>, kBuckets> buckets_{};
+    std::atomic<qint64> sum_us_{0};
+    std::atomic<qint64> max_us_{0};
+};
+
+// Pipeline statistics for diagnosing playback problems in the field. Stages
+// record into lock-free counters and histograms as they run; while active,
+// the GUI thread samples them at "stats/intervalMs" and publishes the result
+// to QML. Queue depths are gauges read at sampling time by whoever listens to
+// aboutToSample().
+class PlayerStats : public QObject {
+    Q_OBJECT
+    Q_PROPERTY(bool active READ isActive WRITE setActive NOTIFY activeChanged)
+    Q_PROPERTY(int interval READ interval WRITE setInterval NOTIFY intervalChanged)
+    Q_PROPERTY(QVariantList queues READ queues NOTIFY updated)
+    Q_PROPERTY(QVariantMap decodeTime READ decodeTime NOTIFY updated)
+    Q_PROPERTY(QVariantMap uploadTime READ uploadTime NOTIFY updated)
+    Q_PROPERTY(QVariantMap renderTime READ renderTime NOTIFY updated)
+    Q_PROPERTY(qint64 framesDecoded READ framesDecoded NOTIFY updated)
+    Q_PROPERTY(qint64 droppedFrames READ droppedFrames NOTIFY updated)
+    Q_PROPERTY(qint64 lateFrames READ lateFrames NOTIFY updated)
+    Q_PROPERTY(qint64 audioUnderruns READ audioUnderruns NOTIFY updated)
+    Q_PROPERTY(qreal avOffset READ avOffset NOTIFY updated)
+    Q_PROPERTY(QVariantMap demux READ demux NOTIFY updated)
+    Q_PROPERTY(QVariantMap memory READ memory NOTIFY updated)
+    Q_PROPERTY(qreal seekLatency READ seekLatency NOTIFY updated)
+    Q_PROPERTY(qreal firstFrameLatency READ firstFrameLatency NOTIFY updated)
+
+public:
+    enum LatencyKind {
+        SeekLatency,    // seek() to the first frame from the new position
+        OpenLatency     // setting a source to its first frame
+    };
+    Q_ENUM(LatencyKind)
+
+    explicit PlayerStats(QObject *parent = nullptr);
+
+    bool isActive() const { return active_; }
+    void setActive(bool active);
+    int interval() const { return interval_ms_; }
+    void setInterval(int ms);
+
+    // Hot paths, any thread
+    void recordDecodeTime(qint64 us) { decode_time_.record(us); frames_decoded_.fetch_add(1, std::memory_order_relaxed); }
+    void recordUploadTime(qint64 us) { upload_time_.record(us); }
+    void recordRenderTime(qint64 us) { render_time_.record(us); }
+    void addDroppedFrames(qint64 count) { dropped_frames_.fetch_add(count, std::memory_order_relaxed); }
+    void addLateFrame() { late_frames_.fetch_add(1, std::memory_order_relaxed); }
+    void addAudioUnderrun() { audio_underruns_.fetch_add(1, std::memory_order_relaxed); }
+
+    // Responsiveness as the user sees it. beginLatency() on the GUI thread starts the
+    // clock; the first recordFramePresented() for a frame demuxed under a seek serial
+    // of at least minSerial stops it, so frames still on their way from before a seek
+    // do not count.
+    // A new request replaces one still waiting.
+    void beginLatency(LatencyKind kind, quint64 minSerial);
+    void recordFramePresented(quint64 serial);
+
+    // Counters restart with each opened source
+    void reset();
+
+    // Filled from aboutToSample()
+    void setQueue(const QString& name, qint64 depth, qint64 capacity, qint64 bytes);
+    void setAvOffset(qreal ms) { av_offset_ms_ = ms; }
+    void setDemux(const QVariantMap& demux) { demux_ = demux; }
+
+    QVariantList queues() const { return queues_; }
+    QVariantMap decodeTime() const { return decode_summary_; }
+    QVariantMap uploadTime() const { return upload_summary_; }
+    QVariantMap renderTime() const { return render_summary_; }
+    qint64 framesDecoded() const { return frames_decoded_; }
+    qint64 droppedFrames() const { return dropped_frames_; }
+    qint64 lateFrames() const { return late_frames_; }
+    qint64 audioUnderruns() const { return audio_underruns_; }
+    qreal avOffset() const { return av_offset_ms_; }
+    QVariantMap demux() const { return demux_; }
+    // Process-wide MemoryBudget::snapshot() at sampling time
+    QVariantMap memory() const { return memory_; }
+    // Most recent measurements in ms, -1 before the first
+    qreal seekLatency() const { return seek_latency_ms_.load(); }
+    qreal firstFrameLatency() const { return first_frame_latency_ms_.load(); }
+
+signals:
+    void activeChanged();
+    void intervalChanged();
+    // Emitted on the GUI thread right before a sample is published
+    void aboutToSample();
+    void updated();
+    // A seek or open completed; emitted from the render thread
+    void latencyMeasured(PlayerStats::LatencyKind kind, qreal ms);
+
+private:
+    void sample();
+    static QVariantMap toMap(const StatsHistogram::Summary& summary);
+
+    QTimer* timer_ = nullptr;
+    bool active_ = false;
+    int interval_ms_ = 500;
+
+    StatsHistogram decode_time_;
+    StatsHistogram upload_time_;
+    StatsHistogram render_time_;
+    std::atomic<qint64> frames_decoded_{0};
+    std::atomic<qint64> dropped_frames_{0};
+    std::atomic<qint64> late_frames_{0};
+    std::atomic<qint64> audio_underruns_{0};
+
+    QElapsedTimer latency_clock_;
+    std::atomic<qint64> latency_start_ns_{-1};  // -1: nothing being timed
+    std::atomic<int> latency_kind_{SeekLatency};
+    std::atomic<quint64> latency_serial_{0};
+    std::atomic<qreal> seek_latency_ms_{-1.0};
+    std::atomic<qreal> first_frame_latency_ms_{-1.0};
+
+    // Published on the GUI thread
+    QVariantList queues_;
+    QVariantList pending_queues_;
+    QVariantMap decode_summary_;
+    QVariantMap upload_summary_;
+    QVariantMap render_summary_;
+    QVariantMap demux_;
+    QVariantMap memory_;
+    qreal av_offset_ms_ = 0.0;
+};
+
+#endif // PLAYERSTATS_H
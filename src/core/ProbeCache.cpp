@@ -0,0 +1,225 @@
+#include "ProbeCache.h"
+#include "MediaCache.h"
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <cstring>
+
+extern "C" {
+#include <libavcodec/codec_par.h>
+#include <libavcodec/defs.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/mem.h>
+}
+
+namespace {
+constexpr quint32 kCacheMagic = 0x51505243; // "QPRC"
+constexpr quint32 kCacheVersion = 1;
+constexpr int kMaxStreams = 1024;
+constexpr int kMaxExtradata = 16 * 1024 * 1024;
+
+QString cachePath(const QString& path)
+{
+    return MediaCache::cacheFilePath(QStringLiteral("probe"), path, QStringLiteral(".probe"));
+}
+
+QDataStream& operator<<(QDataStream& out, const AVRational& r)
+{
+    return out << qint32(r.num) << qint32(r.den);
+}
+
+QDataStream& operator>>(QDataStream& in, AVRational& r)
+{
+    qint32 num = 0, den = 1;
+    in >> num >> den;
+    r = {num, den};
+    return in;
+}
+}
+
+bool ProbeCache::load(const QString& path)
+{
+    const QString cache_path = cachePath(path);
+    if (cache_path.isEmpty()) return false;
+    QFile file(cache_path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0, version = 0;
+    qint32 stream_count = 0;
+    in >> magic >> version;
+    if (magic != kCacheMagic || version != kCacheVersion) return false;
+
+    in >> format_name_ >> probe_size_ >> analyze_duration_us_ >> start_time_ >> duration_ >> bit_rate_
+       >> stream_count;
+    if (in.status() != QDataStream::Ok || stream_count <= 0 || stream_count > kMaxStreams) return false;
+
+    streams_.resize(stream_count);
+    for (StreamEntry& entry : streams_) {
+        readStream(in, entry);
+        if (entry.extradata.size() > kMaxExtradata) return false;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+const AVInputFormat* ProbeCache::inputFormat() const
+{
+    return format_name_.isEmpty() ? nullptr : av_find_input_format(format_name_.constData());
+}
+
+bool ProbeCache::apply(AVFormatContext* ctx) const
+{
+    // Streams are created by the container header; they must be exactly the ones
+    // that were probed, otherwise the entry describes some other layout
+    if (!ctx || streams_.isEmpty() || (int)ctx->nb_streams != streams_.size()) return false;
+    for (unsigned int i = 0; i < ctx->nb_streams; i++) {
+        const AVStream* stream = ctx->streams[i];
+        const StreamEntry& entry = streams_.at(i);
+        if (stream->codecpar->codec_type != entry.codecType || stream->codecpar->codec_id != entry.codecId ||
+            av_cmp_q(stream->time_base, entry.timeBase) != 0) {
+            return false;
+        }
+    }
+
+    for (unsigned int i = 0; i < ctx->nb_streams; i++) {
+        AVStream* stream = ctx->streams[i];
+        AVCodecParameters* par = stream->codecpar;
+        const StreamEntry& entry = streams_.at(i);
+
+        av_freep(&par->extradata);
+        par->extradata_size = 0;
+        if (!entry.extradata.isEmpty()) {
+            par->extradata = static_cast<uint8_t*>(av_mallocz(entry.extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+            if (par->extradata) {
+                std::memcpy(par->extradata, entry.extradata.constData(), entry.extradata.size());
+                par->extradata_size = entry.extradata.size();
+            }
+        }
+        par->codec_tag = entry.codecTag;
+        par->format = entry.format;
+        par->bit_rate = entry.bitRate;
+        par->bits_per_coded_sample = entry.bitsPerCodedSample;
+        par->bits_per_raw_sample = entry.bitsPerRawSample;
+        par->profile = entry.profile;
+        par->level = entry.level;
+        par->width = entry.width;
+        par->height = entry.height;
+        par->sample_aspect_ratio = entry.sampleAspectRatio;
+        par->field_order = static_cast<AVFieldOrder>(entry.fieldOrder);
+        par->color_range = static_cast<AVColorRange>(entry.colorRange);
+        par->color_primaries = static_cast<AVColorPrimaries>(entry.colorPrimaries);
+        par->color_trc = static_cast<AVColorTransferCharacteristic>(entry.colorTrc);
+        par->color_space = static_cast<AVColorSpace>(entry.colorSpace);
+        par->chroma_location = static_cast<AVChromaLocation>(entry.chromaLocation);
+        par->video_delay = entry.videoDelay;
+        av_channel_layout_uninit(&par->ch_layout);
+        if (entry.channelOrder == AV_CHANNEL_ORDER_NATIVE && entry.channelMask) {
+            av_channel_layout_from_mask(&par->ch_layout, entry.channelMask);
+        } else if (entry.channels > 0) {
+            av_channel_layout_default(&par->ch_layout, entry.channels);
+        }
+        par->sample_rate = entry.sampleRate;
+        par->block_align = entry.blockAlign;
+        par->frame_size = entry.frameSize;
+        par->initial_padding = entry.initialPadding;
+        par->trailing_padding = entry.trailingPadding;
+        par->seek_preroll = entry.seekPreroll;
+
+        stream->avg_frame_rate = entry.avgFrameRate;
+        stream->r_frame_rate = entry.rFrameRate;
+        if (stream->start_time == AV_NOPTS_VALUE) stream->start_time = entry.startTime;
+        if (stream->duration == AV_NOPTS_VALUE) stream->duration = entry.duration;
+    }
+
+    // Container timings are normally estimated by avformat_find_stream_info
+    if (ctx->start_time == AV_NOPTS_VALUE) ctx->start_time = start_time_;
+    if (ctx->duration == AV_NOPTS_VALUE) ctx->duration = duration_;
+    if (ctx->bit_rate <= 0) ctx->bit_rate = bit_rate_;
+    return true;
+}
+
+void ProbeCache::store(const QString& path, const AVFormatContext* ctx, qint64 probeSize, qint64 analyzeDurationUs)
+{
+    const QString cache_path = cachePath(path);
+    if (cache_path.isEmpty() || !ctx || !ctx->iformat || ctx->nb_streams == 0) return;
+
+    QFile file(cache_path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "ProbeCache: cannot write cache" << cache_path;
+        return;
+    }
+
+    // iformat->name may list several aliases ("mov,mp4,m4a,..."); the first one
+    // is what av_find_input_format resolves
+    QByteArray format_name(ctx->iformat->name);
+    format_name.truncate(format_name.indexOf(',') >= 0 ? format_name.indexOf(',') : format_name.size());
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << kCacheMagic << kCacheVersion << format_name << probeSize << analyzeDurationUs
+        << qint64(ctx->start_time) << qint64(ctx->duration) << qint64(ctx->bit_rate) << qint32(ctx->nb_streams);
+
+    for (unsigned int i = 0; i < ctx->nb_streams; i++) {
+        const AVStream* stream = ctx->streams[i];
+        const AVCodecParameters* par = stream->codecpar;
+        StreamEntry entry;
+        entry.codecType = par->codec_type;
+        entry.codecId = par->codec_id;
+        entry.codecTag = par->codec_tag;
+        if (par->extradata && par->extradata_size > 0) {
+            entry.extradata = QByteArray(reinterpret_cast<const char*>(par->extradata), par->extradata_size);
+        }
+        entry.format = par->format;
+        entry.bitRate = par->bit_rate;
+        entry.bitsPerCodedSample = par->bits_per_coded_sample;
+        entry.bitsPerRawSample = par->bits_per_raw_sample;
+        entry.profile = par->profile;
+        entry.level = par->level;
+        entry.width = par->width;
+        entry.height = par->height;
+        entry.sampleAspectRatio = par->sample_aspect_ratio;
+        entry.fieldOrder = par->field_order;
+        entry.colorRange = par->color_range;
+        entry.colorPrimaries = par->color_primaries;
+        entry.colorTrc = par->color_trc;
+        entry.colorSpace = par->color_space;
+        entry.chromaLocation = par->chroma_location;
+        entry.videoDelay = par->video_delay;
+        entry.channelOrder = par->ch_layout.order;
+        entry.channels = par->ch_layout.nb_channels;
+        entry.channelMask = par->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ? par->ch_layout.u.mask : 0;
+        entry.sampleRate = par->sample_rate;
+        entry.blockAlign = par->block_align;
+        entry.frameSize = par->frame_size;
+        entry.initialPadding = par->initial_padding;
+        entry.trailingPadding = par->trailing_padding;
+        entry.seekPreroll = par->seek_preroll;
+        entry.timeBase = stream->time_base;
+        entry.avgFrameRate = stream->avg_frame_rate;
+        entry.rFrameRate = stream->r_frame_rate;
+        entry.startTime = stream->start_time;
+        entry.duration = stream->duration;
+        writeStream(out, entry);
+    }
+}
+
+void ProbeCache::writeStream(QDataStream& out, const StreamEntry& e)
+{
+    out << e.codecType << e.codecId << e.codecTag << e.extradata << e.format << e.bitRate
+        << e.bitsPerCodedSample << e.bitsPerRawSample << e.profile << e.level << e.width << e.height
+        << e.sampleAspectRatio << e.fieldOrder << e.colorRange << e.colorPrimaries << e.colorTrc
+        << e.colorSpace << e.chromaLocation << e.videoDelay << e.channelOrder << e.channels << e.channelMask
+        << e.sampleRate << e.blockAlign << e.frameSize << e.initialPadding << e.trailingPadding
+        << e.seekPreroll << e.timeBase << e.avgFrameRate << e.rFrameRate << e.startTime << e.duration;
+}
+
+void ProbeCache::readStream(QDataStream& in, StreamEntry& e)
+{
+    in >> e.codecType >> e.codecId >> e.codecTag >> e.extradata >> e.format >> e.bitRate
+       >> e.bitsPerCodedSample >> e.bitsPerRawSample >> e.profile >> e.level >> e.width >> e.height
+       >> e.sampleAspectRatio >> e.fieldOrder >> e.colorRange >> e.colorPrimaries >> e.colorTrc
+       >> e.colorSpace >> e.chromaLocation >> e.videoDelay >> e.channelOrder >> e.channels >> e.channelMask
+       >> e.sampleRate >> e.blockAlign >> e.frameSize >> e.initialPadding >> e.trailingPadding
+       >> e.seekPreroll >> e.timeBase >> e.avgFrameRate >> e.rFrameRate >> e.startTime >> e.duration;
+}
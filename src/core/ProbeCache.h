@@ -0,0 +1,86 @@
+#ifndef PROBECACHE_H
+#define PROBECACHE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+class QDataStream;
+
+// Persistent copy of what avformat_find_stream_info learned about a local file:
+// the container format, the stream layout and the codec parameters of every
+// stream. Reopening a known file restores these instead of decoding packets.
+// Entries live in the "probe" media cache and are keyed by file identity.
+class ProbeCache {
+public:
+    // Loads the entry for a local file; false when there is none or it is stale
+    bool load(const QString& path);
+
+    // Container format recorded for the file, nullptr when unknown
+    const AVInputFormat* inputFormat() const;
+    // Probe limits that were sufficient for this file last time
+    qint64 probeSize() const { return probe_size_; }
+    qint64 analyzeDurationUs() const { return analyze_duration_us_; }
+
+    // Copies the cached parameters into a context returned by avformat_open_input.
+    // Returns false and leaves ctx untouched when its streams do not match the entry.
+    bool apply(AVFormatContext* ctx) const;
+
+    static void store(const QString& path, const AVFormatContext* ctx, qint64 probeSize, qint64 analyzeDurationUs);
+
+private:
+    struct StreamEntry {
+        qint32 codecType = AVMEDIA_TYPE_UNKNOWN;
+        qint32 codecId = AV_CODEC_ID_NONE;
+        quint32 codecTag = 0;
+        QByteArray extradata;
+        qint32 format = -1;
+        qint64 bitRate = 0;
+        qint32 bitsPerCodedSample = 0;
+        qint32 bitsPerRawSample = 0;
+        qint32 profile = 0;
+        qint32 level = 0;
+        qint32 width = 0;
+        qint32 height = 0;
+        AVRational sampleAspectRatio = {0, 1};
+        qint32 fieldOrder = 0;
+        qint32 colorRange = 0;
+        qint32 colorPrimaries = 0;
+        qint32 colorTrc = 0;
+        qint32 colorSpace = 0;
+        qint32 chromaLocation = 0;
+        qint32 videoDelay = 0;
+        qint32 channelOrder = 0;
+        qint32 channels = 0;
+        quint64 channelMask = 0;
+        qint32 sampleRate = 0;
+        qint32 blockAlign = 0;
+        qint32 frameSize = 0;
+        qint32 initialPadding = 0;
+        qint32 trailingPadding = 0;
+        qint32 seekPreroll = 0;
+
+        AVRational timeBase = {0, 1};
+        AVRational avgFrameRate = {0, 1};
+        AVRational rFrameRate = {0, 1};
+        qint64 startTime = AV_NOPTS_VALUE;
+        qint64 duration = AV_NOPTS_VALUE;
+    };
+
+    static void writeStream(QDataStream& out, const StreamEntry& entry);
+    static void readStream(QDataStream& in, StreamEntry& entry);
+
+    QByteArray format_name_;
+    qint64 probe_size_ = 0;
+    qint64 analyze_duration_us_ = 0;
+    qint64 start_time_ = AV_NOPTS_VALUE;
+    qint64 duration_ = AV_NOPTS_VALUE;
+    qint64 bit_rate_ = 0;
+    QVector<StreamEntry> streams_;
+};
+
+#endif // PROBECACHE_H
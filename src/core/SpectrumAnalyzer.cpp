@@ -0,0 +1,162 @@
+#include "SpectrumAnalyzer.h"
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+
+extern "C" {
+#include <libavutil/mem.h>
+#include <libavutil/tx.h>
+}
+
+namespace {
+constexpr float kPi = 3.14159265358979f;
+constexpr int kFftSize = 2048;
+constexpr int kFrameIntervalMs = 33;
+constexpr float kMinFrequency = 40.0f;
+constexpr float kMaxFrequency = 16000.0f;
+constexpr float kFloorDb = -80.0f;
+constexpr float kDecay = 0.85f;
+constexpr int kFeedChunk = 256;
+}
+
+SpectrumAnalyzer::SpectrumAnalyzer(QObject *parent)
+    : QThread(parent)
+    , ring_(kFftSize * 8)
+{
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer() {
+    setActive(false);
+}
+
+void SpectrumAnalyzer::setActive(bool active) {
+    if (active_ == active) return;
+    active_ = active;
+    if (active) {
+        start(QThread::LowPriority);
+    } else {
+        wait();
+        bands_ = QList<qreal>(band_count_, 0.0);
+        rms_ = 0.0;
+        peak_ = 0.0;
+        emit levelsChanged();
+    }
+    emit activeChanged();
+}
+
+void SpectrumAnalyzer::setBandCount(int count) {
+    count = qBound(1, count, 256);
+    if (band_count_ == count) return;
+    band_count_ = count;
+    emit bandCountChanged();
+}
+
+void SpectrumAnalyzer::feed(const int16_t* samples, int frames, int channels) {
+    if (!active_.load(std::memory_order_relaxed) || channels <= 0) return;
+
+    // Downmix to mono in small stack chunks, never allocating on the audio thread
+    float mono[kFeedChunk];
+    const float scale = 1.0f / (32768.0f * channels);
+    for (int offset = 0; offset < frames; offset += kFeedChunk) {
+        const int n = std::min(kFeedChunk, frames - offset);
+        const int16_t* in = samples + offset * channels;
+        for (int i = 0; i < n; i++) {
+            int sum = 0;
+            for (int c = 0; c < channels; c++) sum += in[i * channels + c];
+            mono[i] = sum * scale;
+        }
+        ring_.write(mono, n);
+    }
+}
+
+void SpectrumAnalyzer::run() {
+    // libavutil's RDFT has SIMD implementations for the common architectures
+    AVTXContext* tx = nullptr;
+    av_tx_fn fft = nullptr;
+    const float tx_scale = 1.0f;
+    if (av_tx_init(&tx, &fft, AV_TX_FLOAT_RDFT, 0, kFftSize, &tx_scale, 0) < 0) {
+        return;
+    }
+    float* input = static_cast<float*>(av_malloc((kFftSize + 2) * sizeof(float)));
+    AVComplexFloat* output = static_cast<AVComplexFloat*>(av_malloc((kFftSize / 2 + 1) * sizeof(AVComplexFloat)));
+
+    std::vector<float> window(kFftSize);
+    for (int i = 0; i < kFftSize; i++) {
+        window[i] = 0.5f - 0.5f * std::cos(2.0f * kPi * i / (kFftSize - 1));
+    }
+    std::vector<float> history(kFftSize, 0.0f);
+    std::vector<float> chunk(ring_.capacity());
+    std::vector<float> smoothed;
+    float rms = 0.0f;
+    float peak = 0.0f;
+
+    ring_.discard();
+    QElapsedTimer timer;
+    while (active_) {
+        timer.start();
+        const int band_count = band_count_;
+        if ((int)smoothed.size() != band_count) smoothed.assign(band_count, 0.0f);
+
+        const size_t n = ring_.read(chunk.data(), chunk.size());
+        if (n > 0) {
+            float sum_sq = 0.0f;
+            float max_abs = 0.0f;
+            for (size_t i = 0; i < n; i++) {
+                sum_sq += chunk[i] * chunk[i];
+                max_abs = std::max(max_abs, std::fabs(chunk[i]));
+            }
+            rms = std::max(std::sqrt(sum_sq / n), rms * kDecay);
+            peak = std::max(max_abs, peak * kDecay);
+
+            // Slide the newest samples into the analysis window
+            if (n >= (size_t)kFftSize) {
+                std::copy(chunk.begin() + (n - kFftSize), chunk.begin() + n, history.begin());
+            } else {
+                std::move(history.begin() + n, history.end(), history.begin());
+                std::copy(chunk.begin(), chunk.begin() + n, history.end() - n);
+            }
+            for (int i = 0; i < kFftSize; i++) input[i] = history[i] * window[i];
+            fft(tx, output, input, sizeof(float));
+
+            // Log-spaced bands, magnitude normalized for the Hann window gain
+            const float max_freq = std::min(kMaxFrequency, sample_rate_ / 2.0f);
+            const float ratio = std::pow(max_freq / kMinFrequency, 1.0f / band_count);
+            for (int b = 0; b < band_count; b++) {
+                const float f_lo = kMinFrequency * std::pow(ratio, float(b));
+                const float f_hi = f_lo * ratio;
+                const int lo = std::clamp(int(f_lo * kFftSize / sample_rate_), 0, kFftSize / 2);
+                const int hi = std::clamp(int(f_hi * kFftSize / sample_rate_), lo + 1, kFftSize / 2 + 1);
+                float mag = 0.0f;
+                for (int k = lo; k < hi; k++) {
+                    mag = std::max(mag, std::hypot(output[k].re, output[k].im));
+                }
+                const float db = 20.0f * std::log10(mag * 4.0f / kFftSize + 1e-9f);
+                const float value = std::clamp((db - kFloorDb) / -kFloorDb, 0.0f, 1.0f);
+                smoothed[b] = std::max(value, smoothed[b] * kDecay);
+            }
+        } else {
+            // Paused or starved: let the display fall back to silence
+            for (float& v : smoothed) v *= kDecay;
+            rms *= kDecay;
+            peak *= kDecay;
+        }
+
+        QList<qreal> bands(smoothed.begin(), smoothed.end());
+        QMetaObject::invokeMethod(this, [this, bands, rms, peak]() {
+            if (!active_) return;
+            bands_ = bands;
+            rms_ = rms;
+            peak_ = peak;
+            emit levelsChanged();
+        }, Qt::QueuedConnection);
+
+        const qint64 elapsed = timer.elapsed();
+        if (elapsed < kFrameIntervalMs) {
+            QThread::msleep(kFrameIntervalMs - elapsed);
+        }
+    }
+
+    av_free(output);
+    av_free(input);
+    av_tx_uninit(&tx);
+}
@@ -0,0 +1,58 @@
+#ifndef SPECTRUMANALYZER_H
+#define SPECTRUMANALYZER_H
+
+#include <QThread>
+#include <QList>
+#include <atomic>
+#include <vector>
+
+#include "SpscRingBuffer.h"
+
+// Spectrum/level meter fed from the audio output thread. The audio thread only
+// copies PCM into a lock-free ring (and only while active); FFT, band mapping and
+// RMS/peak are computed on this thread at display rate and published to QML.
+class SpectrumAnalyzer : public QThread {
+    Q_OBJECT
+    Q_PROPERTY(bool active READ isActive WRITE setActive NOTIFY activeChanged)
+    Q_PROPERTY(int bandCount READ bandCount WRITE setBandCount NOTIFY bandCountChanged)
+    Q_PROPERTY(QList<qreal> bands READ bands NOTIFY levelsChanged)
+    Q_PROPERTY(qreal rms READ rms NOTIFY levelsChanged)
+    Q_PROPERTY(qreal peak READ peak NOTIFY levelsChanged)
+
+public:
+    explicit SpectrumAnalyzer(QObject *parent = nullptr);
+    ~SpectrumAnalyzer();
+
+    bool isActive() const { return active_; }
+    void setActive(bool active);
+    int bandCount() const { return band_count_; }
+    void setBandCount(int count);
+
+    QList<qreal> bands() const { return bands_; }
+    qreal rms() const { return rms_; }
+    qreal peak() const { return peak_; }
+
+    // Audio thread: interleaved S16 samples
+    void feed(const int16_t* samples, int frames, int channels);
+
+signals:
+    void activeChanged();
+    void bandCountChanged();
+    void levelsChanged();
+
+protected:
+    void run() override;
+
+private:
+    SpscRingBuffer<float> ring_;
+    std::atomic<bool> active_{false};
+    std::atomic<int> band_count_{32};
+    int sample_rate_ = 48000;
+
+    // Published on the GUI thread
+    QList<qreal> bands_;
+    qreal rms_ = 0.0;
+    qreal peak_ = 0.0;
+};
+
+#endif // SPECTRUMANALYZER_H
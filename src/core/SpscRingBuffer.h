@@ -0,0 +1,77 @@
+#ifndef SPSCRINGBUFFER_H
+#define SPSCRINGBUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Lock-free single-producer/single-consumer ring of trivially copyable items.
+// write() never blocks: when the consumer falls behind, the excess is dropped.
+template <typename T>
+class SpscRingBuffer {
+    static_assert(std::is_trivially_copyable<T>::value, "SpscRingBuffer needs trivially copyable items");
+
+public:
+    explicit SpscRingBuffer(size_t capacity)
+        : buffer_(roundUpToPowerOfTwo(capacity)), mask_(buffer_.size() - 1) {}
+
+    size_t write(const T* data, size_t count) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        const size_t n = std::min(count, buffer_.size() - (head - tail));
+        copyIn(head, data, n);
+        head_.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t read(T* out, size_t count) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t head = head_.load(std::memory_order_acquire);
+        const size_t n = std::min(count, head - tail);
+        copyOut(tail, out, n);
+        tail_.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t available() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_relaxed);
+    }
+
+    // Consumer side: drop everything currently buffered
+    void discard() {
+        tail_.store(head_.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    size_t capacity() const { return buffer_.size(); }
+
+private:
+    static size_t roundUpToPowerOfTwo(size_t value) {
+        size_t result = 1;
+        while (result < value) result <<= 1;
+        return result;
+    }
+
+    void copyIn(size_t position, const T* data, size_t n) {
+        const size_t offset = position & mask_;
+        const size_t first = std::min(n, buffer_.size() - offset);
+        std::memcpy(buffer_.data() + offset, data, first * sizeof(T));
+        std::memcpy(buffer_.data(), data + first, (n - first) * sizeof(T));
+    }
+
+    void copyOut(size_t position, T* out, size_t n) const {
+        const size_t offset = position & mask_;
+        const size_t first = std::min(n, buffer_.size() - offset);
+        std::memcpy(out, buffer_.data() + offset, first * sizeof(T));
+        std::memcpy(out + first, buffer_.data(), (n - first) * sizeof(T));
+    }
+
+    std::vector<T> buffer_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+#endif // SPSCRINGBUFFER_H
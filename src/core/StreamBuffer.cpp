@@ -0,0 +1,33 @@
+#include "StreamBuffer.h"
+
+void StreamBuffer::setWatermarks(const Watermarks& watermarks) {
+    watermarks_ = watermarks;
+    watermarks_.lowMs = qMax<qint64>(0, watermarks_.lowMs);
+    watermarks_.highMs = qMax(watermarks_.lowMs + 1, watermarks_.highMs);
+    watermarks_.prebufferMs = qBound(watermarks_.lowMs + 1, watermarks_.prebufferMs, watermarks_.highMs);
+}
+
+void StreamBuffer::reset() {
+    buffering_ = true;
+    prebuffering_ = true;
+    percent_ = 0;
+}
+
+bool StreamBuffer::update(qint64 bufferedMs, bool endOfStream, bool saturated) {
+    const bool was_buffering = buffering_;
+
+    if (buffering_) {
+        const qint64 target = prebuffering_ ? watermarks_.prebufferMs : watermarks_.highMs;
+        percent_ = (int)qBound<qint64>(0, bufferedMs * 100 / target, 100);
+        if (bufferedMs >= target || endOfStream || saturated) {
+            buffering_ = false;
+            prebuffering_ = false;
+            percent_ = 100;
+        }
+    } else if (bufferedMs <= watermarks_.lowMs && !endOfStream && !saturated) {
+        buffering_ = true;
+        percent_ = (int)qBound<qint64>(0, bufferedMs * 100 / watermarks_.highMs, 100);
+    }
+
+    return buffering_ != was_buffering;
+}
@@ -0,0 +1,37 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <QtGlobal>
+
+// Buffering state machine for network sources. Watermarks are in milliseconds of
+// demuxed media. Playback starts once prebufferMs is queued; it drops back into
+// buffering when the queue falls to lowMs and leaves it again at highMs.
+class StreamBuffer {
+public:
+    struct Watermarks {
+        qint64 lowMs = 300;
+        qint64 highMs = 3000;
+        qint64 prebufferMs = 2000;
+    };
+
+    void setWatermarks(const Watermarks& watermarks);
+    const Watermarks& watermarks() const { return watermarks_; }
+
+    // Enter the initial prebuffering state
+    void reset();
+
+    // Feed the current buffered duration; returns true when isBuffering() changed.
+    // `saturated` means the queues cannot take more data, which also ends buffering.
+    bool update(qint64 bufferedMs, bool endOfStream, bool saturated);
+
+    bool isBuffering() const { return buffering_; }
+    int percent() const { return percent_; }
+
+private:
+    Watermarks watermarks_;
+    bool buffering_ = true;
+    bool prebuffering_ = true;
+    int percent_ = 0;
+};
+
+#endif // STREAMBUFFER_H
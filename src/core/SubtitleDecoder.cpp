@@ -0,0 +1,293 @@
+#include "SubtitleDecoder.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <QStringList>
+#include <iterator>
+
+namespace {
+// Decoded events waiting for their time; the demuxer reads only a few seconds
+// ahead, so this is only reached by files with unusually dense subtitles
+constexpr size_t kMaxPendingEvents = 512;
+constexpr qint64 kIdleSleepMs = 20;
+}
+
+SubtitleDecoder::SubtitleDecoder(QObject *parent) : PipelineStage(parent) {}
+
+SubtitleDecoder::~SubtitleDecoder() {
+    close();
+}
+
+bool SubtitleDecoder::open(AVFormatContext* formatContext, int streamIndex, const QSize& videoSize) {
+    if (!formatContext || streamIndex < 0) {
+        emit errorOccurred("Invalid format context or stream index");
+        return false;
+    }
+
+    AVStream* stream = formatContext->streams[streamIndex];
+    const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec) {
+        emit errorOccurred("Unsupported subtitle codec");
+        return false;
+    }
+
+    codec_ctx_ = avcodec_alloc_context3(codec);
+    if (!codec_ctx_) {
+        emit errorOccurred("Failed to allocate codec context");
+        return false;
+    }
+
+    if (avcodec_parameters_to_context(codec_ctx_, stream->codecpar) < 0) {
+        emit errorOccurred("Failed to copy codec parameters to context");
+        cleanup();
+        return false;
+    }
+    // Lets the decoder report event times in AV_TIME_BASE
+    codec_ctx_->pkt_timebase = stream->time_base;
+
+    if (avcodec_open2(codec_ctx_, codec, nullptr) < 0) {
+        emit errorOccurred("Failed to open subtitle codec");
+        cleanup();
+        return false;
+    }
+
+    // Bitmap formats declare the canvas they were authored for; text ones and
+    // some DVB streams do not, so they are placed on the video
+    stream_index_ = streamIndex;
+    canvas_size_ = codec_ctx_->width > 0 && codec_ctx_->height > 0
+        ? QSize(codec_ctx_->width, codec_ctx_->height) : videoSize;
+    stop_requested_ = false;
+    return true;
+}
+
+void SubtitleDecoder::close() {
+    requestStop();
+    if (isRunning()) wait();
+    cleanup();
+}
+
+void SubtitleDecoder::cleanup() {
+    if (codec_ctx_) {
+        avcodec_free_context(&codec_ctx_);
+        codec_ctx_ = nullptr;
+    }
+    QMutexLocker locker(&mutex_);
+    events_.clear();
+    current_.reset();
+}
+
+void SubtitleDecoder::setPacketQueue(ThreadSafeQueue<AVPacket*>* queue) {
+    packet_queue_ = queue;
+}
+
+void SubtitleDecoder::flush() {
+    flush_requested_ = true;
+    if (packet_queue_) packet_queue_->wake();
+    QMutexLocker locker(&mutex_);
+    events_.clear();
+    current_.reset();
+}
+
+void SubtitleDecoder::requestStop() {
+    stop_requested_ = true;
+    if (packet_queue_) packet_queue_->wake();
+}
+
+bool SubtitleDecoder::waitForWork(int timeoutMs) {
+    packet_queue_->waitNotEmpty(timeoutMs);
+    return true;
+}
+
+std::shared_ptr<const SubtitleFrame> SubtitleDecoder::frameAt(qint64 ms) {
+    QMutexLocker locker(&mutex_);
+    while (!events_.empty() && events_.front().endMs <= ms) {
+        events_.pop_front();
+    }
+
+    QVector<std::shared_ptr<const SubtitleEvent>> visible;
+    for (const TimedEvent& timed : events_) {
+        if (timed.startMs > ms) break;
+        if (timed.endMs > ms) visible.append(timed.event);
+    }
+
+    // Same events as last time: hand out the same snapshot
+    if (visible.isEmpty()) {
+        current_.reset();
+    } else if (!current_ || current_->events != visible) {
+        auto frame = std::make_shared<SubtitleFrame>();
+        frame->events = std::move(visible);
+        current_ = std::move(frame);
+    }
+    return current_;
+}
+
+bool SubtitleDecoder::begin() {
+    if (!packet_queue_ || !codec_ctx_) {
+        emit errorOccurred("SubtitleDecoder not properly initialized");
+        return false;
+    }
+    return true;
+}
+
+void SubtitleDecoder::end() {}
+
+PipelineStep SubtitleDecoder::step() {
+    if (stop_requested_) return PipelineStep::done();
+
+    if (flush_requested_.exchange(false)) {
+        avcodec_flush_buffers(codec_ctx_);
+        return PipelineStep::again();
+    }
+
+    {
+        QMutexLocker locker(&mutex_);
+        if (events_.size() >= kMaxPendingEvents) {
+            return PipelineStep::sleep(kIdleSleepMs);
+        }
+    }
+
+    // The queue belongs to the demuxer and outlives track switches; never pop
+    // blocking, waitForWork() waits with a timeout
+    AVPacket* packet = nullptr;
+    if (!packet_queue_->tryPop(packet)) {
+        return packet_queue_->isStopped() ? PipelineStep::done() : PipelineStep::wait(kIdleSleepMs);
+    }
+    // A packet of the previous track may slip in while the demuxer switches
+    if (packet && packet->stream_index == stream_index_) {
+        decodePacket(packet);
+    }
+    av_packet_free(&packet);
+    return PipelineStep::again();
+}
+
+void SubtitleDecoder::decodePacket(AVPacket* packet) {
+    AVSubtitle subtitle{};
+    int got_subtitle = 0;
+    if (avcodec_decode_subtitle2(codec_ctx_, &subtitle, &got_subtitle, packet) < 0) {
+        qWarning() << "Error decoding subtitle packet";
+        return;
+    }
+    if (!got_subtitle) return;
+
+    qint64 base_ms = 0;
+    if (subtitle.pts != AV_NOPTS_VALUE) {
+        base_ms = subtitle.pts / 1000;
+    } else if (packet->pts != AV_NOPTS_VALUE) {
+        base_ms = av_rescale_q(packet->pts, codec_ctx_->pkt_timebase, {1, 1000});
+    }
+
+    TimedEvent timed;
+    timed.startMs = base_ms + subtitle.start_display_time;
+    if (subtitle.end_display_time > subtitle.start_display_time &&
+        subtitle.end_display_time != UINT32_MAX) {
+        timed.endMs = base_ms + subtitle.end_display_time;
+    } else if (packet->duration > 0) {
+        timed.endMs = base_ms + av_rescale_q(packet->duration, codec_ctx_->pkt_timebase, {1, 1000});
+    }
+    timed.event = convert(subtitle);
+    const bool bitmap = subtitle.format == 0;
+    avsubtitle_free(&subtitle);
+
+    QMutexLocker locker(&mutex_);
+    // An empty event clears the screen; a bitmap display set replaces the
+    // previous one. Text events with known durations may overlap.
+    for (TimedEvent& previous : events_) {
+        if (previous.endMs == kOpenEnd && (!timed.event || bitmap) && previous.startMs < timed.startMs) {
+            previous.endMs = timed.startMs;
+        }
+    }
+    if (!timed.event) return;
+
+    auto it = events_.end();
+    while (it != events_.begin() && std::prev(it)->startMs > timed.startMs) --it;
+    events_.insert(it, std::move(timed));
+}
+
+std::shared_ptr<const SubtitleEvent> SubtitleDecoder::convert(const AVSubtitle& subtitle) const {
+    auto event = std::make_shared<SubtitleEvent>();
+    event->canvasSize = canvas_size_;
+
+    QStringList lines;
+    for (unsigned int i = 0; i < subtitle.num_rects; i++) {
+        const AVSubtitleRect* rect = subtitle.rects[i];
+        switch (rect->type) {
+        case SUBTITLE_ASS:
+            if (rect->ass) lines << assToText(rect->ass);
+            break;
+        case SUBTITLE_TEXT:
+            if (rect->text) lines << QString::fromUtf8(rect->text).trimmed();
+            break;
+        case SUBTITLE_BITMAP: {
+            QImage image = bitmapToImage(rect);
+            if (!image.isNull()) {
+                event->bitmaps.append({image, QRect(rect->x, rect->y, rect->w, rect->h)});
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    lines.removeAll(QString());
+    event->text = lines.join(QLatin1Char('\n'));
+
+    if (event->text.isEmpty() && event->bitmaps.isEmpty()) return nullptr;
+    return event;
+}
+
+QString SubtitleDecoder::assToText(const char* ass) {
+    // "ReadOrder,Layer,Style,Name,MarginL,MarginR,MarginV,Effect,Text", or the
+    // older full "Dialogue:" line with Start/End instead of ReadOrder
+    const QString line = QString::fromUtf8(ass);
+    int fields = line.startsWith(QLatin1String("Dialogue:")) ? 9 : 8;
+    int pos = 0;
+    while (fields > 0 && pos >= 0) {
+        pos = line.indexOf(QLatin1Char(','), pos);
+        if (pos >= 0) pos++;
+        fields--;
+    }
+    if (pos < 0) return QString();
+
+    // Styling overrides ({\b1}, {\pos(...)}, ...) are dropped; the renderer uses one style
+    QString text;
+    text.reserve(line.size() - pos);
+    bool in_override = false;
+    for (int i = pos; i < line.size(); i++) {
+        const QChar c = line.at(i);
+        if (in_override) {
+            if (c == QLatin1Char('}')) in_override = false;
+        } else if (c == QLatin1Char('{')) {
+            in_override = true;
+        } else if (c == QLatin1Char('\\') && i + 1 < line.size()) {
+            const QChar next = line.at(i + 1);
+            if (next == QLatin1Char('N') || next == QLatin1Char('n')) {
+                text += QLatin1Char('\n');
+                i++;
+            } else if (next == QLatin1Char('h')) {
+                text += QLatin1Char(' ');
+                i++;
+            } else {
+                text += c;
+            }
+        } else {
+            text += c;
+        }
+    }
+    return text.trimmed();
+}
+
+QImage SubtitleDecoder::bitmapToImage(const AVSubtitleRect* rect) {
+    if (rect->w <= 0 || rect->h <= 0 || !rect->data[0] || !rect->data[1]) return QImage();
+
+    // Palette entries are native-endian 0xAARRGGBB, the same layout as ARGB32
+    const uint32_t* palette = reinterpret_cast<const uint32_t*>(rect->data[1]);
+    QImage image(rect->w, rect->h, QImage::Format_ARGB32);
+    for (int y = 0; y < rect->h; y++) {
+        const uint8_t* src = rect->data[0] + y * rect->linesize[0];
+        QRgb* dst = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < rect->w; x++) {
+            dst[x] = src[x] < rect->nb_colors ? palette[src[x]] : 0;
+        }
+    }
+    // Uploaded as is, blended premultiplied
+    return image.convertToFormat(QImage::Format_RGBA8888_Premultiplied);
+}
@@ -0,0 +1,103 @@
+#ifndef SUBTITLE_DECODER_H
+#define SUBTITLE_DECODER_H
+
+#include <QImage>
+#include <QMutex>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include <deque>
+#include <limits>
+#include <memory>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include "PipelineStage.h"
+#include "ThreadSafeQueue.h"
+
+// Payload of one decoded subtitle event. Text events carry plain text (ASS
+// override tags removed, lines separated by '\n'); bitmap events carry their
+// images converted to premultiplied RGBA, placed on a canvas of canvasSize.
+// Timing stays with the decoder so an event never changes once handed out.
+struct SubtitleEvent {
+    struct Bitmap {
+        QImage image;
+        QRect rect;
+    };
+
+    QString text;
+    QVector<Bitmap> bitmaps;
+    QSize canvasSize;
+};
+
+// The events visible at one point in time. Snapshots are shared and immutable:
+// as long as the visible set does not change, frameAt() returns the same one,
+// so the renderer can tell "nothing changed" by comparing pointers.
+struct SubtitleFrame {
+    QVector<std::shared_ptr<const SubtitleEvent>> events;
+};
+
+// Decodes the demuxer's subtitle queue (SRT, ASS, mov_text, PGS, DVB, ...) into
+// timed events. Subtitles are sparse and cheap to decode, so the stage mostly
+// sleeps; the renderer asks for the frame at the video clock.
+class SubtitleDecoder : public PipelineStage {
+    Q_OBJECT
+public:
+    explicit SubtitleDecoder(QObject *parent = nullptr);
+    ~SubtitleDecoder();
+
+    // videoSize is the canvas for bitmap subtitles that do not declare one
+    bool open(AVFormatContext* formatContext, int streamIndex, const QSize& videoSize);
+    void close();
+    bool isOpen() const { return codec_ctx_ != nullptr; }
+
+    void setPacketQueue(ThreadSafeQueue<AVPacket*>* queue);
+
+    // nullptr when nothing is on screen at ms
+    std::shared_ptr<const SubtitleFrame> frameAt(qint64 ms);
+
+    void flush();
+    void requestStop();
+
+signals:
+    void errorOccurred(const QString& message);
+
+protected:
+    bool begin() override;
+    void end() override;
+    PipelineStep step() override;
+    bool waitForWork(int timeoutMs) override;
+
+private:
+    void cleanup();
+    void decodePacket(AVPacket* packet);
+    std::shared_ptr<const SubtitleEvent> convert(const AVSubtitle& subtitle) const;
+    static QString assToText(const char* ass);
+    static QImage bitmapToImage(const AVSubtitleRect* rect);
+
+    AVCodecContext* codec_ctx_ = nullptr;
+    ThreadSafeQueue<AVPacket*>* packet_queue_ = nullptr;
+    int stream_index_ = -1;
+    QSize canvas_size_;
+    std::atomic<bool> stop_requested_{false};
+    std::atomic<bool> flush_requested_{false};
+
+    static constexpr qint64 kOpenEnd = std::numeric_limits<qint64>::max();
+    struct TimedEvent {
+        std::shared_ptr<const SubtitleEvent> event;
+        qint64 startMs = 0;
+        qint64 endMs = kOpenEnd;  // until the next event clears the screen
+    };
+
+    // Decoded events in start order and the snapshot last handed out
+    QMutex mutex_;
+    std::deque<TimedEvent> events_;
+    std::shared_ptr<const SubtitleFrame> current_;
+};
+
+#endif
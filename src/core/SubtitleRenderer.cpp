@@ -0,0 +1,288 @@
+#include "SubtitleRenderer.h"
+#include "SubtitleDecoder.h"
+#include "MemoryBudget.h"
+#include <QDebug>
+#include <QOpenGLShaderProgram>
+#include <QRectF>
+#include <QStringList>
+
+namespace {
+// Text height relative to the picture, and the gap kept below the last line
+constexpr qreal kFontHeightRatio = 0.055;
+constexpr qreal kBottomMarginRatio = 0.06;
+constexpr qreal kMaxLineWidthRatio = 0.9;
+constexpr int kFloatsPerVertex = 4;
+}
+
+SubtitleRenderer::SubtitleRenderer() = default;
+
+SubtitleRenderer::~SubtitleRenderer() {
+    // Destroyed with the GL renderer, while its context is current
+    if (!initialized_) return;
+    releaseBitmaps(nullptr);
+    if (atlas_texture_) glDeleteTextures(1, &atlas_texture_);
+    if (vbo_) glDeleteBuffers(1, &vbo_);
+    delete program_;
+    MemoryBudget::release(MemoryBudget::Textures, texture_bytes_);
+}
+
+void SubtitleRenderer::initialize() {
+    if (initialized_) return;
+    initializeOpenGLFunctions();
+
+    // Program binary cached on disk like the video shaders
+    program_ = new QOpenGLShaderProgram();
+    if (!program_->addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, ":/shaders/subtitle.vert") ||
+        !program_->addCacheableShaderFromSourceFile(QOpenGLShader::Fragment, ":/shaders/subtitle.frag") ||
+        !program_->link()) {
+        qWarning() << "SubtitleRenderer: failed to build shaders" << program_->log();
+    }
+
+    glGenBuffers(1, &vbo_);
+    glGenTextures(1, &atlas_texture_);
+    glBindTexture(GL_TEXTURE_2D, atlas_texture_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    initialized_ = true;
+}
+
+void SubtitleRenderer::setFrame(std::shared_ptr<const SubtitleFrame> frame) {
+    frame_ = std::move(frame);
+}
+
+void SubtitleRenderer::render(const QSize& target) {
+    if (!frame_) {
+        // Nothing on screen: drop what the last subtitle left behind, once
+        if (built_frame_) {
+            built_frame_.reset();
+            batches_.clear();
+            releaseBitmaps(nullptr);
+        }
+        return;
+    }
+    if (!initialized_ || !program_->isLinked() || target.isEmpty()) return;
+
+    if (frame_ != built_frame_ || target != built_size_) {
+        rebuild(target);
+    }
+    if (batches_.isEmpty()) return;
+
+    program_->bind();
+    program_->setUniformValue("viewportSize", QSizeF(target));
+    program_->setUniformValue("subtitleTexture", 0);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, kFloatsPerVertex * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, kFloatsPerVertex * sizeof(float), (void*)(2 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+
+    // Both text and bitmaps come out premultiplied
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glActiveTexture(GL_TEXTURE0);
+    for (const Batch& batch : batches_) {
+        glBindTexture(GL_TEXTURE_2D, batch.texture);
+        program_->setUniformValue("mode", batch.mode);
+        glDrawArrays(GL_TRIANGLES, batch.first, batch.count);
+    }
+    glDisable(GL_BLEND);
+    program_->release();
+}
+
+void SubtitleRenderer::rebuild(const QSize& target) {
+    built_frame_ = frame_;
+    built_size_ = target;
+    vertices_.clear();
+    batches_.clear();
+    releaseBitmaps(frame_.get());
+
+    QStringList paragraphs;
+    for (const auto& event : frame_->events) {
+        if (!event->text.isEmpty()) {
+            paragraphs << event->text.split(QLatin1Char('\n'));
+        }
+
+        // Bitmaps are authored for a canvas and scaled with the picture
+        const QSize canvas = event->canvasSize.isEmpty() ? target : event->canvasSize;
+        const qreal sx = qreal(target.width()) / canvas.width();
+        const qreal sy = qreal(target.height()) / canvas.height();
+        const QVector<GLuint>& textures = bitmapTextures(event);
+        for (int i = 0; i < event->bitmaps.size() && i < textures.size(); i++) {
+            const QRect& rect = event->bitmaps[i].rect;
+            Batch batch{textures[i], 1, int(vertices_.size() / kFloatsPerVertex), 6};
+            addQuad(QRectF(rect.x() * sx, rect.y() * sy, rect.width() * sx, rect.height() * sy),
+                    QRectF(0, 0, 1, 1));
+            batches_.append(batch);
+        }
+    }
+    if (!paragraphs.isEmpty()) {
+        layoutText(paragraphs, target);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBufferData(GL_ARRAY_BUFFER, vertices_.size() * sizeof(float), vertices_.constData(), GL_DYNAMIC_DRAW);
+}
+
+void SubtitleRenderer::layoutText(const QStringList& paragraphs, const QSize& target) {
+    atlas_.setPixelSize(qRound(target.height() * kFontHeightRatio));
+    const int max_width = qRound(target.width() * kMaxLineWidthRatio);
+
+    // A full atlas starts over once; glyphs of earlier subtitles are not needed anymore
+    QVector<QVector<uint>> lines;
+    if (!layoutLines(paragraphs, max_width, lines)) {
+        atlas_.clear();
+        lines.clear();
+        layoutLines(paragraphs, max_width, lines);
+    }
+    uploadAtlas();
+
+    const int line_height = atlas_.lineHeight();
+    const qreal atlas_size = atlas_.size();
+    qreal baseline = target.height() - target.height() * kBottomMarginRatio
+        - line_height * lines.size() + atlas_.ascent();
+
+    Batch batch{atlas_texture_, 0, int(vertices_.size() / kFloatsPerVertex), 0};
+    for (const QVector<uint>& line : lines) {
+        qreal x = (target.width() - lineWidth(line)) / 2.0;
+        for (uint code_point : line) {
+            const AtlasGlyph* glyph = atlas_.glyph(code_point);
+            if (!glyph) continue;
+            if (!glyph->rect.isEmpty()) {
+                const QRect& r = glyph->rect;
+                addQuad(QRectF(x + glyph->offset.x(), baseline + glyph->offset.y(), r.width(), r.height()),
+                        QRectF(r.x() / atlas_size, r.y() / atlas_size,
+                               r.width() / atlas_size, r.height() / atlas_size));
+            }
+            x += glyph->advance;
+        }
+        baseline += line_height;
+    }
+    batch.count = int(vertices_.size() / kFloatsPerVertex) - batch.first;
+    if (batch.count > 0) batches_.append(batch);
+}
+
+bool SubtitleRenderer::layoutLines(const QStringList& paragraphs, int maxWidth, QVector<QVector<uint>>& lines) {
+    // Greedy word wrap on glyph advances. One glyph per code point, so scripts
+    // that need shaping are drawn unjoined.
+    for (const QString& paragraph : paragraphs) {
+        const QStringList words = paragraph.split(QLatin1Char(' '), Qt::SkipEmptyParts);
+        QVector<uint> line;
+        int width = 0;
+        // Glyph pointers do not survive later insertions, keep the value
+        const AtlasGlyph* space = atlas_.glyph(U' ');
+        if (!space) return false;
+        const int space_advance = space->advance;
+        for (const QString& word : words) {
+            const QList<uint> code_points = word.toUcs4();
+            int word_width = 0;
+            for (uint code_point : code_points) {
+                const AtlasGlyph* glyph = atlas_.glyph(code_point);
+                if (!glyph) return false;
+                word_width += glyph->advance;
+            }
+            if (!line.isEmpty() && width + space_advance + word_width > maxWidth) {
+                lines.append(line);
+                line.clear();
+                width = 0;
+            }
+            if (!line.isEmpty()) {
+                line.append(U' ');
+                width += space_advance;
+            }
+            line.append(code_points);
+            width += word_width;
+        }
+        if (!line.isEmpty()) lines.append(line);
+    }
+    return true;
+}
+
+int SubtitleRenderer::lineWidth(const QVector<uint>& line) {
+    int width = 0;
+    for (uint code_point : line) {
+        if (const AtlasGlyph* glyph = atlas_.glyph(code_point)) width += glyph->advance;
+    }
+    return width;
+}
+
+void SubtitleRenderer::addQuad(const QRectF& rect, const QRectF& uv) {
+    const float corners[6][4] = {
+        {float(rect.left()), float(rect.top()), float(uv.left()), float(uv.top())},
+        {float(rect.right()), float(rect.top()), float(uv.right()), float(uv.top())},
+        {float(rect.right()), float(rect.bottom()), float(uv.right()), float(uv.bottom())},
+        {float(rect.left()), float(rect.top()), float(uv.left()), float(uv.top())},
+        {float(rect.right()), float(rect.bottom()), float(uv.right()), float(uv.bottom())},
+        {float(rect.left()), float(rect.bottom()), float(uv.left()), float(uv.bottom())},
+    };
+    for (const auto& corner : corners) {
+        vertices_.append(corner[0]);
+        vertices_.append(corner[1]);
+        vertices_.append(corner[2]);
+        vertices_.append(corner[3]);
+    }
+}
+
+void SubtitleRenderer::uploadAtlas() {
+    const QRect dirty = atlas_.takeDirtyRect();
+    if (dirty.isEmpty()) return;
+
+    const int size = atlas_.size();
+    glBindTexture(GL_TEXTURE_2D, atlas_texture_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (!atlas_allocated_) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, size, size, 0, GL_RG, GL_UNSIGNED_BYTE, atlas_.data());
+        atlas_allocated_ = true;
+        MemoryBudget::charge(MemoryBudget::Textures, qint64(size) * size * 2);
+        texture_bytes_ += qint64(size) * size * 2;
+    } else {
+        // Only the glyphs added since the last upload
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, size);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, dirty.x(), dirty.y(), dirty.width(), dirty.height(),
+                        GL_RG, GL_UNSIGNED_BYTE, atlas_.data() + (dirty.y() * size + dirty.x()) * 2);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+const QVector<GLuint>& SubtitleRenderer::bitmapTextures(const std::shared_ptr<const SubtitleEvent>& event) {
+    auto it = bitmap_textures_.find(event.get());
+    if (it != bitmap_textures_.end()) return it->textures;
+
+    // First time this event is shown: upload its images once
+    BitmapTextures entry;
+    entry.event = event;
+    for (const SubtitleEvent::Bitmap& bitmap : event->bitmaps) {
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, int(bitmap.image.bytesPerLine() / 4));
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, bitmap.image.width(), bitmap.image.height(), 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, bitmap.image.constBits());
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        entry.textures.append(texture);
+        entry.bytes += qint64(bitmap.image.width()) * bitmap.image.height() * 4;
+    }
+    MemoryBudget::charge(MemoryBudget::Textures, entry.bytes);
+    texture_bytes_ += entry.bytes;
+    return bitmap_textures_.insert(event.get(), entry)->textures;
+}
+
+void SubtitleRenderer::releaseBitmaps(const SubtitleFrame* keep) {
+    for (auto it = bitmap_textures_.begin(); it != bitmap_textures_.end();) {
+        if (keep && keep->events.contains(it->event)) {
+            ++it;
+            continue;
+        }
+        glDeleteTextures(int(it->textures.size()), it->textures.constData());
+        MemoryBudget::release(MemoryBudget::Textures, it->bytes);
+        texture_bytes_ -= it->bytes;
+        it = bitmap_textures_.erase(it);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef SUBTITLE_RENDERER_H
+#define SUBTITLE_RENDERER_H
+
+#include <QHash>
+#include <QOpenGLFunctions>
+#include <QRectF>
+#include <QSize>
+#include <QStringList>
+#include <QVector>
+#include <memory>
+
+#include "GlyphAtlas.h"
+
+class QOpenGLShaderProgram;
+struct SubtitleEvent;
+struct SubtitleFrame;
+
+// Draws the current subtitle frame over the video, inside the video renderer's
+// GL pass. Text goes through the glyph atlas, bitmap events get one texture
+// each, uploaded when the event first shows up. Layout and uploads happen only
+// when the frame or the target size changes; other frames redraw the cached
+// quads, and no subtitle means no GL work at all.
+class SubtitleRenderer : protected QOpenGLFunctions {
+public:
+    SubtitleRenderer();
+    ~SubtitleRenderer();
+
+    void initialize();
+    // Called from synchronize(); nullptr when nothing is on screen
+    void setFrame(std::shared_ptr<const SubtitleFrame> frame);
+    void render(const QSize& target);
+
+private:
+    struct Batch {
+        GLuint texture = 0;
+        int mode = 0;   // 0: atlas text, 1: premultiplied bitmap
+        int first = 0;
+        int count = 0;
+    };
+
+    void rebuild(const QSize& target);
+    void layoutText(const QStringList& paragraphs, const QSize& target);
+    bool layoutLines(const QStringList& paragraphs, int maxWidth, QVector<QVector<uint>>& lines);
+    int lineWidth(const QVector<uint>& line);
+    void addQuad(const QRectF& rect, const QRectF& uv);
+    void uploadAtlas();
+    const QVector<GLuint>& bitmapTextures(const std::shared_ptr<const SubtitleEvent>& event);
+    void releaseBitmaps(const SubtitleFrame* keep);
+
+    bool initialized_ = false;
+    QOpenGLShaderProgram* program_ = nullptr;
+    GLuint vbo_ = 0;
+    GLuint atlas_texture_ = 0;
+    bool atlas_allocated_ = false;
+    qint64 texture_bytes_ = 0;  // atlas and bitmaps, charged to MemoryBudget::Textures
+    GlyphAtlas atlas_;
+
+    std::shared_ptr<const SubtitleFrame> frame_;
+    std::shared_ptr<const SubtitleFrame> built_frame_;
+    QSize built_size_;
+    QVector<float> vertices_;   // x, y in target pixels, u, v
+    QVector<Batch> batches_;
+
+    // Textures of the bitmap events on screen, one per rect. The entry keeps its
+    // event alive so the key cannot be reused by a later event.
+    struct BitmapTextures {
+        std::shared_ptr<const SubtitleEvent> event;
+        QVector<GLuint> textures;
+        qint64 bytes = 0;
+    };
+    QHash<const SubtitleEvent*, BitmapTextures> bitmap_textures_;
+};
+
+#endif
@@ -1,17 +1,24 @@
 #ifndef THREADSAFEQUEUE_H
 #define THREADSAFEQUEUE_H
 
+#include <QDeadlineTimer>
 #include <QMutex>
 #include <QWaitCondition>
 #include <cstddef>
+#include <functional>
 #include <queue>
 
+#include "MemoryBudget.h"
+
 template <typename T>
 class ThreadSafeQueue {
 public:
     explicit ThreadSafeQueue(size_t capacity = 100)
         : capacity_(capacity), stopped_(false) {}
-    ~ThreadSafeQueue() { stop(); }
+    ~ThreadSafeQueue() {
+        stop();
+        MemoryBudget::release(budget_category_, bytes_);
+    }
 
     void push(T value) {
         QMutexLocker locker(&mutex_);
@@ -21,9 +28,21 @@ public:
         if (stopped_) {
             return;
         }
+        account(value, 1);
+        queue_.push(value);
+        size_++;
+        notEmpty_.wakeOne();
+    }
+
+    // Non-blocking push; false when the queue is full or stopped, the caller keeps the value
+    bool tryPush(const T& value) {
+        QMutexLocker locker(&mutex_);
+        if (size_ >= capacity_ || stopped_) return false;
+        account(value, 1);
         queue_.push(value);
         size_++;
         notEmpty_.wakeOne();
+        return true;
     }
 
     bool pop(T& value) {
@@ -36,16 +55,61 @@ public:
         value = std::move(queue_.front());
         queue_.pop();
         size_--;
+        account(value, -1);
+        notFull_.wakeOne();
+        return true;
+    }
+
+    // Like pop(), but gives up after timeoutMs so the caller can re-check its own stop flag
+    bool popFor(T& value, int timeoutMs) {
+        QMutexLocker locker(&mutex_);
+        if (size_ == 0 && !stopped_) {
+            notEmpty_.wait(&mutex_, QDeadlineTimer(timeoutMs));
+        }
+
+        if (stopped_ || size_ == 0) return false;
+        value = std::move(queue_.front());
+        queue_.pop();
+        size_--;
+        account(value, -1);
         notFull_.wakeOne();
         return true;
     }
 
+    // Blocks until an item is queued, the queue is stopped or wake() is called, at
+    // most timeoutMs; true when an item is there. Nothing is taken off the queue.
+    bool waitNotEmpty(int timeoutMs) {
+        QMutexLocker locker(&mutex_);
+        if (size_ == 0 && !stopped_) {
+            notEmpty_.wait(&mutex_, QDeadlineTimer(timeoutMs));
+        }
+        return size_ > 0;
+    }
+
+    // Like waitNotEmpty(), until there is room for an item
+    bool waitNotFull(int timeoutMs) {
+        QMutexLocker locker(&mutex_);
+        if (size_ >= capacity_ && !stopped_) {
+            notFull_.wait(&mutex_, QDeadlineTimer(timeoutMs));
+        }
+        return size_ < capacity_;
+    }
+
+    // Releases threads blocked in waitNotEmpty() or waitNotFull() early, e.g. after
+    // setting a flag they have to see
+    void wake() {
+        QMutexLocker locker(&mutex_);
+        notEmpty_.wakeAll();
+        notFull_.wakeAll();
+    }
+
     bool tryPop(T& value) {
         QMutexLocker locker(&mutex_);
         if (size_ == 0) return false;
         value = std::move(queue_.front());
         queue_.pop();
         size_--;
+        account(value, -1);
         notFull_.wakeOne();
         return true;
     }
@@ -55,6 +119,9 @@ public:
         std::queue<T> empty;
         std::swap(queue_, empty);
         size_ = 0;
+        weight_ = 0;
+        MemoryBudget::release(budget_category_, bytes_);
+        bytes_ = 0;
         notFull_.wakeAll();
     }
 
@@ -70,6 +137,11 @@ public:
         stopped_ = false;
     }
 
+    bool isStopped() const {
+        QMutexLocker locker(&mutex_);
+        return stopped_;
+    }
+
     size_t size() const {
         QMutexLocker locker(&mutex_);
         return size_;
@@ -81,10 +153,57 @@ public:
     }
 
     size_t capacity() const {
+        QMutexLocker locker(&mutex_);
         return capacity_;
     }
 
+    void setCapacity(size_t capacity) {
+        QMutexLocker locker(&mutex_);
+        capacity_ = capacity;
+        notFull_.wakeAll();
+    }
+
+    // Optional per-item weight (e.g. samples or duration); weight() is the sum
+    // over all queued items. Set before the queue is used.
+    void setWeigher(std::function<qint64(const T&)> weigher) {
+        QMutexLocker locker(&mutex_);
+        weigher_ = std::move(weigher);
+    }
+
+    qint64 weight() const {
+        QMutexLocker locker(&mutex_);
+        return weight_;
+    }
+
+    // Optional memory size of an item, summed up by bytes(). With a category the
+    // bytes are charged to the MemoryBudget while the items are queued. Set before
+    // the queue is used.
+    void setSizer(std::function<qint64(const T&)> sizer,
+                  MemoryBudget::Category category = MemoryBudget::CategoryCount) {
+        QMutexLocker locker(&mutex_);
+        sizer_ = std::move(sizer);
+        budget_category_ = category;
+    }
+
+    qint64 bytes() const {
+        QMutexLocker locker(&mutex_);
+        return bytes_;
+    }
+
 private:
+    void account(const T& value, int sign) {
+        if (weigher_) weight_ += sign * weigher_(value);
+        if (sizer_) {
+            const qint64 bytes = sizer_(value);
+            bytes_ += sign * bytes;
+            if (sign > 0) {
+                MemoryBudget::charge(budget_category_, bytes);
+            } else {
+                MemoryBudget::release(budget_category_, bytes);
+            }
+        }
+    }
+
     size_t capacity_;
     bool stopped_;
     mutable QMutex mutex_;
@@ -92,6 +211,11 @@ private:
     QWaitCondition notFull_;
     std::queue<T> queue_;
     size_t size_ = 0;
+    std::function<qint64(const T&)> weigher_;
+    qint64 weight_ = 0;
+    std::function<qint64(const T&)> sizer_;
+    qint64 bytes_ = 0;
+    MemoryBudget::Category budget_category_ = MemoryBudget::CategoryCount;  // none
 };
 
 #endif // THREADSAFEQUEUE_H
\ No newline at end of file
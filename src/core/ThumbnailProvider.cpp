@@ -0,0 +1,324 @@
+#include "ThumbnailProvider.h"
+#include "ConfigManager.h"
+#include "MediaCache.h"
+#include "MediaIO.h"
+#include "MemoryBudget.h"
+#include "ProbeCache.h"
+#include "Utils.h"
+#include <QDebug>
+#include <QFile>
+#include <QQuickTextureFactory>
+#include <QUrl>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+
+namespace {
+constexpr int kDefaultWidth = 160;
+constexpr int kMaxPacketsPerGrab = 600;
+
+class ThumbnailResponse;
+
+// Shared by a response and its job. The engine owns the response and may delete
+// it while the job is still queued or running, so the job only reaches it
+// through here, under the mutex.
+struct ThumbnailJobState {
+    QMutex mutex;
+    ThumbnailResponse* response = nullptr;     // cleared when the response goes away
+    std::atomic<bool> cancelled{false};
+};
+
+class ThumbnailResponse : public QQuickImageResponse {
+public:
+    explicit ThumbnailResponse(std::shared_ptr<ThumbnailJobState> state)
+        : state_(std::move(state)) {
+        state_->response = this;
+    }
+
+    ~ThumbnailResponse() override {
+        QMutexLocker locker(&state_->mutex);
+        state_->response = nullptr;
+        state_->cancelled = true;
+    }
+
+    QQuickTextureFactory* textureFactory() const override {
+        return QQuickTextureFactory::textureFactoryForImage(image_);
+    }
+
+    QString errorString() const override {
+        return image_.isNull() && !state_->cancelled ? QStringLiteral("No thumbnail") : QString();
+    }
+
+    // A cancelled response still finishes, so the engine can clean it up
+    void cancel() override { state_->cancelled = true; }
+
+    // Called by the job with the state's mutex held
+    void finish(const QImage& image) {
+        image_ = image;
+        emit finished();
+    }
+
+private:
+    std::shared_ptr<ThumbnailJobState> state_;
+    QImage image_;
+};
+
+class ThumbnailJob : public QRunnable {
+public:
+    ThumbnailJob(ThumbnailProvider* provider, std::shared_ptr<ThumbnailJobState> state, const QString& source,
+                 qint64 positionMs, const QSize& size)
+        : provider_(provider), state_(std::move(state)), source_(source), position_ms_(positionMs), size_(size) {}
+
+    void run() override {
+        QImage image;
+        if (!state_->cancelled) {
+            image = provider_->thumbnail(source_, position_ms_, size_, state_->cancelled);
+        }
+        QMutexLocker locker(&state_->mutex);
+        if (state_->response) {
+            state_->response->finish(image);
+        }
+    }
+
+private:
+    ThumbnailProvider* provider_;
+    std::shared_ptr<ThumbnailJobState> state_;
+    QString source_;
+    qint64 position_ms_;
+    QSize size_;
+};
+}
+
+// ========== ThumbnailExtractor ==========
+
+ThumbnailExtractor::~ThumbnailExtractor() {
+    close();
+}
+
+void ThumbnailExtractor::close() {
+    av_frame_free(&frame_);
+    av_packet_free(&packet_);
+    sws_freeContext(sws_ctx_);
+    sws_ctx_ = nullptr;
+    avcodec_free_context(&codec_ctx_);
+    avformat_close_input(&format_ctx_);
+    io_.reset();
+    stream_index_ = -1;
+    path_.clear();
+}
+
+bool ThumbnailExtractor::open(const QString& path) {
+    close();
+    path_ = path;
+
+    io_ = MediaIO::create(path);
+    format_ctx_ = avformat_alloc_context();
+    if (io_) {
+        format_ctx_->pb = io_->avioContext();
+        if (format_ctx_->pb) format_ctx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    ProbeCache probe_cache;
+    const bool cached = probe_cache.load(path);
+    QByteArray path_utf8 = path.toUtf8();
+    if (avformat_open_input(&format_ctx_, path_utf8.constData(), cached ? probe_cache.inputFormat() : nullptr,
+                            nullptr) < 0) {
+        format_ctx_ = nullptr;
+        close();
+        return false;
+    }
+    if (!(cached && probe_cache.apply(format_ctx_)) && avformat_find_stream_info(format_ctx_, nullptr) < 0) {
+        close();
+        return false;
+    }
+
+    const AVCodec* codec = nullptr;
+    stream_index_ = av_find_best_stream(format_ctx_, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (stream_index_ < 0 || !codec) {
+        close();
+        return false;
+    }
+    for (unsigned int i = 0; i < format_ctx_->nb_streams; i++) {
+        format_ctx_->streams[i]->discard = (int)i == stream_index_ ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+
+    codec_ctx_ = avcodec_alloc_context3(codec);
+    if (!codec_ctx_ || avcodec_parameters_to_context(codec_ctx_, format_ctx_->streams[stream_index_]->codecpar) < 0) {
+        close();
+        return false;
+    }
+    // One codec thread and keyframes only: previews must not compete with playback
+    codec_ctx_->thread_count = 1;
+    codec_ctx_->skip_frame = AVDISCARD_NONKEY;
+    codec_ctx_->flags2 |= AV_CODEC_FLAG2_FAST;
+    if (avcodec_open2(codec_ctx_, codec, nullptr) < 0) {
+        close();
+        return false;
+    }
+
+    packet_ = av_packet_alloc();
+    frame_ = av_frame_alloc();
+    return packet_ && frame_;
+}
+
+QImage ThumbnailExtractor::grab(qint64 positionMs, const QSize& size, const std::atomic<bool>& cancelled) {
+    if (!codec_ctx_) return QImage();
+
+    AVStream* stream = format_ctx_->streams[stream_index_];
+    int64_t target = av_rescale_q(positionMs, {1, 1000}, stream->time_base);
+    if (stream->start_time != AV_NOPTS_VALUE) {
+        target += stream->start_time;
+    }
+    if (av_seek_frame(format_ctx_, stream_index_, target, AVSEEK_FLAG_BACKWARD) < 0) {
+        return QImage();
+    }
+    avcodec_flush_buffers(codec_ctx_);
+
+    for (int i = 0; i < kMaxPacketsPerGrab && !cancelled; i++) {
+        int ret = av_read_frame(format_ctx_, packet_);
+        if (ret < 0) {
+            // Drain: short files may end before the decoder has output anything
+            avcodec_send_packet(codec_ctx_, nullptr);
+        } else if (packet_->stream_index != stream_index_) {
+            av_packet_unref(packet_);
+            continue;
+        } else {
+            avcodec_send_packet(codec_ctx_, packet_);
+            av_packet_unref(packet_);
+        }
+
+        if (avcodec_receive_frame(codec_ctx_, frame_) == 0) {
+            QImage image = convert(frame_, size);
+            av_frame_unref(frame_);
+            return image;
+        }
+        if (ret < 0) break;
+    }
+    return QImage();
+}
+
+QImage ThumbnailExtractor::convert(const AVFrame* frame, const QSize& size) {
+    QSize target = size.isValid() && !size.isEmpty() ? size : QSize(kDefaultWidth, 0);
+    const QSize source(frame->width, frame->height);
+    if (source.isEmpty()) return QImage();
+    if (target.height() <= 0) {
+        target.setHeight(qMax(1, target.width() * source.height() / source.width()));
+    } else {
+        target = source.scaled(target, Qt::KeepAspectRatio);
+    }
+    target = target.boundedTo(source).expandedTo(QSize(2, 2));
+
+    sws_ctx_ = sws_getCachedContext(sws_ctx_, frame->width, frame->height, AVPixelFormat(frame->format),
+                                    target.width(), target.height(), AV_PIX_FMT_RGB32,
+                                    SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+    if (!sws_ctx_) return QImage();
+
+    QImage image(target, QImage::Format_RGB32);
+    uint8_t* dst[4] = {image.bits(), nullptr, nullptr, nullptr};
+    int dst_stride[4] = {int(image.bytesPerLine()), 0, 0, 0};
+    sws_scale(sws_ctx_, frame->data, frame->linesize, 0, frame->height, dst, dst_stride);
+    return image;
+}
+
+// ========== ThumbnailProvider ==========
+
+ThumbnailProvider::ThumbnailProvider() {
+    ConfigManager& config = ConfigManager::instance();
+    max_cost_kb_ = qBound(1, config.value(QStringLiteral("thumbnails/cacheMB"), 32).toInt(), 1024) * 1024;
+    cache_.setMaxCost(max_cost_kb_);
+    bucket_ms_ = qBound(100, config.value(QStringLiteral("thumbnails/bucketMs"), 1000).toInt(), 60000);
+    persist_ = config.value(QStringLiteral("thumbnails/persist"), false).toBool();
+
+    pool_.setMaxThreadCount(1);
+    pool_.setThreadPriority(QThread::LowPriority);
+}
+
+ThumbnailProvider::~ThumbnailProvider() {
+    pool_.clear();
+    pool_.waitForDone();
+    MemoryBudget::release(MemoryBudget::Caches, charged_bytes_);
+}
+
+QQuickImageResponse* ThumbnailProvider::requestImageResponse(const QString& id, const QSize& requestedSize) {
+    // id is "<ms>/<source>"; the source may itself contain slashes
+    const int slash = id.indexOf(QLatin1Char('/'));
+    const qint64 position_ms = id.left(slash).toLongLong();
+    QString source = slash >= 0 ? id.mid(slash + 1) : QString();
+    if (source.contains(QLatin1Char('%'))) {
+        source = QUrl::fromPercentEncoding(source.toUtf8());
+    }
+
+    auto state = std::make_shared<ThumbnailJobState>();
+    auto* response = new ThumbnailResponse(state);
+    // Newest request first: while scrubbing, the position under the cursor wins
+    pool_.start(new ThumbnailJob(this, state, Utils::toLocalPath(source), position_ms, requestedSize),
+                sequence_.fetch_add(1) & 0x3fffffff);
+    return response;
+}
+
+QImage ThumbnailProvider::thumbnail(const QString& source, qint64 positionMs, const QSize& size,
+                                    const std::atomic<bool>& cancelled) {
+    const qint64 bucket = positionMs / bucket_ms_;
+    const QString key = QStringLiteral("%1|%2|%3x%4").arg(source).arg(bucket).arg(size.width()).arg(size.height());
+
+    {
+        QMutexLocker locker(&mutex_);
+        if (QImage* cached = cache_.object(key)) {
+            return *cached;
+        }
+    }
+
+    const QString disk_path = persist_
+        ? MediaCache::cacheFilePath(QStringLiteral("thumbnails"), source,
+                                    QStringLiteral("-%1-%2.jpg").arg(bucket).arg(size.width()))
+        : QString();
+    QImage image;
+    if (!disk_path.isEmpty() && QFile::exists(disk_path)) {
+        image.load(disk_path);
+    }
+
+    if (image.isNull()) {
+        // The extractor is taken out for the decode, so the cache stays available meanwhile
+        std::unique_ptr<ThumbnailExtractor> extractor;
+        {
+            QMutexLocker locker(&mutex_);
+            extractor = std::move(extractor_);
+        }
+        if (!extractor || extractor->path() != source) {
+            extractor = std::make_unique<ThumbnailExtractor>();
+            if (!extractor->open(source)) {
+                return QImage();
+            }
+        }
+        image = extractor->grab(bucket * bucket_ms_, size, cancelled);
+        {
+            QMutexLocker locker(&mutex_);
+            if (!extractor_) extractor_ = std::move(extractor);
+        }
+        if (image.isNull()) return image;
+        if (!disk_path.isEmpty()) {
+            image.save(disk_path, "JPG", 80);
+        }
+    }
+
+    // Setting a lower limit evicts the least recently used thumbnails right away
+    QMutexLocker locker(&mutex_);
+    cache_.setMaxCost(qMax<qint64>(1024, MemoryBudget::scaled(max_cost_kb_)));
+    cache_.insert(key, new QImage(image), qMax<qsizetype>(1, image.sizeInBytes() / 1024));
+    accountCache();
+    return image;
+}
+
+void ThumbnailProvider::accountCache() {
+    const qint64 bytes = qint64(cache_.totalCost()) * 1024;
+    if (bytes > charged_bytes_) {
+        MemoryBudget::charge(MemoryBudget::Caches, bytes - charged_bytes_);
+    } else {
+        MemoryBudget::release(MemoryBudget::Caches, charged_bytes_ - bytes);
+    }
+    charged_bytes_ = bytes;
+}
@@ -0,0 +1,78 @@
+#ifndef THUMBNAILPROVIDER_H
+#define THUMBNAILPROVIDER_H
+
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+#include <QQuickAsyncImageProvider>
+#include <QRunnable>
+#include <QString>
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+class MediaIO;
+
+// Decodes preview pictures for one file on a context of its own. Only keyframes
+// are decoded (skip_frame = AVDISCARD_NONKEY) on a single codec thread, and
+// frames are scaled down by libswscale's SIMD paths.
+class ThumbnailExtractor {
+public:
+    ~ThumbnailExtractor();
+
+    bool open(const QString& path);
+    QString path() const { return path_; }
+    // Keyframe at or before positionMs scaled to fit size; null image on failure
+    QImage grab(qint64 positionMs, const QSize& size, const std::atomic<bool>& cancelled);
+
+private:
+    void close();
+    QImage convert(const AVFrame* frame, const QSize& size);
+
+    QString path_;
+    std::unique_ptr<MediaIO> io_;
+    AVFormatContext* format_ctx_ = nullptr;
+    AVCodecContext* codec_ctx_ = nullptr;
+    SwsContext* sws_ctx_ = nullptr;
+    AVPacket* packet_ = nullptr;
+    AVFrame* frame_ = nullptr;
+    int stream_index_ = -1;
+};
+
+// "image://thumbnail/<ms>/<source>" for the seek bar. Requests run one at a time
+// on a low-priority pool, newest first, so fast scrubbing stays responsive and
+// playback decoding keeps the CPU. QML cancels outdated requests itself.
+// Results are kept in a memory-bounded LRU cache, optionally also on disk; the
+// cache shrinks under memory pressure (see MemoryBudget).
+class ThumbnailProvider : public QQuickAsyncImageProvider {
+public:
+    ThumbnailProvider();
+    ~ThumbnailProvider() override;
+
+    QQuickImageResponse* requestImageResponse(const QString& id, const QSize& requestedSize) override;
+
+    // Called on the pool thread
+    QImage thumbnail(const QString& source, qint64 positionMs, const QSize& size,
+                     const std::atomic<bool>& cancelled);
+
+private:
+    void accountCache();
+
+    QThreadPool pool_;
+    std::atomic<int> sequence_{0};
+
+    QMutex mutex_;                      // the cache and the idle extractor; never held while decoding
+    QCache<QString, QImage> cache_;     // cost in KB
+    int max_cost_kb_ = 0;
+    qint64 charged_bytes_ = 0;
+    std::unique_ptr<ThumbnailExtractor> extractor_;
+    int bucket_ms_ = 1000;
+    bool persist_ = false;
+};
+
+#endif // THUMBNAILPROVIDER_H
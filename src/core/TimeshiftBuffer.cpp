@@ -0,0 +1,202 @@
+#include "TimeshiftBuffer.h"
+#include "MediaCache.h"
+#include <QByteArray>
+#include <QDebug>
+#include <cstring>
+
+extern "C" {
+#include <libavcodec/packet.h>
+#include <libavformat/avformat.h>
+}
+
+TimeshiftBuffer::~TimeshiftBuffer() {
+    close();
+}
+
+bool TimeshiftBuffer::open(AVFormatContext* formatContext, int clockStream, qint64 windowMs, qint64 capacityBytes) {
+    close();
+    if (!formatContext || clockStream < 0 || windowMs <= 0 || capacityBytes <= 0) return false;
+
+    // The ring lives next to the other media caches and is removed with this object
+    file_ = std::make_unique<QTemporaryFile>(MediaCache::cacheDirectory(QStringLiteral("timeshift")) +
+                                             QStringLiteral("/ring-XXXXXX"));
+    if (!file_->open()) {
+        qWarning() << "TimeshiftBuffer: cannot create ring file" << file_->fileTemplate();
+        file_.reset();
+        return false;
+    }
+
+    format_context_ = formatContext;
+    clock_stream_ = clockStream;
+    window_limit_ms_ = windowMs;
+    capacity_ = capacityBytes;
+    return true;
+}
+
+void TimeshiftBuffer::close() {
+    file_.reset();
+    format_context_ = nullptr;
+    clock_stream_ = -1;
+    entries_.clear();
+    first_serial_ = 0;
+    cursor_ = 0;
+    write_offset_ = 0;
+    last_ms_ = 0;
+    window_ms_ = 0;
+    delay_ms_ = 0;
+}
+
+qint64 TimeshiftBuffer::packetMs(const AVPacket* packet) const {
+    const int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+    if (ts == AV_NOPTS_VALUE) return last_ms_;
+    return av_rescale_q(ts, format_context_->streams[packet->stream_index]->time_base, {1, 1000});
+}
+
+void TimeshiftBuffer::append(const AVPacket* packet) {
+    if (!isOpen() || !packet || packet->size <= 0) return;
+    QMutexLocker lock(&mutex_);
+
+    // Side data (new extradata, parameter changes, ...) follows the payload as
+    // (type, size, bytes) records
+    QByteArray side_data;
+    for (int i = 0; i < packet->side_data_elems; i++) {
+        const AVPacketSideData& item = packet->side_data[i];
+        const qint32 header[2] = {qint32(item.type), qint32(item.size)};
+        side_data.append(reinterpret_cast<const char*>(header), sizeof(header));
+        side_data.append(reinterpret_cast<const char*>(item.data), qsizetype(item.size));
+    }
+    const qint64 total = qint64(packet->size) + side_data.size();
+    if (total > capacity_) return;
+
+    evict(total);
+    if (!writeAt(write_offset_, reinterpret_cast<const char*>(packet->data), packet->size)) return;
+    if (!side_data.isEmpty() && !writeAt(write_offset_ + packet->size, side_data.constData(), int(side_data.size()))) return;
+
+    Entry entry;
+    entry.offset = write_offset_;
+    entry.size = packet->size;
+    entry.sideDataSize = int(side_data.size());
+    entry.streamIndex = packet->stream_index;
+    entry.flags = packet->flags;
+    entry.pts = packet->pts;
+    entry.dts = packet->dts;
+    entry.duration = packet->duration;
+    entry.ms = packetMs(packet);
+    entry.key = packet->stream_index == clock_stream_ && (packet->flags & AV_PKT_FLAG_KEY);
+    entries_.push_back(entry);
+    write_offset_ += total;
+    if (packet->stream_index == clock_stream_) {
+        last_ms_ = entry.ms;
+    }
+    updateStats();
+}
+
+void TimeshiftBuffer::evict(qint64 incomingBytes) {
+    // Drop what the new packet will overwrite and whatever fell out of the window
+    const qint64 overwritten_below = write_offset_ + incomingBytes - capacity_;
+    while (!entries_.empty() &&
+           (entries_.front().offset < overwritten_below || last_ms_ - entries_.front().ms > window_limit_ms_)) {
+        entries_.pop_front();
+        first_serial_++;
+    }
+}
+
+bool TimeshiftBuffer::writeAt(qint64 offset, const char* data, int size) {
+    // A packet crossing the end of the ring continues at its start
+    const qint64 physical = offset % capacity_;
+    const qint64 first = qMin<qint64>(size, capacity_ - physical);
+    if (!file_->seek(physical) || file_->write(data, first) != first) return false;
+    if (first < size && (!file_->seek(0) || file_->write(data + first, size - first) != size - first)) return false;
+    return true;
+}
+
+bool TimeshiftBuffer::readAt(qint64 offset, char* data, int size) {
+    const qint64 physical = offset % capacity_;
+    const qint64 first = qMin<qint64>(size, capacity_ - physical);
+    if (!file_->seek(physical) || file_->read(data, first) != first) return false;
+    if (first < size && (!file_->seek(0) || file_->read(data + first, size - first) != size - first)) return false;
+    return true;
+}
+
+bool TimeshiftBuffer::readNext(AVPacket* packet) {
+    if (!isOpen()) return false;
+    QMutexLocker lock(&mutex_);
+
+    // A paused reader that fell out of the window resumes at the oldest keyframe
+    if (cursor_ < first_serial_) {
+        cursor_ = keyframeSerialBefore(entries_.empty() ? 0 : entries_.front().ms);
+        if (cursor_ < first_serial_) cursor_ = first_serial_;
+    }
+    if (cursor_ - first_serial_ >= qint64(entries_.size())) {
+        delay_ms_ = 0;
+        return false;
+    }
+
+    const Entry& entry = entries_[cursor_ - first_serial_];
+    if (av_new_packet(packet, entry.size) < 0) return false;
+    if (!readAt(entry.offset, reinterpret_cast<char*>(packet->data), entry.size)) {
+        qWarning() << "TimeshiftBuffer: ring read failed";
+        av_packet_unref(packet);
+        return false;
+    }
+    if (entry.sideDataSize > 0 && !readSideData(entry, packet)) {
+        qWarning() << "TimeshiftBuffer: ring read failed";
+        av_packet_unref(packet);
+        return false;
+    }
+    packet->stream_index = entry.streamIndex;
+    packet->flags = entry.flags;
+    packet->pts = entry.pts;
+    packet->dts = entry.dts;
+    packet->duration = entry.duration;
+    cursor_++;
+    updateStats();
+    return true;
+}
+
+bool TimeshiftBuffer::readSideData(const Entry& entry, AVPacket* packet) {
+    QByteArray side_data(entry.sideDataSize, Qt::Uninitialized);
+    if (!readAt(entry.offset + entry.size, side_data.data(), entry.sideDataSize)) return false;
+
+    qsizetype position = 0;
+    qint32 header[2];
+    while (position + qsizetype(sizeof(header)) <= side_data.size()) {
+        std::memcpy(header, side_data.constData() + position, sizeof(header));
+        position += sizeof(header);
+        if (header[1] < 0 || position + header[1] > side_data.size()) return false;
+        uint8_t* data = av_packet_new_side_data(packet, AVPacketSideDataType(header[0]), size_t(header[1]));
+        if (!data) return false;
+        std::memcpy(data, side_data.constData() + position, size_t(header[1]));
+        position += header[1];
+    }
+    return true;
+}
+
+qint64 TimeshiftBuffer::keyframeSerialBefore(qint64 positionMs) const {
+    // Newest clock keyframe at or before the position, else the oldest one
+    qint64 oldest = -1;
+    for (qint64 i = qint64(entries_.size()) - 1; i >= 0; i--) {
+        const Entry& entry = entries_[i];
+        if (!entry.key) continue;
+        if (entry.ms <= positionMs) return first_serial_ + i;
+        oldest = first_serial_ + i;
+    }
+    return oldest >= 0 ? oldest : first_serial_;
+}
+
+void TimeshiftBuffer::seek(qint64 positionMs) {
+    if (!isOpen()) return;
+    QMutexLocker lock(&mutex_);
+    cursor_ = keyframeSerialBefore(positionMs == kLiveEdge ? last_ms_ : positionMs);
+    updateStats();
+}
+
+void TimeshiftBuffer::updateStats() {
+    window_ms_ = entries_.empty() ? 0 : qMax<qint64>(0, last_ms_ - entries_.front().ms);
+    const qint64 pending = cursor_ - first_serial_;
+    if (pending >= 0 && pending < qint64(entries_.size())) {
+        delay_ms_ = qMax<qint64>(0, last_ms_ - entries_[pending].ms);
+    } else {
+        delay_ms_ = 0;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef TIMESHIFTBUFFER_H
+#define TIMESHIFTBUFFER_H
+
+#include <QMutex>
+#include <QTemporaryFile>
+#include <QtGlobal>
+#include <atomic>
+#include <deque>
+#include <limits>
+#include <memory>
+
+struct AVFormatContext;
+struct AVPacket;
+
+// Stream-copy recorder for live sources. Demuxed packets are appended unchanged,
+// side data included, to a fixed-size ring file on disk; an in-memory index
+// keeps their timestamps, flags and ring offsets. Playback reads packets back through a cursor, so it
+// can pause, rewind and catch up with live while recording carries on.
+// append() runs on the recording thread, readNext() and seek() on the demuxer
+// thread; open() and close() only while no recording thread is running.
+class TimeshiftBuffer {
+public:
+    static constexpr qint64 kLiveEdge = std::numeric_limits<qint64>::max();
+
+    TimeshiftBuffer() = default;
+    ~TimeshiftBuffer();
+
+    // clockStream provides the timeline and the keyframes that seeks land on
+    bool open(AVFormatContext* formatContext, int clockStream, qint64 windowMs, qint64 capacityBytes);
+    void close();
+    bool isOpen() const { return format_context_ != nullptr; }
+
+    void append(const AVPacket* packet);
+    // Next packet after the cursor; false when playback has caught up with live
+    bool readNext(AVPacket* packet);
+    // Move the cursor to the last keyframe at or before positionMs (stream time);
+    // kLiveEdge jumps to the newest keyframe
+    void seek(qint64 positionMs);
+
+    qint64 windowMs() const { return window_ms_; }   // recorded span
+    qint64 delayMs() const { return delay_ms_; }     // playback cursor behind live
+
+private:
+    struct Entry {
+        qint64 offset;      // logical byte offset, physical = offset % capacity
+        int size;           // payload; the side data records follow it in the ring
+        int sideDataSize;
+        int streamIndex;
+        int flags;
+        qint64 pts;
+        qint64 dts;
+        qint64 duration;
+        qint64 ms;          // stream time of the packet
+        bool key;           // keyframe of the clock stream
+    };
+
+    qint64 packetMs(const AVPacket* packet) const;
+    void evict(qint64 incomingBytes);
+    bool writeAt(qint64 offset, const char* data, int size);
+    bool readAt(qint64 offset, char* data, int size);
+    bool readSideData(const Entry& entry, AVPacket* packet);
+    qint64 keyframeSerialBefore(qint64 positionMs) const;
+    void updateStats();
+
+    AVFormatContext* format_context_ = nullptr;
+    int clock_stream_ = -1;
+    qint64 window_limit_ms_ = 0;
+    qint64 capacity_ = 0;
+    std::unique_ptr<QTemporaryFile> file_;
+
+    QMutex mutex_;              // guards the index and the ring file below
+    std::deque<Entry> entries_;
+    qint64 first_serial_ = 0;   // serial number of entries_.front()
+    qint64 cursor_ = 0;         // serial number of the next packet to play
+    qint64 write_offset_ = 0;   // logical bytes written so far
+    qint64 last_ms_ = 0;
+
+    std::atomic<qint64> window_ms_{0};
+    std::atomic<qint64> delay_ms_{0};
+};
+
+#endif // TIMESHIFTBUFFER_H
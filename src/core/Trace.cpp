@@ -0,0 +1,229 @@
+#include "Trace.h"
+
+#include <QDebug>
+
+std::atomic<bool> Trace::enabled_{false};
+
+#ifdef QMLPLAYER_TRACING
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QFile>
+#include <QMutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace {
+
+constexpr quint64 kRingSize = 1 << 15;  // events kept per thread, ~1.3 MB
+constexpr size_t kMaxBuffers = 64;      // beyond this, buffers of exited threads are reused
+
+struct Event {
+    const char* category;
+    const char* name;
+    qint64 ts_ns;
+    qint64 value;   // duration for spans, the sample for counters
+    char phase;     // 'X' span, 'C' counter
+};
+
+// Written by its thread only; dump() reads the published part
+struct ThreadBuffer {
+    std::unique_ptr<Event[]> events{new Event[kRingSize]};
+    std::atomic<quint64> written{0};
+    std::atomic<quint64> cleared{0};    // events before this index are not dumped
+    std::atomic<const char*> name{nullptr};
+    std::atomic<bool> retired{false};   // its thread has exited
+    int tid = 0;
+};
+
+QMutex g_registry_mutex;
+std::vector<std::unique_ptr<ThreadBuffer>> g_buffers;
+int g_next_tid = 1;
+
+const auto g_origin = std::chrono::steady_clock::now();
+
+ThreadBuffer* registerThread() {
+    QMutexLocker locker(&g_registry_mutex);
+    ThreadBuffer* buffer = nullptr;
+    if (g_buffers.size() >= kMaxBuffers) {
+        for (const auto& candidate : g_buffers) {
+            if (candidate->retired.load()) {
+                buffer = candidate.get();
+                break;
+            }
+        }
+    }
+    if (buffer) {
+        // Restarted pipeline threads come and go; the oldest events make way
+        buffer->cleared = buffer->written.load();
+        buffer->name = nullptr;
+        buffer->retired = false;
+    } else {
+        g_buffers.push_back(std::make_unique<ThreadBuffer>());
+        buffer = g_buffers.back().get();
+    }
+    buffer->tid = g_next_tid++;
+    return buffer;
+}
+
+// The buffer is only created once the thread records something, so naming
+// threads costs nothing while tracing is off
+struct ThreadSlot {
+    ThreadBuffer* buffer = nullptr;
+    const char* name = nullptr;
+    ~ThreadSlot() {
+        if (buffer) buffer->retired = true;
+    }
+    ThreadBuffer* get() {
+        if (!buffer) {
+            buffer = registerThread();
+            buffer->name = name;
+        }
+        return buffer;
+    }
+};
+
+thread_local ThreadSlot t_slot;
+
+void record(const char* category, const char* name, qint64 ts_ns, qint64 value, char phase) {
+    ThreadBuffer* buffer = t_slot.get();
+    const quint64 index = buffer->written.load(std::memory_order_relaxed);
+    Event& event = buffer->events[index & (kRingSize - 1)];
+    event.category = category;
+    event.name = name;
+    event.ts_ns = ts_ns;
+    event.value = value;
+    event.phase = phase;
+    buffer->written.store(index + 1, std::memory_order_release);
+}
+
+void appendString(QByteArray& out, const char* text) {
+    out.append('"');
+    for (const char* c = text ? text : ""; *c; c++) {
+        if (*c == '"' || *c == '\\') out.append('\\');
+        out.append(*c);
+    }
+    out.append('"');
+}
+
+void appendUs(QByteArray& out, qint64 ns) {
+    out.append(QByteArray::number(ns / 1000.0, 'f', 3));
+}
+
+} // namespace
+
+bool Trace::isAvailable() {
+    return true;
+}
+
+void Trace::setEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void Trace::setThreadName(const char* name) {
+    t_slot.name = name;
+    if (t_slot.buffer) t_slot.buffer->name = name;
+}
+
+qint64 Trace::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_origin).count();
+}
+
+void Trace::complete(const char* category, const char* name, qint64 startNs, qint64 endNs) {
+    record(category, name, startNs, endNs - startNs, 'X');
+}
+
+void Trace::counter(const char* category, const char* name, qint64 value) {
+    record(category, name, nowNs(), value, 'C');
+}
+
+void Trace::clear() {
+    QMutexLocker locker(&g_registry_mutex);
+    for (const auto& buffer : g_buffers) {
+        buffer->cleared = buffer->written.load();
+    }
+}
+
+bool Trace::dump(const QString& path) {
+    QByteArray out;
+    out.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    bool first = true;
+    const auto separate = [&out, &first]() {
+        if (!first) out.append(",\n");
+        first = false;
+    };
+
+    QMutexLocker locker(&g_registry_mutex);
+    for (const auto& buffer : g_buffers) {
+        const quint64 end = buffer->written.load(std::memory_order_acquire);
+        quint64 begin = buffer->cleared.load();
+        // The writer may be overwriting the oldest slots right now; leave them out
+        if (end - begin > kRingSize - kRingSize / 16) begin = end - (kRingSize - kRingSize / 16);
+        const QByteArray tid = QByteArray::number(buffer->tid);
+
+        if (const char* name = buffer->name.load()) {
+            separate();
+            out.append("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":").append(pid)
+               .append(",\"tid\":").append(tid).append(",\"args\":{\"name\":");
+            appendString(out, name);
+            out.append("}}");
+        }
+        for (quint64 i = begin; i < end; i++) {
+            const Event& event = buffer->events[i & (kRingSize - 1)];
+            separate();
+            out.append("{\"ph\":\"").append(event.phase).append("\",\"cat\":");
+            appendString(out, event.category);
+            out.append(",\"name\":");
+            appendString(out, event.name);
+            out.append(",\"pid\":").append(pid).append(",\"tid\":").append(tid).append(",\"ts\":");
+            appendUs(out, event.ts_ns);
+            if (event.phase == 'X') {
+                out.append(",\"dur\":");
+                appendUs(out, event.value);
+                out.append('}');
+            } else {
+                out.append(",\"args\":{\"value\":").append(QByteArray::number(event.value)).append("}}");
+            }
+        }
+    }
+    locker.unlock();
+    out.append("\n]}\n");
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(out) != out.size()) {
+        qWarning() << "Trace: cannot write" << path;
+        return false;
+    }
+    return true;
+}
+
+#else
+
+bool Trace::isAvailable() {
+    return false;
+}
+
+void Trace::setEnabled(bool enabled) {
+    if (enabled) qWarning() << "Trace: not built in, configure with -DQMLPLAYER_TRACING=ON";
+}
+
+void Trace::setThreadName(const char*) {}
+
+bool Trace::dump(const QString& path) {
+    qWarning() << "Trace: not built in, nothing written to" << path;
+    return false;
+}
+
+void Trace::clear() {}
+
+void Trace::complete(const char*, const char*, qint64, qint64) {}
+
+void Trace::counter(const char*, const char*, qint64) {}
+
+qint64 Trace::nowNs() {
+    return 0;
+}
+
+#endif // QMLPLAYER_TRACING
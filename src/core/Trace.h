@@ -0,0 +1,76 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+
+// Timeline instrumentation in the Chrome trace event format, for chrome://tracing
+// and ui.perfetto.dev. Spans and counters go into a ring buffer per thread,
+// without locks or allocation on the recording path; dump() merges the buffers
+// into one JSON file. Each thread keeps its most recent events only, so a dump
+// right after a stutter shows the seconds leading up to it.
+//
+// Only built with -DQMLPLAYER_TRACING=ON; otherwise the TRACE_* macros expand to
+// nothing and isAvailable() is false. When built in, nothing is recorded until
+// setEnabled(true), and a disabled macro costs one relaxed atomic load.
+// Categories and names must be string literals (or otherwise outlive the trace).
+class Trace {
+public:
+    static bool isAvailable();
+    static bool isEnabled() { return enabled_.load(std::memory_order_relaxed); }
+    static void setEnabled(bool enabled);
+
+    // Labels the calling thread's track
+    static void setThreadName(const char* name);
+    // Everything recorded since the last clear(); false if the file could not be written
+    static bool dump(const QString& path);
+    static void clear();
+
+    // Recording, any thread; the TRACE_* macros below are the usual way in
+    static void complete(const char* category, const char* name, qint64 startNs, qint64 endNs);
+    static void counter(const char* category, const char* name, qint64 value);
+    static qint64 nowNs();
+
+private:
+    static std::atomic<bool> enabled_;
+};
+
+#ifdef QMLPLAYER_TRACING
+
+class TraceScope {
+public:
+    TraceScope(const char* category, const char* name)
+        : category_(category)
+        , name_(name)
+        , start_ns_(Trace::isEnabled() ? Trace::nowNs() : -1) {}
+    ~TraceScope() {
+        if (start_ns_ >= 0) Trace::complete(category_, name_, start_ns_, Trace::nowNs());
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* category_;
+    const char* name_;
+    qint64 start_ns_;
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+// A span from here to the end of the enclosing block
+#define TRACE_SCOPE(category, name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(category, name)
+// A sample on a counter track; value is only evaluated while tracing
+#define TRACE_COUNTER(category, name, value) \
+    do { if (Trace::isEnabled()) Trace::counter(category, name, qint64(value)); } while (0)
+#define TRACE_THREAD_NAME(name) Trace::setThreadName(name)
+
+#else
+
+#define TRACE_SCOPE(category, name) do {} while (0)
+#define TRACE_COUNTER(category, name, value) do {} while (0)
+#define TRACE_THREAD_NAME(name) do {} while (0)
+
+#endif // QMLPLAYER_TRACING
+
+#endif // TRACE_H
@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <QString>
+#include <QUrl>
 #include <QtGlobal>
 
 namespace Utils {
@@ -20,6 +21,14 @@ inline QString formatTimeMs(qint64 ms)
         .arg(seconds, 2, 10, QLatin1Char('0'));
 }
 
+// Convert a "file:" URL coming from QML into a local path; other sources are returned unchanged
+inline QString toLocalPath(const QString& source)
+{
+    if (source.startsWith(QLatin1String("file:"), Qt::CaseInsensitive))
+        return QUrl(source).toLocalFile();
+    return source;
+}
+
 inline qreal scaleToRange(qreal value, qreal inMin, qreal inMax, qreal outMin, qreal outMax)
 {
     if (qFuzzyCompare(inMax, inMin))
@@ -1,6 +1,11 @@
 #include "VideoDecoder.h"
+#include "AVDemuxer.h"
+#include "MemoryBudget.h"
+#include "PlayerStats.h"
+#include "Trace.h"
 #include <QSize>
 #include <QDateTime>
+#include <QElapsedTimer>
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -8,9 +13,22 @@ extern "C" {
 #include <libavutil/avutil.h>
 }
 
+namespace {
+// A frame handed to the renderer later than this after its due time counts as late
+constexpr qint64 kLateFrameMs = 40;
+}
+
 VideoDecoder::VideoDecoder(QObject *parent)
-    : QThread(parent)
+    : PipelineStage(parent)
 {
+    frame_queue_.setSizer([](AVFrame* const& frame) -> qint64 {
+        qint64 bytes = 0;
+        for (int i = 0; frame && i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+            bytes += frame->buf[i]->size;
+        }
+        return bytes;
+    }, MemoryBudget::VideoFrames);
+
     // Initialize FFmpeg (once globally)
     static bool ffmpeg_initialized = false;
     if (!ffmpeg_initialized) {
@@ -74,6 +92,17 @@ bool VideoDecoder::open(AVFormatContext* formatCtx, int streamIndex) {
         cleanup();
         return false;
     }
+    if (executor()) {
+        // On a shared pool the parallelism comes from decoding many streams side by
+        // side; codec threads on top of that would only oversubscribe the cores
+        codec_context_->thread_count = 1;
+    } else if (codec_threads_ >= 0) {
+        codec_context_->thread_count = codec_threads_;
+    }
+#if QMLPLAYER_HAS_COPY_OPAQUE
+    // Frames keep the seek serial of their packets (AVDemuxer::frameSerial)
+    codec_context_->flags |= AV_CODEC_FLAG_COPY_OPAQUE;
+#endif
     
     if (avcodec_open2(codec_context_, codec, nullptr) < 0) {
         emit errorOccurred("Failed to open video codec");
@@ -111,108 +140,170 @@ void VideoDecoder::setPacketQueue(ThreadSafeQueue<AVPacket*>* queue) {
     packet_queue_ = queue;
 }
 
+void VideoDecoder::skipFramesBefore(quint64 serial, int64_t pts) {
+    // Never pair the new target with the old serial
+    skip_before_pts_ = AV_NOPTS_VALUE;
+    skip_serial_ = serial;
+    skip_before_pts_ = pts;
+}
+
 void VideoDecoder::flush() {
     flush_requested_ = true;
+    if (stats_) stats_->addDroppedFrames(qint64(frame_queue_.size()));
     frame_queue_.clear();
     if (codec_context_) {
         avcodec_flush_buffers(codec_context_);
     }
-    // flush_requested_ will be reset by run() after it detects the flag
+    if (packet_queue_) packet_queue_->wake();
+    // flush_requested_ will be reset by step() after it detects the flag
 }
 
 void VideoDecoder::requestStop() {
     stop_requested_ = true;
     frame_queue_.stop();
+    if (packet_queue_) packet_queue_->wake();
+}
+
+bool VideoDecoder::waitForWork(int timeoutMs) {
+    packet_queue_->waitNotEmpty(timeoutMs);
+    return true;
 }
 
-void VideoDecoder::run() {
+bool VideoDecoder::begin() {
     if (!packet_queue_ || !codec_context_) {
         emit errorOccurred("VideoDecoder not properly initialized");
-        return;
+        return false;
     }
     
-    AVFrame* decoded_frame = av_frame_alloc();
-    if (!decoded_frame) {
+    decoded_frame_ = av_frame_alloc();
+    if (!decoded_frame_) {
         emit errorOccurred("Failed to allocate decoded frame");
-        return;
+        return false;
+    }
+    start_time_ = -1;
+    first_pts_ = -1;
+    return true;
+}
+
+void VideoDecoder::end() {
+    av_frame_free(&pending_frame_);
+    av_frame_free(&decoded_frame_);
+}
+
+PipelineStep VideoDecoder::step() {
+    if (stop_requested_) return PipelineStep::done();
+
+    if (flush_requested_) {
+        start_time_ = -1;
+        first_pts_ = -1;
+        if (pending_frame_ && stats_) stats_->addDroppedFrames(1);
+        av_frame_free(&pending_frame_);
+        flush_requested_ = false;
+        return PipelineStep::again();
     }
     
-    qint64 start_time = -1;
-    qint64 first_pts = -1;
-    
-    while (!stop_requested_) {
-        if (flush_requested_) {
-            start_time = -1;
-            first_pts = -1;
-            flush_requested_ = false;
-            continue;
-        }
-        
-        if (state_ != Playing) {
-            start_time = -1;
-            first_pts = -1;
-            QThread::msleep(10);
-            continue;
-        }
-        
-        AVPacket* packet = nullptr;
-        if (!packet_queue_->tryPop(packet)) {
-            QThread::msleep(5);
-            continue;
+    if (state_ != Playing) {
+        start_time_ = -1;
+        first_pts_ = -1;
+        return PipelineStep::sleep(10);
+    }
+
+    if (pending_frame_) {
+        return presentPending();
+    }
+
+    QElapsedTimer codec_timer;
+    codec_timer.start();
+    int ret = 0;
+    {
+        TRACE_SCOPE("video", "receive");
+        ret = avcodec_receive_frame(codec_context_, decoded_frame_);
+    }
+    decode_ns_ += codec_timer.nsecsElapsed();
+    if (ret == 0) {
+        if (stats_) stats_->recordDecodeTime(decode_ns_ / 1000);
+        decode_ns_ = 0;
+        if (skip_before_pts_ != AV_NOPTS_VALUE && AVDemuxer::frameSerial(decoded_frame_) >= skip_serial_) {
+            const int64_t pts = decoded_frame_->best_effort_timestamp;
+            if (pts != AV_NOPTS_VALUE && pts < skip_before_pts_) {
+                av_frame_unref(decoded_frame_);
+                return PipelineStep::again();
+            }
+            skip_before_pts_ = AV_NOPTS_VALUE;
         }
-        
-        if (!packet) {
-            continue;
+        pending_pts_ = 0;
+        if (decoded_frame_->pts != AV_NOPTS_VALUE) {
+            pending_pts_ = av_rescale_q(decoded_frame_->pts, time_base_, {1, 1000});
         }
-        
-        int ret = avcodec_send_packet(codec_context_, packet);
-        av_packet_free(&packet);
-        
-        if (ret < 0) {
-            continue;
+        // Moving the references over allocates only the frame itself, where a
+        // clone would also allocate a reference per plane and side data entry
+        pending_frame_ = av_frame_alloc();
+        if (!pending_frame_) {
+            av_frame_unref(decoded_frame_);
+            return PipelineStep::again();
         }
-        
-        while (ret >= 0 && !stop_requested_) {
-            ret = avcodec_receive_frame(codec_context_, decoded_frame);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                break;
-            }
-            if (ret < 0) {
-                break;
-            }
-            
-            qint64 pts_ms = 0;
-            if (decoded_frame->pts != AV_NOPTS_VALUE) {
-                pts_ms = av_rescale_q(decoded_frame->pts, time_base_, {1, 1000});
-            }
-            
-            // Frame rate control
-            qint64 now = QDateTime::currentMSecsSinceEpoch();
-            if (start_time < 0) {
-                start_time = now;
-                first_pts = pts_ms;
-            } else {
-                qint64 elapsed = now - start_time;
-                qint64 target = pts_ms - first_pts;
-                if (target > elapsed) {
-                    QThread::msleep(target - elapsed);
-                }
-            }
-            
-            AVFrame* output_frame = av_frame_clone(decoded_frame);
-            if (output_frame) {
-                if (position_ != pts_ms) {
-                    position_ = pts_ms;
-                    emit positionChanged(position_);
-                }
-                frame_queue_.push(output_frame);
-                emit frameReady(output_frame);
-            }
-            av_frame_unref(decoded_frame);
+        av_frame_move_ref(pending_frame_, decoded_frame_);
+        return presentPending();
+    }
+    if (ret == AVERROR_EOF) {
+        // Drained after the end-of-stream marker; ready for more packets should the demuxer seek back
+        avcodec_flush_buffers(codec_context_);
+        emit endOfStream();
+        return PipelineStep::again();
+    }
+
+    // The codec wants input
+    AVPacket* packet = nullptr;
+    if (!packet_queue_->tryPop(packet)) {
+        return PipelineStep::wait(5);
+    }
+    // A null packet marks the end of the stream and makes the codec drain its last frames
+    codec_timer.restart();
+#if !QMLPLAYER_HAS_COPY_OPAQUE
+    if (packet) codec_context_->reordered_opaque = int64_t(reinterpret_cast<uintptr_t>(packet->opaque));
+#endif
+    {
+        TRACE_SCOPE("video", "send");
+        avcodec_send_packet(codec_context_, packet);
+    }
+    decode_ns_ += codec_timer.nsecsElapsed();
+    av_packet_free(&packet);
+    return PipelineStep::again();
+}
+
+PipelineStep VideoDecoder::presentPending() {
+    // Frame rate control: hold the frame until its time has come, without
+    // blocking the thread (or pool worker) running this stage
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (!paced_ || start_time_ < 0) {
+        // Unpaced: keep the reference current so re-enabling pacing starts from here
+        start_time_ = now;
+        first_pts_ = pending_pts_;
+    } else {
+        qint64 elapsed = now - start_time_;
+        qint64 target = pending_pts_ - first_pts_;
+        if (target > elapsed) {
+            return PipelineStep::sleep(target - elapsed);
         }
     }
-    
-    av_frame_free(&decoded_frame);
+
+    if (!frame_queue_.tryPush(pending_frame_)) {
+        // The renderer has not caught up yet
+        return PipelineStep::sleep(2);
+    }
+    // Late: the codec or a full frame queue held the frame past its time
+    if (stats_ && now - start_time_ - (pending_pts_ - first_pts_) > kLateFrameMs) {
+        stats_->addLateFrame();
+    }
+    TRACE_COUNTER("queue", "video frames", frame_queue_.size());
+    AVFrame* output_frame = pending_frame_;
+    pending_frame_ = nullptr;
+    if (position_ != pending_pts_) {
+        position_ = pending_pts_;
+        emit positionChanged(position_);
+    }
+    emit frameReady(output_frame);
+    return PipelineStep::again();
 }
 
 bool VideoDecoder::hasVideo() const {
@@ -1,7 +1,6 @@
 #ifndef VIDEODECODER_H
 #define VIDEODECODER_H
 
-#include <QThread>
 #include <QString>
 #include <QMutex>
 #include <atomic>
@@ -12,9 +11,12 @@ extern "C" {
 #include <libswscale/swscale.h>
 }
 
+#include "PipelineStage.h"
 #include "ThreadSafeQueue.h"
 
-class VideoDecoder : public QThread
+class PlayerStats;
+
+class VideoDecoder : public PipelineStage
 {
     Q_OBJECT
     Q_PROPERTY(PlaybackState state READ state NOTIFY stateChanged)
@@ -28,7 +30,8 @@ public:
     enum PlaybackState {
         Stopped,
         Playing,
-        Paused
+        Paused,
+        Buffering   // reported by VideoRenderer while a network source refills
     };
     Q_ENUM(PlaybackState)
     explicit VideoDecoder(QObject *parent = nullptr);
@@ -38,6 +41,13 @@ public:
     void close();
     
     void setPacketQueue(ThreadSafeQueue<AVPacket*>* queue);
+    // Decode times, late and dropped frames; set before start()
+    void setStats(PlayerStats* stats) { stats_ = stats; }
+    // Unpaced decoders hand out frames as fast as they are decoded (benchmarks, offline work)
+    void setPaced(bool paced) { paced_ = paced; }
+    // Codec threads for the next open(); 0 lets FFmpeg pick, -1 keeps the codec default.
+    // Ignored on a shared executor, which always decodes single-threaded.
+    void setCodecThreads(int count) { codec_threads_ = count; }
     
     ThreadSafeQueue<AVFrame*>& frameQueue() { return frame_queue_; }
     
@@ -45,6 +55,10 @@ public:
     QSize videoSize() const;
     
     void flush();
+    // Frames demuxed under seek serial `serial` or later are dropped until one at or
+    // past pts (stream time base) arrives, so playback resumes exactly there rather
+    // than at the keyframe before it; AV_NOPTS_VALUE cancels
+    void skipFramesBefore(quint64 serial, int64_t pts);
     void requestStop();
 
     PlaybackState state() const;
@@ -61,10 +75,15 @@ signals:
     void positionChanged(qint64 position);
     void metadataChanged();
     void frameReady(AVFrame* frame);
+    // The last frame of the stream has been queued
+    void endOfStream();
     void errorOccurred(const QString& error);
 
 protected:
-    void run() override;
+    bool begin() override;
+    void end() override;
+    PipelineStep step() override;
+    bool waitForWork(int timeoutMs) override;
 
 public slots:
     void play();
@@ -74,6 +93,7 @@ public slots:
 private:
     void cleanup();
     void setState(PlaybackState state);
+    PipelineStep presentPending();
 
     AVCodecContext* codec_context_ = nullptr;
     ThreadSafeQueue<AVPacket*>* packet_queue_ = nullptr;
@@ -81,8 +101,23 @@ private:
     AVRational time_base_{};
     std::atomic<bool> stop_requested_{false};
     std::atomic<bool> flush_requested_{false};
+    std::atomic<quint64> skip_serial_{0};
+    std::atomic<int64_t> skip_before_pts_{AV_NOPTS_VALUE};
     mutable QMutex mutex_;
 
+    // Step state: the decoded frame waiting for its presentation time, and the
+    // wall clock / stream time pair the pacing is measured from
+    AVFrame* decoded_frame_ = nullptr;
+    AVFrame* pending_frame_ = nullptr;
+    qint64 pending_pts_ = 0;
+    qint64 start_time_ = -1;
+    qint64 first_pts_ = -1;
+
+    PlayerStats* stats_ = nullptr;
+    std::atomic<bool> paced_{true};
+    int codec_threads_ = -1;
+    qint64 decode_ns_ = 0;  // codec time spent since the last decoded frame
+
     PlaybackState state_ = Stopped;
     qint64 duration_ = 0;
     qint64 position_ = 0;
@@ -2,7 +2,18 @@
 #include "VideoDecoder.h"
 #include "AVDemuxer.h"
 #include "AudioDecoder.h"
+#include "SubtitleDecoder.h"
+#include "SubtitleRenderer.h"
 #include "AudioOutput.h"
+#include "SpectrumAnalyzer.h"
+#include "ConfigManager.h"
+#include "FrameStepper.h"
+#include "MemoryBudget.h"
+#include "PipelineExecutor.h"
+#include "PlayerStats.h"
+#include "Trace.h"
+#include "Utils.h"
+#include "YuvPacker.h"
 #include <QQuickFramebufferObject>
 #include <QOpenGLFramebufferObject>
 #include <QOpenGLShaderProgram>
@@ -11,23 +22,23 @@
 #include <QDebug>
 #include <QObject>
 #include <QString>
-#include <QFile>
 #include <QUrl>
+#include <QVariantMap>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QDir>
+#include <QStandardPaths>
+#include <initializer_list>
+#include <utility>
 #include <gl/gl.h>
 
 extern "C" {
 #include <libavutil/frame.h>
 }
 
-// Utility: load shader file
-static QString loadShader(const QString& path) {
-    QFile file(path);
-    if (!file.open(QIODevice::ReadOnly)) {
-        qWarning() << "Failed to load shader:" << path;
-        return QString();
-    }
-    return file.readAll();
-}
+// How long before the end of an item the next playlist entry is opened
+static constexpr qint64 kPlaylistPrerollMs = 5000;
 
 class GLVideoRenderer : protected QOpenGLFunctions {
 public:
@@ -36,15 +47,20 @@ public:
 
     void initialize();
     void updateTextures(AVFrame* frame);
-    void render();
+    void setSubtitleFrame(std::shared_ptr<const SubtitleFrame> frame);
+    void render(const QSize& target);
 
 private:
+    SubtitleRenderer subtitles_;
+    YuvPacker packer_;
     bool initialized_;
+    bool failed_ = false;       // shaders did not build; reported once, never retried
     GLuint textureY_;
     GLuint textureU_;
     GLuint textureV_;
-    GLuint shaderProgram_;
+    QOpenGLShaderProgram* program_;
     GLuint vbo_;
+    qint64 texture_bytes_ = 0;  // charged to MemoryBudget::Textures
 };
 
 GLVideoRenderer::GLVideoRenderer()
@@ -52,7 +68,7 @@ GLVideoRenderer::GLVideoRenderer()
     , textureY_(0)
     , textureU_(0)
     , textureV_(0)
-    , shaderProgram_(0)
+    , program_(nullptr)
     , vbo_(0)
 {
 }
@@ -61,42 +77,32 @@ GLVideoRenderer::~GLVideoRenderer() {
     if (textureY_) glDeleteTextures(1, &textureY_);
     if (textureU_) glDeleteTextures(1, &textureU_);
     if (textureV_) glDeleteTextures(1, &textureV_);
-    if (shaderProgram_) glDeleteProgram(shaderProgram_);
+    delete program_;
     if (vbo_) glDeleteBuffers(1, &vbo_);
+    MemoryBudget::release(MemoryBudget::Textures, texture_bytes_);
 }
 
 void GLVideoRenderer::initialize() {
-    if (initialized_) return;
+    if (initialized_ || failed_) return;
     initializeOpenGLFunctions();
 
-    QString vertexShaderSource = loadShader(":/shaders/vertex.vert");
-    QString fragmentShaderSource = loadShader(":/shaders/fragment.frag");
-    
-    if (vertexShaderSource.isEmpty() || fragmentShaderSource.isEmpty()) {
-        qCritical() << "Failed to load shader files";
-        return;
+    {
+        // Cacheable shaders: Qt keeps the linked program binary on disk, keyed by the
+        // GL renderer, driver version and shader source, so only the very first start
+        // on a machine compiles and links
+        TRACE_SCOPE("render", "build shaders");
+        program_ = new QOpenGLShaderProgram();
+        if (!program_->addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, QStringLiteral(":/shaders/vertex.vert")) ||
+            !program_->addCacheableShaderFromSourceFile(QOpenGLShader::Fragment, QStringLiteral(":/shaders/fragment.frag")) ||
+            !program_->link()) {
+            qCritical() << "GLVideoRenderer: failed to build shaders, video output disabled" << program_->log();
+            delete program_;
+            program_ = nullptr;
+            // The same driver fails the same way on every frame
+            failed_ = true;
+            return;
+        }
     }
-    
-    // Compile shaders
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    QByteArray vertexBytes = vertexShaderSource.toUtf8();
-    const char* vertexData = vertexBytes.constData();
-    glShaderSource(vertexShader, 1, &vertexData, nullptr);
-    glCompileShader(vertexShader);
-    
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    QByteArray fragmentBytes = fragmentShaderSource.toUtf8();
-    const char* fragmentData = fragmentBytes.constData();
-    glShaderSource(fragmentShader, 1, &fragmentData, nullptr);
-    glCompileShader(fragmentShader);
-
-    shaderProgram_ = glCreateProgram();
-    glAttachShader(shaderProgram_, vertexShader);
-    glAttachShader(shaderProgram_, fragmentShader);
-    glLinkProgram(shaderProgram_);
-
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
 
     float vertices[] = {
         1.0f,  1.0f, 0.0f, 1.0f, 0.0f,
@@ -113,38 +119,48 @@ void GLVideoRenderer::initialize() {
     glGenTextures(1, &textureU_);
     glGenTextures(1, &textureV_);
 
+    subtitles_.initialize();
     initialized_ = true;
 }
 
 void GLVideoRenderer::updateTextures(AVFrame* frame) {
     if (!frame || !initialized_) return;
-    
-    glBindTexture(GL_TEXTURE_2D, textureY_);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, frame->width, frame->height, 0, GL_RED,
-        GL_UNSIGNED_BYTE, frame->data[0]);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    
-    glBindTexture(GL_TEXTURE_2D, textureU_);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, frame->width / 2, frame->height / 2, 0, GL_RED,
-        GL_UNSIGNED_BYTE, frame->data[1]);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    
-    glBindTexture(GL_TEXTURE_2D, textureV_);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, frame->width / 2, frame->height / 2, 0, GL_RED,
-        GL_UNSIGNED_BYTE, frame->data[2]);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);   
+    if (!packer_.pack(frame)) return;
+
+    // Packed rows of odd width are not 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    const GLuint textures[3] = {textureY_, textureU_, textureV_};
+    qint64 texture_bytes = 0;
+    for (int i = 0; i < 3; i++) {
+        const YuvPacker::Plane& plane = packer_.plane(i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, plane.width, plane.height, 0, GL_RED,
+            GL_UNSIGNED_BYTE, plane.data);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        texture_bytes += qint64(plane.width) * plane.height;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    // One byte per texel; only a change of video size changes the charge
+    if (texture_bytes != texture_bytes_) {
+        MemoryBudget::release(MemoryBudget::Textures, texture_bytes_);
+        MemoryBudget::charge(MemoryBudget::Textures, texture_bytes);
+        texture_bytes_ = texture_bytes;
+    }
+}
+
+void GLVideoRenderer::setSubtitleFrame(std::shared_ptr<const SubtitleFrame> frame) {
+    subtitles_.setFrame(std::move(frame));
 }
 
-void GLVideoRenderer::render() {
+void GLVideoRenderer::render(const QSize& target) {
     if (!initialized_) return;
     
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
     
-    glUseProgram(shaderProgram_);
+    program_->bind();
     glBindBuffer(GL_ARRAY_BUFFER, vbo_);
 
     // Position attribute (location = 0)
@@ -157,19 +173,21 @@ void GLVideoRenderer::render() {
     
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, textureY_);
-    glUniform1i(glGetUniformLocation(shaderProgram_, "yTexture"), 0);
+    program_->setUniformValue("yTexture", 0);
     
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, textureU_);
-    glUniform1i(glGetUniformLocation(shaderProgram_, "uTexture"), 1);
+    program_->setUniformValue("uTexture", 1);
     
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, textureV_);
-    glUniform1i(glGetUniformLocation(shaderProgram_, "vTexture"), 2);
+    program_->setUniformValue("vTexture", 2);
     
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-    
-} 
+
+    // Composited over the picture in the same pass
+    subtitles_.render(target);
+}
 
 VideoRenderer::VideoRenderer(QQuickItem *parent)
     : QQuickFramebufferObject(parent)
@@ -183,30 +201,56 @@ VideoRenderer::VideoRenderer(QQuickItem *parent)
     decoder_ = new VideoDecoder(this);
     audioDecoder_ = new AudioDecoder(this);
     audioOutput_ = new AudioOutput(this);
+    subtitleDecoder_ = new SubtitleDecoder(this);
+    connect(subtitleDecoder_, &SubtitleDecoder::errorOccurred, this, [](const QString& e){ qWarning() << e; });
     glRenderer_ = new GLVideoRenderer();
-    
-    connect(decoder_, &VideoDecoder::frameReady, this, [this](AVFrame* frame) {
-        Q_UNUSED(frame);
-        update(); // Request re-render
+    spectrum_ = new SpectrumAnalyzer(this);
+    stats_ = new PlayerStats(this);
+    stepper_ = new FrameStepper(this);
+    connect(stepper_, &FrameStepper::errorOccurred, this, [](const QString& e){ qWarning() << e; });
+    connect(stepper_, &FrameStepper::stepped, this, [this](qint64 pts, qint64 positionMs) {
+        if (!stepping_) return;
+        step_pts_ = pts;
+        step_position_ms_ = positionMs;
+        emit positionChanged(positionMs);
+        update();
     });
-    connect(decoder_, &VideoDecoder::errorOccurred, this, [](const QString& e){ qWarning() << e; });
+    
+    next_demuxer_ = new AVDemuxer(this);
+    next_decoder_ = new VideoDecoder(this);
+    next_audio_decoder_ = new AudioDecoder(this);
+    shared_decoding_ = ConfigManager::instance().value(QStringLiteral("pipeline/shared"), false).toBool();
+    if (ConfigManager::instance().value(QStringLiteral("trace/enabled"), false).toBool()) {
+        Trace::setEnabled(true);
+    }
+    connectVideoDecoder(decoder_);
+    connectVideoDecoder(next_decoder_);
+    decoder_->setStats(stats_);
+    next_decoder_->setStats(stats_);
+    audioOutput_->setStats(stats_);
+    connect(stats_, &PlayerStats::aboutToSample, this, &VideoRenderer::sampleStats);
 
-    // Forward decoder state/duration/position to QML-facing signals
-    connect(decoder_, &VideoDecoder::stateChanged, this, [this](VideoDecoder::PlaybackState s) {
-        emit stateChanged(static_cast<int>(s));
-        // When entering Playing state, kick the render loop once
-        if (s == VideoDecoder::Playing) {
-            update();
+    connect(audioOutput_, &AudioOutput::latencyChanged, this, &VideoRenderer::audioLatencyChanged);
+
+    // Gapless playlist handoff. The output switches decoders on its own thread
+    // exactly at the end-of-stream marker; the rest of the pipeline follows here.
+    connect(audioOutput_, &AudioOutput::decoderSwitched, this, [this](AudioDecoder* decoder) {
+        if (decoder == audioDecoder_) return;
+        if (decoder == next_audio_decoder_ && next_index_ >= 0) {
+            advancePlaylist(true);
         }
     });
-    connect(decoder_, &VideoDecoder::durationChanged, this, [this](qint64 d) {
-        emit durationChanged(d);
-    });
-    connect(decoder_, &VideoDecoder::positionChanged, this, [this](qint64 p) {
-        emit positionChanged(p);
-    });
-    connect(decoder_, &VideoDecoder::metadataChanged, this, [this]() {
-        emit metadataChanged();
+    connect(audioOutput_, &AudioOutput::endOfStream, this, &VideoRenderer::onCurrentEnded);
+    playlist_timer_ = new QTimer(this);
+    playlist_timer_->setInterval(250);
+    connect(playlist_timer_, &QTimer::timeout, this, &VideoRenderer::checkPlaylist);
+
+    buffer_timer_ = new QTimer(this);
+    buffer_timer_->setInterval(100);
+    connect(buffer_timer_, &QTimer::timeout, this, &VideoRenderer::pollBuffering);
+    // Only feed the analyzer while something in QML is displaying it
+    connect(spectrum_, &SpectrumAnalyzer::activeChanged, this, [this]() {
+        audioOutput_->setSpectrumTap(spectrum_->isActive() ? spectrum_ : nullptr);
     });
     
     // Queue an initial update to start the render loop
@@ -216,17 +260,55 @@ VideoRenderer::VideoRenderer(QQuickItem *parent)
 }
 
 VideoRenderer::~VideoRenderer() {
+    audioOutput_->setSpectrumTap(nullptr);
     closeMedia();
     delete glRenderer_;
 }
 
+void VideoRenderer::connectVideoDecoder(VideoDecoder* decoder) {
+    // Both pipelines stay connected; only the current decoder is forwarded to QML
+    connect(decoder, &VideoDecoder::frameReady, this, [this, decoder](AVFrame* frame) {
+        Q_UNUSED(frame);
+        if (decoder == decoder_) update(); // Request re-render
+    });
+    connect(decoder, &VideoDecoder::errorOccurred, this, [](const QString& e){ qWarning() << e; });
+
+    // Forward decoder state/duration/position to QML-facing signals
+    connect(decoder, &VideoDecoder::stateChanged, this, [this, decoder](VideoDecoder::PlaybackState s) {
+        if (decoder != decoder_) return;
+        emit stateChanged(state());
+        // When entering Playing state, kick the render loop once
+        if (s == VideoDecoder::Playing) {
+            update();
+        }
+    });
+    connect(decoder, &VideoDecoder::durationChanged, this, [this, decoder](qint64 d) {
+        if (decoder == decoder_) emit durationChanged(d);
+    });
+    connect(decoder, &VideoDecoder::positionChanged, this, [this, decoder](qint64 p) {
+        if (decoder == decoder_) emit positionChanged(p);
+    });
+    connect(decoder, &VideoDecoder::metadataChanged, this, [this, decoder]() {
+        if (decoder == decoder_) emit metadataChanged();
+    });
+    connect(decoder, &VideoDecoder::endOfStream, this, [this, decoder]() {
+        // With audio present the audio clock decides when the item is over
+        if (decoder == decoder_ && demuxer_->audioStreamIndex() < 0) onCurrentEnded();
+    });
+}
+
 QString VideoRenderer::source() const {
     return source_;
 }
 
 void VideoRenderer::setSource(const QString& source) {
     if (source_ != source) {
+        stats_->beginLatency(PlayerStats::OpenLatency, 0);
         source_ = source;
+        if (playlist_index_ != playlist_.indexOf(source)) {
+            playlist_index_ = playlist_.indexOf(source);
+            emit playlistIndexChanged();
+        }
         openMedia(source);
         emit sourceChanged();
         update();
@@ -236,19 +318,14 @@ void VideoRenderer::setSource(const QString& source) {
 void VideoRenderer::openMedia(const QString& path) {
     closeMedia();
     
-    QString localPath = path;
-    if (localPath.startsWith(QLatin1String("file:///"), Qt::CaseInsensitive)) {
-        QUrl u(localPath);
-        localPath = u.toLocalFile();
-    } else if (localPath.startsWith(QLatin1String("file:"), Qt::CaseInsensitive)) {
-        QUrl u(localPath);
-        localPath = u.toLocalFile();
-    }
+    const QString localPath = Utils::toLocalPath(path);
     
     if (!demuxer_->open(localPath)) {
         return;
     }
     media_open_ = true;
+    stats_->reset();
+    applyExecution(demuxer_, decoder_, audioDecoder_);
     
     AVFormatContext* ctx = demuxer_->formatContext();
     
@@ -261,6 +338,8 @@ void VideoRenderer::openMedia(const QString& path) {
     // Initialize audio decoder and output
     if (demuxer_->audioStreamIndex() >= 0) {
         audioDecoder_->setPacketQueue(&demuxer_->audioQueue());
+        // Sender and sound card clocks drift apart on long-running live sources
+        audioDecoder_->setDriftCompensation(demuxer_->isLiveSource());
         if (audioDecoder_->open(ctx, demuxer_->audioStreamIndex())) {
             audioOutput_->setVolume(volume_);
             audioOutput_->setMuted(muted_);
@@ -269,19 +348,56 @@ void VideoRenderer::openMedia(const QString& path) {
         }
     }
     
+    emit tracksChanged();
+    emit audioTrackChanged();
+    emit subtitleTrackChanged();
+    emit timeshiftChanged();
+
+    // Network sources prebuffer before the first frame is shown
+    resume_after_buffering_ = true;
+    if (demuxer_->isNetworkSource()) {
+        ConfigManager& config = ConfigManager::instance();
+        StreamBuffer::Watermarks watermarks;
+        watermarks.lowMs = config.value(QStringLiteral("network/lowWatermarkMs"), 300).toLongLong();
+        watermarks.highMs = config.value(QStringLiteral("network/highWatermarkMs"), 3000).toLongLong();
+        watermarks.prebufferMs = config.value(QStringLiteral("network/prebufferMs"), 2000).toLongLong();
+        stream_buffer_.setWatermarks(watermarks);
+        // Let the demuxer read far enough ahead to actually reach the high watermark
+        demuxer_->setTargetBufferMs(qMax(demuxer_->targetBufferMs(), stream_buffer_.watermarks().highMs + 1000));
+        startBuffering();
+    }
+
     // Start all threads
     demuxer_->start();
     if (decoder_->hasVideo()) {
         decoder_->start();
-        decoder_->play();
+        if (!buffering_) {
+            decoder_->play();
+        }
     }
     if (demuxer_->audioStreamIndex() >= 0) {
         audioDecoder_->start();
         audioOutput_->start(audioDecoder_);
+        if (buffering_) {
+            audioOutput_->pause();
+        }
+    }
+    if (playlist_index_ >= 0) {
+        playlist_timer_->start();
     }
 }
 
 void VideoRenderer::closeMedia() {
+    if (playlist_timer_) {
+        playlist_timer_->stop();
+    }
+    if (buffer_timer_) {
+        buffer_timer_->stop();
+    }
+    if (buffering_) {
+        buffering_ = false;
+        emit bufferingChanged();
+    }
     if (audioOutput_) {
         audioOutput_->stop();
     }
@@ -291,9 +407,16 @@ void VideoRenderer::closeMedia() {
     if (decoder_) {
         decoder_->close();
     }
+    endStepping();
+    stepper_->close();
+    displayed_pts_ = AV_NOPTS_VALUE;
+    closeSubtitles();
     if (demuxer_) {
         demuxer_->close();
     }
+    // After the output is stopped, so it cannot be switching to the spare pipeline
+    discardNext();
+    emit timeshiftChanged();
 }
 
 QQuickFramebufferObject::Renderer *VideoRenderer::createRenderer() const {
@@ -301,15 +424,20 @@ QQuickFramebufferObject::Renderer *VideoRenderer::createRenderer() const {
 }
 
 void VideoRenderer::renderToFbo(QOpenGLFramebufferObject* fbo) {
-    Q_UNUSED(fbo);
     if (glRenderer_) {
-        glRenderer_->render();
+        // CPU time to submit the pass; the GPU runs it asynchronously
+        QElapsedTimer timer;
+        timer.start();
+        glRenderer_->render(fbo->size());
+        stats_->recordRenderTime(timer.nsecsElapsed() / 1000);
     }
 }
 
 int VideoRenderer::state() const {
     if (!decoder_)
         return 0;
+    if (buffering_)
+        return VideoDecoder::Buffering;
     return static_cast<int>(decoder_->state());
 }
 
@@ -318,6 +446,7 @@ qint64 VideoRenderer::duration() const {
 }
 
 qint64 VideoRenderer::position() const {
+    if (stepping_) return step_position_ms_;
     return decoder_ ? decoder_->position() : 0;
 }
 
@@ -352,9 +481,20 @@ void VideoRenderer::play() {
         if (source_.isEmpty()) return;
         openMedia(source_);
     }
+    if (stepping_) {
+        // The decoder is still where playback was paused: continue from the stepped frame
+        // instead, without showing the frames between its keyframe and it
+        seekTo(step_position_ms_, step_pts_);
+        return;
+    }
     if (demuxer_ && !demuxer_->isRunning()) {
         demuxer_->start();
     }
+    if (buffering_) {
+        // Playback resumes by itself once the buffer is refilled
+        resume_after_buffering_ = true;
+        return;
+    }
     if (decoder_) {
         if (!decoder_->isRunning()) {
             decoder_->start();
@@ -378,6 +518,10 @@ void VideoRenderer::play() {
 void VideoRenderer::pause() {
     if (!media_open_)
         return;
+    if (buffering_) {
+        resume_after_buffering_ = false;
+        return;
+    }
     if (decoder_)
         decoder_->pause();
     if (audioOutput_)
@@ -387,6 +531,14 @@ void VideoRenderer::pause() {
 void VideoRenderer::stop() {
     if (!media_open_)
         return;
+    if (buffer_timer_) {
+        buffer_timer_->stop();
+    }
+    if (buffering_) {
+        buffering_ = false;
+        emit bufferingChanged();
+    }
+    endStepping();
     // Stop decoders first
     if (decoder_) {
         decoder_->stop();
@@ -401,19 +553,34 @@ void VideoRenderer::stop() {
     if (audioOutput_) {
         audioOutput_->stop();
     }
+    closeSubtitles();
     // Stop demuxer and clear queues
     if (demuxer_) {
         demuxer_->close();
     }
+    discardNext();
     media_open_ = false;
 }
 
 void VideoRenderer::seek(qint64 position) {
+    seekTo(position, AV_NOPTS_VALUE);
+}
+
+void VideoRenderer::seekTo(qint64 position, int64_t exactPts) {
     if (!media_open_ || !demuxer_)
         return;
-    
+    endStepping();
+
+    // Frames read after this seek carry the next serial
+    const quint64 serial = demuxer_->seekSerial() + 1;
+    if (decoder_ && decoder_->hasVideo()) {
+        stats_->beginLatency(PlayerStats::SeekLatency, serial);
+    }
+    if (decoder_) {
+        decoder_->skipFramesBefore(serial, exactPts);
+    }
     // Seek demuxer (clears queues internally)
-    demuxer_->seek(position);
+    demuxer_->seek(position, exactPts != AV_NOPTS_VALUE);
     
     // Flush decoders
     if (decoder_) {
@@ -422,6 +589,13 @@ void VideoRenderer::seek(qint64 position) {
     if (audioDecoder_) {
         audioDecoder_->flush();
     }
+    subtitleDecoder_->flush();
+
+    // The queues were just emptied: refill them before resuming a network source
+    if (demuxer_->isNetworkSource()) {
+        resume_after_buffering_ = true;
+        startBuffering();
+    }
 
     // Ensure threads are running and resume playback
     if (demuxer_ && !demuxer_->isRunning()) {
@@ -431,7 +605,9 @@ void VideoRenderer::seek(qint64 position) {
         if (!decoder_->isRunning()) {
             decoder_->start();
         }
-        decoder_->play();
+        if (!buffering_) {
+            decoder_->play();
+        }
     }
     if (audioDecoder_) {
         if (!audioDecoder_->isRunning()) {
@@ -443,11 +619,44 @@ void VideoRenderer::seek(qint64 position) {
         audioOutput_->start(audioDecoder_);
         audioOutput_->setVolume(volume_);
         audioOutput_->setMuted(muted_);
+        if (buffering_) {
+            audioOutput_->pause();
+        }
     }
 
     update();
 }
 
+void VideoRenderer::stepForward() {
+    step(1);
+}
+
+void VideoRenderer::stepBackward() {
+    step(-1);
+}
+
+void VideoRenderer::step(int direction) {
+    // Live sources cannot be decoded a second time
+    if (!media_open_ || buffering_ || !decoder_->hasVideo() || demuxer_->isLiveSource())
+        return;
+    if (!stepping_) {
+        if (displayed_pts_ == AV_NOPTS_VALUE) return;
+        step_position_ms_ = position();
+        step_pts_ = displayed_pts_;
+        pause();
+        stepping_ = true;
+    }
+    stepper_->setOutputQueue(&decoder_->frameQueue());
+    stepper_->setSource(Utils::toLocalPath(source_));
+    stepper_->step(displayed_pts_, direction);
+}
+
+void VideoRenderer::endStepping() {
+    if (!stepping_) return;
+    stepping_ = false;
+    stepper_->reset();
+}
+
 int VideoRenderer::videoWidth() const {
     return decoder_ ? decoder_->videoWidth() : 0;
 }
@@ -464,6 +673,446 @@ qint64 VideoRenderer::bitrate() const {
     return decoder_ ? decoder_->bitrate() : 0;
 }
 
+QVariantList VideoRenderer::audioTracks() const {
+    QVariantList tracks;
+    if (!demuxer_) return tracks;
+
+    for (const TrackInfo& info : demuxer_->audioTracks()) {
+        QVariantMap track;
+        track.insert(QStringLiteral("index"), info.streamIndex);
+        track.insert(QStringLiteral("codec"), info.codec);
+        track.insert(QStringLiteral("language"), info.language);
+        track.insert(QStringLiteral("title"), info.title);
+        track.insert(QStringLiteral("channels"), info.channels);
+        track.insert(QStringLiteral("sampleRate"), info.sampleRate);
+        tracks.append(track);
+    }
+    return tracks;
+}
+
+int VideoRenderer::audioTrack() const {
+    return demuxer_ ? demuxer_->audioStreamIndex() : -1;
+}
+
+void VideoRenderer::setAudioTrack(int streamIndex) {
+    if (!media_open_ || !demuxer_ || streamIndex == demuxer_->audioStreamIndex())
+        return;
+
+    // Only the audio branch is rebuilt; the format context, demuxer thread and
+    // video decoder keep running
+    const bool paused = decoder_ && decoder_->state() == VideoDecoder::Paused;
+    const qint64 resume_ms = position();
+    audioOutput_->stop();
+    audioDecoder_->close();
+
+    if (!demuxer_->selectAudioStream(streamIndex, resume_ms)) {
+        qWarning() << "VideoRenderer: invalid audio track" << streamIndex;
+    }
+
+    audioDecoder_->setPacketQueue(&demuxer_->audioQueue());
+    if (audioDecoder_->open(demuxer_->formatContext(), demuxer_->audioStreamIndex())) {
+        audioDecoder_->start();
+        audioOutput_->start(audioDecoder_);
+        audioOutput_->setVolume(volume_);
+        audioOutput_->setMuted(muted_);
+        if (paused) {
+            audioOutput_->pause();
+        }
+    } else {
+        qWarning() << "VideoRenderer: failed to open audio decoder";
+    }
+    emit audioTrackChanged();
+}
+
+QVariantList VideoRenderer::subtitleTracks() const {
+    QVariantList tracks;
+    if (!demuxer_) return tracks;
+
+    for (const TrackInfo& info : demuxer_->subtitleTracks()) {
+        QVariantMap track;
+        track.insert(QStringLiteral("index"), info.streamIndex);
+        track.insert(QStringLiteral("codec"), info.codec);
+        track.insert(QStringLiteral("language"), info.language);
+        track.insert(QStringLiteral("title"), info.title);
+        tracks.append(track);
+    }
+    return tracks;
+}
+
+int VideoRenderer::subtitleTrack() const {
+    return subtitleDecoder_->isOpen() && demuxer_ ? demuxer_->subtitleStreamIndex() : -1;
+}
+
+void VideoRenderer::setSubtitleTrack(int streamIndex) {
+    if (streamIndex < 0) streamIndex = -1;
+    if (!media_open_ || !demuxer_ || streamIndex == subtitleTrack())
+        return;
+
+    // Audio and video keep running; only the subtitle branch is rebuilt
+    closeSubtitles();
+    if (!demuxer_->selectSubtitleStream(streamIndex)) {
+        qWarning() << "VideoRenderer: invalid subtitle track" << streamIndex;
+    } else if (streamIndex >= 0) {
+        subtitleDecoder_->setPacketQueue(&demuxer_->subtitleQueue());
+        subtitleDecoder_->setExecutor(decoder_->executor());
+        subtitleDecoder_->setPriority(decode_priority_);
+        if (subtitleDecoder_->open(demuxer_->formatContext(), streamIndex, decoder_->videoSize())) {
+            subtitleDecoder_->start();
+        } else {
+            demuxer_->selectSubtitleStream(-1);
+        }
+    }
+    emit subtitleTrackChanged();
+    update();
+}
+
+void VideoRenderer::closeSubtitles() {
+    if (subtitleDecoder_) {
+        subtitleDecoder_->close();
+    }
+}
+
+bool VideoRenderer::lowLatencyAudio() const {
+    return low_latency_audio_;
+}
+
+void VideoRenderer::setLowLatencyAudio(bool enabled) {
+    if (low_latency_audio_ == enabled) return;
+    low_latency_audio_ = enabled;
+    // Both sides switch at runtime: the decoder re-chunks its next frames and the
+    // output thread rebuilds its sink with the new buffer size
+    audioDecoder_->setLowLatency(enabled);
+    next_audio_decoder_->setLowLatency(enabled);
+    audioOutput_->setLatencyProfile(enabled ? AudioOutput::LowLatency : AudioOutput::DefaultLatency);
+    emit lowLatencyAudioChanged();
+}
+
+qreal VideoRenderer::audioLatency() const {
+    return audioOutput_ ? audioOutput_->outputLatencyMs() : 0.0;
+}
+
+int VideoRenderer::bufferProgress() const {
+    return buffering_ ? stream_buffer_.percent() : 100;
+}
+
+bool VideoRenderer::timeshift() const {
+    return media_open_ && demuxer_ && demuxer_->isTimeshifting();
+}
+
+qint64 VideoRenderer::timeshiftWindow() const {
+    return timeshift() ? demuxer_->timeshiftWindowMs() : 0;
+}
+
+qint64 VideoRenderer::timeshiftDelay() const {
+    return timeshift() ? demuxer_->timeshiftDelayMs() : 0;
+}
+
+void VideoRenderer::goLive() {
+    if (timeshift()) {
+        seek(TimeshiftBuffer::kLiveEdge);
+    }
+}
+
+void VideoRenderer::sampleStats() {
+    if (!media_open_) return;
+
+    auto add_queue = [this](const QString& name, const auto& queue) {
+        stats_->setQueue(name, qint64(queue.size()), qint64(queue.capacity()), queue.bytes());
+    };
+    if (demuxer_->videoStreamIndex() >= 0) {
+        add_queue(QStringLiteral("video packets"), demuxer_->videoQueue());
+        add_queue(QStringLiteral("video frames"), decoder_->frameQueue());
+    }
+    if (demuxer_->audioStreamIndex() >= 0) {
+        add_queue(QStringLiteral("audio packets"), demuxer_->audioQueue());
+        add_queue(QStringLiteral("audio frames"), audioDecoder_->frameQueue());
+    }
+
+    // Positive: the picture is ahead of the sound
+    const qint64 audio_clock = audioOutput_->clockMs();
+    stats_->setAvOffset(decoder_->hasVideo() && audioOutput_->isRunning() && audio_clock >= 0
+        ? qreal(decoder_->position() - audio_clock) : 0.0);
+
+    const DemuxStats demux = demuxer_->demuxStats();
+    const IoStats io = demuxer_->ioStats();
+    QVariantMap map;
+    map.insert(QStringLiteral("packetsRead"), demux.packetsRead);
+    map.insert(QStringLiteral("packetsParked"), demux.packetsParked);
+    map.insert(QStringLiteral("videoUnderruns"), demux.videoUnderruns);
+    map.insert(QStringLiteral("audioUnderruns"), demux.audioUnderruns);
+    map.insert(QStringLiteral("overflowStalls"), demux.overflowStalls);
+    map.insert(QStringLiteral("bufferedMs"), demuxer_->bufferedMs());
+    map.insert(QStringLiteral("ioThroughput"), io.throughputMBps);
+    map.insert(QStringLiteral("ioStallMs"), io.stallMs);
+    if (decoder_->executor()) {
+        const PipelineExecutor* executor = decoder_->executor();
+        map.insert(QStringLiteral("poolThreads"), executor->threadCount());
+        map.insert(QStringLiteral("poolSteps"), executor->stepCount());
+        map.insert(QStringLiteral("poolSteals"), executor->stealCount());
+    }
+    stats_->setDemux(map);
+}
+
+void VideoRenderer::startBuffering() {
+    stream_buffer_.reset();
+    if (decoder_ && decoder_->state() == VideoDecoder::Playing) {
+        decoder_->pause();
+    }
+    if (!buffering_) {
+        buffering_ = true;
+        emit bufferingChanged();
+        emit stateChanged(state());
+    }
+    buffer_timer_->start();
+}
+
+void VideoRenderer::pollBuffering() {
+    if (!media_open_ || !demuxer_) return;
+    if (demuxer_->isTimeshifting()) {
+        // Window and delay move continuously, also while paused
+        emit timeshiftChanged();
+    }
+
+    const int previous_percent = stream_buffer_.percent();
+    if (stream_buffer_.update(demuxer_->bufferedMs(), demuxer_->isEndOfFile(), demuxer_->queuesSaturated())) {
+        setBuffering(stream_buffer_.isBuffering());
+    } else if (buffering_ && stream_buffer_.percent() != previous_percent) {
+        emit bufferingChanged();
+    }
+}
+
+void VideoRenderer::setBuffering(bool buffering) {
+    if (buffering_ == buffering) return;
+
+    if (buffering) {
+        // Underrun: hold the clocks so playback resumes where it stalled
+        resume_after_buffering_ = decoder_->state() != VideoDecoder::Paused;
+        buffering_ = true;
+        decoder_->pause();
+        audioOutput_->pause();
+    } else {
+        buffering_ = false;
+        if (resume_after_buffering_) {
+            if (decoder_->hasVideo()) {
+                decoder_->play();
+            }
+            audioOutput_->resume();
+        }
+    }
+    emit bufferingChanged();
+    emit stateChanged(state());
+}
+
+QStringList VideoRenderer::playlist() const {
+    return playlist_;
+}
+
+void VideoRenderer::setPlaylist(const QStringList& playlist) {
+    if (playlist_ == playlist) return;
+    playlist_ = playlist;
+    emit playlistChanged();
+    if (!playlist_.isEmpty()) {
+        playIndex(0);
+    } else if (playlist_index_ >= 0) {
+        playlist_index_ = -1;
+        discardNext();
+        emit playlistIndexChanged();
+    }
+}
+
+void VideoRenderer::setSharedDecoding(bool shared) {
+    if (shared_decoding_ == shared) return;
+    shared_decoding_ = shared;
+    emit sharedDecodingChanged();
+}
+
+bool VideoRenderer::tracing() const {
+    return Trace::isEnabled();
+}
+
+void VideoRenderer::setTracing(bool enabled) {
+    if (enabled == Trace::isEnabled()) return;
+    if (enabled) Trace::clear();
+    Trace::setEnabled(enabled);  // stays off, with a warning, when not built in
+    if (Trace::isEnabled() == enabled) emit tracingChanged();
+}
+
+QString VideoRenderer::dumpTrace() {
+    const QString path = QDir(QStandardPaths::writableLocation(QStandardPaths::TempLocation)).filePath(
+        QStringLiteral("qmlplayer-trace-%1.json").arg(QDateTime::currentDateTime().toString(QStringLiteral("yyyyMMdd-hhmmss"))));
+    return Trace::dump(path) ? path : QString();
+}
+
+void VideoRenderer::setDecodePriority(int priority) {
+    if (decode_priority_ == priority) return;
+    decode_priority_ = priority;
+    const std::initializer_list<PipelineStage*> stages = {
+        demuxer_, decoder_, audioDecoder_, subtitleDecoder_, next_demuxer_, next_decoder_, next_audio_decoder_};
+    for (PipelineStage* stage : stages) {
+        stage->setPriority(priority);
+    }
+    emit decodePriorityChanged();
+}
+
+void VideoRenderer::applyExecution(AVDemuxer* demuxer, VideoDecoder* decoder, AudioDecoder* audioDecoder) {
+    // Called between open() of the demuxer and of the decoders, with all three stopped
+    PipelineExecutor* executor = shared_decoding_ ? &PipelineExecutor::instance() : nullptr;
+    // Network reads block on the socket, so such demuxers keep a thread of their own
+    demuxer->setExecutor(demuxer->isNetworkSource() ? nullptr : executor);
+    decoder->setExecutor(executor);
+    audioDecoder->setExecutor(executor);
+    for (PipelineStage* stage : std::initializer_list<PipelineStage*>{demuxer, decoder, audioDecoder}) {
+        stage->setPriority(decode_priority_);
+    }
+}
+
+void VideoRenderer::setLoopPlaylist(bool loop) {
+    if (loop_playlist_ == loop) return;
+    loop_playlist_ = loop;
+    emit loopPlaylistChanged();
+}
+
+void VideoRenderer::playIndex(int index) {
+    if (index < 0 || index >= playlist_.size()) return;
+    playlist_index_ = index;
+    source_ = playlist_.at(index);
+    openMedia(source_);
+    emit sourceChanged();
+    emit playlistIndexChanged();
+    update();
+}
+
+void VideoRenderer::next() {
+    const int index = nextIndex();
+    if (index >= 0) playIndex(index);
+}
+
+void VideoRenderer::previous() {
+    if (playlist_.isEmpty()) return;
+    if (playlist_index_ > 0) {
+        playIndex(playlist_index_ - 1);
+    } else if (loop_playlist_) {
+        playIndex(playlist_.size() - 1);
+    }
+}
+
+int VideoRenderer::nextIndex() const {
+    if (playlist_index_ < 0) return -1;
+    if (playlist_index_ + 1 < playlist_.size()) return playlist_index_ + 1;
+    return loop_playlist_ ? 0 : -1;
+}
+
+void VideoRenderer::checkPlaylist() {
+    if (!media_open_ || next_index_ >= 0 || next_failed_) return;
+    if (nextIndex() < 0) return;
+
+    // Pre-roll once the demuxer has read everything, or a few seconds before the end
+    const qint64 remaining = duration() - position();
+    if (demuxer_->isEndOfFile() || (duration() > 0 && remaining < kPlaylistPrerollMs)) {
+        prepareNext();
+    }
+}
+
+void VideoRenderer::prepareNext() {
+    const int index = nextIndex();
+    const QString path = Utils::toLocalPath(playlist_.at(index));
+
+    // Network items cannot be pre-rolled reliably; they are opened at the switch
+    if (path.contains(QLatin1String("://")) || !next_demuxer_->open(path)) {
+        next_failed_ = true;
+        return;
+    }
+    applyExecution(next_demuxer_, next_decoder_, next_audio_decoder_);
+
+    if (next_demuxer_->videoStreamIndex() >= 0) {
+        next_decoder_->setPacketQueue(&next_demuxer_->videoQueue());
+        next_decoder_->open(next_demuxer_->formatContext(), next_demuxer_->videoStreamIndex());
+    }
+    bool has_audio = false;
+    if (next_demuxer_->audioStreamIndex() >= 0) {
+        next_audio_decoder_->setPacketQueue(&next_demuxer_->audioQueue());
+        next_audio_decoder_->setDriftCompensation(false);
+        has_audio = next_audio_decoder_->open(next_demuxer_->formatContext(), next_demuxer_->audioStreamIndex());
+    }
+
+    // Demux and decode ahead: audio fills its frame queue, video waits for play()
+    next_demuxer_->start();
+    if (next_decoder_->hasVideo()) {
+        next_decoder_->start();
+    }
+    if (has_audio) {
+        next_audio_decoder_->start();
+    }
+    next_index_ = index;
+
+    if (has_audio && audioOutput_->isRunning()) {
+        audioOutput_->queueNext(next_audio_decoder_);
+    }
+}
+
+void VideoRenderer::discardNext() {
+    if (!next_demuxer_) return;
+    audioOutput_->queueNext(nullptr);
+    next_audio_decoder_->close();
+    next_decoder_->close();
+    next_demuxer_->close();
+    next_index_ = -1;
+    next_failed_ = false;
+}
+
+void VideoRenderer::onCurrentEnded() {
+    if (next_index_ >= 0) {
+        advancePlaylist(false);
+    } else if (nextIndex() >= 0) {
+        // Nothing pre-rolled (network item or open failure): plain reopen
+        playIndex(nextIndex());
+    }
+}
+
+void VideoRenderer::advancePlaylist(bool audioSwitched) {
+    if (next_index_ < 0) return;
+
+    // Without an audio handoff the output still reads the finished decoder
+    if (!audioSwitched) {
+        audioOutput_->stop();
+    }
+
+    // Subtitles were read from the finished demuxer
+    closeSubtitles();
+    std::swap(demuxer_, next_demuxer_);
+    std::swap(decoder_, next_decoder_);
+    std::swap(audioDecoder_, next_audio_decoder_);
+    playlist_index_ = next_index_;
+    next_index_ = -1;
+    source_ = playlist_.at(playlist_index_);
+
+    // The finished pipeline becomes the spare one. Its last picture stays in the
+    // textures until the new decoder delivers, so there is no black frame.
+    next_audio_decoder_->close();
+    next_decoder_->close();
+    next_demuxer_->close();
+    next_failed_ = false;
+
+    if (decoder_->hasVideo()) {
+        decoder_->play();
+    }
+    if (!audioSwitched && demuxer_->audioStreamIndex() >= 0) {
+        audioOutput_->start(audioDecoder_);
+        audioOutput_->setVolume(volume_);
+        audioOutput_->setMuted(muted_);
+    }
+
+    emit sourceChanged();
+    emit playlistIndexChanged();
+    emit durationChanged(duration());
+    emit metadataChanged();
+    emit tracksChanged();
+    emit audioTrackChanged();
+    emit subtitleTrackChanged();
+    emit stateChanged(state());
+    update();
+}
+
 // ========== VideoRendererInternal implementation ==========
 
 VideoRendererInternal::VideoRendererInternal()
@@ -475,11 +1124,14 @@ VideoRendererInternal::~VideoRendererInternal() {
 }
 
 void VideoRendererInternal::render() {
+    TRACE_SCOPE("render", "render");
     if (!item_) return;
     item_->renderToFbo(framebufferObject());
 }
 
 void VideoRendererInternal::synchronize(QQuickFramebufferObject *item) {
+    TRACE_THREAD_NAME("render");
+    TRACE_SCOPE("render", "synchronize");
     item_ = static_cast<VideoRenderer*>(item);
     
     if (item_->glRenderer_) {
@@ -490,9 +1142,28 @@ void VideoRendererInternal::synchronize(QQuickFramebufferObject *item) {
     if (decoder && decoder->hasVideo() && item_->glRenderer_) {
         AVFrame* frame = nullptr;
         if (decoder->frameQueue().tryPop(frame) && frame) {
+            // Frames are queued once they are due: when the render loop fell behind,
+            // the older ones are skipped so the picture catches up
+            AVFrame* newer = nullptr;
+            while (decoder->frameQueue().tryPop(newer)) {
+                if (!newer) continue;
+                av_frame_free(&frame);
+                frame = newer;
+                item_->stats_->addDroppedFrames(1);
+            }
+            TRACE_SCOPE("render", "upload");
+            QElapsedTimer upload_timer;
+            upload_timer.start();
             item_->glRenderer_->updateTextures(frame);
+            item_->displayed_pts_ = frame->best_effort_timestamp;
+            item_->stats_->recordUploadTime(upload_timer.nsecsElapsed() / 1000);
+            item_->stats_->recordFramePresented(AVDemuxer::frameSerial(frame));
             av_frame_free(&frame);
         }
+        // Same snapshot while the visible subtitles do not change, nullptr without any
+        SubtitleDecoder* subtitles = item_->subtitleDecoder_;
+        item_->glRenderer_->setSubtitleFrame(
+            subtitles->isOpen() ? subtitles->frameAt(item_->position()) : nullptr);
     }
 
     // Request next frame while playing
@@ -5,6 +5,10 @@
 #include <QOpenGLFunctions>
 #include <QObject>
 #include <QString>
+#include <QStringList>
+#include <QVariantList>
+
+#include "StreamBuffer.h"
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -13,8 +17,13 @@ extern "C" {
 class AVDemuxer;
 class VideoDecoder;
 class AudioDecoder;
+class SubtitleDecoder;
 class AudioOutput;
+class FrameStepper;
 class GLVideoRenderer;
+class SpectrumAnalyzer;
+class PlayerStats;
+class QTimer;
 
 class VideoRenderer : public QQuickFramebufferObject {
     Q_OBJECT
@@ -28,6 +37,25 @@ class VideoRenderer : public QQuickFramebufferObject {
     Q_PROPERTY(int videoHeight READ videoHeight NOTIFY metadataChanged)
     Q_PROPERTY(QString videoCodec READ videoCodec NOTIFY metadataChanged)
     Q_PROPERTY(qint64 bitrate READ bitrate NOTIFY metadataChanged)
+    Q_PROPERTY(QVariantList audioTracks READ audioTracks NOTIFY tracksChanged)
+    Q_PROPERTY(int audioTrack READ audioTrack WRITE setAudioTrack NOTIFY audioTrackChanged)
+    Q_PROPERTY(QVariantList subtitleTracks READ subtitleTracks NOTIFY tracksChanged)
+    Q_PROPERTY(int subtitleTrack READ subtitleTrack WRITE setSubtitleTrack NOTIFY subtitleTrackChanged)
+    Q_PROPERTY(bool lowLatencyAudio READ lowLatencyAudio WRITE setLowLatencyAudio NOTIFY lowLatencyAudioChanged)
+    Q_PROPERTY(qreal audioLatency READ audioLatency NOTIFY audioLatencyChanged)
+    Q_PROPERTY(SpectrumAnalyzer* spectrum READ spectrum CONSTANT)
+    Q_PROPERTY(PlayerStats* stats READ stats CONSTANT)
+    Q_PROPERTY(QStringList playlist READ playlist WRITE setPlaylist NOTIFY playlistChanged)
+    Q_PROPERTY(int playlistIndex READ playlistIndex NOTIFY playlistIndexChanged)
+    Q_PROPERTY(bool loopPlaylist READ loopPlaylist WRITE setLoopPlaylist NOTIFY loopPlaylistChanged)
+    Q_PROPERTY(bool buffering READ buffering NOTIFY bufferingChanged)
+    Q_PROPERTY(int bufferProgress READ bufferProgress NOTIFY bufferingChanged)
+    Q_PROPERTY(bool timeshift READ timeshift NOTIFY timeshiftChanged)
+    Q_PROPERTY(qint64 timeshiftWindow READ timeshiftWindow NOTIFY timeshiftChanged)
+    Q_PROPERTY(qint64 timeshiftDelay READ timeshiftDelay NOTIFY timeshiftChanged)
+    Q_PROPERTY(bool sharedDecoding READ sharedDecoding WRITE setSharedDecoding NOTIFY sharedDecodingChanged)
+    Q_PROPERTY(int decodePriority READ decodePriority WRITE setDecodePriority NOTIFY decodePriorityChanged)
+    Q_PROPERTY(bool tracing READ tracing WRITE setTracing NOTIFY tracingChanged)
 
 public:
     explicit VideoRenderer(QQuickItem *parent = nullptr);
@@ -50,11 +78,57 @@ public:
     int videoHeight() const;
     QString videoCodec() const;
     qint64 bitrate() const;
+    QVariantList audioTracks() const;
+    int audioTrack() const;
+    void setAudioTrack(int streamIndex);
+    QVariantList subtitleTracks() const;
+    // Stream index of the shown subtitles, -1 for none
+    int subtitleTrack() const;
+    void setSubtitleTrack(int streamIndex);
+    bool lowLatencyAudio() const;
+    void setLowLatencyAudio(bool enabled);
+    qreal audioLatency() const;
+    SpectrumAnalyzer* spectrum() const { return spectrum_; }
+    PlayerStats* stats() const { return stats_; }
+    QStringList playlist() const;
+    void setPlaylist(const QStringList& playlist);
+    int playlistIndex() const { return playlist_index_; }
+    bool loopPlaylist() const { return loop_playlist_; }
+    void setLoopPlaylist(bool loop);
+    bool buffering() const { return buffering_; }
+    int bufferProgress() const;
+    // Live sources recorded for pause/rewind: recorded span and playback delay behind live, in ms
+    bool timeshift() const;
+    qint64 timeshiftWindow() const;
+    qint64 timeshiftDelay() const;
+    // Demux and decode on the process-wide PipelineExecutor instead of threads of
+    // this item's own (mosaics); applies from the next opened source
+    bool sharedDecoding() const { return shared_decoding_; }
+    void setSharedDecoding(bool shared);
+    // Scheduling priority on the shared pool, e.g. 1 for the focused tile
+    int decodePriority() const { return decode_priority_; }
+    void setDecodePriority(int priority);
+    // Process-wide timeline recording (see Trace); false when not built in
+    bool tracing() const;
+    void setTracing(bool enabled);
 
     Q_INVOKABLE void play();
     Q_INVOKABLE void pause();
     Q_INVOKABLE void stop();
     Q_INVOKABLE void seek(qint64 position);
+    Q_INVOKABLE void playIndex(int index);
+    Q_INVOKABLE void next();
+    Q_INVOKABLE void previous();
+    // Catch up with the live edge of a timeshifted source
+    Q_INVOKABLE void goLive();
+    // Show the next or previous frame and stay paused. Steps back are decoded
+    // from the previous keyframe once per GOP and then served from a cache;
+    // play() continues from the stepped frame.
+    Q_INVOKABLE void stepForward();
+    Q_INVOKABLE void stepBackward();
+    // Writes the recorded timeline as Chrome trace JSON into the temp directory;
+    // the file path, or an empty string on failure
+    Q_INVOKABLE QString dumpTrace();
 
 signals:
     void sourceChanged();
@@ -64,20 +138,83 @@ signals:
     void volumeChanged(qreal volume);
     void mutedChanged(bool muted);
     void metadataChanged();
+    void tracksChanged();
+    void audioTrackChanged();
+    void subtitleTrackChanged();
+    void lowLatencyAudioChanged();
+    void audioLatencyChanged(qreal latencyMs);
+    void bufferingChanged();
+    void timeshiftChanged();
+    void sharedDecodingChanged();
+    void decodePriorityChanged();
+    void tracingChanged();
+    void playlistChanged();
+    void playlistIndexChanged();
+    void loopPlaylistChanged();
 
 private:
     void openMedia(const QString& path);
     void closeMedia();
+    void connectVideoDecoder(VideoDecoder* decoder);
+    void closeSubtitles();
+    void applyExecution(AVDemuxer* demuxer, VideoDecoder* decoder, AudioDecoder* audioDecoder);
+    int nextIndex() const;
+    void checkPlaylist();
+    void prepareNext();
+    void discardNext();
+    void onCurrentEnded();
+    void advancePlaylist(bool audioSwitched);
+    void startBuffering();
+    void pollBuffering();
+    void setBuffering(bool buffering);
+    void sampleStats();
+    void step(int direction);
+    void endStepping();
+    // seek(); with exactPts (video stream time base) set, playback resumes at that
+    // frame instead of at the keyframe before it
+    void seekTo(qint64 position, int64_t exactPts);
 
     QString source_;
     AVDemuxer* demuxer_ = nullptr;
     VideoDecoder* decoder_ = nullptr;
     AudioDecoder* audioDecoder_ = nullptr;
     AudioOutput* audioOutput_ = nullptr;
+    // Follows the current pipeline only; a playlist switch turns subtitles off
+    SubtitleDecoder* subtitleDecoder_ = nullptr;
     GLVideoRenderer* glRenderer_ = nullptr;
+    SpectrumAnalyzer* spectrum_ = nullptr;
+    PlayerStats* stats_ = nullptr;
     qreal volume_ = 0.8;
     bool muted_ = false;
+    bool low_latency_audio_ = false;
     bool media_open_ = false;
+    bool shared_decoding_ = false;
+    int decode_priority_ = 0;
+
+    // Gapless playlist: the next item is opened into a second pipeline shortly
+    // before the current one ends, and the two are swapped at the handoff
+    QStringList playlist_;
+    int playlist_index_ = -1;
+    bool loop_playlist_ = false;
+    AVDemuxer* next_demuxer_ = nullptr;
+    VideoDecoder* next_decoder_ = nullptr;
+    AudioDecoder* next_audio_decoder_ = nullptr;
+    int next_index_ = -1;       // playlist entry loaded into the spare pipeline
+    bool next_failed_ = false;  // pre-roll not possible, reopen at the end instead
+    QTimer* playlist_timer_ = nullptr;
+
+    // Network sources only: playback is held while the packet queues refill
+    StreamBuffer stream_buffer_;
+    QTimer* buffer_timer_ = nullptr;
+    bool buffering_ = false;
+    bool resume_after_buffering_ = true;
+
+    // Frame stepping: while stepping_ the shown frames come from the stepper
+    FrameStepper* stepper_ = nullptr;
+    bool stepping_ = false;
+    qint64 step_position_ms_ = 0;
+    int64_t step_pts_ = AV_NOPTS_VALUE;         // frame of the last step, stream time base
+    int64_t displayed_pts_ = AV_NOPTS_VALUE;    // frame on screen, stream time base; set while rendering
     
     friend class VideoRendererInternal;
 };
@@ -0,0 +1,416 @@
+#include "WaveformAnalyzer.h"
+#include "MediaCache.h"
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <QRunnable>
+#include <QThreadPool>
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
+}
+
+namespace {
+
+constexpr quint32 kCacheMagic = 0x51575646; // "QWVF"
+constexpr quint32 kCacheVersion = 1;
+constexpr int kMinLevelSize = 64;
+constexpr int kFlushPeaks = 1024;
+constexpr int kMinSegmentSeconds = 60;
+// Analysis runs next to playback; leave most of the cores to the decoders
+constexpr int kMaxSegmentWorkers = 4;
+
+// Decodes the audio of [begin_peak_, end_peak_) with a private format context
+class SegmentWorker : public QRunnable {
+public:
+    SegmentWorker(WaveformAnalyzer* analyzer, const QString& filename,
+                  qint64 beginPeak, qint64 endPeak)
+        : analyzer_(analyzer), file_name_(filename),
+          begin_peak_(beginPeak), end_peak_(endPeak) {}
+
+    void run() override {
+        AVFormatContext* format_ctx = nullptr;
+        AVCodecContext* codec_ctx = nullptr;
+        SwrContext* swr_ctx = nullptr;
+
+        QByteArray path = file_name_.toUtf8();
+        bool ok = false;
+        if (avformat_open_input(&format_ctx, path.constData(), nullptr, nullptr) >= 0) {
+            if (avformat_find_stream_info(format_ctx, nullptr) >= 0 &&
+                openDecoder(format_ctx, &codec_ctx, &swr_ctx)) {
+                ok = decodeSegment(format_ctx, codec_ctx, swr_ctx);
+            }
+        }
+        if (!ok && !analyzer_->isCancelled()) {
+            analyzer_->segmentFailed();
+        }
+
+        if (swr_ctx) swr_free(&swr_ctx);
+        if (codec_ctx) avcodec_free_context(&codec_ctx);
+        if (format_ctx) avformat_close_input(&format_ctx);
+    }
+
+private:
+    bool openDecoder(AVFormatContext* format_ctx, AVCodecContext** codec_ctx, SwrContext** swr_ctx) {
+        const AVCodec* codec = nullptr;
+        stream_index_ = av_find_best_stream(format_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0);
+        if (stream_index_ < 0 || !codec) return false;
+
+        // Only the audio track is of interest, let the demuxer skip everything else
+        for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+            format_ctx->streams[i]->discard = (int)i == stream_index_ ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+        }
+
+        *codec_ctx = avcodec_alloc_context3(codec);
+        if (!*codec_ctx) return false;
+        AVStream* stream = format_ctx->streams[stream_index_];
+        if (avcodec_parameters_to_context(*codec_ctx, stream->codecpar) < 0) return false;
+        // Parallelism comes from the segments, keep each decoder single threaded
+        (*codec_ctx)->thread_count = 1;
+        if (avcodec_open2(*codec_ctx, codec, nullptr) < 0) return false;
+
+        // Downmix to mono float at the native rate, min/max are taken on the mix
+        AVChannelLayout mono = AV_CHANNEL_LAYOUT_MONO;
+        if (swr_alloc_set_opts2(swr_ctx, &mono, AV_SAMPLE_FMT_FLT, (*codec_ctx)->sample_rate,
+                                &(*codec_ctx)->ch_layout, (*codec_ctx)->sample_fmt,
+                                (*codec_ctx)->sample_rate, 0, nullptr) < 0) {
+            return false;
+        }
+        return swr_init(*swr_ctx) >= 0;
+    }
+
+    // False when reading stopped on an error before the end of the segment
+    bool decodeSegment(AVFormatContext* format_ctx, AVCodecContext* codec_ctx, SwrContext* swr_ctx) {
+        AVStream* stream = format_ctx->streams[stream_index_];
+        const int sample_rate = codec_ctx->sample_rate;
+        const AVRational sample_tb{1, sample_rate};
+        const int64_t start_time = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+
+        if (begin_peak_ > 0) {
+            int64_t ts = av_rescale_q(begin_peak_ * WaveformAnalyzer::kSamplesPerPeak, sample_tb, stream->time_base);
+            av_seek_frame(format_ctx, stream_index_, start_time + ts, AVSEEK_FLAG_BACKWARD);
+        }
+
+        AVPacket* packet = av_packet_alloc();
+        AVFrame* frame = av_frame_alloc();
+        std::vector<float> samples;
+        qint64 position = -1;
+        bool done = false;
+        int ret = 0;
+
+        while (!done && !analyzer_->isCancelled() && (ret = av_read_frame(format_ctx, packet)) >= 0) {
+            if (packet->stream_index != stream_index_ || avcodec_send_packet(codec_ctx, packet) < 0) {
+                av_packet_unref(packet);
+                continue;
+            }
+            av_packet_unref(packet);
+
+            while (!done && avcodec_receive_frame(codec_ctx, frame) >= 0) {
+                if (position < 0) {
+                    int64_t pts = frame->best_effort_timestamp;
+                    position = pts != AV_NOPTS_VALUE
+                        ? av_rescale_q(pts - start_time, stream->time_base, sample_tb) : 0;
+                }
+
+                samples.resize(swr_get_out_samples(swr_ctx, frame->nb_samples));
+                uint8_t* out = reinterpret_cast<uint8_t*>(samples.data());
+                int converted = swr_convert(swr_ctx, &out, (int)samples.size(),
+                                            (const uint8_t**)frame->extended_data, frame->nb_samples);
+                av_frame_unref(frame);
+                if (converted > 0) {
+                    done = accumulate(samples.data(), converted, position);
+                    position += converted;
+                }
+            }
+        }
+        commitCurrent();
+        flushPending();
+
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        return done || ret >= 0 || ret == AVERROR_EOF;
+    }
+
+    // Returns true once the end of the segment has been reached
+    bool accumulate(const float* samples, int count, qint64 position) {
+        const int spp = WaveformAnalyzer::kSamplesPerPeak;
+        int i = 0;
+        while (i < count) {
+            const qint64 peak = (position + i) / spp;
+            const int run = (int)qMin<qint64>(count - i, (peak + 1) * spp - (position + i));
+            if (peak >= end_peak_) return true;
+
+            float lo = samples[i];
+            float hi = samples[i];
+            for (int k = i + 1; k < i + run; k++) {
+                lo = std::min(lo, samples[k]);
+                hi = std::max(hi, samples[k]);
+            }
+            i += run;
+            if (peak < begin_peak_) continue;
+
+            if (peak != current_peak_) {
+                commitCurrent();
+                current_peak_ = peak;
+                current_ = {toSample(lo), toSample(hi)};
+            } else {
+                current_.min = std::min(current_.min, toSample(lo));
+                current_.max = std::max(current_.max, toSample(hi));
+            }
+        }
+        return false;
+    }
+
+    void commitCurrent() {
+        if (current_peak_ < 0) return;
+        if (!pending_.isEmpty() && current_peak_ != pending_offset_ + pending_.size()) {
+            flushPending();
+        }
+        if (pending_.isEmpty()) pending_offset_ = current_peak_;
+        pending_.append(current_);
+        if (pending_.size() >= kFlushPeaks) flushPending();
+    }
+
+    void flushPending() {
+        if (pending_.isEmpty()) return;
+        analyzer_->storePeaks(pending_offset_, pending_);
+        pending_.clear();
+    }
+
+    static qint16 toSample(float v) {
+        return (qint16)std::clamp(v * 32767.0f, -32768.0f, 32767.0f);
+    }
+
+    WaveformAnalyzer* analyzer_;
+    QString file_name_;
+    qint64 begin_peak_;
+    qint64 end_peak_;
+    int stream_index_ = -1;
+
+    qint64 current_peak_ = -1;
+    WaveformPeak current_;
+    QVector<WaveformPeak> pending_;
+    qint64 pending_offset_ = 0;
+};
+
+}
+
+WaveformAnalyzer::WaveformAnalyzer(QObject *parent)
+    : QThread(parent) {}
+
+WaveformAnalyzer::~WaveformAnalyzer() {
+    cancel();
+}
+
+void WaveformAnalyzer::analyze(const QString& filename) {
+    cancel();
+    {
+        QMutexLocker locker(&mutex_);
+        levels_.clear();
+        sample_rate_ = 0;
+        total_peaks_ = 0;
+    }
+    file_name_ = filename;
+    stored_peaks_ = 0;
+    failed_segments_ = 0;
+    stop_requested_ = false;
+    start(QThread::LowPriority);
+}
+
+void WaveformAnalyzer::cancel() {
+    stop_requested_ = true;
+    if (isRunning()) wait();
+}
+
+int WaveformAnalyzer::levelCount() const {
+    QMutexLocker locker(&mutex_);
+    return levels_.size();
+}
+
+QVector<WaveformPeak> WaveformAnalyzer::level(int index) const {
+    QMutexLocker locker(&mutex_);
+    if (index < 0 || index >= levels_.size()) return {};
+    return levels_.at(index);
+}
+
+qreal WaveformAnalyzer::progress() const {
+    QMutexLocker locker(&mutex_);
+    if (total_peaks_ <= 0) return 0.0;
+    return qMin<qreal>(1.0, qreal(stored_peaks_.load()) / total_peaks_);
+}
+
+void WaveformAnalyzer::storePeaks(qint64 offset, const QVector<WaveformPeak>& peaks) {
+    QMutexLocker locker(&mutex_);
+    if (levels_.isEmpty()) return;
+    QVector<WaveformPeak>& base = levels_[0];
+    const qint64 count = qMin<qint64>(peaks.size(), base.size() - offset);
+    if (offset < 0 || count <= 0) return;
+    std::copy(peaks.constBegin(), peaks.constBegin() + count, base.begin() + offset);
+    stored_peaks_ += count;
+}
+
+bool WaveformAnalyzer::probe(qint64& totalPeaks) {
+    AVFormatContext* format_ctx = nullptr;
+    QByteArray path = file_name_.toUtf8();
+    if (avformat_open_input(&format_ctx, path.constData(), nullptr, nullptr) < 0) {
+        emit errorOccurred("Failed to open file: " + file_name_);
+        return false;
+    }
+
+    bool ok = false;
+    if (avformat_find_stream_info(format_ctx, nullptr) >= 0) {
+        int index = av_find_best_stream(format_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+        if (index >= 0) {
+            AVStream* stream = format_ctx->streams[index];
+            const int sample_rate = stream->codecpar->sample_rate;
+            sample_rate_ = sample_rate;
+            qint64 samples = 0;
+            if (sample_rate > 0 && stream->duration != AV_NOPTS_VALUE) {
+                samples = av_rescale_q(stream->duration, stream->time_base, {1, sample_rate});
+            } else if (sample_rate > 0 && format_ctx->duration != AV_NOPTS_VALUE) {
+                samples = av_rescale(format_ctx->duration, sample_rate, AV_TIME_BASE);
+            }
+            totalPeaks = (samples + kSamplesPerPeak - 1) / kSamplesPerPeak;
+            ok = sample_rate > 0 && totalPeaks > 0;
+        }
+    }
+    avformat_close_input(&format_ctx);
+
+    if (!ok) {
+        emit errorOccurred("No audio stream with a known duration");
+    }
+    return ok;
+}
+
+void WaveformAnalyzer::run() {
+    const QString cache_path = MediaCache::cacheFilePath(QStringLiteral("waveforms"), file_name_,
+                                                         QStringLiteral(".peaks"));
+    if (!cache_path.isEmpty() && loadCache(cache_path)) {
+        stored_peaks_ = total_peaks_;
+        emit peaksUpdated();
+        emit progressChanged(1.0);
+        emit analysisFinished(true);
+        return;
+    }
+
+    qint64 total_peaks = 0;
+    if (!probe(total_peaks)) return;
+    {
+        QMutexLocker locker(&mutex_);
+        levels_ = {QVector<WaveformPeak>(total_peaks)};
+        total_peaks_ = total_peaks;
+    }
+
+    // Split into segments of at least a minute, one per worker. Workers are capped
+    // at half the cores and run at low priority, like thumbnail decoding
+    const int workers = qBound(1, QThread::idealThreadCount() / 2, kMaxSegmentWorkers);
+    const qint64 min_segment = qint64(kMinSegmentSeconds) * sample_rate_ / kSamplesPerPeak;
+    const int segments = (int)qBound<qint64>(1, total_peaks / qMax<qint64>(1, min_segment), workers);
+    QThreadPool pool;
+    pool.setMaxThreadCount(segments);
+    pool.setThreadPriority(QThread::LowPriority);
+    for (int i = 0; i < segments; i++) {
+        qint64 begin = total_peaks * i / segments;
+        qint64 end = total_peaks * (i + 1) / segments;
+        pool.start(new SegmentWorker(this, file_name_, begin, end));
+    }
+
+    while (!pool.waitForDone(100)) {
+        {
+            QMutexLocker locker(&mutex_);
+            buildPyramid();
+        }
+        emit peaksUpdated();
+        emit progressChanged(progress());
+    }
+    if (stop_requested_) return;
+
+    {
+        QMutexLocker locker(&mutex_);
+        buildPyramid();
+    }
+    emit peaksUpdated();
+    emit progressChanged(1.0);
+
+    // Failed segments show as silence; a later run may decode them, so keep them out of the cache
+    if (failed_segments_ > 0) {
+        qWarning() << "WaveformAnalyzer:" << failed_segments_.load() << "segments of" << file_name_
+                   << "could not be decoded";
+    } else if (!cache_path.isEmpty()) {
+        saveCache(cache_path);
+    }
+    emit analysisFinished(false);
+}
+
+void WaveformAnalyzer::buildPyramid() {
+    // mutex_ must be held
+    if (levels_.isEmpty()) return;
+    levels_.resize(1);
+    while (levels_.constLast().size() > kMinLevelSize) {
+        const QVector<WaveformPeak>& prev = levels_.constLast();
+        QVector<WaveformPeak> next((prev.size() + 1) / 2);
+        for (qsizetype i = 0; i < next.size(); i++) {
+            const WaveformPeak& a = prev.at(2 * i);
+            const WaveformPeak& b = 2 * i + 1 < prev.size() ? prev.at(2 * i + 1) : a;
+            next[i] = {std::min(a.min, b.min), std::max(a.max, b.max)};
+        }
+        levels_.append(std::move(next));
+    }
+}
+
+bool WaveformAnalyzer::loadCache(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0, version = 0;
+    qint32 sample_rate = 0, samples_per_peak = 0, level_count = 0;
+    in >> magic >> version >> sample_rate >> samples_per_peak >> level_count;
+    if (magic != kCacheMagic || version != kCacheVersion || samples_per_peak != kSamplesPerPeak ||
+        sample_rate <= 0 || level_count <= 0 || level_count > 64) {
+        return false;
+    }
+
+    QVector<QVector<WaveformPeak>> levels;
+    for (int i = 0; i < level_count; i++) {
+        qint64 size = 0;
+        in >> size;
+        if (in.status() != QDataStream::Ok || size <= 0 || size > (qint64(1) << 28)) return false;
+        QVector<WaveformPeak> level(size);
+        const int bytes = int(size * qint64(sizeof(WaveformPeak)));
+        if (in.readRawData(reinterpret_cast<char*>(level.data()), bytes) != bytes) return false;
+        levels.append(std::move(level));
+    }
+
+    QMutexLocker locker(&mutex_);
+    levels_ = std::move(levels);
+    sample_rate_ = sample_rate;
+    total_peaks_ = levels_.constFirst().size();
+    return true;
+}
+
+void WaveformAnalyzer::saveCache(const QString& path) const {
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "WaveformAnalyzer: cannot write cache" << path;
+        return;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    QMutexLocker locker(&mutex_);
+    out << kCacheMagic << kCacheVersion << qint32(sample_rate_.load()) << qint32(kSamplesPerPeak)
+        << qint32(levels_.size());
+    for (const QVector<WaveformPeak>& level : levels_) {
+        out << qint64(level.size());
+        out.writeRawData(reinterpret_cast<const char*>(level.constData()),
+                         int(level.size() * sizeof(WaveformPeak)));
+    }
+}
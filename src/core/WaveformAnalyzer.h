@@ -0,0 +1,67 @@
+#ifndef WAVEFORMANALYZER_H
+#define WAVEFORMANALYZER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <atomic>
+
+struct WaveformPeak {
+    qint16 min = 0;
+    qint16 max = 0;
+};
+
+// Builds a min/max peak pyramid for the audio track of a file in the background.
+// Level 0 holds one peak per kSamplesPerPeak source samples, every further level
+// halves the resolution of the previous one. Decoding uses its own format
+// contexts, split into segments that are analyzed in parallel, so playback of the
+// same file is not disturbed. Finished pyramids are cached on disk.
+class WaveformAnalyzer : public QThread {
+    Q_OBJECT
+public:
+    static constexpr int kSamplesPerPeak = 256;
+
+    explicit WaveformAnalyzer(QObject *parent = nullptr);
+    ~WaveformAnalyzer();
+
+    void analyze(const QString& filename);
+    void cancel();
+
+    int levelCount() const;
+    QVector<WaveformPeak> level(int index) const;
+    int sampleRate() const { return sample_rate_.load(); }
+    qreal progress() const;
+
+    // Called by segment workers
+    void storePeaks(qint64 offset, const QVector<WaveformPeak>& peaks);
+    // A segment could not be decoded; its peaks stay zero and the result is not cached
+    void segmentFailed() { failed_segments_++; }
+    bool isCancelled() const { return stop_requested_; }
+
+signals:
+    void peaksUpdated();
+    void progressChanged(qreal progress);
+    void analysisFinished(bool fromCache);
+    void errorOccurred(const QString& message);
+
+protected:
+    void run() override;
+
+private:
+    bool probe(qint64& totalPeaks);
+    void buildPyramid();
+    bool loadCache(const QString& path);
+    void saveCache(const QString& path) const;
+
+    QString file_name_;
+    mutable QMutex mutex_;
+    QVector<QVector<WaveformPeak>> levels_;
+    std::atomic<int> sample_rate_{0};
+    qint64 total_peaks_ = 0;
+    std::atomic<qint64> stored_peaks_{0};
+    std::atomic<int> failed_segments_{0};
+    std::atomic<bool> stop_requested_{false};
+};
+
+#endif // WAVEFORMANALYZER_H
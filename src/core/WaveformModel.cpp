@@ -0,0 +1,120 @@
+#include "WaveformModel.h"
+#include "Utils.h"
+#include <QFileInfo>
+#include <algorithm>
+
+WaveformModel::WaveformModel(QObject *parent)
+    : QAbstractListModel(parent)
+    , analyzer_(new WaveformAnalyzer(this))
+{
+    connect(analyzer_, &WaveformAnalyzer::peaksUpdated, this, &WaveformModel::refresh);
+    connect(analyzer_, &WaveformAnalyzer::progressChanged, this, [this](qreal p) {
+        progress_ = p;
+        emit progressChanged();
+    });
+    connect(analyzer_, &WaveformAnalyzer::analysisFinished, this, [this]() {
+        setReady(true);
+    });
+}
+
+WaveformModel::~WaveformModel() {
+    analyzer_->cancel();
+}
+
+int WaveformModel::rowCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : data_.size();
+}
+
+QVariant WaveformModel::data(const QModelIndex& index, int role) const {
+    if (!index.isValid() || index.row() >= data_.size())
+        return QVariant();
+
+    const WaveformPeak& peak = data_.at(index.row());
+    switch (role) {
+    case MinRole:
+        return peak.min / 32768.0;
+    case MaxRole:
+        return peak.max / 32768.0;
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> WaveformModel::roleNames() const {
+    return {
+        {MinRole, "minValue"},
+        {MaxRole, "maxValue"},
+    };
+}
+
+void WaveformModel::setSource(const QString& source) {
+    if (source_ == source) return;
+    source_ = source;
+    emit sourceChanged();
+
+    beginResetModel();
+    data_.fill(WaveformPeak(), bins_);
+    endResetModel();
+    progress_ = 0.0;
+    emit progressChanged();
+    setReady(false);
+
+    // Network streams have no stable identity or duration, only local files are analyzed
+    const QString path = Utils::toLocalPath(source);
+    if (QFileInfo(path).isFile()) {
+        analyzer_->analyze(path);
+    } else {
+        analyzer_->cancel();
+    }
+}
+
+void WaveformModel::setBins(int bins) {
+    bins = qMax(0, bins);
+    if (bins_ == bins) return;
+    bins_ = bins;
+    beginResetModel();
+    data_.fill(WaveformPeak(), bins_);
+    endResetModel();
+    emit binsChanged();
+    refresh();
+}
+
+void WaveformModel::refresh() {
+    if (bins_ <= 0) return;
+
+    // Pick the coarsest pyramid level that still has at least one peak per bin
+    QVector<WaveformPeak> level;
+    for (int i = analyzer_->levelCount() - 1; i >= 0; i--) {
+        level = analyzer_->level(i);
+        if (level.size() >= bins_) break;
+    }
+    if (level.isEmpty()) return;
+
+    int first_changed = -1;
+    int last_changed = -1;
+    for (int bin = 0; bin < bins_; bin++) {
+        const qsizetype begin = level.size() * bin / bins_;
+        const qsizetype end = qMax(begin + 1, level.size() * (bin + 1) / bins_);
+        WaveformPeak peak = level.at(begin);
+        for (qsizetype i = begin + 1; i < end && i < level.size(); i++) {
+            peak.min = std::min(peak.min, level.at(i).min);
+            peak.max = std::max(peak.max, level.at(i).max);
+        }
+        WaveformPeak& current = data_[bin];
+        if (current.min != peak.min || current.max != peak.max) {
+            current = peak;
+            if (first_changed < 0) first_changed = bin;
+            last_changed = bin;
+        }
+    }
+
+    if (first_changed >= 0) {
+        emit dataChanged(index(first_changed), index(last_changed), {MinRole, MaxRole});
+    }
+}
+
+void WaveformModel::setReady(bool ready) {
+    if (ready_ == ready) return;
+    ready_ = ready;
+    emit readyChanged();
+}
@@ -0,0 +1,60 @@
+#ifndef WAVEFORMMODEL_H
+#define WAVEFORMMODEL_H
+
+#include <QAbstractListModel>
+#include <QString>
+#include <QVector>
+
+#include "WaveformAnalyzer.h"
+
+// List model of `bins` min/max pairs spanning the whole file, normalized to [-1, 1].
+// Rows are updated in place while the analyzer progresses so QML can draw the
+// waveform incrementally.
+class WaveformModel : public QAbstractListModel {
+    Q_OBJECT
+    Q_PROPERTY(QString source READ source WRITE setSource NOTIFY sourceChanged)
+    Q_PROPERTY(int bins READ bins WRITE setBins NOTIFY binsChanged)
+    Q_PROPERTY(qreal progress READ progress NOTIFY progressChanged)
+    Q_PROPERTY(bool ready READ ready NOTIFY readyChanged)
+
+public:
+    enum Roles {
+        MinRole = Qt::UserRole + 1,
+        MaxRole
+    };
+
+    explicit WaveformModel(QObject *parent = nullptr);
+    ~WaveformModel() override;
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    QString source() const { return source_; }
+    void setSource(const QString& source);
+    int bins() const { return bins_; }
+    void setBins(int bins);
+    qreal progress() const { return progress_; }
+    bool ready() const { return ready_; }
+
+signals:
+    void sourceChanged();
+    void binsChanged();
+    void progressChanged();
+    void readyChanged();
+
+private slots:
+    void refresh();
+
+private:
+    void setReady(bool ready);
+
+    WaveformAnalyzer* analyzer_;
+    QString source_;
+    int bins_ = 0;
+    qreal progress_ = 0.0;
+    bool ready_ = false;
+    QVector<WaveformPeak> data_;
+};
+
+#endif // WAVEFORMMODEL_H
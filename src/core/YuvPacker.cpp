@@ -0,0 +1,72 @@
+#include "YuvPacker.h"
+
+#include <cstring>
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+YuvPacker::~YuvPacker() {
+    sws_freeContext(sws_ctx_);
+}
+
+bool YuvPacker::pack(const AVFrame* frame) {
+    copied_bytes_ = 0;
+    if (!frame || frame->width <= 0 || frame->height <= 0) return false;
+    const auto format = AVPixelFormat(frame->format);
+    if (format != AV_PIX_FMT_YUV420P && format != AV_PIX_FMT_YUVJ420P) {
+        return convert(frame);
+    }
+
+    const int chroma_width = (frame->width + 1) / 2;
+    const int chroma_height = (frame->height + 1) / 2;
+    const int widths[3] = {frame->width, chroma_width, chroma_width};
+    const int heights[3] = {frame->height, chroma_height, chroma_height};
+
+    size_t needed = 0;
+    for (int i = 0; i < 3; i++) {
+        if (frame->linesize[i] != widths[i]) needed += size_t(widths[i]) * heights[i];
+    }
+    if (buffer_.size() < needed) buffer_.resize(needed);
+
+    uint8_t* out = buffer_.data();
+    for (int i = 0; i < 3; i++) {
+        if (frame->linesize[i] == widths[i]) {
+            planes_[i] = {frame->data[i], widths[i], heights[i]};
+            continue;
+        }
+        // Decoders pad rows for SIMD; negative line sizes are bottom-up pictures
+        const uint8_t* row = frame->data[i];
+        for (int y = 0; y < heights[i]; y++) {
+            memcpy(out + size_t(y) * widths[i], row, size_t(widths[i]));
+            row += frame->linesize[i];
+        }
+        planes_[i] = {out, widths[i], heights[i]};
+        out += size_t(widths[i]) * heights[i];
+    }
+    copied_bytes_ = int64_t(needed);
+    return true;
+}
+
+bool YuvPacker::convert(const AVFrame* frame) {
+    const int chroma_width = (frame->width + 1) / 2;
+    const int chroma_height = (frame->height + 1) / 2;
+    sws_ctx_ = sws_getCachedContext(sws_ctx_, frame->width, frame->height, AVPixelFormat(frame->format),
+                                    frame->width, frame->height, AV_PIX_FMT_YUV420P,
+                                    SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (!sws_ctx_) return false;
+
+    const size_t luma = size_t(frame->width) * frame->height;
+    const size_t chroma = size_t(chroma_width) * chroma_height;
+    if (buffer_.size() < luma + 2 * chroma) buffer_.resize(luma + 2 * chroma);
+    uint8_t* dst[4] = {buffer_.data(), buffer_.data() + luma, buffer_.data() + luma + chroma, nullptr};
+    int dst_stride[4] = {frame->width, chroma_width, chroma_width, 0};
+    if (sws_scale(sws_ctx_, frame->data, frame->linesize, 0, frame->height, dst, dst_stride) <= 0) {
+        return false;
+    }
+    planes_[0] = {dst[0], frame->width, frame->height};
+    planes_[1] = {dst[1], chroma_width, chroma_height};
+    planes_[2] = {dst[2], chroma_width, chroma_height};
+    copied_bytes_ = int64_t(luma + 2 * chroma);
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef YUVPACKER_H
+#define YUVPACKER_H
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+struct SwsContext;
+
+// Prepares decoded pictures for the three single-channel textures of the video
+// shader: 8-bit 4:2:0 planes without row padding. Planes that already are tight
+// are used in place, padded rows are packed into a buffer that is reused from
+// frame to frame, and other pixel formats are converted with swscale first.
+class YuvPacker {
+public:
+    struct Plane {
+        const uint8_t* data = nullptr;
+        int width = 0;
+        int height = 0;
+    };
+
+    YuvPacker() = default;
+    ~YuvPacker();
+    YuvPacker(const YuvPacker&) = delete;
+    YuvPacker& operator=(const YuvPacker&) = delete;
+
+    // False for frames that cannot be shown (no picture, hardware surfaces).
+    // The planes stay valid until the next pack() and, when used in place,
+    // as long as the frame.
+    bool pack(const AVFrame* frame);
+    const Plane& plane(int index) const { return planes_[index]; }
+    // Bytes written by the last pack(); 0 when every plane was used in place
+    int64_t copiedBytes() const { return copied_bytes_; }
+
+private:
+    bool convert(const AVFrame* frame);
+
+    Plane planes_[3];
+    std::vector<uint8_t> buffer_;
+    SwsContext* sws_ctx_ = nullptr;
+    int64_t copied_bytes_ = 0;
+};
+
+#endif // YUVPACKER_H
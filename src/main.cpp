@@ -1,14 +1,48 @@
+#include <QElapsedTimer>
 #include <QGuiApplication>
 #include <QQmlApplicationEngine>
+#include <QQmlComponent>
 #include <QQmlContext>
 #include <QtQml/qqml.h>
 #include <QJSEngine>
 #include <QQuickWindow>
 #include <QSurfaceFormat>
+#include <memory>
 #include "core/VideoRenderer.h"
 #include "core/ConfigBridge.h"
+#include "core/ConfigManager.h"
+#include "core/PlayerStats.h"
+#include "core/SpectrumAnalyzer.h"
+#include "core/ThumbnailProvider.h"
+#include "core/WaveformModel.h"
+
+// "startup/report": how long until the window showed its first frame and, when the
+// last file is reopened at startup, until its first video frame
+static void reportStartup(QQuickWindow* window, const QElapsedTimer* startup, qint64 appMs, qint64 qmlMs) {
+    auto window_shown = std::make_shared<bool>(false);
+    QObject::connect(window, &QQuickWindow::frameSwapped, qApp, [=]() {
+        if (*window_shown) return;
+        *window_shown = true;
+        qInfo().noquote() << QStringLiteral("Startup: application %1 ms, QML loaded %2 ms, window shown %3 ms")
+            .arg(appMs).arg(qmlMs).arg(startup->elapsed());
+    }, Qt::QueuedConnection);
+
+    VideoRenderer* renderer = window->findChild<VideoRenderer*>();
+    if (!renderer) return;
+    auto video_shown = std::make_shared<bool>(false);
+    QObject::connect(renderer->stats(), &PlayerStats::latencyMeasured, qApp,
+                     [=](PlayerStats::LatencyKind kind, qreal ms) {
+        if (kind != PlayerStats::OpenLatency || *video_shown) return;
+        *video_shown = true;
+        qInfo().noquote() << QStringLiteral("Startup: first video frame %1 ms (%2 ms after opening)")
+            .arg(startup->elapsed()).arg(qRound(ms));
+    }, Qt::QueuedConnection);
+}
 
 int main(int argc, char *argv[]) {
+    QElapsedTimer startup;
+    startup.start();
+
     // Configure OpenGL surface format (no explicit version/profile)
     QSurfaceFormat format;
     format.setDepthBufferSize(24);
@@ -25,7 +59,13 @@ int main(int argc, char *argv[]) {
     QCoreApplication::setApplicationName(QStringLiteral("QMLPlayerFFmpeg"));
 
     QGuiApplication app(argc, argv);
+    const qint64 app_ms = startup.elapsed();
     qmlRegisterType<VideoRenderer>("VideoPlayer", 1, 0, "VideoRenderer");
+    qmlRegisterType<WaveformModel>("VideoPlayer", 1, 0, "WaveformModel");
+    qmlRegisterUncreatableType<SpectrumAnalyzer>("VideoPlayer", 1, 0, "SpectrumAnalyzer",
+        QStringLiteral("SpectrumAnalyzer is provided by VideoRenderer.spectrum"));
+    qmlRegisterUncreatableType<PlayerStats>("VideoPlayer", 1, 0, "PlayerStats",
+        QStringLiteral("PlayerStats is provided by VideoRenderer.stats"));
     qmlRegisterSingletonType<ConfigBridge>("VideoPlayer", 1, 0, "Config",
         [](QQmlEngine *engine, QJSEngine *scriptEngine) -> QObject * {
             Q_UNUSED(engine)
@@ -34,9 +74,32 @@ int main(int argc, char *argv[]) {
         });
 
     QQmlApplicationEngine engine;
-    engine.load(QUrl(QStringLiteral("qrc:/qml/main.qml")));
-    
-    if (engine.rootObjects().isEmpty()) {
+    engine.addImageProvider(QStringLiteral("thumbnail"), new ThumbnailProvider);
+    // Compiled ahead of time by qmlcachegen (see qt_add_qml_module in CMakeLists.txt) and
+    // loaded asynchronously, so the event loop already runs while it loads; main.qml
+    // in turn creates the control panel after the window is up
+    QQmlComponent component(&engine);
+    std::unique_ptr<QObject> root;
+    const bool report = ConfigManager::instance().value(QStringLiteral("startup/report"), false).toBool();
+    QObject::connect(&component, &QQmlComponent::statusChanged, &app, [&](QQmlComponent::Status status) {
+        if (status == QQmlComponent::Ready) {
+            root.reset(component.create());
+        }
+        if (status == QQmlComponent::Error || (status == QQmlComponent::Ready && !root)) {
+            qCritical().noquote() << component.errorString();
+            QCoreApplication::exit(-1);
+        }
+        if (!root) return;
+        const qint64 qml_ms = startup.elapsed();
+        if (report) {
+            if (auto* window = qobject_cast<QQuickWindow*>(root.get())) {
+                reportStartup(window, &startup, app_ms, qml_ms);
+            }
+        }
+    });
+    component.loadUrl(QUrl(QStringLiteral("qrc:/qt/qml/QmlPlayerUi/main.qml")), QQmlComponent::Asynchronous);
+    // A component already in the type cache finishes inside loadUrl, before exit() could take effect
+    if (component.isError() || (component.isReady() && !root)) {
         return -1;
     }
 
@@ -33,6 +33,7 @@ Rectangle {
         height: 20
         duration: renderer ? renderer.duration : 0
         position: renderer ? renderer.position : 0
+        source: renderer ? renderer.source : ""
         formatTimeFunc: controlPanel.formatTimeFunc
         onSeekRequested: function(positionMs) {
             if (renderer) renderer.seek(positionMs)
@@ -122,6 +123,58 @@ Rectangle {
                 Item { width: 36; height: 36; anchors.verticalCenter: parent.verticalCenter }
             }
 
+            // Spectrum / level display, only analyzed while the panel is shown
+            Row {
+                id: spectrumView
+                spacing: 1
+                height: 24
+                Layout.alignment: Qt.AlignVCenter
+                visible: renderer && renderer.spectrum
+                // Levels arrive ~30 times a second: the delegates stay and only their heights follow
+                property var bands: renderer && renderer.spectrum ? renderer.spectrum.bands : []
+
+                Binding {
+                    target: renderer ? renderer.spectrum : null
+                    property: "active"
+                    value: controlPanel.visible && controlPanel.opacity > 0
+                }
+                Binding {
+                    target: renderer ? renderer.spectrum : null
+                    property: "bandCount"
+                    value: 16
+                }
+
+                Repeater {
+                    model: renderer && renderer.spectrum ? renderer.spectrum.bandCount : 0
+                    Rectangle {
+                        width: 3
+                        height: Math.max(1, (index < spectrumView.bands.length ? spectrumView.bands[index] : 0) * spectrumView.height)
+                        anchors.bottom: parent.bottom
+                        radius: 1
+                        color: "#b0ffffff"
+                    }
+                }
+
+                // RMS level with peak marker
+                Rectangle {
+                    width: 4
+                    height: spectrumView.height
+                    color: "#3a3a3c"
+                    Rectangle {
+                        anchors.bottom: parent.bottom
+                        width: parent.width
+                        height: renderer && renderer.spectrum ? renderer.spectrum.rms * parent.height : 0
+                        color: "#ffffff"
+                    }
+                    Rectangle {
+                        width: parent.width
+                        height: 1
+                        y: parent.height - (renderer && renderer.spectrum ? renderer.spectrum.peak * parent.height : 0)
+                        color: "#ff9f0a"
+                    }
+                }
+            }
+
             // Right: Volume Control
             Row {
                 spacing: 8
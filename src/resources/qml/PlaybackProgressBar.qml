@@ -1,5 +1,6 @@
 import QtQuick 2.15
 import QtQuick.Controls 2.15
+import VideoPlayer 1.0
 
 Item {
     id: root
@@ -9,6 +10,7 @@ Item {
     property real duration: 0        // total duration in ms
     property real position: 0        // current position in ms
     property var formatTimeFunc: null
+    property string source: ""        // media source, used for the waveform
 
     signal seekRequested(real positionMs)
 
@@ -56,21 +58,106 @@ Item {
                 }
             }
 
-            background: Rectangle {
+            // Position under the cursor or the dragged handle, -1 when neither
+            readonly property real previewPosition: pressed ? value
+                : (previewHover.containsMouse && availableWidth > 0
+                   ? Math.max(0, Math.min(1, (previewHover.mouseX - leftPadding) / availableWidth)) * to : -1)
+
+            MouseArea {
+                id: previewHover
+                anchors.fill: parent
+                hoverEnabled: true
+                acceptedButtons: Qt.NoButton
+            }
+
+            // Seek preview: nearest keyframe of the previewed second
+            Rectangle {
+                id: preview
+                visible: root.source !== "" && root.duration > 0 && progress.previewPosition >= 0
+                width: previewImage.width + 4
+                height: previewImage.height + previewLabel.height + 8
+                x: Math.max(0, Math.min(progress.width - width,
+                    progress.leftPadding + progress.previewPosition / progress.to * progress.availableWidth - width / 2))
+                y: -height - 8
+                radius: 4
+                color: "#e0000000"
+
+                Image {
+                    id: previewImage
+                    x: 2
+                    y: 2
+                    width: 160
+                    height: 90
+                    fillMode: Image.PreserveAspectFit
+                    asynchronous: true
+                    cache: false
+                    sourceSize: Qt.size(160, 90)
+                    source: preview.visible
+                        ? "image://thumbnail/" + Math.floor(progress.previewPosition / 1000) * 1000
+                          + "/" + encodeURIComponent(root.source)
+                        : ""
+                }
+
+                Text {
+                    id: previewLabel
+                    anchors.top: previewImage.bottom
+                    anchors.topMargin: 2
+                    anchors.horizontalCenter: parent.horizontalCenter
+                    color: "white"
+                    font.pixelSize: 11
+                    text: root.formattedTime(progress.previewPosition)
+                }
+            }
+
+            background: Item {
                 x: progress.leftPadding
-                y: progress.topPadding + progress.availableHeight / 2 - height / 2
+                y: progress.topPadding
                 implicitWidth: 200
                 implicitHeight: 4
                 width: progress.availableWidth
-                height: implicitHeight
-                radius: 2
-                color: "#3a3a3c" // Darker track
+                height: progress.availableHeight
+
+                // Waveform drawn behind the track, filled in while the analyzer runs
+                Row {
+                    id: waveformRow
+                    anchors.fill: parent
+                    visible: waveform.count > 0
+
+                    Repeater {
+                        id: waveform
+                        model: WaveformModel {
+                            source: root.source
+                            bins: Math.max(0, Math.floor(waveformRow.width / 3))
+                        }
+
+                        Item {
+                            width: 3
+                            height: waveformRow.height
+
+                            Rectangle {
+                                width: 2
+                                y: (1 - model.maxValue) * parent.height / 2
+                                height: Math.max(1, (model.maxValue - model.minValue) * parent.height / 2)
+                                color: index < progress.visualPosition * waveform.count ? "#b0ffffff" : "#50ffffff"
+                            }
+                        }
+                    }
+                }
 
                 Rectangle {
-                    width: progress.visualPosition * parent.width
-                    height: parent.height
-                    color: "#ffffff" // White progress
+                    anchors.verticalCenter: parent.verticalCenter
+                    width: parent.width
+                    height: 4
                     radius: 2
+                    color: "#3a3a3c" // Darker track
+                    opacity: waveformRow.visible ? 0.5 : 1.0
+
+                    Rectangle {
+                        width: progress.visualPosition * parent.width
+                        height: parent.height
+                        color: "#ffffff" // White progress
+                        radius: 2
+                    }
                 }
             }
 
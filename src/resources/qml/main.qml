@@ -11,6 +11,10 @@ Window {
     height: 600
     title: "QmlPlayer"
 
+    // Auto-hide of the control panel; kept here since the panel itself loads later
+    property real controlsOpacity: 1.0
+    Behavior on controlsOpacity { NumberAnimation { duration: 300 } }
+
     Component.onCompleted: {
         // Load last opened file from config
         var lastFile = Config.getValue("lastOpenedFile", "")
@@ -22,13 +26,15 @@ Window {
     VideoRenderer {
         id: renderer
         anchors.fill: parent
+        lowLatencyAudio: String(Config.getValue("lowLatencyAudio", false)) === "true"
+        loopPlaylist: String(Config.getValue("loopPlaylist", false)) === "true"
     }
 
     // Mouse inactivity detector
     Timer {
         id: hideTimer
         interval: 3000
-        onTriggered: controlPanel.opacity = 0.0
+        onTriggered: root.controlsOpacity = 0.0
     }
 
     // Overlay to detect mouse movement over video
@@ -38,7 +44,7 @@ Window {
         propagateComposedEvents: true // Let events propagate (though VideoRenderer might not need them)
         
         onPositionChanged: {
-            controlPanel.opacity = 1.0
+            root.controlsOpacity = 1.0
             hideTimer.restart()
         }
         
@@ -47,7 +53,7 @@ Window {
             if (renderer.state === 1) renderer.pause()
             else renderer.play()
             
-            controlPanel.opacity = 1.0
+            root.controlsOpacity = 1.0
             hideTimer.restart()
         }
     }
@@ -88,6 +94,119 @@ Window {
         }
     }
 
+    // Shown while a network stream refills its buffer
+    Rectangle {
+        id: bufferingOverlay
+        anchors.centerIn: parent
+        width: bufferingText.implicitWidth + 32
+        height: bufferingText.implicitHeight + 16
+        radius: 6
+        color: "#a0000000"
+        visible: renderer.buffering
+        z: 50
+
+        Text {
+            id: bufferingText
+            anchors.centerIn: parent
+            text: "Buffering " + renderer.bufferProgress + "%"
+            color: "white"
+            font.pixelSize: 18
+        }
+    }
+
+    // Timeshifted live stream: delay behind live, click to catch up
+    Rectangle {
+        id: timeshiftBadge
+        anchors.margins: 12
+        anchors.right: parent.right
+        anchors.top: parent.top
+        width: timeshiftText.implicitWidth + 16
+        height: 24
+        radius: 4
+        color: renderer.timeshiftDelay < 1000 ? "#d03030" : "#a0000000"
+        visible: renderer.timeshift
+        z: 50
+
+        Text {
+            id: timeshiftText
+            anchors.centerIn: parent
+            text: renderer.timeshiftDelay < 1000 ? "LIVE" : "-" + formatTime(renderer.timeshiftDelay)
+            color: "white"
+            font.pixelSize: 12
+            font.bold: true
+        }
+
+        MouseArea {
+            anchors.fill: parent
+            onClicked: renderer.goLive()
+        }
+    }
+
+    // Pipeline statistics ("I"); sampled only while shown
+    Rectangle {
+        id: statsOverlay
+        anchors.margins: 12
+        anchors.left: parent.left
+        anchors.top: openBtn.bottom
+        width: statsText.implicitWidth + 16
+        height: statsText.implicitHeight + 12
+        radius: 4
+        color: "#c0000000"
+        visible: renderer.stats.active
+        z: 50
+
+        function timing(name, t) {
+            if (!t || !t.count) return name + ": -"
+            return name + ": avg " + t.average.toFixed(2) + "  p95 " + t.p95.toFixed(2)
+                + "  max " + t.max.toFixed(2) + " ms"
+        }
+
+        function mib(bytes) {
+            return (bytes / 1048576).toFixed(1)
+        }
+
+        Text {
+            id: statsText
+            x: 8
+            y: 6
+            color: "white"
+            font.family: "monospace"
+            font.pixelSize: 11
+            text: {
+                var s = renderer.stats
+                var lines = []
+                for (var i = 0; i < s.queues.length; i++) {
+                    var q = s.queues[i]
+                    lines.push(q.name + ": " + q.depth + "/" + q.capacity + "  " + (q.bytes / 1024).toFixed(0) + " KiB")
+                }
+                lines.push(statsOverlay.timing("decode", s.decodeTime))
+                lines.push(statsOverlay.timing("upload", s.uploadTime))
+                lines.push(statsOverlay.timing("render", s.renderTime))
+                lines.push("frames " + s.framesDecoded + "  late " + s.lateFrames + "  dropped " + s.droppedFrames)
+                lines.push("audio underruns " + s.audioUnderruns + "  A/V " + s.avOffset.toFixed(0) + " ms")
+                lines.push("last seek " + (s.seekLatency < 0 ? "-" : s.seekLatency.toFixed(0) + " ms")
+                    + "  first frame " + (s.firstFrameLatency < 0 ? "-" : s.firstFrameLatency.toFixed(0) + " ms"))
+                var d = s.demux
+                if (d.packetsRead !== undefined) {
+                    lines.push("demux read " + d.packetsRead + "  buffered " + d.bufferedMs + " ms  starved v"
+                        + d.videoUnderruns + "/a" + d.audioUnderruns)
+                    lines.push("io " + d.ioThroughput.toFixed(1) + " MB/s  stalled " + d.ioStallMs + " ms")
+                }
+                if (d.poolThreads !== undefined) {
+                    lines.push("pool " + d.poolThreads + " threads  steps " + d.poolSteps + "  steals " + d.poolSteals)
+                }
+                var m = s.memory
+                if (m.total !== undefined) {
+                    lines.push("memory " + statsOverlay.mib(m.total) + (m.budget > 0 ? " of " + statsOverlay.mib(m.budget) : "")
+                        + " MiB  peak " + statsOverlay.mib(m.peak) + "  pressure " + m.pressure)
+                    lines.push("  packets " + statsOverlay.mib(m.packets) + "  frames " + statsOverlay.mib(m.videoFrames + m.audioFrames)
+                        + "  textures " + statsOverlay.mib(m.textures) + "  caches " + statsOverlay.mib(m.caches))
+                }
+                return lines.join("\n")
+            }
+        }
+    }
+
     Rectangle {
         id: openBtn
         width: 80
@@ -115,8 +234,17 @@ Window {
     FileDialog {
         id: fileDialog
         title: "Choose a media file"
-        fileMode: FileDialog.OpenFile
+        fileMode: FileDialog.OpenFiles
         onAccepted: {
+            // Several files play back to back as a gapless playlist
+            if (selectedFiles.length > 1) {
+                var urls = []
+                for (var i = 0; i < selectedFiles.length; i++) {
+                    urls.push(selectedFiles[i].toString())
+                }
+                renderer.playlist = urls
+                return
+            }
             var fileUrl = ""
             if (typeof selectedFile !== 'undefined' && selectedFile) {
                 fileUrl = selectedFile.toString()
@@ -130,10 +258,29 @@ Window {
         }
     }
 
-    UrlInputDialog {
-        id: urlDialog
-        // Dialog handles its own centering or positioning
-        onUrlAccepted: function(url) {
+    // Loaded on first use, so it costs nothing at startup
+    readonly property bool urlDialogOpen: urlDialogLoader.item !== null && urlDialogLoader.item.visible
+
+    function openUrlDialog() {
+        if (urlDialogLoader.active) {
+            urlDialogLoader.item.open()
+        } else {
+            urlDialogLoader.active = true
+        }
+    }
+
+    Loader {
+        id: urlDialogLoader
+        // The dialog centers itself in this, i.e. in the window
+        anchors.fill: parent
+        active: false
+        source: "UrlInputDialog.qml"
+        onLoaded: item.open()
+    }
+
+    Connections {
+        target: urlDialogLoader.item
+        function onUrlAccepted(url) {
             renderer.source = url
             Config.setValue("lastOpenedFile", url)
         }
@@ -145,7 +292,7 @@ Window {
 
     Shortcut {
         sequence: "Space"
-        enabled: !urlDialog.visible
+        enabled: !root.urlDialogOpen
         onActivated: {
             if (renderer.state === 1) renderer.pause()
             else renderer.play()
@@ -154,47 +301,71 @@ Window {
 
     Shortcut {
         sequence: "Left"
-        enabled: !urlDialog.visible
+        enabled: !root.urlDialogOpen
         onActivated: {
             if (renderer.duration > 0) {
                 var newPos = Math.max(0, renderer.position - 5000)
                 renderer.seek(newPos)
+            } else if (renderer.timeshift) {
+                renderer.seek(Math.max(0, renderer.position - 5000))
             }
         }
     }
 
     Shortcut {
         sequence: "Right"
-        enabled: !urlDialog.visible
+        enabled: !root.urlDialogOpen
         onActivated: {
             if (renderer.duration > 0) {
                 var newPos = Math.min(renderer.duration, renderer.position + 5000)
                 renderer.seek(newPos)
+            } else if (renderer.timeshift) {
+                // Past the live edge the demuxer stays at the newest keyframe
+                renderer.seek(renderer.position + 5000)
             }
         }
     }
 
+    // Single frames; playback stays paused until Space
+    Shortcut {
+        sequence: "."
+        enabled: !root.urlDialogOpen
+        onActivated: renderer.stepForward()
+    }
+
+    Shortcut {
+        sequence: ","
+        enabled: !root.urlDialogOpen
+        onActivated: renderer.stepBackward()
+    }
+
+    Shortcut {
+        sequence: "End"
+        enabled: !root.urlDialogOpen && renderer.timeshift
+        onActivated: renderer.goLive()
+    }
+
     Shortcut {
         sequence: "Up"
-        enabled: !urlDialog.visible
+        enabled: !root.urlDialogOpen
         onActivated: renderer.volume = Math.min(1.0, renderer.volume + 0.05)
     }
 
     Shortcut {
         sequence: "Down"
-        enabled: !urlDialog.visible
+        enabled: !root.urlDialogOpen
         onActivated: renderer.volume = Math.max(0.0, renderer.volume - 0.05)
     }
 
     Shortcut {
         sequence: "F"
-        enabled: !urlDialog.visible
+        enabled: !root.urlDialogOpen
         onActivated: root.visibility = root.visibility === Window.FullScreen ? Window.Windowed : Window.FullScreen
     }
 
     Shortcut {
         sequence: "O"
-        enabled: !urlDialog.visible
+        enabled: !root.urlDialogOpen
         onActivated: fileDialog.open()
     }
 
@@ -206,41 +377,128 @@ Window {
 
     Shortcut {
         sequence: "M"
-        enabled: !urlDialog.visible
+        enabled: !root.urlDialogOpen
         onActivated: renderer.muted = !renderer.muted
     }
 
+    Shortcut {
+        sequence: "A"
+        enabled: !root.urlDialogOpen
+        onActivated: {
+            // Cycle through the available audio tracks
+            var tracks = renderer.audioTracks
+            if (tracks.length < 2) return
+            for (var i = 0; i < tracks.length; i++) {
+                if (tracks[i].index === renderer.audioTrack) {
+                    renderer.audioTrack = tracks[(i + 1) % tracks.length].index
+                    return
+                }
+            }
+            renderer.audioTrack = tracks[0].index
+        }
+    }
+
+    Shortcut {
+        sequence: "I"
+        enabled: !root.urlDialogOpen
+        onActivated: renderer.stats.active = !renderer.stats.active
+    }
+
+    Shortcut {
+        sequence: "T"
+        enabled: !root.urlDialogOpen
+        onActivated: {
+            // Start recording a timeline; later presses write out what was recorded so far
+            if (!renderer.tracing) {
+                renderer.tracing = true
+                return
+            }
+            var path = renderer.dumpTrace()
+            if (path !== "") console.log("Trace written to " + path + " (open in ui.perfetto.dev)")
+        }
+    }
+
+    Shortcut {
+        sequence: "Shift+T"
+        enabled: !root.urlDialogOpen
+        onActivated: renderer.tracing = false
+    }
+
+    Shortcut {
+        sequence: "S"
+        enabled: !root.urlDialogOpen
+        onActivated: {
+            // Cycle Off -> each subtitle track -> Off
+            var tracks = renderer.subtitleTracks
+            if (tracks.length === 0) return
+            for (var i = 0; i < tracks.length; i++) {
+                if (tracks[i].index === renderer.subtitleTrack) {
+                    renderer.subtitleTrack = i + 1 < tracks.length ? tracks[i + 1].index : -1
+                    return
+                }
+            }
+            renderer.subtitleTrack = tracks[0].index
+        }
+    }
+
+    Shortcut {
+        sequence: "L"
+        enabled: !root.urlDialogOpen
+        onActivated: {
+            renderer.lowLatencyAudio = !renderer.lowLatencyAudio
+            Config.setValue("lowLatencyAudio", renderer.lowLatencyAudio)
+        }
+    }
+
+    Shortcut {
+        sequence: "N"
+        enabled: !root.urlDialogOpen
+        onActivated: renderer.next()
+    }
+
+    Shortcut {
+        sequence: "P"
+        enabled: !root.urlDialogOpen
+        onActivated: renderer.previous()
+    }
+
     Shortcut {
         sequence: "U"
-        enabled: !urlDialog.visible
-        onActivated: urlDialog.open()
+        enabled: !root.urlDialogOpen
+        onActivated: root.openUrlDialog()
     }
 
-    // Modern control panel with time display and smooth seeking
-    ControlPanel {
-        id: controlPanel
+    // Modern control panel with time display and smooth seeking. Created asynchronously
+    // once the window is up: its progress bar, thumbnails and spectrum are most of the UI
+    Loader {
+        id: controlPanelLoader
         anchors.left: parent.left
         anchors.right: parent.right
         anchors.bottom: parent.bottom
-        renderer: renderer
-        formatTimeFunc: formatTime
-        
-        // Auto-hide logic
-        opacity: 1.0
-        visible: opacity > 0
-        Behavior on opacity { NumberAnimation { duration: 300 } }
+        asynchronous: true
+        sourceComponent: Component {
+            ControlPanel {
+                id: controlPanel
+                renderer: renderer
+                formatTimeFunc: root.formatTime
 
-        // Keep visible when hovering control panel
-        MouseArea {
-            anchors.fill: parent
-            hoverEnabled: true
-            propagateComposedEvents: true
-            onEntered: {
-                controlPanel.opacity = 1.0
-                hideTimer.stop()
+                // Auto-hide logic
+                opacity: root.controlsOpacity
+                visible: opacity > 0
+
+                // Keep visible when hovering control panel
+                MouseArea {
+                    anchors.fill: parent
+                    hoverEnabled: true
+                    propagateComposedEvents: true
+                    onEntered: {
+                        root.controlsOpacity = 1.0
+                        hideTimer.stop()
+                    }
+                    onExited: hideTimer.restart()
+                    onPressed: (mouse) => { mouse.accepted = false }
+                }
             }
-            onExited: hideTimer.restart()
-            onPressed: (mouse) => { mouse.accepted = false }
         }
     }
 
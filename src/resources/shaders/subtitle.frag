@@ -0,0 +1,18 @@
+#version 330 core
+in vec2 TexCoord;
+out vec4 FragColor;
+
+uniform sampler2D subtitleTexture;
+uniform int mode;
+
+void main() {
+    if (mode == 0) {
+        // Glyph atlas: fill coverage in R, outline coverage in G.
+        // White text on a black outline, premultiplied.
+        vec2 coverage = texture(subtitleTexture, TexCoord).rg;
+        FragColor = vec4(vec3(coverage.r), max(coverage.r, coverage.g));
+    } else {
+        // Bitmap subtitles are uploaded premultiplied
+        FragColor = texture(subtitleTexture, TexCoord);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#version 330 core
+layout(location = 0) in vec2 aPos;
+layout(location = 1) in vec2 aTexCoord;
+
+uniform vec2 viewportSize;
+
+out vec2 TexCoord;
+
+void main() {
+    // Pixel coordinates, origin at the top-left like the video texture
+    vec2 ndc = aPos / viewportSize * 2.0 - 1.0;
+    gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+    TexCoord = aTexCoord;
+}
\ No newline at end of file